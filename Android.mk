@@ -11,6 +11,10 @@ LOCAL_ARM_MODE := arm
 LOCAL_SRC_FILES := \
 		memmgr.c \
 		tilermgr.c \
+		lz_utils.c \
+		crc_utils.c \
+		exec_utils.c \
+		lock_utils.c \
 
 
 LOCAL_C_INCLUDES += \
@@ -23,6 +27,26 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+LOCAL_ARM_MODE := arm
+LOCAL_SRC_FILES := tiler_arbd.c
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/ \
+
+LOCAL_MODULE    := tiler_arbd
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_ARM_MODE := arm
+LOCAL_SRC_FILES := tiler_keepd.c
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/ \
+
+LOCAL_MODULE    := tiler_keepd
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_PRELINK_MODULE := false
 LOCAL_ARM_MODE := arm
@@ -59,4 +83,16 @@ LOCAL_MODULE    := tiler_ptest
 LOCAL_MODULE_TAGS := optional tests
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_PRELINK_MODULE := false
+LOCAL_ARM_MODE := arm
+LOCAL_SRC_FILES := memmgr_bench.c testlib.c benchlib.c
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/ \
+
+LOCAL_SHARED_LIBRARIES := libtimemmgr
+LOCAL_MODULE    := memmgr_bench
+LOCAL_MODULE_TAGS := optional tests
+include $(BUILD_EXECUTABLE)
+
 endif
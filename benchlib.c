@@ -0,0 +1,391 @@
+/*
+ *  benchlib.c
+ *
+ *  Benchmark harness.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+/* retrieve type definitions */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "benchlib.h"
+
+#include <utils.h>
+#include <debug_utils.h>
+
+#define BENCHLIB_MIN_SAMPLES    5
+#define BENCHLIB_MAX_SAMPLES    1000
+#define BENCHLIB_STABLE         0.02    /* MAD relative to the median */
+#define BENCHLIB_NAME_LEN       128
+
+/* result of a previous run */
+struct baseline {
+    char   name[BENCHLIB_NAME_LEN];
+    double median_us, mad_us;
+};
+
+static int inited = 0;
+static int warmup = 2, max_samples = 25;
+static FILE *json = NULL;
+static struct baseline *base = NULL;
+static int num_base = 0;
+
+static const char *counter_names[BENCHLIB_NUM_COUNTERS] = {
+    "cycles", "cache_misses", "dtlb_misses", "page_faults"
+};
+
+/**
+ * Returns the current monotonic time in microseconds.
+ *
+ * @return time in microseconds
+ */
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Returns an integer from the environment.
+ *
+ * @param var   Name of the variable
+ * @param def   Default value
+ *
+ * @return value of the variable, or def if it is not set
+ */
+static int env_int(const char *var, int def)
+{
+    const char *val = getenv(var);
+    return val && *val ? atoi(val) : def;
+}
+
+/**
+ * Loads the results of a previous run from its JSON output.
+ *
+ * @param path  Path of the JSON output
+ */
+static void baseline_load(const char *path)
+{
+    char line[1024];
+    const char *p, *q;
+    FILE *f = fopen(path, "r");
+    if (NOT_P(f,!=,NULL)) return;
+    while (fgets(line, sizeof(line), f))
+    {
+        struct baseline b;
+        if (!(p = strstr(line, "\"name\":\"")) || !(q = strchr(p + 8, '"')) ||
+            q - p - 8 >= BENCHLIB_NAME_LEN) continue;
+        memcpy(b.name, p + 8, q - p - 8);
+        b.name[q - p - 8] = '\0';
+        if (!(p = strstr(line, "\"median_us\":")) ||
+            !(q = strstr(line, "\"mad_us\":"))) continue;
+        b.median_us = strtod(p + 12, NULL);
+        b.mad_us = strtod(q + 9, NULL);
+
+        struct baseline *grown = realloc(base, (num_base + 1) * sizeof(*base));
+        if (NOT_P(grown,!=,NULL)) break;
+        base = grown;
+        base[num_base++] = b;
+    }
+    fclose(f);
+}
+
+/** Initializes the harness from the environment. */
+static void init()
+{
+    const char *path;
+    if (inited) return;
+    inited = 1;
+
+    warmup = env_int("BENCHLIB_WARMUP", warmup);
+    max_samples = env_int("BENCHLIB_SAMPLES", max_samples);
+    if (max_samples < BENCHLIB_MIN_SAMPLES) max_samples = BENCHLIB_MIN_SAMPLES;
+    if (max_samples > BENCHLIB_MAX_SAMPLES) max_samples = BENCHLIB_MAX_SAMPLES;
+    if ((path = getenv("BENCHLIB_JSON")) && *path)
+    {
+        json = fopen(path, "a");
+        CHK_P(json,!=,NULL);
+    }
+    if ((path = getenv("BENCHLIB_BASELINE")) && *path) baseline_load(path);
+}
+
+/**
+ * Opens a counter of the calling process, and its threads
+ * started later.  The counter is disabled.
+ *
+ * @param counter  Counter to open
+ *
+ * @return file descriptor of the counter, or -1 if the counter is
+ *         unavailable
+ */
+static int counter_open(int counter)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    ZERO(attr);
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    switch (counter)
+    {
+    case BENCHLIB_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case BENCHLIB_CACHE_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case BENCHLIB_DTLB_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    default:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+        break;
+    }
+
+    /* kernel events may not be allowed for unprivileged processes */
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0)
+    {
+        attr.exclude_kernel = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+/** Orders doubles for qsort */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Returns the median of values.  The values are sorted.
+ *
+ * @param vals  Values
+ * @param num   Number of values (at least 1)
+ *
+ * @return median
+ */
+static double median(double *vals, int num)
+{
+    qsort(vals, num, sizeof(*vals), cmp_double);
+    return num & 1 ? vals[num / 2] : (vals[num / 2 - 1] + vals[num / 2]) / 2;
+}
+
+/**
+ * Returns the median absolute deviation of values.
+ *
+ * @param vals     Values
+ * @param num      Number of values (at least 1)
+ * @param med      Median of the values
+ * @param scratch  Scratch array of num values
+ *
+ * @return median absolute deviation
+ */
+static double mad(const double *vals, int num, double med, double *scratch)
+{
+    int ix;
+    for (ix = 0; ix < num; ix++)
+    {
+        scratch[ix] = vals[ix] < med ? med - vals[ix] : vals[ix] - med;
+    }
+    return median(scratch, num);
+}
+
+/**
+ * Prints a result, appends it to the JSON output, and compares
+ * it with the baseline.
+ *
+ * @param name     Name of the measurement
+ * @param num_ops  Number of operations per sample
+ * @param r        Result
+ */
+static void result_report(const char *name, int num_ops,
+                          const BenchLib_Result *r)
+{
+    int ix;
+
+    printf("%s: %.3f us/op (MAD %.3f us, %d samples of %d ops%s)\n", name,
+           r->median_us, r->mad_us, r->num_samples, num_ops,
+           r->stable ? "" : ", unstable");
+    printf("%s:", name);
+    for (ix = 0; ix < BENCHLIB_NUM_COUNTERS; ix++)
+    {
+        if (r->counters[ix] < 0) printf(" %s n/a", counter_names[ix]);
+        else printf(" %s %.2f/op", counter_names[ix], r->counters[ix]);
+    }
+    printf("\n");
+
+    if (json)
+    {
+        fprintf(json, "{\"name\":\"%s\",\"num_ops\":%d,\"samples\":%d,"
+                "\"stable\":%s,\"median_us\":%.6f,\"mad_us\":%.6f", name,
+                num_ops, r->num_samples, r->stable ? "true" : "false",
+                r->median_us, r->mad_us);
+        for (ix = 0; ix < BENCHLIB_NUM_COUNTERS; ix++)
+        {
+            if (r->counters[ix] < 0)
+                fprintf(json, ",\"%s\":null", counter_names[ix]);
+            else fprintf(json, ",\"%s\":%.4f", counter_names[ix], r->counters[ix]);
+        }
+        fprintf(json, "}\n");
+        fflush(json);
+    }
+
+    /* differences within 3 MADs of both runs are noise */
+    for (ix = 0; ix < num_base; ix++)
+    {
+        const struct baseline *b = base + ix;
+        if (strcmp(b->name, name)) continue;
+        double diff = r->median_us - b->median_us;
+        int changed = diff > 3 * (r->mad_us + b->mad_us) ||
+                      -diff > 3 * (r->mad_us + b->mad_us);
+        printf("%s: %+.1f%% vs baseline %.3f us/op (%s)\n", name,
+               b->median_us ? 100 * diff / b->median_us : 0., b->median_us,
+               !changed ? "no change" : diff > 0 ? "slower" : "faster");
+        break;
+    }
+    fflush(stdout);
+}
+
+int BenchLib_Measure(const char *name, BenchLib_Fn fn, void *arg,
+                     int num_ops, BenchLib_Result *result)
+{
+    int fds[BENCHLIB_NUM_COUNTERS];
+    double *times = NULL, *counts[BENCHLIB_NUM_COUNTERS], *scratch = NULL;
+    uint64_t val;
+    BenchLib_Result r;
+    cpu_set_t cpus, pinned;
+    int ix, cx, cpu, ret = 0, repin = 0;
+
+    init();
+    ZERO(r);
+    if (NOT_P(name,!=,NULL) || NOT_P(fn,!=,NULL) || NOT_I(num_ops,>,0))
+        return 1;
+
+    /* pin the calling thread for the measurement */
+    cpu = env_int("BENCHLIB_CPU", sched_getcpu());
+    if (cpu >= 0 && !sched_getaffinity(0, sizeof(cpus), &cpus))
+    {
+        CPU_ZERO(&pinned);
+        CPU_SET(cpu, &pinned);
+        repin = !NOT_I(sched_setaffinity(0, sizeof(pinned), &pinned),==,0);
+    }
+
+    ALLOCN(times, max_samples);
+    ALLOCN(scratch, max_samples);
+    for (cx = 0; cx < BENCHLIB_NUM_COUNTERS; cx++)
+    {
+        ALLOCN(counts[cx], max_samples);
+        if (!counts[cx]) ret = 1;
+        fds[cx] = counter_open(cx);
+        r.counters[cx] = -1;
+    }
+    if (NOT_P(times,!=,NULL) || NOT_P(scratch,!=,NULL) || ret)
+    {
+        ret = 1;
+        goto DONE;
+    }
+
+    for (ix = 0; !ret && ix < warmup; ix++)
+    {
+        ret = fn(arg, num_ops);
+    }
+
+    /* sample until the MAD settles within a fraction of the median */
+    for (ix = 0; !ret && ix < max_samples; )
+    {
+        for (cx = 0; cx < BENCHLIB_NUM_COUNTERS; cx++)
+        {
+            if (fds[cx] < 0) continue;
+            ioctl(fds[cx], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[cx], PERF_EVENT_IOC_ENABLE, 0);
+        }
+        double t = now_us();
+        ret = fn(arg, num_ops);
+        t = now_us() - t;
+        for (cx = 0; cx < BENCHLIB_NUM_COUNTERS; cx++)
+        {
+            if (fds[cx] < 0) continue;
+            ioctl(fds[cx], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds[cx], &val, sizeof(val)) != sizeof(val)) val = 0;
+            counts[cx][ix] = (double) val / num_ops;
+        }
+        times[ix++] = t / num_ops;
+
+        memcpy(scratch, times, ix * sizeof(*times));
+        r.median_us = median(scratch, ix);
+        r.mad_us = mad(times, ix, r.median_us, scratch);
+        r.num_samples = ix;
+        r.stable = ix >= BENCHLIB_MIN_SAMPLES &&
+                   r.mad_us <= BENCHLIB_STABLE * r.median_us;
+        if (r.stable) break;
+    }
+    if (ret || !r.num_samples) goto DONE;
+
+    for (cx = 0; cx < BENCHLIB_NUM_COUNTERS; cx++)
+    {
+        if (fds[cx] >= 0) r.counters[cx] = median(counts[cx], r.num_samples);
+    }
+    result_report(name, num_ops, &r);
+    if (result) *result = r;
+
+DONE:
+    for (cx = 0; cx < BENCHLIB_NUM_COUNTERS; cx++)
+    {
+        if (fds[cx] >= 0) close(fds[cx]);
+        FREE(counts[cx]);
+    }
+    FREE(times);
+    FREE(scratch);
+    if (repin) sched_setaffinity(0, sizeof(cpus), &cpus);
+    return ret;
+}
@@ -0,0 +1,112 @@
+/*
+ *  benchlib.h
+ *
+ *  Benchmark harness API.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BENCHLIB_H_
+#define _BENCHLIB_H_
+
+/*
+ * The harness is configured through the environment:
+ *
+ *   BENCHLIB_CPU       CPU to pin measurements to.  Defaults to the CPU
+ *                      the measurement starts on; -1 disables pinning.
+ *   BENCHLIB_WARMUP    Number of warm-up runs before sampling (2).
+ *   BENCHLIB_SAMPLES   Maximum number of samples (25).  Sampling stops
+ *                      earlier once the results are stable.
+ *   BENCHLIB_JSON      File to append the results to, one JSON object
+ *                      per line.
+ *   BENCHLIB_BASELINE  JSON output of a previous run to compare the
+ *                      results with.
+ */
+
+/* counters sampled along with the time */
+enum BenchLib_Counter {
+    BENCHLIB_CYCLES,
+    BENCHLIB_CACHE_MISSES,
+    BENCHLIB_DTLB_MISSES,
+    BENCHLIB_PAGE_FAULTS,
+    BENCHLIB_NUM_COUNTERS
+};
+
+/* result of a measurement.  Times and counts are per operation. */
+struct BenchLib_Result {
+    double median_us;       /* median time */
+    double mad_us;          /* median absolute deviation of the time */
+    double counters[BENCHLIB_NUM_COUNTERS]; /* medians, or -1 if the
+                                               counter is unavailable */
+    int    num_samples;
+    int    stable;          /* whether the samples converged */
+};
+
+typedef struct BenchLib_Result BenchLib_Result;
+
+/**
+ * Measured function.
+ *
+ * @param arg      Argument passed to BenchLib_Measure()
+ * @param num_ops  Number of operations to perform
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+typedef int (*BenchLib_Fn)(void *arg, int num_ops);
+
+/**
+ * Measures a function.  The function is run a few times to warm
+ * up, then sampled until the median absolute deviation of the
+ * samples is within 2% of their median, or the maximum number of
+ * samples is reached.  Each sample times one call, and reads the
+ * cycle, cache miss, dTLB miss and page fault counters of the
+ * process with perf_event_open.  Counters that the kernel does
+ * not provide are reported as unavailable.
+ * <p>
+ * The calling thread is pinned to a CPU while it is measured.
+ * Threads started by the function inherit the pinning.
+ * <p>
+ * The results are printed, appended to the JSON output, and
+ * compared with the baseline if there is one.
+ *
+ * @param name     Name of the measurement, unique within the
+ *                 benchmark program.  It identifies the result in
+ *                 the JSON output and in the baseline.
+ * @param fn       Function to measure
+ * @param arg      Argument to pass to the function
+ * @param num_ops  Number of operations per sample
+ * @param result   Pointer to store the result, or NULL
+ *
+ * @return 0 on success, or the error value of the function
+ */
+int BenchLib_Measure(const char *name, BenchLib_Fn fn, void *arg,
+                     int num_ops, BenchLib_Result *result);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ *  crc_utils.c
+ *
+ *  CRC32C checksums for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#endif
+
+#include "crc_utils.h"
+
+/* reflected CRC32C polynomial */
+#define POLY 0x82F63B78U
+
+/* the CRC32C instructions have a latency of several cycles, so data is
+   checksummed in three interleaved streams of this many bytes, and the
+   checksums of the streams are combined through shift tables */
+#define STREAM_LEN 128
+
+static uint32_t table[8][256];
+static uint32_t x2n_table[32];
+static uint32_t shift_table[4][256];   /* multiplies by x^(8 * STREAM_LEN) */
+static int accelerated;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/**
+ * Multiplies two polynomials modulo the CRC polynomial.  Both are
+ * reflected, with x^0 in the top bit.
+ */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31, p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if (!(a & (m - 1))) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+/* returns x^(n * 2^k) modulo the CRC polynomial */
+static uint32_t x2nmodp(size_t n, unsigned k)
+{
+    uint32_t p = 1U << 31;
+    for (; n; n >>= 1, k++)
+    {
+        if (n & 1) p = multmodp(x2n_table[k & 31], p);
+    }
+    return p;
+}
+
+static void init()
+{
+    uint32_t ix, jx, crc, p;
+    for (ix = 0; ix < 256; ix++)
+    {
+        for (crc = ix, jx = 0; jx < 8; jx++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        }
+        table[0][ix] = crc;
+    }
+    for (ix = 0; ix < 256; ix++)
+    {
+        for (jx = 1; jx < 8; jx++)
+        {
+            table[jx][ix] = (table[jx - 1][ix] >> 8) ^
+                            table[0][table[jx - 1][ix] & 0xFF];
+        }
+    }
+
+    x2n_table[0] = p = 1U << 30;
+    for (ix = 1; ix < 32; ix++)
+    {
+        x2n_table[ix] = p = multmodp(p, p);
+    }
+    p = x2nmodp(STREAM_LEN, 3);
+    for (ix = 0; ix < 256; ix++)
+    {
+        for (jx = 0; jx < 4; jx++)
+        {
+            shift_table[jx][ix] = multmodp(p, ix << (8 * jx));
+        }
+    }
+
+#if defined(__ARM_FEATURE_CRC32)
+    accelerated = 1;
+#elif defined(__x86_64__) && defined(__GNUC__)
+    accelerated = !!__builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/* slicing-by-8 */
+static uint32_t crc_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    for (; len && ((uintptr_t) p & 7); len--)
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+    }
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+              table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+              table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+    }
+    while (len--)
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+#define HW_ATTR
+#define CRC_U8(crc, v)  __crc32cb(crc, v)
+#define CRC_U64(crc, v) __crc32cd(crc, v)
+typedef uint32_t hw_crc_t;
+#elif defined(__x86_64__) && defined(__GNUC__)
+#define HW_ATTR __attribute__((target("sse4.2")))
+#define CRC_U8(crc, v)  __builtin_ia32_crc32qi(crc, v)
+#define CRC_U64(crc, v) __builtin_ia32_crc32di(crc, v)
+typedef unsigned long long hw_crc_t;
+#endif
+
+#ifdef HW_ATTR
+/* shifts a checksum over STREAM_LEN bytes of zeros */
+static uint32_t shift_stream(uint32_t crc)
+{
+    return shift_table[0][crc & 0xFF] ^ shift_table[1][(crc >> 8) & 0xFF] ^
+           shift_table[2][(crc >> 16) & 0xFF] ^ shift_table[3][crc >> 24];
+}
+
+HW_ATTR
+static uint32_t crc_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    hw_crc_t c0 = crc, c1, c2;
+    size_t ix;
+    uint64_t v0, v1, v2;
+
+    for (; len && ((uintptr_t) p & 7); len--)
+    {
+        c0 = CRC_U8(c0, *p++);
+    }
+
+    /* the second and third streams start from 0, and the first stream is
+       shifted over them when they are combined */
+    for (; len >= 3 * STREAM_LEN; len -= 3 * STREAM_LEN, p += 3 * STREAM_LEN)
+    {
+        c1 = c2 = 0;
+        for (ix = 0; ix < STREAM_LEN; ix += 8)
+        {
+            memcpy(&v0, p + ix, 8);
+            memcpy(&v1, p + STREAM_LEN + ix, 8);
+            memcpy(&v2, p + 2 * STREAM_LEN + ix, 8);
+            c0 = CRC_U64(c0, v0);
+            c1 = CRC_U64(c1, v1);
+            c2 = CRC_U64(c2, v2);
+        }
+        c0 = shift_stream(shift_stream((uint32_t) c0) ^ (uint32_t) c1) ^
+             (uint32_t) c2;
+    }
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        memcpy(&v0, p, 8);
+        c0 = CRC_U64(c0, v0);
+    }
+    while (len--)
+    {
+        c0 = CRC_U8(c0, *p++);
+    }
+    return (uint32_t) c0;
+}
+#else
+#define crc_hw crc_sw
+#endif
+
+uint32_t CRC32C_Update(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&once, init);
+    crc = ~crc;
+    crc = accelerated ? crc_hw(crc, buf, len) : crc_sw(crc, buf, len);
+    return ~crc;
+}
+
+uint32_t CRC32C_Combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    pthread_once(&once, init);
+    return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+int CRC32C_IsAccelerated()
+{
+    pthread_once(&once, init);
+    return accelerated;
+}
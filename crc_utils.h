@@ -0,0 +1,79 @@
+/*
+ *  crc_utils.h
+ *
+ *  CRC32C checksums for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CRC_UTILS_H_
+#define _CRC_UTILS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC32C (Castagnoli) checksums, as used by iSCSI and ext4.  The
+ * checksum is computed with the CRC32C instruction of SSE4.2
+ * (detected at run time) or ARMv8 (when built for it), and with
+ * slicing-by-8 tables otherwise.  Checksums of consecutive pieces
+ * of data can be combined, so that the pieces can be checksummed
+ * in parallel.
+ */
+
+/**
+ * Continues the checksum of data with the next piece.
+ *
+ * @param crc    Checksum of the data so far (0 for none)
+ * @param buf    Next piece of the data
+ * @param len    Length of the piece
+ *
+ * @return Checksum of the data including the piece.
+ */
+uint32_t CRC32C_Update(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * Combines the checksums of two consecutive pieces of data.
+ *
+ * @param crc1   Checksum of the first piece
+ * @param crc2   Checksum of the second piece
+ * @param len2   Length of the second piece
+ *
+ * @return Checksum of the two pieces together.
+ */
+uint32_t CRC32C_Combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/**
+ * Returns whether the checksum is computed with a CRC32C
+ * instruction.
+ */
+int CRC32C_IsAccelerated();
+
+#endif
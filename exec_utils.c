@@ -0,0 +1,306 @@
+/*
+ *  exec_utils.c
+ *
+ *  Work-stealing executor for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define __DEBUG__
+#undef  __DEBUG_ENTRY__
+#define __DEBUG_ASSERT__
+
+#include "utils.h"
+#include "debug_utils.h"
+#include "exec_utils.h"
+
+/* remaining items of a worker.  The range is padded to a cache line, so
+   that workers do not share lines while taking items. */
+struct _Range {
+    pthread_mutex_t lock;
+    volatile int lo, hi;
+    char pad[64];
+};
+
+struct _Worker {
+    Exec     *ex;
+    int       ix;
+};
+
+struct Exec {
+    int             num_workers;
+    pthread_t      *threads;
+    struct _Worker *workers;
+    struct _Range  *ranges;
+
+    pthread_mutex_t run_mutex;  /* serializes jobs */
+    pthread_mutex_t mutex;      /* protects the fields below */
+    pthread_cond_t  start;      /* signaled when a job is posted */
+    pthread_cond_t  done;       /* signaled when the last worker is done */
+    uint32_t        gen;        /* incremented for each job */
+    int             active;     /* worker threads still in the job */
+    int             stop;
+    ExecFn          fn;
+    void           *arg;
+    ExecStats       stats;
+};
+
+/**
+ * Steals the upper half of the largest remaining range of another
+ * worker, and makes the rest of it the range of this worker.
+ *
+ * @param ex      Pointer to the executor
+ * @param w       Index of this worker
+ * @param steals  Pointer to the steal count of this worker
+ *
+ * @return Index of the first stolen item, or -1 if no items are
+ *         left.
+ */
+static int steal(Exec *ex, int w, uint64_t *steals)
+{
+    for (;;)
+    {
+        int ix, victim = -1, most = 0, lo = 0, hi = 0;
+
+        /* the sizes are only hints, they are checked under the lock */
+        for (ix = 0; ix < ex->num_workers; ix++)
+        {
+            int n = ex->ranges[ix].hi - ex->ranges[ix].lo;
+            if (ix != w && n > most)
+            {
+                most = n;
+                victim = ix;
+            }
+        }
+        if (victim < 0) return -1;
+
+        struct _Range *v = ex->ranges + victim;
+        pthread_mutex_lock(&v->lock);
+        if (v->hi > v->lo)
+        {
+            hi = v->hi;
+            lo = v->hi - (v->hi - v->lo + 1) / 2;
+            v->hi = lo;
+        }
+        pthread_mutex_unlock(&v->lock);
+
+        if (hi > lo)
+        {
+            struct _Range *r = ex->ranges + w;
+            pthread_mutex_lock(&r->lock);
+            r->lo = lo + 1;
+            r->hi = hi;
+            pthread_mutex_unlock(&r->lock);
+            (*steals)++;
+            return lo;
+        }
+    }
+}
+
+/**
+ * Processes items of the current job until none are left.
+ *
+ * @param ex      Pointer to the executor
+ * @param w       Index of this worker
+ */
+static void work(Exec *ex, int w)
+{
+    struct _Range *r = ex->ranges + w;
+    uint64_t items = 0, steals = 0;
+
+    for (;;)
+    {
+        int item = -1;
+        pthread_mutex_lock(&r->lock);
+        if (r->lo < r->hi) item = r->lo++;
+        pthread_mutex_unlock(&r->lock);
+
+        if (item < 0 && (item = steal(ex, w, &steals)) < 0) break;
+        ex->fn(ex->arg, item, w);
+        items++;
+    }
+
+    pthread_mutex_lock(&ex->mutex);
+    ex->stats.items += items;
+    ex->stats.steals += steals;
+    pthread_mutex_unlock(&ex->mutex);
+}
+
+static void *worker_main(void *arg)
+{
+    struct _Worker *wk = (struct _Worker *) arg;
+    Exec *ex = wk->ex;
+    uint32_t gen = 0;
+
+    pthread_mutex_lock(&ex->mutex);
+    while (!ex->stop)
+    {
+        if (gen == ex->gen)
+        {
+            pthread_cond_wait(&ex->start, &ex->mutex);
+            continue;
+        }
+        gen = ex->gen;
+        pthread_mutex_unlock(&ex->mutex);
+
+        work(ex, wk->ix);
+
+        pthread_mutex_lock(&ex->mutex);
+        if (!--ex->active) pthread_cond_signal(&ex->done);
+    }
+    pthread_mutex_unlock(&ex->mutex);
+    return NULL;
+}
+
+Exec *Exec_Create(int num_workers)
+{
+    IN;
+    int ix;
+
+    if (NOT_I(num_workers,>,0)) return R_P(NULL);
+    Exec *ex = NEW(Exec);
+    if (NOT_P(ex,!=,NULL)) return R_P(NULL);
+    ex->num_workers = num_workers;
+    pthread_mutex_init(&ex->run_mutex, NULL);
+    pthread_mutex_init(&ex->mutex, NULL);
+    pthread_cond_init(&ex->start, NULL);
+    pthread_cond_init(&ex->done, NULL);
+
+    ALLOCN(ex->threads, num_workers);
+    ALLOCN(ex->workers, num_workers);
+    ALLOCN(ex->ranges, num_workers);
+    if (NOT_P(ex->threads,!=,NULL) || NOT_P(ex->workers,!=,NULL) ||
+        NOT_P(ex->ranges,!=,NULL))
+    {
+        ex->num_workers = 1;
+        goto FAIL;
+    }
+    for (ix = 0; ix < num_workers; ix++)
+    {
+        pthread_mutex_init(&ex->ranges[ix].lock, NULL);
+        ex->workers[ix].ex = ex;
+        ex->workers[ix].ix = ix;
+    }
+
+    /* worker 0 is the calling thread */
+    for (ix = 1; ix < num_workers; ix++)
+    {
+        if (NOT_I(pthread_create(ex->threads + ix, NULL, worker_main,
+                                 ex->workers + ix),==,0))
+        {
+            ex->num_workers = ix;
+            goto FAIL;
+        }
+    }
+    return R_P(ex);
+
+FAIL:
+    Exec_Destroy(ex);
+    return R_P(NULL);
+}
+
+int Exec_Workers(Exec *ex)
+{
+    return ex->num_workers;
+}
+
+int Exec_Run(Exec *ex, int num_items, ExecFn fn, void *arg)
+{
+    IN;
+    int ix;
+
+    if (NOT_P(ex,!=,NULL) || NOT_P(fn,!=,NULL) ||
+        NOT_I(num_items,>=,0)) return R_I(-EINVAL);
+
+    pthread_mutex_lock(&ex->run_mutex);
+
+    /* split the items into contiguous ranges */
+    pthread_mutex_lock(&ex->mutex);
+    for (ix = 0; ix < ex->num_workers; ix++)
+    {
+        ex->ranges[ix].lo = (int) ((int64_t) num_items * ix / ex->num_workers);
+        ex->ranges[ix].hi = (int) ((int64_t) num_items * (ix + 1) /
+                                   ex->num_workers);
+    }
+    ex->fn = fn;
+    ex->arg = arg;
+    ex->active = ex->num_workers - 1;
+    ex->gen++;
+    ex->stats.jobs++;
+    pthread_cond_broadcast(&ex->start);
+    pthread_mutex_unlock(&ex->mutex);
+
+    work(ex, 0);
+
+    pthread_mutex_lock(&ex->mutex);
+    while (ex->active)
+    {
+        pthread_cond_wait(&ex->done, &ex->mutex);
+    }
+    pthread_mutex_unlock(&ex->mutex);
+
+    pthread_mutex_unlock(&ex->run_mutex);
+    return R_I(0);
+}
+
+void Exec_GetStats(Exec *ex, ExecStats *stats)
+{
+    pthread_mutex_lock(&ex->mutex);
+    *stats = ex->stats;
+    pthread_mutex_unlock(&ex->mutex);
+}
+
+void Exec_Destroy(Exec *ex)
+{
+    IN;
+    int ix;
+
+    if (!ex) return;
+    pthread_mutex_lock(&ex->mutex);
+    ex->stop = 1;
+    pthread_cond_broadcast(&ex->start);
+    pthread_mutex_unlock(&ex->mutex);
+    for (ix = 1; ix < ex->num_workers; ix++)
+    {
+        pthread_join(ex->threads[ix], NULL);
+    }
+
+    FREE(ex->threads);
+    FREE(ex->workers);
+    FREE(ex->ranges);
+    FREE(ex);
+}
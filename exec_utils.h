@@ -0,0 +1,119 @@
+/*
+ *  exec_utils.h
+ *
+ *  Work-stealing executor for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EXEC_UTILS_H_
+#define _EXEC_UTILS_H_
+
+#include <stdint.h>
+
+/**
+ * Work-stealing executor for data-parallel jobs.  A job is a
+ * number of items that are processed by calling a function for
+ * each item index.  The items are split into one contiguous
+ * range for each worker, so that neighboring items are processed
+ * by the same worker.  A worker that runs out of items steals
+ * the upper half of the largest remaining range of another
+ * worker.  The calling thread takes part as worker 0.
+ */
+
+struct Exec;
+
+typedef struct Exec Exec;
+
+/**
+ * Function processing an item of a job.
+ *
+ * @param arg     Argument of the job
+ * @param item    Index of the item
+ * @param worker  Index of the worker processing the item
+ */
+typedef void (*ExecFn)(void *arg, int item, int worker);
+
+/**
+ * Statistics of an executor.
+ */
+struct ExecStats {
+    uint64_t jobs;          /* jobs run */
+    uint64_t items;         /* items processed */
+    uint64_t steals;        /* ranges stolen */
+};
+
+typedef struct ExecStats ExecStats;
+
+/**
+ * Creates an executor, and starts its worker threads.
+ *
+ * @param num_workers  Number of workers including the calling
+ *                     thread
+ *
+ * @return Pointer to the executor, or NULL on failure.
+ */
+Exec *Exec_Create(int num_workers);
+
+/**
+ * Returns the number of workers of an executor, including the
+ * calling thread.
+ */
+int Exec_Workers(Exec *ex);
+
+/**
+ * Runs a job, and waits for it to complete.  Jobs of an executor
+ * are run one at a time.
+ *
+ * @param ex         Pointer to the executor
+ * @param num_items  Number of items
+ * @param fn         Function processing an item
+ * @param arg        Argument passed to fn
+ *
+ * @return 0 on success, -EINVAL on invalid arguments.
+ */
+int Exec_Run(Exec *ex, int num_items, ExecFn fn, void *arg);
+
+/**
+ * Gets the statistics of an executor.
+ *
+ * @param ex     Pointer to the executor
+ * @param stats  Pointer to the statistics to fill out
+ */
+void Exec_GetStats(Exec *ex, ExecStats *stats);
+
+/**
+ * Stops the worker threads of an executor, and frees it.
+ *
+ * @param ex     Pointer to the executor, or NULL
+ */
+void Exec_Destroy(Exec *ex);
+
+#endif
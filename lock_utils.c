@@ -0,0 +1,268 @@
+/*
+ *  lock_utils.c
+ *
+ *  Instrumented locks for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* clock_gettime is not part of ANSI C */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define __DEBUG__
+#undef  __DEBUG_ENTRY__
+#define __DEBUG_ASSERT__
+
+#include "utils.h"
+#include "debug_utils.h"
+#include "lock_utils.h"
+
+int lock_stats_enabled = 0;
+
+/* locks taken with statistics enabled.  stats_mutex guards the
+   registry and the statistics of all locks and call sites.  It is
+   only ever taken last, so Lock_Query and Lock_Reset never wait for
+   the instrumented locks themselves. */
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Lock *registry = NULL;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* returns the histogram bucket of a time */
+static int bucket(uint64_t ns)
+{
+    int b = 0;
+    while (ns >= 2 && b < LOCK_BUCKETS - 1)
+    {
+        ns >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* records an acquisition.  Must be called with stats_mutex held. */
+static void record_wait(LockStats *st, uint64_t wait, int contended)
+{
+    st->acquisitions++;
+    st->contended += contended;
+    st->wait_ns += wait;
+    st->wait_hist[bucket(wait)]++;
+}
+
+/* records a release.  Must be called with stats_mutex held. */
+static void record_hold(LockStats *st, uint64_t hold)
+{
+    st->hold_ns += hold;
+    st->hold_hist[bucket(hold)]++;
+}
+
+/* completes a timed acquisition.  Must be called with the lock held. */
+static void acquired(Lock *lock, LockSite *site, uint64_t wait,
+                     int contended)
+{
+    pthread_mutex_lock(&stats_mutex);
+    if (!lock->registered)
+    {
+        lock->next = registry;
+        registry = lock;
+        lock->registered = 1;
+    }
+    if (!site->registered)
+    {
+        site->next = lock->sites;
+        lock->sites = site;
+        site->registered = 1;
+    }
+    record_wait(&lock->stats, wait, contended);
+    record_wait(&site->stats, wait, contended);
+    pthread_mutex_unlock(&stats_mutex);
+    lock->holder = site;
+}
+
+void Lock_AcquireTimed(Lock *lock, LockSite *site)
+{
+    uint64_t t;
+
+    /* only contended acquisitions are timed */
+    if (!pthread_mutex_trylock(&lock->mutex))
+    {
+        lock->acquired = now_ns();
+        acquired(lock, site, 0, 0);
+        return;
+    }
+    t = now_ns();
+    pthread_mutex_lock(&lock->mutex);
+    lock->acquired = now_ns();
+    acquired(lock, site, lock->acquired - t, 1);
+}
+
+int Lock_TryAcquireTimed(Lock *lock, LockSite *site)
+{
+    int ret =  pthread_mutex_trylock(&lock->mutex);
+    if (!ret)
+    {
+        lock->acquired = now_ns();
+        acquired(lock, site, 0, 0);
+    }
+    return ret;
+}
+
+void Lock_ReleaseTimed(Lock *lock)
+{
+    uint64_t hold = now_ns() - lock->acquired;
+    pthread_mutex_lock(&stats_mutex);
+    record_hold(&lock->stats, hold);
+    record_hold(&lock->holder->stats, hold);
+    pthread_mutex_unlock(&stats_mutex);
+    lock->holder = NULL;
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+int Lock_SetStats(int enable)
+{
+    int prev = lock_stats_enabled;
+    lock_stats_enabled = enable ? 1 : 0;
+    return prev;
+}
+
+int Lock_Query(LockInfo info[], int max_info)
+{
+    Lock *lock;
+    LockSite *site;
+    int n = 0;
+
+    pthread_mutex_lock(&stats_mutex);
+    for (lock = registry; lock; lock = lock->next)
+    {
+        if (n < max_info)
+        {
+            info[n].name = lock->name;
+            info[n].func = NULL;
+            info[n].line = 0;
+            info[n].stats = lock->stats;
+        }
+        n++;
+        for (site = lock->sites; site; site = site->next, n++)
+        {
+            if (n >= max_info) continue;
+            info[n].name = lock->name;
+            info[n].func = site->func;
+            info[n].line = site->line;
+            info[n].stats = site->stats;
+        }
+    }
+    pthread_mutex_unlock(&stats_mutex);
+    return n;
+}
+
+void Lock_Reset()
+{
+    Lock *lock;
+    LockSite *site;
+
+    pthread_mutex_lock(&stats_mutex);
+    for (lock = registry; lock; lock = lock->next)
+    {
+        ZERO(lock->stats);
+        for (site = lock->sites; site; site = site->next)
+        {
+            ZERO(site->stats);
+        }
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+/* returns the upper bound of the 99th percentile of a histogram in us */
+static double p99_us(const uint64_t hist[LOCK_BUCKETS], uint64_t count)
+{
+    uint64_t sum = 0;
+    int b;
+    for (b = 0; b < LOCK_BUCKETS - 1; b++)
+    {
+        sum += hist[b];
+        if (sum * 100 >= count * 99) break;
+    }
+    return (double) (2ULL << b) / 1000;
+}
+
+static void dump_stats(const char *what, const LockStats *st)
+{
+    uint64_t n = st->acquisitions;
+    fprintf(stderr, "%s: %llu acquisitions, %llu contended, "
+            "wait %.3f us (p99 < %.3f us), hold %.3f us (p99 < %.3f us)\n",
+            what, (unsigned long long) n, (unsigned long long) st->contended,
+            n ? (double) st->wait_ns / n / 1000 : 0., p99_us(st->wait_hist, n),
+            n ? (double) st->hold_ns / n / 1000 : 0., p99_us(st->hold_hist, n));
+}
+
+void Lock_Dump()
+{
+    LockInfo *info = NULL;
+    char what[128];
+    int ix, num, n = Lock_Query(NULL, 0);
+
+    ALLOCN(info, n);
+    num = info ? Lock_Query(info, n) : 0;
+    /* locks may have been taken meanwhile */
+    if (num > n) num = n;
+    for (ix = 0; ix < num; ix++)
+    {
+        if (info[ix].func)
+            snprintf(what, sizeof(what), "  %s:%d", info[ix].func,
+                     info[ix].line);
+        else
+            snprintf(what, sizeof(what), "%s", info[ix].name);
+        dump_stats(what, &info[ix].stats);
+    }
+    FREE(info);
+}
+
+/* statistics are enabled, and dumped at exit, if MEMMGR_LOCK_STATS is
+   set in the environment */
+static void __attribute__((constructor)) lock_init()
+{
+    if (getenv("MEMMGR_LOCK_STATS"))
+    {
+        lock_stats_enabled = 1;
+        atexit(Lock_Dump);
+    }
+}
@@ -0,0 +1,196 @@
+/*
+ *  lock_utils.h
+ *
+ *  Instrumented locks for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LOCK_UTILS_H_
+#define _LOCK_UTILS_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Instrumented mutexes.  While statistics are enabled, a lock
+ * records how long threads wait for it and how long they hold
+ * it, for the lock and for each call site that takes it, as
+ * histograms with power-of-2 nanosecond buckets: bucket 0 counts
+ * times below 2 ns, bucket b times in [2^b, 2^(b+1)) ns, and the
+ * last bucket all longer times.  While disabled, taking and
+ * releasing a lock costs a branch each.
+ */
+#define LOCK_BUCKETS 24
+
+struct LockStats {
+    uint64_t acquisitions;
+    uint64_t contended;         /* acquisitions that had to wait */
+    uint64_t wait_ns;           /* total wait time */
+    uint64_t hold_ns;           /* total hold time */
+    uint64_t wait_hist[LOCK_BUCKETS];
+    uint64_t hold_hist[LOCK_BUCKETS];
+};
+
+typedef struct LockStats LockStats;
+
+/* a call site taking a lock */
+struct LockSite {
+    const char *func;
+    int line;
+    int registered;             /* in the site list of its lock */
+    LockStats stats;
+    struct LockSite *next;
+};
+
+typedef struct LockSite LockSite;
+
+struct Lock {
+    pthread_mutex_t mutex;
+    const char *name;
+    int registered;             /* in the lock registry */
+    LockStats stats;
+    LockSite *sites;            /* sites that took the lock while enabled */
+    LockSite *holder;           /* site holding the lock if timed */
+    uint64_t acquired;          /* time the lock was acquired if timed */
+    struct Lock *next;
+};
+
+typedef struct Lock Lock;
+
+#define LOCK_INITIALIZER(name) { PTHREAD_MUTEX_INITIALIZER, name }
+#define LOCK_SITE_INITIALIZER  { __FUNCTION__, __LINE__ }
+
+/* declares the static call site of a Lock_TryAcquire call */
+#define LOCK_SITE(site) static LockSite site = LOCK_SITE_INITIALIZER
+
+/* takes and releases a lock, recording the call site */
+#define LOCK(lock) do { \
+    static LockSite site_ = LOCK_SITE_INITIALIZER; \
+    Lock_Acquire(&(lock), &site_); \
+} while (0)
+#define UNLOCK(lock) Lock_Release(&(lock))
+
+/* a lock or call site in the statistics returned by Lock_Query */
+struct LockInfo {
+    const char *name;           /* name of the lock */
+    const char *func;           /* function of the call site, or NULL
+                                   for the totals of the lock */
+    int line;                   /* line of the call site */
+    LockStats stats;
+};
+
+typedef struct LockInfo LockInfo;
+
+extern int lock_stats_enabled;
+
+void Lock_AcquireTimed(Lock *lock, LockSite *site);
+int Lock_TryAcquireTimed(Lock *lock, LockSite *site);
+void Lock_ReleaseTimed(Lock *lock);
+
+/**
+ * Takes a lock.
+ *
+ * @param lock   Pointer to the lock
+ * @param site   Pointer to the static call site
+ */
+static __inline__ void Lock_Acquire(Lock *lock, LockSite *site)
+{
+    if (lock_stats_enabled)
+        Lock_AcquireTimed(lock, site);
+    else
+        pthread_mutex_lock(&lock->mutex);
+}
+
+/**
+ * Takes a lock if it is free.
+ *
+ * @param lock   Pointer to the lock
+ * @param site   Pointer to the static call site
+ *
+ * @return 0 if the lock was taken, non-0 if it is held.
+ */
+static __inline__ int Lock_TryAcquire(Lock *lock, LockSite *site)
+{
+    if (lock_stats_enabled)
+        return Lock_TryAcquireTimed(lock, site);
+    return pthread_mutex_trylock(&lock->mutex);
+}
+
+/**
+ * Releases a lock.  The hold time is recorded if the lock was
+ * taken with statistics enabled.
+ *
+ * @param lock   Pointer to the lock
+ */
+static __inline__ void Lock_Release(Lock *lock)
+{
+    if (lock->holder)
+        Lock_ReleaseTimed(lock);
+    else
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+/**
+ * Enables or disables lock statistics.  Locks held while the
+ * setting changes are accounted as they were taken.
+ *
+ * @param enable  Non-0 to enable statistics
+ *
+ * @return the previous setting
+ */
+int Lock_SetStats(int enable);
+
+/**
+ * Copies the statistics of the locks that were taken with
+ * statistics enabled: for each lock its totals, followed by its
+ * call sites.
+ *
+ * @param info      Array of at least max_info elements
+ * @param max_info  Number of elements that fit into the array
+ *
+ * @return the number of available entries, which may be more
+ *         than max_info.
+ */
+int Lock_Query(LockInfo info[], int max_info);
+
+/**
+ * Resets the statistics of all locks and call sites.
+ */
+void Lock_Reset();
+
+/**
+ * Prints the statistics of all locks and call sites to stderr:
+ * acquisitions, contention, and the mean and 99th percentile of
+ * the wait and hold times.
+ */
+void Lock_Dump();
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ *  lz_utils.c
+ *
+ *  LZ77 block compression for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz_utils.h"
+
+#define MIN_MATCH   4
+#define MAX_OFFSET  0xFFFF
+#define HASH_BITS   12
+
+/* the last match must end this many bytes before the end of the block,
+   so that matches can always be read 4 bytes at a time */
+#define END_LITERALS 5
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * Writes a length extension: 255 for each full 255, then the
+ * remainder.
+ *
+ * @return pointer after the extension, or NULL if it does not
+ *         fit.
+ */
+static uint8_t *put_len(uint8_t *op, uint8_t *oend, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op >= oend) return NULL;
+        *op++ = 255;
+    }
+    if (op >= oend) return NULL;
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+/**
+ * Writes a token with its literals, and optionally a match.
+ *
+ * @return pointer after the token, or NULL if it does not fit.
+ */
+static uint8_t *put_token(uint8_t *op, uint8_t *oend, const uint8_t *lit,
+                          size_t num_lit, size_t offset, size_t match_len)
+{
+    uint8_t *token = op++;
+    if (token >= oend) return NULL;
+    *token = (uint8_t) ((num_lit < 15 ? num_lit : 15) << 4);
+    if (num_lit >= 15 && !(op = put_len(op, oend, num_lit - 15))) return NULL;
+    if ((size_t) (oend - op) < num_lit) return NULL;
+    memcpy(op, lit, num_lit);
+    op += num_lit;
+
+    if (match_len)
+    {
+        if (oend - op < 2) return NULL;
+        *op++ = (uint8_t) offset;
+        *op++ = (uint8_t) (offset >> 8);
+        match_len -= MIN_MATCH;
+        *token |= (uint8_t) (match_len < 15 ? match_len : 15);
+        if (match_len >= 15 && !(op = put_len(op, oend, match_len - 15)))
+            return NULL;
+    }
+    return op;
+}
+
+size_t LZ_Compress(const void *src, size_t len, void *dst, size_t dst_len)
+{
+    const uint8_t *base = src, *ip = base, *anchor = base;
+    const uint8_t *mlimit = base + (len > END_LITERALS + MIN_MATCH ?
+                                    len - END_LITERALS - MIN_MATCH : 0);
+    uint8_t *op = dst, *oend = op + dst_len;
+    uint32_t table[1 << HASH_BITS];
+
+    memset(table, 0, sizeof(table));
+    while (ip < mlimit)
+    {
+        uint32_t v = read32(ip), h = hash32(v);
+        const uint8_t *ref = base + table[h];
+        table[h] = ip - base;
+        if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != v)
+        {
+            ip++;
+            continue;
+        }
+
+        /* extend the match */
+        const uint8_t *mend = base + len - END_LITERALS;
+        size_t mlen = MIN_MATCH;
+        while (ip + mlen < mend && ref[mlen] == ip[mlen]) mlen++;
+
+        op = put_token(op, oend, anchor, ip - anchor, ip - ref, mlen);
+        if (!op) return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    /* last literals */
+    op = put_token(op, oend, anchor, base + len - anchor, 0, 0);
+    return op ? (size_t) (op - (uint8_t *) dst) : 0;
+}
+
+/**
+ * Reads a length extension.
+ *
+ * @return 0 on success, non-0 if the data ends prematurely.
+ */
+static int get_len(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= iend) return 1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+size_t LZ_Decompress(const void *src, size_t len, void *dst, size_t dst_len)
+{
+    const uint8_t *ip = src, *iend = ip + len;
+    uint8_t *op = dst, *oend = op + dst_len;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+
+        /* literals */
+        size_t num = token >> 4;
+        if (num == 15 && get_len(&ip, iend, &num)) return 0;
+        if ((size_t) (iend - ip) < num || (size_t) (oend - op) < num) return 0;
+        memcpy(op, ip, num);
+        ip += num;
+        op += num;
+        if (ip == iend) break;
+
+        /* match - it may overlap the output, so copy bytewise */
+        if (iend - ip < 2) return 0;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        num = token & 15;
+        if (num == 15 && get_len(&ip, iend, &num)) return 0;
+        num += MIN_MATCH;
+        if (!offset || offset > (size_t) (op - (uint8_t *) dst) ||
+            (size_t) (oend - op) < num) return 0;
+        const uint8_t *ref = op - offset;
+        while (num--) *op++ = *ref++;
+    }
+    return op - (uint8_t *) dst;
+}
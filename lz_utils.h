@@ -0,0 +1,88 @@
+/*
+ *  lz_utils.h
+ *
+ *  LZ77 block compression for the Memory Allocator.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LZ_UTILS_H_
+#define _LZ_UTILS_H_
+
+#include <stddef.h>
+
+/**
+ * Fast LZ77 block compression in the style of LZ4, used to keep
+ * the contents of demoted buffers in system memory.  It favors
+ * speed over ratio: matches are found through a single-entry hash
+ * table, and there is no entropy coding.
+ * <p>
+ * The format is a sequence of tokens.  Each token has a literal
+ * length (high nibble) and a match length - 4 (low nibble),
+ * followed by length extension bytes for 15, the literals, a
+ * 16-bit little endian match offset and match length extension
+ * bytes.  The last token has only literals.
+ */
+
+/**
+ * Returns the size of the buffer needed to compress len bytes in
+ * the worst case.
+ */
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/**
+ * Compresses a block.
+ *
+ * @param src      Data to compress
+ * @param len      Length of the data
+ * @param dst      Buffer for the compressed data
+ * @param dst_len  Size of the buffer.  LZ_BOUND(len) is always
+ *                 enough.
+ *
+ * @return Length of the compressed data, or 0 if it does not
+ *         fit into the buffer.
+ */
+size_t LZ_Compress(const void *src, size_t len, void *dst, size_t dst_len);
+
+/**
+ * Decompresses a block.
+ *
+ * @param src      Compressed data
+ * @param len      Length of the compressed data
+ * @param dst      Buffer for the decompressed data
+ * @param dst_len  Size of the buffer
+ *
+ * @return Length of the decompressed data, or 0 if the
+ *         compressed data is corrupt or does not fit into the
+ *         buffer.
+ */
+size_t LZ_Decompress(const void *src, size_t len, void *dst, size_t dst_len);
+
+#endif
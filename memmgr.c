@@ -33,20 +33,28 @@
  *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* MAP_ANONYMOUS and MAP_NORESERVE are not part of ANSI C */
+#define _GNU_SOURCE
+
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <pthread.h>
 #include <errno.h>
-
-#define BUF_ALLOCED 1
-#define BUF_MAPPED  2
-#define BUF_ANY     ~0
+#include <sched.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/futex.h>
 
 #include <tiler.h>
 
@@ -62,9 +70,25 @@ typedef struct tiler_block_info tiler_block_info;
 #include "utils.h"
 #include "list_utils.h"
 #include "debug_utils.h"
+#include "lz_utils.h"
+#include "crc_utils.h"
+#include "exec_utils.h"
+#include "lock_utils.h"
+#include "tiler_arb.h"
+#include "tiler_keep.h"
 #include "tilermem.h"
 #include "tilermem_utils.h"
+#include "tilermem_iter.h"
 #include "memmgr.h"
+#include "memmgr_view.h"
+#ifdef STUB_TILER
+    #include "tiler_stub.h"
+#endif
+
+/* private short names of the buffer types */
+#define BUF_ALLOCED MEMMGR_BUF_ALLOCED
+#define BUF_MAPPED  MEMMGR_BUF_MAPPED
+#define BUF_ANY     MEMMGR_BUF_ANY
 
 /* list of allocations */
 struct _AllocData {
@@ -72,6 +96,35 @@ struct _AllocData {
     bytes_t   size;
     uint32_t  tiler_id;
     int       buf_type;
+    int       num_blocks;
+    uint32_t  formats;
+    struct tiler_block_info *blocks;    /* block info in aperture mode */
+    volatile uint32_t gen;              /* incremented when freed */
+    volatile uint32_t fence[MEMMGR_FENCE_SLOTS];    /* signal counts */
+    volatile uint32_t waiters[MEMMGR_FENCE_SLOTS];  /* futex waiters */
+    int       fence_fd[MEMMGR_FENCE_SLOTS];         /* exported eventfds */
+    struct _DirtyRange {
+        void *start, *end;
+    } *dirty;                           /* sorted dirty ranges */
+    int       num_dirty;
+    uint32_t  slots, pages;             /* capacity taken up */
+    uint64_t  last_use;                 /* time of last use in us */
+    int       pins;                     /* pin count */
+    bool      demotable;                /* may be demoted when idle */
+    uint32_t  keep_id;                  /* ID with the keeper, or 0 */
+    uint8_t   user_data[MEMMGR_USER_DATA_SIZE]; /* client metadata */
+    volatile int refs;                  /* references, 0 once freed */
+    uint32_t  usage;                    /* usage bits, or 0 */
+    bool      ring;                     /* mapped twice, back to back */
+    void     *locked;                   /* user pages locked, or NULL */
+    uint8_t   blk_fmt[TILER_MAX_NUM_BLOCKS];    /* block formats */
+    bytes_t   blk_stride[TILER_MAX_NUM_BLOCKS]; /* block row pitches */
+    struct _AllocData *hash_next;       /* next in buf_hash bucket */
+    struct _Demoted {
+        struct tiler_buf_info buf;      /* blocks before demotion */
+        void     *data;                 /* compressed contents */
+        bytes_t   len;                  /* compressed size */
+    } *demoted;                         /* set while demoted */
     struct _AllocList {
         struct _AllocList *next, *last;
         struct _AllocData *me;
@@ -80,13 +133,85 @@ struct _AllocData {
 static struct _AllocList bufs = {0};
 static int bufs_inited = 0;
 
+/* records are recycled instead of freed, so that snapshots can walk the
+   list of allocations without locking */
+static struct _AllocList free_ads = {0};
+static int num_ads = 0;
+
+/* read-only view of the registry: the ranges of all blocks sorted by
+   address.  Its sequence count is the registry version - odd while the
+   list of allocations is being changed.  Full arrays are replaced by
+   larger ones, and the replaced ones are kept, as readers may still be
+   searching them. */
+static MemMgrView bufs_view = {0};
+static int view_size = 0;
+
+/* records by buffer pointer, for lockless lookups.  Buckets are changed
+   along with the list of allocations, so readers validate their lookup
+   against bufs_view.seq the same way. */
+#define BUF_HASH_SIZE   256
+static struct _AllocData *buf_hash[BUF_HASH_SIZE];
+
+/* concatenated views of 1D buffers - protected by che_mutex.  Each part
+   is a separate mapping of a source buffer, and is unmapped separately. */
+struct _Concat {
+    void     *ptr;                      /* start of the view */
+    int       num_parts;
+    struct _ConcatPart {
+        void     *bufPtr;               /* source buffer */
+        uint32_t  tiler_id;             /* tiler ID of the source */
+        bytes_t   len;                  /* length of its mapping */
+    } *parts;
+    struct _ConcatList {
+        struct _ConcatList *next, *last;
+        struct _Concat *me;
+    } link;
+};
+static struct _ConcatList concats = {0};
+
 typedef struct _AllocList _AllocList;
 typedef struct _AllocData _AllocData;
+typedef struct _DirtyRange _DirtyRange;
+typedef struct _Demoted _Demoted;
+typedef struct _Concat _Concat;
+typedef struct _ConcatList _ConcatList;
+typedef struct _ConcatPart _ConcatPart;
+
+/* dirty ranges are tracked at cache line granularity, and up to
+   MAX_DIRTY ranges are kept per buffer */
+#define CACHE_LINE_SIZE 32
+#define MAX_DIRTY       64
+
+/* aperture mode: each TILER_MEM_* region is mapped once into a window of a
+   single virtual reservation, and buffers are addressed at a fixed offset.
+   ap_index holds the record for each container slot and page-mode page. */
+#define AP_REGION_SIZE  (TILER_MEM_16BIT - TILER_MEM_8BIT)
+#define AP_NUM_REGIONS  ((TILER_MEM_END - TILER_MEM_8BIT) / AP_REGION_SIZE)
+#define AP_NUM_SLOTS    (TILER_WIDTH * TILER_HEIGHT)
+#define AP_NUM_ENTRIES  (AP_NUM_SLOTS + TILER_LENGTH / PAGE_SIZE)
+static bool aperture = false;
+static void *ap_base = NULL;
+static struct _AllocData **ap_index = NULL;
+
+/* demotion state - protected by che_mutex */
+static int num_demoted = 0;
+static MemMgrDemoteStats demote_stats = {0};
+
+/* lease mode: capacity is leased from the arbitration service in chunks,
+   and charged with each buffer */
+static int arb_fd = -1;
+static uint32_t arb_chunk = 0;
+static MemMgrLeaseStats lease = {0};
+static Lock arb_mutex = LOCK_INITIALIZER("arb_mutex");
+
+/* connection to the buffer keeper */
+static int keep_sock = -1;
+static Lock keep_mutex = LOCK_INITIALIZER("keep_mutex");
 
 static int refCnt = 0;
 static int td = -1;
-static pthread_mutex_t ref_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t che_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Lock ref_mutex = LOCK_INITIALIZER("ref_mutex");
+static Lock che_mutex = LOCK_INITIALIZER("che_mutex");
 
 /**
  * Initializes the static structures
@@ -98,6 +223,8 @@ static void init()
     if (!bufs_inited)
     {
         DLIST_INIT(bufs);
+        DLIST_INIT(free_ads);
+        DLIST_INIT(concats);
         bufs_inited = 1;
     }
 }
@@ -113,27 +240,22 @@ static void init()
 static int inc_ref()
 {
     /* initialize tiler on first call */
-    pthread_mutex_lock(&ref_mutex);
+    LOCK(ref_mutex);
 
     int res = MEMMGR_ERR_NONE;
 
     if (!refCnt++) {
         /* initialize lists */
         init();
-#ifndef STUB_TILER
         td = open("/dev/tiler", O_RDWR | O_SYNC);
         if (NOT_I(td,>=,0)) res = MEMMGR_ERR_GENERIC;
-#else
-        td = 2;
-        res = MEMMGR_ERR_NONE;
-#endif
     }
     if (res)
     {
         refCnt--;
     }
 
-    pthread_mutex_unlock(&ref_mutex);
+    UNLOCK(ref_mutex);
     return res;
 }
 
@@ -147,19 +269,17 @@ static int inc_ref()
  */
 static int dec_ref()
 {
-    pthread_mutex_lock(&ref_mutex);
+    LOCK(ref_mutex);
 
     int res = MEMMGR_ERR_NONE;;
 
     if (refCnt <= 0) res = MEMMGR_ERR_GENERIC;
     else if (!--refCnt) {
-#ifndef STUB_TILER
         close(td);
         td = -1;
-#endif
     }
 
-    pthread_mutex_unlock(&ref_mutex);
+    UNLOCK(ref_mutex);
     return res;
 }
 
@@ -203,804 +323,3467 @@ static bytes_t def_bpp(pixel_fmt_t pixelFormat)
  */
 static bytes_t def_size(tiler_block_info *blk)
 {
-    return (blk->fmt == PIXEL_FMT_PAGE ?
+    return (blk->fmt == (enum tiler_fmt) PIXEL_FMT_PAGE ?
             blk->dim.len :
             blk->dim.area.height * def_stride(blk->dim.area.width * def_bpp(blk->fmt)));
 }
 
 /**
- * Records a buffer-pointer -- tiler-ID mapping for a specific
- * buffer type.
- *
- * @author a0194118 (9/7/2009)
+ * Marks the beginning of a change to the list of allocations.
+ * Must be called with che_mutex held.
+ */
+static void bufs_change_begin()
+{
+    bufs_view.seq++;
+    __sync_synchronize();
+}
+
+/**
+ * Marks the end of a change to the list of allocations.  Must
+ * be called with che_mutex held.
+ */
+static void bufs_change_end()
+{
+    __sync_synchronize();
+    bufs_view.seq++;
+}
+
+/**
+ * Returns the buf_hash bucket of a buffer pointer.
+ */
+static struct _AllocData **buf_hash_bucket(void *bufPtr)
+{
+    uint32_t h = (uint32_t) ((uintptr_t) bufPtr >> 12) * 0x9E3779B1u;
+    return buf_hash + (h >> 24) % BUF_HASH_SIZE;
+}
+
+/**
+ * Adds the blocks of a buffer to the view of the registry.
+ * Must be called with che_mutex held, while changing the list
+ * of allocations.
  *
  * @param bufPtr    Buffer pointer
- * @param tiler_id  Tiler ID
+ * @param buf       Registered buffer
  * @param buf_type  Buffer type: BUF_ALLOCED or BUF_MAPPED
  *
  * @return 0 on success, -ENOMEM on memory allocation failure
  */
-static int buf_cache_add(void *bufPtr, bytes_t size, uint32_t tiler_id,
-                          int buf_type)
+static int view_add(void *bufPtr, struct tiler_buf_info *buf, int buf_type)
 {
-    pthread_mutex_lock(&che_mutex);
-    _AllocData *ad = NEW(_AllocData);
-    if (ad)
+    int ix, pos, num = bufs_view.num_ranges;
+    bytes_t offs = 0;
+
+    if (num + buf->num_blocks > view_size)
     {
-	    ad->bufPtr = bufPtr;
-	    ad->size = size;
-	    ad->tiler_id = tiler_id;
-	    ad->buf_type = buf_type;
-	    DLIST_MADD_BEFORE(bufs, ad, link);
+        int size = view_size ? view_size * 2 : 64;
+        while (size < num + buf->num_blocks) size *= 2;
+        MemMgrViewRange *ranges = NEWN(MemMgrViewRange, size);
+        if (!ranges) return -ENOMEM;
+        if (num) memcpy(ranges, bufs_view.ranges, sizeof(*ranges) * num);
+
+        /* publish the array before the number of ranges grows */
+        __sync_synchronize();
+        bufs_view.ranges = ranges;
+        view_size = size;
     }
-    pthread_mutex_unlock(&che_mutex);
-    return ad == NULL ? -ENOMEM : 0;
+
+    /* blocks are mapped consecutively, except for aperture mode, where
+       the rows of 2D blocks interleave with other buffers' */
+    for (ix = 0; ix < buf->num_blocks; ix++)
+    {
+        struct tiler_block_info *blk = buf->blocks + ix;
+        void *ptr = aperture ? blk->ptr :
+            (void *)((((uintptr_t)bufPtr + offs) & ~(PAGE_SIZE - 1)) |
+                     (blk->ssptr & (PAGE_SIZE - 1)));
+        offs += def_size(blk);
+        if (aperture && blk->fmt != TILFMT_PAGE) continue;
+
+        for (pos = num; pos && bufs_view.ranges[pos - 1].start > (uintptr_t)ptr;
+             pos--);
+        memmove(bufs_view.ranges + pos + 1, bufs_view.ranges + pos,
+                sizeof(MemMgrViewRange) * (num - pos));
+        MemMgrViewRange *r = bufs_view.ranges + pos;
+        r->start = (uintptr_t)ptr;
+        r->end = (uintptr_t)ptr + def_size(blk);
+        r->bufPtr = bufPtr;
+        r->stride = blk->stride;
+        r->fmt = blk->fmt;
+        r->type = buf_type;
+        num++;
+    }
+    __sync_synchronize();
+    bufs_view.num_ranges = num;
+    return 0;
 }
 
 /**
- * Retrieves the tiler ID for given pointer and buffer type from
- * the records.  If the pointer lies within a tracked buffer,
- * the tiler ID is returned.  Otherwise 0 is returned.
- *
- * @author a0194118 (9/7/2009)
+ * Sets the stride of a block of a buffer in the view of the
+ * registry.  Must be called with che_mutex held, while changing
+ * the list of allocations.
  *
  * @param bufPtr    Buffer pointer
- * @param buf_type  Buffer type: BUF_ALLOCED or BUF_MAPPED
- *
- * @return Tiler ID on success, 0 on failure.
+ * @param ptr       Pointer within the block
+ * @param stride    Stride of the block
  */
-static uint32_t buf_cache_query(void *ptr, int buf_type_mask,
-                                void **bufPtr)
+static void view_set_stride(void *bufPtr, void *ptr, bytes_t stride)
 {
-    IN;
-    if(0) DP("in(p=%p,t=%d,bp*=%p)", ptr, buf_type_mask, bufPtr);
-    _AllocData *ad;
-    pthread_mutex_lock(&che_mutex);
-    DLIST_MLOOP(bufs, ad, link) {
-        if(0) {
-            DP("got(%p-%p,%d)", ad->bufPtr, ad->bufPtr + ad->size, ad->buf_type);
-            CHK_P(ad->bufPtr,<=,ptr);
-            CHK_P(ptr,<,ad->bufPtr + ad->size);
-            CHK_I(ad->buf_type & buf_type_mask,!=,0);
-            CHK_P(bufPtr,!=,0);
-        }
-        if ((ad->buf_type & buf_type_mask) &&
-            ad->bufPtr <= ptr && ptr < ad->bufPtr + ad->size) {
-            if (bufPtr)
-            {
-                *bufPtr = ad->bufPtr;
-            }
-            uint32_t tiler_id = ad->tiler_id;
-            pthread_mutex_unlock(&che_mutex);
-            return R_UP(tiler_id);
-        }
+    int ix;
+    for (ix = 0; ix < bufs_view.num_ranges; ix++)
+    {
+        MemMgrViewRange *r = bufs_view.ranges + ix;
+        if (r->bufPtr == bufPtr && r->start <= (uintptr_t)ptr &&
+            (uintptr_t)ptr < r->end) r->stride = stride;
     }
-    pthread_mutex_unlock(&che_mutex);
-    return R_UP(0);
 }
 
 /**
- * Retrieves the tiler ID for given buffer pointer and buffer
- * type from the records.  If the tiler ID is found, it is
- * removed from the records as well.
- *
- * @author a0194118 (9/7/2009)
+ * Removes the blocks of a buffer from the view of the registry.
+ * Must be called with che_mutex held, while changing the list
+ * of allocations.
  *
  * @param bufPtr    Buffer pointer
- * @param buf_type  Buffer type: BUF_ALLOCED or BUF_MAPPED
- *
- * @return Tiler ID on success, 0 on failure.
  */
-static uint32_t buf_cache_del(void *bufPtr, int buf_type)
+static void view_del(void *bufPtr)
 {
-    _AllocData *ad;
-    pthread_mutex_lock(&che_mutex);
-    DLIST_MLOOP(bufs, ad, link) {
-        if (ad->bufPtr == bufPtr && ad->buf_type == buf_type) {
-            uint32_t tiler_id = ad->tiler_id;
-            DLIST_REMOVE(ad->link);
-            FREE(ad);
-            pthread_mutex_unlock(&che_mutex);
-            return tiler_id;
+    int ix, num = 0;
+    for (ix = 0; ix < bufs_view.num_ranges; ix++)
+    {
+        if (bufs_view.ranges[ix].bufPtr != bufPtr)
+        {
+            bufs_view.ranges[num++] = bufs_view.ranges[ix];
         }
     }
-    pthread_mutex_unlock(&che_mutex);
-    return 0;
+    bufs_view.num_ranges = num;
 }
 
 /**
- * Checks the consistency of the internal record cache.  The
- * number of elements in the cache should equal to the number of
- * references.
+ * Returns the address of a system space address in aperture
+ * mode.
  *
- * @author a0194118 (9/7/2009)
+ * @param ssptr  System space address within the tiler space
  *
- * @return 0 on success, non-0 error value on failure.
+ * @return Pointer into the aperture window of ssptr
  */
-static int cache_check()
+static void *ap_ptr(SSPtr ssptr)
 {
-    int num_bufs = 0;
-    pthread_mutex_lock(&che_mutex);
-
-    init();
-
-    _AllocData *ad;
-    DLIST_MLOOP(bufs, ad, link) { num_bufs++; }
+    return ap_base + (ssptr - TILER_MEM_8BIT);
+}
 
-    pthread_mutex_unlock(&che_mutex);
-    return (num_bufs == refCnt) ? MEMMGR_ERR_NONE : MEMMGR_ERR_GENERIC;
+/**
+ * Returns the system space address of a pointer in aperture
+ * mode.
+ *
+ * @param ptr    Pointer
+ *
+ * @return System space address, or 0 if ptr is not in an
+ *         aperture window
+ */
+static SSPtr ap_ssptr(void *ptr)
+{
+    if (!ap_base || ptr < ap_base ||
+        ptr >= ap_base + (TILER_MEM_END - TILER_MEM_8BIT)) return 0;
+    return TILER_MEM_8BIT + (SSPtr)(ptr - ap_base);
 }
 
-static void dump_block(struct tiler_block_info *blk, char *prefix, char *suffix)
+/**
+ * Returns the aperture index entry of a system space address:
+ * the container slot for 2D views, or the page for the
+ * page-mode area.
+ *
+ * @param ssptr  System space address within the tiler space
+ *
+ * @return Index into ap_index
+ */
+static int ap_entry(SSPtr ssptr)
 {
-#if 1
-    switch (blk->fmt)
+    int region = (ssptr - TILER_MEM_8BIT) / AP_REGION_SIZE;
+    bytes_t offs = (ssptr - TILER_MEM_8BIT) % AP_REGION_SIZE;
+    if (region == AP_NUM_REGIONS - 1)
     {
-    case TILFMT_PAGE:
-        P("%s [p=%p(0x%x),l=0x%x,s=%d]%s", prefix, blk->ptr, blk->ssptr,
-          blk->dim.len, blk->stride, suffix);
-        break;
-    case TILFMT_8BIT:
-    case TILFMT_16BIT:
-    case TILFMT_32BIT:
-        P("%s [p=%p(0x%x),%d*%d*%d,s=%d]%s", prefix, blk->ptr, blk->ssptr,
-          blk->dim.area.width, blk->dim.area.height, def_bpp(blk->fmt) * 8,
-          blk->stride, suffix);
-        break;
-    default:
-        P("%s*[p=%p(0x%x),l=0x%x,s=%d,fmt=0x%x]%s", prefix, blk->ptr,
-          blk->ssptr, blk->dim.len, blk->stride, blk->fmt, suffix);
+        return AP_NUM_SLOTS + offs / PAGE_SIZE;
     }
-#endif
+
+    /* slots are 64 rows high in the 8-bit view, and 32 rows otherwise */
+    bytes_t slot_h = region ? TILER_PAGE_HEIGHT / 2 : TILER_PAGE_HEIGHT;
+    bytes_t stride = TilerMem_GetStride(ssptr);
+    return offs / stride / slot_h * TILER_WIDTH +
+           offs % stride / (PAGE_SIZE / slot_h);
 }
 
-static void dump_buf(struct tiler_buf_info* buf, char* prefix)
+/**
+ * Sets the aperture index entries of all slots or pages
+ * covered by a block.  Must be called with che_mutex held.
+ *
+ * @param blk    Pointer to the block info
+ * @param ad     Record to set, or NULL to clear the entries
+ */
+static void ap_index_set(struct tiler_block_info *blk, _AllocData *ad)
 {
-#if 0
-    P("%sbuf={n=%d,id=0x%x,", prefix, buf->num_blocks, buf->offset);
-    int ix = 0;
-    for (ix = 0; ix < buf->num_blocks; ix++)
+    int first = ap_entry(blk->ssptr), last, ix, iy;
+    if (blk->fmt == TILFMT_PAGE)
     {
-        dump_block(buf->blocks + ix, "", ix + 1 == buf->num_blocks ? "}" : "");
+        last = ap_entry(blk->ssptr + blk->dim.len - 1);
+        for (ix = first; ix <= last; ix++)
+        {
+            ap_index[ix] = ad;
+        }
+    }
+    else
+    {
+        last = ap_entry(blk->ssptr +
+                        (blk->dim.area.height - 1) * blk->stride +
+                        blk->dim.area.width * def_bpp(blk->fmt) - 1);
+        for (iy = first / TILER_WIDTH; iy <= last / TILER_WIDTH; iy++)
+        {
+            for (ix = first % TILER_WIDTH; ix <= last % TILER_WIDTH; ix++)
+            {
+                ap_index[iy * TILER_WIDTH + ix] = ad;
+            }
+        }
     }
-#endif
 }
 
 /**
- * Returns the tiler format for an address
+ * Finds the record of a pointer in aperture mode.  Must be
+ * called with che_mutex held.
  *
- * @author a0194118 (9/7/2009)
+ * @param ptr    Pointer
  *
- * @param ssptr   Address
+ * @return Pointer to the record, or NULL if ptr is not within
+ *         a buffer.
+ */
+static _AllocData *ap_lookup(void *ptr)
+{
+    SSPtr ssptr = ap_ssptr(ptr);
+    return ssptr ? ap_index[ap_entry(ssptr)] : NULL;
+}
+
+/**
+ * Wakes up all waiters of a fence slot, and notifies its
+ * exported eventfd.
  *
- * @return The tiler format
+ * @param ad     Pointer to the record
+ * @param slot   Fence slot
  */
-static enum tiler_fmt tiler_get_fmt(SSPtr ssptr)
+static void fence_wake(_AllocData *ad, int slot)
 {
-#ifndef STUB_TILER
-    return (ssptr == 0              ? TILFMT_INVALID :
-            ssptr < TILER_MEM_8BIT  ? TILFMT_NONE :
-            ssptr < TILER_MEM_16BIT ? TILFMT_8BIT :
-            ssptr < TILER_MEM_32BIT ? TILFMT_16BIT :
-            ssptr < TILER_MEM_PAGED ? TILFMT_32BIT :
-            ssptr < TILER_MEM_END   ? TILFMT_PAGE : TILFMT_NONE);
-#else
-    /* if emulating, we need to get through all allocated memory segments */
-    pthread_mutex_lock(&che_mutex);
-    init();
-    _AllocData *ad;
-    void *ptr = (void *) ssptr;
-    if (!ptr) return TILFMT_INVALID;
-    /* P("?%p", (void *)ssptr); */
-    DLIST_MLOOP(bufs, ad, link) {
-        int ix;
-        struct tiler_buf_info *buf = (struct tiler_buf_info *) ad->tiler_id;
-        /* P("buf[%d]", buf->num_blocks); */
-        for (ix = 0; ix < buf->num_blocks; ix++)
+    if (ad->waiters[slot])
+    {
+        syscall(SYS_futex, ad->fence + slot, FUTEX_WAKE_PRIVATE, INT_MAX,
+                NULL, NULL, 0);
+    }
+    if (ad->fence_fd[slot] >= 0)
+    {
+        eventfd_write(ad->fence_fd[slot], 1);
+    }
+}
+
+/**
+ * Releases the fences of a buffer that is being freed.  Waiters
+ * are woken up, and find that the buffer is gone.  Must be
+ * called with che_mutex held.
+ *
+ * @param ad     Pointer to the record
+ */
+static void fence_release(_AllocData *ad)
+{
+    int slot;
+    ad->gen++;
+    for (slot = 0; slot < MEMMGR_FENCE_SLOTS; slot++)
+    {
+        __sync_fetch_and_add(ad->fence + slot, 1);
+        fence_wake(ad, slot);
+        if (ad->fence_fd[slot] >= 0)
         {
-            /* P("block[%p-%p]", buf->blocks[ix].ptr, buf->blocks[ix].ptr + def_size(buf->blocks + ix)); */
-            if (ptr >= buf->blocks[ix].ptr &&
-                ptr < buf->blocks[ix].ptr + def_size(buf->blocks + ix)) {
-                enum tiler_fmt fmt = buf->blocks[ix].fmt;
-                pthread_mutex_unlock(&che_mutex);
-                return fmt;
-            }
+            close(ad->fence_fd[slot]);
+            ad->fence_fd[slot] = -1;
         }
     }
-    pthread_mutex_unlock(&che_mutex);
-    return TILFMT_NONE;
-#endif
 }
 
 /**
- * Allocates a memory block using tiler
+ * Returns the monotonic time in microseconds.
+ */
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Returns the page-aligned address range that a buffer is mapped
+ * into.
  *
- * @author a0194118 (9/7/2009)
+ * @param ad     Pointer to the record
+ * @param base   Pointer to store the start of the range
  *
- * @param blk    Pointer to the block info
+ * @return Length of the range
+ */
+static bytes_t buf_extent(_AllocData *ad, void **base)
+{
+    *base = (void *)((uintptr_t)ad->bufPtr & ~(PAGE_SIZE - 1));
+    return ROUND_UP_TO2POW(ad->bufPtr - *base + ad->size, PAGE_SIZE);
+}
+
+/**
+ * Returns the number of container slots, or pages for 1D
+ * blocks, that a block takes up.
  *
- * @return ssptr of block allocated, or 0 on error
+ * @param blk    Pointer to the tiler_block_info struct
+ *
+ * @return Number of slots
  */
-static SSPtr tiler_alloc(struct tiler_block_info *blk)
+static uint32_t blk_slots(struct tiler_block_info *blk)
 {
-    if (0) dump_block(blk, "=(ta)=>", "");
-    blk->ptr = NULL;
-    R_I(ioctl(td, TILIOC_GBUF, blk));
-    if (blk->fmt != PIXEL_FMT_PAGE)
+    if (blk->fmt == TILFMT_PAGE)
     {
-        blk->stride = def_stride(blk->dim.area.width * def_bpp(blk->fmt));
+        return ROUND_UP_TO2POW((blk->ssptr & (PAGE_SIZE - 1)) + blk->dim.len,
+                               PAGE_SIZE) / PAGE_SIZE;
     }
-    dump_block(blk, "alloced: ", "");
-    return R_UP(blk->ssptr);
+
+    /* a slot is 64x64 pixels for 8-bit, 64x32 for 16-bit and 32x32 for
+       32-bit blocks */
+    uint32_t w = blk->fmt == TILFMT_32BIT ? 32 : 64;
+    uint32_t h = blk->fmt == TILFMT_8BIT ? 64 : 32;
+    return ((blk->dim.area.width + w - 1) / w) *
+           ((blk->dim.area.height + h - 1) / h);
 }
 
 /**
- * Frees a memory block using tiler
- *
- * @author a0194118 (9/7/2009)
+ * Sends a request to the arbitration service, and receives the
+ * reply in its place.  Must be called with arb_mutex held.
  *
- * @param blk    Pointer to the block info
+ * @param msg    Pointer to the request
  *
- * @return 0 on success, non-0 error value on failure.
+ * @return the result of the request, or -EIO on communication
+ *         failure
  */
-static int tiler_free(struct tiler_block_info *blk)
+static int arb_request(struct tiler_arb_msg *msg)
 {
-    return R_I(ioctl(td, TILIOC_FBUF, blk));
+    lease.round_trips++;
+    if (NOT_I(send(arb_fd, msg, sizeof(*msg), MSG_NOSIGNAL),==,sizeof(*msg)) ||
+        NOT_I(recv(arb_fd, msg, sizeof(*msg), 0),==,sizeof(*msg)))
+        return -EIO;
+    return msg->result;
 }
 
 /**
- * Maps a memory block into tiler using tiler
+ * Charges capacity against the lease of the process.  If the
+ * lease runs out, more is leased, rounded up to the lease chunk
+ * if possible.
  *
- * @author a0194118 (9/7/2009)
- *
- * @param blk    Pointer to the block info
+ * @param slots  Container slots
+ * @param pages  Page-mode pages
  *
- * @return ssptr of block mapped, or 0 on error
+ * @return 0 on success, non-0 error value if the service denied
+ *         the lease.
  */
-static SSPtr tiler_map(struct tiler_block_info *blk)
+static int lease_charge(uint32_t slots, uint32_t pages)
 {
-    dump_block(blk, "=(tm)=>", "");
-    R_I(ioctl(td, TILIOC_MBUF, blk));
-    return R_UP(blk->ssptr);
+    struct tiler_arb_msg msg;
+    int ret = 0;
+
+    LOCK(arb_mutex);
+    if (arb_fd >= 0)
+    {
+        uint32_t need_slots = lease.used_slots + slots > lease.slots ?
+                              lease.used_slots + slots - lease.slots : 0;
+        uint32_t need_pages = lease.used_pages + pages > lease.pages ?
+                              lease.used_pages + pages - lease.pages : 0;
+        if (need_slots || need_pages)
+        {
+            ZERO(msg);
+            msg.cmd = TILER_ARB_LEASE;
+            msg.slots = need_slots ? ROUND_UP_TO(need_slots, arb_chunk) : 0;
+            msg.pages = need_pages ? ROUND_UP_TO(need_pages, arb_chunk) : 0;
+            ret = arb_request(&msg);
+
+            /* the rest of the chunk may not be available */
+            if (ret == -EDQUOT || ret == -ENOSPC)
+            {
+                ZERO(msg);
+                msg.cmd = TILER_ARB_LEASE;
+                msg.slots = need_slots;
+                msg.pages = need_pages;
+                ret = arb_request(&msg);
+            }
+            if (!ret)
+            {
+                lease.slots += msg.slots;
+                lease.pages += msg.pages;
+            }
+        }
+        if (!ret)
+        {
+            lease.used_slots += slots;
+            lease.used_pages += pages;
+        }
+        else
+        {
+            lease.denied++;
+        }
+    }
+    UNLOCK(arb_mutex);
+    return ret;
 }
 
 /**
- * Unmaps a memory block from tiler using tiler
+ * Credits capacity back to the lease of the process.  If more
+ * than two chunks of the lease are unused, all but one chunk is
+ * returned to the service.
  *
- * @author a0194118 (9/7/2009)
+ * @param slots  Container slots
+ * @param pages  Page-mode pages
+ */
+static void lease_credit(uint32_t slots, uint32_t pages)
+{
+    struct tiler_arb_msg msg;
+
+    LOCK(arb_mutex);
+    if (arb_fd >= 0)
+    {
+        lease.used_slots -= slots;
+        lease.used_pages -= pages;
+
+        ZERO(msg);
+        msg.cmd = TILER_ARB_RETURN;
+        if (lease.slots - lease.used_slots > 2 * arb_chunk)
+            msg.slots = lease.slots - lease.used_slots - arb_chunk;
+        if (lease.pages - lease.used_pages > 2 * arb_chunk)
+            msg.pages = lease.pages - lease.used_pages - arb_chunk;
+        if ((msg.slots || msg.pages) && !arb_request(&msg))
+        {
+            lease.slots -= msg.slots;
+            lease.pages -= msg.pages;
+        }
+    }
+    UNLOCK(arb_mutex);
+}
+
+/**
+ * Sends a request to the buffer keeper, and receives the reply
+ * in its place.  Must be called with keep_mutex held.
  *
- * @param blk    Pointer to the block info
+ * @param msg       Pointer to the request
+ * @param fd        File descriptor to send, or -1
+ * @param reply_fd  Pointer to store the file descriptor of the
+ *                  reply on success, or NULL to close it
  *
- * @return 0 on success, non-0 error value on failure.
+ * @return the result of the request, or -EIO on communication
+ *         failure
  */
-static int tiler_unmap(struct tiler_block_info *blk)
+static int keep_request(struct tiler_keep_msg *msg, int fd, int *reply_fd)
 {
-    return ioctl(td, TILIOC_UMBUF, blk);
+    int rfd = -1;
+    if (NOT_I(TilerKeep_Send(keep_sock, msg, fd),==,0) ||
+        NOT_I(TilerKeep_Recv(keep_sock, msg, &rfd),==,sizeof(*msg)))
+        msg->result = -EIO;
+    if (reply_fd && !msg->result)
+        *reply_fd = rfd;
+    else if (rfd >= 0)
+        close(rfd);
+    return msg->result;
+}
+
+/* stops keeping a buffer, if still connected to the keeper */
+static void keep_drop(uint32_t id)
+{
+    struct tiler_keep_msg msg;
+    ZERO(msg);
+    msg.cmd = TILER_KEEP_DROP;
+    msg.id = id;
+    LOCK(keep_mutex);
+    if (keep_sock >= 0) CHK_I(keep_request(&msg, -1, NULL),==,0);
+    UNLOCK(keep_mutex);
 }
 
 /**
- * Returns the size of a buffer.
- *
- * @author a0194118 (9/7/2009)
+ * Returns the capacity that the blocks of a buffer take up.
  *
- * @param blks        Pointer to array of block info structures
+ * @param blks        Pointer to the block info array
  * @param num_blocks  Number of blocks
+ * @param pages       Pointer to store the number of page-mode
+ *                    pages
  *
- * @return Size of a resulting buffer
+ * @return Number of container slots
  */
-static bytes_t tiler_size(struct tiler_block_info *blks, int num_blocks)
+static uint32_t buf_slots(struct tiler_block_info *blks, int num_blocks,
+                          uint32_t *pages)
 {
-    bytes_t size = 0;
+    uint32_t slots = 0;
     int ix;
-    for (ix = 0; ix < num_blocks; ix++)
+    for (*pages = ix = 0; ix < num_blocks; ix++)
     {
-        size += def_size(blks + ix);
+        if (blks[ix].fmt == TILFMT_PAGE)
+            *pages += blk_slots(blks + ix);
+        else
+            slots += blk_slots(blks + ix);
     }
-    return size;
+    return slots;
 }
 
 /**
- * Registers a buffer structure with tiler, and maps the buffer
- * into memory using tiler. On success, it writes the tiler ID
- * of the buffer into the area pointed by tiler ID.
+ * Records a buffer-pointer -- tiler-ID mapping for a specific
+ * buffer type.  The tiler ID is the offset of the registered
+ * buffer.
  *
  * @author a0194118 (9/7/2009)
  *
- * @param blks        Pointer to array of block info structures
- * @param num_blocks  Number of blocks
- * @param tiler_id      Pointer to tiler ID.
+ * @param bufPtr    Buffer pointer
+ * @param size      Buffer size
+ * @param buf       Registered buffer
+ * @param buf_type  Buffer type: BUF_ALLOCED or BUF_MAPPED
+ * @param ring      Whether the buffer is mapped twice, back to
+ *                  back (size covers both mappings)
+ *
+ * @return 0 on success, -ENOMEM on memory allocation failure
+ */
+static int buf_cache_add(void *bufPtr, bytes_t size,
+                         struct tiler_buf_info *buf, int buf_type, bool ring)
+{
+    LOCK(che_mutex);
+    init();
+
+    _AllocData *ad = NULL;
+    if (DLIST_IS_EMPTY(free_ads))
+    {
+        ad = NEW(_AllocData);
+        if (ad) num_ads++;
+    }
+
+    bufs_change_begin();
+    if (!ad && !DLIST_IS_EMPTY(free_ads))
+    {
+        ad = DLIST_FIRST(free_ads);
+        DLIST_REMOVE(ad->link);
+    }
+    if (ad && aperture && !ad->blocks)
+    {
+        ad->blocks = NEWN(struct tiler_block_info, TILER_MAX_NUM_BLOCKS);
+    }
+    if (ad && ((aperture && !ad->blocks) ||
+               NOT_I(view_add(bufPtr, buf, buf_type),==,0)))
+    {
+        DLIST_MADD_BEFORE(free_ads, ad, link);
+        ad = NULL;
+    }
+    if (ad)
+    {
+        int ix;
+	    ad->bufPtr = bufPtr;
+	    ad->size = size;
+	    ad->tiler_id = buf->offset;
+	    ad->buf_type = buf_type;
+        ad->num_blocks = buf->num_blocks;
+        for (ix = 0; ix < MEMMGR_FENCE_SLOTS; ix++)
+        {
+            ad->fence[ix] = 0;
+            ad->fence_fd[ix] = -1;
+        }
+        ad->num_dirty = 0;
+        ad->slots = buf_slots(buf->blocks, buf->num_blocks, &ad->pages);
+        ad->last_use = now_us();
+        ad->pins = 0;
+        ad->demotable = false;
+        ad->keep_id = 0;
+        memset(ad->user_data, 0, sizeof(ad->user_data));
+        ad->refs = 1;
+        ad->usage = 0;
+        ad->ring = ring;
+        ad->locked = NULL;
+        ad->demoted = NULL;
+        for (ad->formats = ix = 0; ix < buf->num_blocks; ix++)
+        {
+            ad->formats |= 1 << buf->blocks[ix].fmt;
+            ad->blk_fmt[ix] = buf->blocks[ix].fmt;
+            ad->blk_stride[ix] = buf->blocks[ix].stride;
+            if (aperture)
+            {
+                ad->blocks[ix] = buf->blocks[ix];
+                ap_index_set(ad->blocks + ix, ad);
+            }
+        }
+	    DLIST_MADD_BEFORE(bufs, ad, link);
+        ad->hash_next = *buf_hash_bucket(bufPtr);
+        *buf_hash_bucket(bufPtr) = ad;
+    }
+    bufs_change_end();
+
+    UNLOCK(che_mutex);
+    return ad == NULL ? -ENOMEM : 0;
+}
+
+/**
+ * Finds the record of the buffer that contains a pointer.  Must
+ * be called with che_mutex held.
+ *
+ * @param ptr            Pointer
+ * @param buf_type_mask  Mask of buffer types to look for
+ *
+ * @return Pointer to the record, or NULL if not found.
+ */
+static _AllocData *buf_cache_find(void *ptr, int buf_type_mask)
+{
+    _AllocData *ad;
+    if (aperture)
+    {
+        ad = ap_lookup(ptr);
+        return ad && (ad->buf_type & buf_type_mask) ? ad : NULL;
+    }
+    DLIST_MLOOP(bufs, ad, link) {
+        if ((ad->buf_type & buf_type_mask) &&
+            ad->bufPtr <= ptr && ptr < ad->bufPtr + ad->size) return ad;
+    }
+    return NULL;
+}
+
+/**
+ * Retrieves the tiler ID for given buffer pointer and buffer
+ * type from the records.  If the tiler ID is found, it is
+ * removed from the records as well.  If the buffer is demoted,
+ * its contents and address range are released, as its blocks
+ * are already freed.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param bufPtr    Buffer pointer
+ * @param buf_type  Buffer type: BUF_ALLOCED or BUF_MAPPED
+ * @param demoted   Pointer to store whether the buffer was
+ *                  demoted, or NULL
+ * @param slots     Pointer to store the slots to credit to the
+ *                  lease.  The lease is not credited here, as
+ *                  that may take a round trip to tiler_arbd.
+ * @param pages     Pointer to store the pages to credit
+ *
+ * @return Tiler ID on success, 0 on failure.
+ */
+static uint32_t buf_cache_del(void *bufPtr, int buf_type, bool *demoted,
+                              uint32_t *slots, uint32_t *pages)
+{
+    _AllocData *ad, *found = NULL;
+    uint32_t tiler_id = 0;
+    *slots = *pages = 0;
+    LOCK(che_mutex);
+    if (aperture)
+    {
+        found = ap_lookup(bufPtr);
+    }
+    else
+    {
+        DLIST_MLOOP(bufs, ad, link) {
+            if (ad->bufPtr == bufPtr && ad->buf_type == buf_type) {
+                found = ad;
+                break;
+            }
+        }
+    }
+    if (found && found->bufPtr == bufPtr && found->buf_type == buf_type)
+    {
+        int ix;
+        _AllocData **pad = buf_hash_bucket(bufPtr);
+        tiler_id = found->tiler_id;
+        bufs_change_begin();
+        while (*pad != found)
+        {
+            pad = &(*pad)->hash_next;
+        }
+        *pad = found->hash_next;
+        found->refs = 0;
+        view_del(bufPtr);
+        for (ix = 0; aperture && ix < found->num_blocks; ix++)
+        {
+            ap_index_set(found->blocks + ix, NULL);
+        }
+        fence_release(found);
+        /* demoted buffers have already returned their capacity */
+        if (!found->demoted)
+        {
+            *slots = found->slots;
+            *pages = found->pages;
+        }
+        if (demoted) *demoted = found->demoted != NULL;
+        if (found->demoted)
+        {
+            void *base;
+            bytes_t len = buf_extent(found, &base);
+            A_I(munmap(base, len),==,0);
+            FREE(found->demoted->data);
+            FREE(found->demoted);
+            num_demoted--;
+        }
+        DLIST_REMOVE(found->link);
+        DLIST_MADD_BEFORE(free_ads, found, link);
+        bufs_change_end();
+    }
+    UNLOCK(che_mutex);
+    return tiler_id;
+}
+
+/**
+ * Checks the consistency of the internal record cache.  The
+ * number of elements in the cache should equal to the number of
+ * references.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int cache_check()
+{
+    int num_bufs = 0;
+    LOCK(che_mutex);
+
+    init();
+
+    _AllocData *ad;
+    DLIST_MLOOP(bufs, ad, link) { num_bufs++; }
+
+    UNLOCK(che_mutex);
+    return (num_bufs == refCnt) ? MEMMGR_ERR_NONE : MEMMGR_ERR_GENERIC;
+}
+
+static void dump_block(struct tiler_block_info *blk, char *prefix, char *suffix)
+{
+#if 1
+    switch (blk->fmt)
+    {
+    case TILFMT_PAGE:
+        P("%s [p=%p(0x%x),l=0x%x,s=%d]%s", prefix, blk->ptr, blk->ssptr,
+          blk->dim.len, blk->stride, suffix);
+        break;
+    case TILFMT_8BIT:
+    case TILFMT_16BIT:
+    case TILFMT_32BIT:
+        P("%s [p=%p(0x%x),%d*%d*%d,s=%d]%s", prefix, blk->ptr, blk->ssptr,
+          blk->dim.area.width, blk->dim.area.height, def_bpp(blk->fmt) * 8,
+          blk->stride, suffix);
+        break;
+    default:
+        P("%s*[p=%p(0x%x),l=0x%x,s=%d,fmt=0x%x]%s", prefix, blk->ptr,
+          blk->ssptr, blk->dim.len, blk->stride, blk->fmt, suffix);
+    }
+#endif
+}
+
+static void dump_buf(struct tiler_buf_info* buf, char* prefix)
+{
+#if 0
+    P("%sbuf={n=%d,id=0x%x,", prefix, buf->num_blocks, buf->offset);
+    int ix = 0;
+    for (ix = 0; ix < buf->num_blocks; ix++)
+    {
+        dump_block(buf->blocks + ix, "", ix + 1 == buf->num_blocks ? "}" : "");
+    }
+#endif
+}
+
+/**
+ * Returns the tiler format for an address
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param ssptr   Address
+ *
+ * @return The tiler format
+ */
+static enum tiler_fmt tiler_get_fmt(SSPtr ssptr)
+{
+    return (ssptr == 0              ? TILFMT_INVALID :
+            ssptr < TILER_MEM_8BIT  ? TILFMT_NONE :
+            ssptr < TILER_MEM_16BIT ? TILFMT_8BIT :
+            ssptr < TILER_MEM_32BIT ? TILFMT_16BIT :
+            ssptr < TILER_MEM_PAGED ? TILFMT_32BIT :
+            ssptr < TILER_MEM_END   ? TILFMT_PAGE : TILFMT_NONE);
+}
+
+/**
+ * Allocates a memory block using tiler
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blk    Pointer to the block info
+ *
+ * @return ssptr of block allocated, or 0 on error
+ */
+static SSPtr tiler_alloc(struct tiler_block_info *blk)
+{
+    if (0) dump_block(blk, "=(ta)=>", "");
+    blk->ptr = NULL;
+    if (NOT_I(ioctl(td, TILIOC_GBUF, blk),==,0)) return R_UP(0);
+    if (blk->fmt != (enum tiler_fmt) PIXEL_FMT_PAGE)
+    {
+        blk->stride = def_stride(blk->dim.area.width * def_bpp(blk->fmt));
+    }
+    dump_block(blk, "alloced: ", "");
+    return R_UP(blk->ssptr);
+}
+
+/**
+ * Frees a memory block using tiler
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blk    Pointer to the block info
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int tiler_free(struct tiler_block_info *blk)
+{
+    return R_I(ioctl(td, TILIOC_FBUF, blk));
+}
+
+/**
+ * Maps a memory block into tiler using tiler
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blk    Pointer to the block info
+ *
+ * @return ssptr of block mapped, or 0 on error
+ */
+static SSPtr tiler_map(struct tiler_block_info *blk)
+{
+    dump_block(blk, "=(tm)=>", "");
+    if (NOT_I(ioctl(td, TILIOC_MBUF, blk),==,0)) return R_UP(0);
+    return R_UP(blk->ssptr);
+}
+
+/**
+ * Unmaps a memory block from tiler using tiler
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blk    Pointer to the block info
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int tiler_unmap(struct tiler_block_info *blk)
+{
+    return ioctl(td, TILIOC_UMBUF, blk);
+}
+
+/**
+ * Returns the size of a buffer.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blks        Pointer to array of block info structures
+ * @param num_blocks  Number of blocks
+ *
+ * @return Size of a resulting buffer
+ */
+static bytes_t tiler_size(struct tiler_block_info *blks, int num_blocks)
+{
+    bytes_t size = 0;
+    int ix;
+    for (ix = 0; ix < num_blocks; ix++)
+    {
+        size += def_size(blks + ix);
+    }
+    return size;
+}
+
+/**
+ * Allocates all blocks of a buffer using tiler in a single
+ * pass.  The blocks are allocated in place in the buffer
+ * structure, so that it can be used as the registration
+ * payload without further copying.  If any allocation fails,
+ * the blocks already allocated are freed.
+ *
+ * @param buf    Pointer to the buffer info structure
+ *
+ * @return Size of the resulting buffer on success, 0 on
+ *         failure.
+ */
+static bytes_t tiler_alloc_buf(struct tiler_buf_info *buf)
+{
+    bytes_t size = 0;
+    int ix;
+    for (ix = 0; ix < buf->num_blocks; ix++)
+    {
+        struct tiler_block_info *blk = buf->blocks + ix;
+        CHK_P(blk->ptr,==,NULL);
+        if (NOT_I(tiler_alloc(blk),>,0)) break;
+        size += def_size(blk);
+    }
+
+    /* free blocks on failure */
+    if (ix < buf->num_blocks)
+    {
+        while (ix)
+        {
+            tiler_free(buf->blocks + --ix);
+        }
+        size = 0;
+    }
+    return size;
+}
+
+/**
+ * Maps a registered 1D buffer twice, back to back, so that
+ * accesses across its end continue at its start.
+ *
+ * @param offset  Offset of the registered buffer
+ * @param len     Length of the buffer (multiple of the page
+ *                size)
+ *
+ * @return Pointer to the first mapping, or MAP_FAILED on error.
+ */
+static void *ring_mmap(uint32_t offset, bytes_t len)
+{
+    /* reserve both halves, then replace them with the mappings */
+    void *base = mmap(NULL, 2 * len, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (NOT_P(base,!=,MAP_FAILED)) return MAP_FAILED;
+    if (NOT_P(mmap(base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                   td, offset),==,base))
+    {
+        munmap(base, 2 * len);
+        return MAP_FAILED;
+    }
+    if (NOT_P(mmap(base + len, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, td, offset),==,base + len))
+    {
+        munmap(base, len);
+        munmap(base + len, len);
+        return MAP_FAILED;
+    }
+    return base;
+}
+
+/**
+ * Registers a buffer structure with tiler, and maps the buffer
+ * into memory using tiler.  The block information in the
+ * buffer structure is used as the registration payload as is,
+ * and on success its ptr fields are updated to the mapped
+ * addresses of the blocks.  The buffer is unregistered on
+ * failure.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param buf         Pointer to the buffer info structure with
+ *                    all blocks already allocated or mapped
+ * @param size        Size of the buffer (see tiler_size)
+ * @param buf_type    Buffer type: BUF_ALLOCED or BUF_MAPPED
+ * @param registered  Whether the buffer is already registered
+ *                    (buf->offset is set)
+ * @param ring        Whether to map the buffer twice, back to
+ *                    back (not in aperture mode)
+ *
+ * @return pointer to the mapped buffer.
+ */
+static void *tiler_mmap(struct tiler_buf_info *buf, bytes_t size,
+                        int buf_type, bool registered, bool ring)
+{
+    IN;
+
+    bytes_t offs;
+    int ix;
+
+    /* register buffer with tiler */
+    if (!registered)
+    {
+        dump_buf(buf, "==(RBUF)=>");
+        int ret = ioctl(td, TILIOC_RBUF, buf);
+        dump_buf(buf, "<=(RBUF)==");
+        if (NOT_I(ret,==,0)) return NULL;
+    }
+    if (NOT_L(buf->offset,!=,0)) return NULL;
+
+    /* in aperture mode the blocks are already mapped at their fixed
+       offsets, and 2D blocks use the stride of the container view */
+    if (aperture)
+    {
+        for (ix = 0; ix < buf->num_blocks; ix++)
+        {
+            struct tiler_block_info *blk = buf->blocks + ix;
+            blk->ptr = ap_ptr(blk->ssptr);
+            if (blk->fmt != (enum tiler_fmt) PIXEL_FMT_PAGE)
+            {
+                blk->stride = TilerMem_GetStride(blk->ssptr);
+            }
+        }
+        if (NOT_I(buf_cache_add(buf->blocks[0].ptr, size, buf, buf_type,
+                                false),==,0))
+        {
+            A_I(ioctl(td, TILIOC_URBUF, buf),==,0);
+            buf->offset = 0;
+            return R_P(NULL);
+        }
+        return R_P(buf->blocks[0].ptr);
+    }
+
+    /* map blocks to process space.  Rings are mapped twice into a
+       reserved range, so that the mappings are back to back. */
+    void *bufPtr = ring ? ring_mmap(buf->offset, size) :
+                   mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        td, buf->offset);
+    if (bufPtr == MAP_FAILED){
+        bufPtr = NULL;
+    } else {
+        bufPtr += buf->blocks[0].ssptr & (PAGE_SIZE - 1);
+    }
+    if(0) DP("ptr=%p", bufPtr);
+
+    /* if failed to map: unregister buffer */
+    if (NOT_P(bufPtr,!=,NULL) ||
+	/* or failed to cache tiler ID for buffer */
+        NOT_I(buf_cache_add(bufPtr, ring ? 2 * size : size, buf, buf_type,
+                            ring),==,0))
+    {
+        if (bufPtr) munmap((void *)((uintptr_t)bufPtr & ~(PAGE_SIZE - 1)), size);
+        if (bufPtr && ring) munmap(bufPtr + size, size);
+        A_I(ioctl(td, TILIOC_URBUF, buf),==,0);
+        buf->offset = 0;
+        return R_P(NULL);
+    }
+
+    /* fill out pointers in the same pass */
+    for (offs = ix = 0; ix < buf->num_blocks; ix++)
+    {
+        struct tiler_block_info *blk = buf->blocks + ix;
+        blk->ptr = bufPtr + offs;
+        offs += def_size(blk);
+        blk->ptr = (void *)((((uintptr_t)blk->ptr) & ~(PAGE_SIZE - 1)) | (blk->ssptr & (PAGE_SIZE - 1)));
+    }
+
+    return R_P(bufPtr);
+}
+
+/**
+ * Checks whether the tiler_block_info is filled in correctly.
+ * Verifies the pixel format, correct length, width and or
+ * height, the length/stride relationship for 1D buffers, and
+ * the correct stride for 2D buffers.  Also verifies block size
+ * to be page sized if desired.
+ *
+ * @author a0194118 (9/4/2009)
+ *
+ * @param blk            Pointer to the tiler_block_info struct
+ * @param is_page_sized  Whether the block needs to be page
+ *                       sized (fit on whole pages).
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int check_block(tiler_block_info *blk, bool is_page_sized)
+{
+    /* check pixelformat */
+    if (NOT_I(blk->fmt,>=,(enum tiler_fmt) PIXEL_FMT_MIN) ||
+        NOT_I(blk->fmt,<=,(enum tiler_fmt) PIXEL_FMT_MAX)) return MEMMGR_ERR_GENERIC;
+
+
+    if (blk->fmt == (enum tiler_fmt) PIXEL_FMT_PAGE)
+    {   /* check 1D buffers */
+
+        /* length must be multiple of stride if stride > 0 */
+        if (NOT_I(blk->dim.len,>,0) ||
+            (blk->stride && NOT_I(blk->dim.len % blk->stride,==,0)))
+            return MEMMGR_ERR_GENERIC;
+    }
+    else
+    {   /* check 2D buffers */
+
+        /* check width, height and stride (must be the default stride or 0) */
+        bytes_t stride = def_stride(blk->dim.area.width * def_bpp(blk->fmt));
+        if (NOT_I(blk->dim.area.width,>,0) ||
+            NOT_I(blk->dim.area.height,>,0) ||
+            (blk->stride && NOT_I(blk->stride,==,stride)))
+            return MEMMGR_ERR_GENERIC;
+    }
+
+    if (is_page_sized && NOT_I(def_size(blk) & (PAGE_SIZE - 1),==,0))
+        return MEMMGR_ERR_GENERIC;
+
+    return MEMMGR_ERR_NONE;
+}
+
+/**
+ * Checks whether the block information is correct for map and
+ * alloc operations.  Checks the number of blocks, and validity
+ * of each block.  Warns if reserved member is not 0.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blks                 Pointer to the block info array.
+ * @param num_blocks           Number of blocks.
+ * @param num_pagesize_blocks  Number of blocks that must be
+ *                             page sized (these must be in
+ *                             front)
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int check_blocks(struct tiler_block_info *blks, int num_blocks,
+                 int num_pagesize_blocks)
+{
+    /* check arguments */
+    if (NOT_I(num_blocks,>,0) ||
+        NOT_I(num_blocks,<=,TILER_MAX_NUM_BLOCKS)) return MEMMGR_ERR_GENERIC;
+
+    /* check block allocation params */
+    int ix;
+    for (ix = 0; ix < num_blocks; ix++)
+    {
+        struct tiler_block_info *blk = blks + ix;
+        CHK_I(blk->ssptr,==,0);
+        int ret = check_block(blk, ix < num_pagesize_blocks);
+        if (ret)
+        {
+            DP("for block[%d]", ix);
+            return ret;
+        }
+    }
+
+    return MEMMGR_ERR_NONE;
+}
+
+/**
+ * Resets the ptr and reserved fields of the block info
+ * structures.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param blks                 Pointer to the block info array.
+ * @param num_blocks           Number of blocks.
+ */
+static void reset_blocks(struct tiler_block_info *blks, int num_blocks)
+{
+    int ix;
+    for (ix = 0; ix < num_blocks; ix++)
+    {
+        blks[ix].ssptr = 0;
+        blks[ix].ptr = NULL;
+    }
+
+}
+
+/**
+ * Demotes a buffer: compresses its contents into system memory,
+ * replaces its mapping with an inaccessible reservation, and
+ * unregisters and frees its blocks.  Must be called with
+ * che_mutex held.  The caller credits the capacity of the buffer
+ * to the lease once it has released che_mutex.
+ *
+ * @param ad     Pointer to the record
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+static int buf_demote(_AllocData *ad)
+{
+    uint64_t start = now_us();
+    uint32_t slots = 0;
+    bytes_t cap = LZ_BOUND(ad->size);
+    void *base, *data;
+    bytes_t len = buf_extent(ad, &base);
+    int ix;
+
+    _Demoted *dm = NEW(_Demoted);
+    if (NOT_P(dm,!=,NULL)) return -ENOMEM;
+    ALLOCN(dm->data, cap);
+    dm->buf.offset = ad->tiler_id;
+    if (NOT_P(dm->data,!=,NULL) ||
+        NOT_I(ioctl(td, TILIOC_QBUF, &dm->buf),==,0)) goto FAIL;
+    dm->len = LZ_Compress(ad->bufPtr, ad->size, dm->data, cap);
+
+    /* keep the address range reserved, so that the pointer stays valid */
+    if (NOT_P(mmap(base, len, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                   -1, 0),==,base)) goto FAIL;
+
+    /* the contents are gone now, so release the blocks even on errors */
+    A_I(ioctl(td, TILIOC_URBUF, &dm->buf),==,0);
+    for (ix = 0; ix < dm->buf.num_blocks; ix++)
+    {
+        slots += blk_slots(dm->buf.blocks + ix);
+        A_I(tiler_free(dm->buf.blocks + ix),==,0);
+    }
+
+    data = realloc(dm->data, dm->len);
+    if (data) dm->data = data;
+    ad->demoted = dm;
+    num_demoted++;
+
+    demote_stats.demoted++;
+    demote_stats.slots += slots;
+    demote_stats.bytes += ad->size;
+    demote_stats.compressed += dm->len;
+    demote_stats.demote_us += now_us() - start;
+    return 0;
+
+FAIL:
+    FREE(dm->data);
+    FREE(dm);
+    return MEMMGR_ERR_GENERIC;
+}
+
+/**
+ * Restores a demoted buffer into newly allocated blocks, mapped
+ * at the original address.  Must be called with che_mutex held,
+ * and with the capacity of the buffer charged against the lease.
+ *
+ * @param ad     Pointer to the record
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+static int buf_restore(_AllocData *ad)
+{
+    uint64_t start = now_us();
+    _Demoted *dm = ad->demoted;
+    struct tiler_buf_info buf = dm->buf;
+    void *base;
+    bytes_t len = buf_extent(ad, &base);
+    int ix;
+
+    buf.offset = 0;
+    reset_blocks(buf.blocks, buf.num_blocks);
+    if (NOT_I(tiler_alloc_buf(&buf),>,0)) return MEMMGR_ERR_GENERIC;
+
+    dump_buf(&buf, "==(RBUF)=>");
+    int ret = ioctl(td, TILIOC_RBUF, &buf);
+    dump_buf(&buf, "<=(RBUF)==");
+    if (NOT_I(ret,==,0) || NOT_L(buf.offset,!=,0)) goto FAIL;
+
+    /* the buffer must keep its page offset to keep its pointer */
+    if (NOT_L(buf.blocks[0].ssptr & (PAGE_SIZE - 1),==,
+              (uintptr_t)ad->bufPtr & (PAGE_SIZE - 1)) ||
+        NOT_P(mmap(base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                   td, buf.offset),==,base))
+    {
+        A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
+        goto FAIL;
+    }
+    A_L(LZ_Decompress(dm->data, dm->len, ad->bufPtr, ad->size),==,ad->size);
+
+    bufs_change_begin();
+    ad->tiler_id = buf.offset;
+    ad->demoted = NULL;
+    bufs_change_end();
+    num_demoted--;
+    FREE(dm->data);
+    FREE(dm);
+
+    demote_stats.restored++;
+    demote_stats.restore_us += now_us() - start;
+    return 0;
+
+FAIL:
+    for (ix = 0; ix < buf.num_blocks; ix++)
+    {
+        tiler_free(buf.blocks + ix);
+    }
+    return MEMMGR_ERR_GENERIC;
+}
+
+/**
+ * Finds the record of the buffer that contains a pointer passed
+ * to a memory allocator call.  The buffer is marked used, and is
+ * restored if it is demoted.  Must be called with che_mutex
+ * held.  To restore a buffer, che_mutex is released while its
+ * capacity is charged against the lease, so records found before
+ * the call must be looked up again.
+ *
+ * @param ptr            Pointer
+ * @param buf_type_mask  Mask of buffer types to look for
+ *
+ * @return Pointer to the record, or NULL if not found or the
+ *         buffer could not be restored.
+ */
+static _AllocData *buf_cache_use(void *ptr, int buf_type_mask)
+{
+    _AllocData *ad = buf_cache_find(ptr, buf_type_mask);
+    while (ad && ad->demoted)
+    {
+        /* the service may be a round trip away, so charge the lease
+           without holding che_mutex */
+        uint32_t gen = ad->gen, slots = ad->slots, pages = ad->pages;
+        UNLOCK(che_mutex);
+        int ret = lease_charge(slots, pages);
+        LOCK(che_mutex);
+        if (NOT_I(ret,==,0)) return NULL;
+
+        /* the buffer may have been freed or restored meanwhile */
+        ad = buf_cache_find(ptr, buf_type_mask);
+        if (ad && ad->gen == gen && ad->demoted)
+        {
+            ret = buf_restore(ad);
+            if (!NOT_I(ret,==,0)) break;
+            ad = NULL;
+        }
+        UNLOCK(che_mutex);
+        lease_credit(slots, pages);
+        LOCK(che_mutex);
+        if (ret) return NULL;
+        ad = buf_cache_find(ptr, buf_type_mask);
+    }
+    if (ad) ad->last_use = now_us();
+    return ad;
+}
+
+/**
+ * Retrieves the tiler ID for given pointer and buffer type from
+ * the records.  If the pointer lies within a tracked buffer,
+ * the tiler ID is returned.  Otherwise 0 is returned.  A
+ * demoted buffer is restored first.
+ *
+ * @author a0194118 (9/7/2009)
+ *
+ * @param bufPtr    Buffer pointer
+ * @param buf_type  Buffer type: BUF_ALLOCED or BUF_MAPPED
+ *
+ * @return Tiler ID on success, 0 on failure.
+ */
+static uint32_t buf_cache_query(void *ptr, int buf_type_mask,
+                                void **bufPtr)
+{
+    IN;
+    uint32_t tiler_id = 0;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_use(ptr, buf_type_mask);
+    if (ad)
+    {
+        if (bufPtr)
+        {
+            *bufPtr = ad->bufPtr;
+        }
+        tiler_id = ad->tiler_id;
+    }
+    UNLOCK(che_mutex);
+    return R_UP(tiler_id);
+}
+
+bytes_t MemMgr_PageSize()
+{
+    return PAGE_SIZE;
+}
+
+void *MemMgr_Alloc(MemAllocBlock blocks[], int num_blocks)
+{
+    IN;
+    void *bufPtr = NULL;
+
+    /* need to access ssptrs */
+    struct tiler_block_info *blks = (tiler_block_info *) blocks;
+
+    /* check block allocation params, and state */
+    if (NOT_I(check_blocks(blks, num_blocks, num_blocks - 1),==,0) ||
+        NOT_I(inc_ref(),==,0)) goto DONE;
+
+    /* ----- begin recoverable portion ----- */
+
+    /* the buffer info is the registration payload as well, so build it
+       once and allocate the blocks in place */
+    struct tiler_buf_info buf;
+    buf.num_blocks = num_blocks;
+    memcpy(buf.blocks, blks, sizeof(*blks) * num_blocks);
+
+    /* allocate all blocks using tiler driver and initialize block info */
+    bytes_t size = tiler_alloc_buf(&buf);
+    if (NOT_I(size,>,0)) goto FAIL;
+
+    /* charge the blocks against the lease in lease mode */
+    uint32_t pages, slots = buf_slots(buf.blocks, num_blocks, &pages);
+    if (NOT_I(lease_charge(slots, pages),==,0)) goto FAIL_LEASE;
+
+    bufPtr = tiler_mmap(&buf, size, BUF_ALLOCED, false, false);
+    if (A_P(bufPtr,!=,0))
+    {
+        /* return ssptr, ptr and stride for all blocks */
+        memcpy(blks, buf.blocks, sizeof(*blks) * num_blocks);
+        goto DONE;
+    }
+
+    /* ------ error handling ------ */
+    lease_credit(slots, pages);
+FAIL_LEASE:;
+    int ix = num_blocks;
+    while (ix)
+    {
+        tiler_free(buf.blocks + --ix);
+    }
+
+FAIL:
+    /* clear ssptr and ptr fields for all blocks */
+    reset_blocks(blks, num_blocks);
+
+    A_I(dec_ref(),==,0);
+DONE:
+    CHK_I(cache_check(),==,0);
+    return R_P(bufPtr);
+}
+
+/**
+ * Frees an allocated buffer - see MemMgr_Free().  Called once
+ * the last reference to the buffer is dropped.
+ *
+ * @param bufPtr  Pointer to the buffer
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int buf_free(void *bufPtr)
+{
+    IN;
+
+    int ret = MEMMGR_ERR_GENERIC;
+    struct tiler_buf_info buf;
+    ZERO(buf);
+
+    /* a kept buffer is dropped from the keeper as well */
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(bufPtr, BUF_ALLOCED);
+    uint32_t keep_id = ad && ad->bufPtr == bufPtr ? ad->keep_id : 0;
+    bool ring = ad && ad->bufPtr == bufPtr && ad->ring;
+    UNLOCK(che_mutex);
+
+    /* retrieve registered buffers from vsptr */
+    /* :NOTE: if this succeeds, Memory Allocator stops tracking this buffer */
+    bool demoted = false;
+    uint32_t slots, pages;
+    buf.offset = buf_cache_del(bufPtr, BUF_ALLOCED, &demoted, &slots, &pages);
+    if (buf.offset && keep_id) keep_drop(keep_id);
+
+    /* the blocks of a demoted buffer are already freed */
+    if (demoted)
+    {
+        ret = A_I(dec_ref(),==,0);
+    }
+    else if (A_L(buf.offset,!=,0))
+    {
+        /* get block information for the buffer */
+        dump_buf(&buf, "==(QBUF)=>");
+        ret = A_I(ioctl(td, TILIOC_QBUF, &buf),==,0);
+        dump_buf(&buf, "<=(QBUF)==");
+
+        /* unregister buffer, and free tiler chunks even if there is an
+           error */
+        if (!ret)
+        {
+            dump_buf(&buf, "==(URBUF)=>");
+            ret = A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
+            dump_buf(&buf, "<=(URBUF)==");
+
+            /* free each block */
+            int ix;
+            for (ix = 0; ix < buf.num_blocks; ix++)
+            {
+                ERR_ADD(ret, tiler_free(buf.blocks + ix));
+            }
+
+            /* unmap buffer (unless it is in the aperture) */
+            if (!ap_ssptr(bufPtr))
+            {
+                bytes_t size = tiler_size(buf.blocks, buf.num_blocks);
+                bufPtr = (void *)((uintptr_t)bufPtr & ~(PAGE_SIZE - 1));
+                ERR_ADD(ret, munmap(bufPtr, size));
+                if (ring) ERR_ADD(ret, munmap(bufPtr + size, size));
+            }
+        }
+        ERR_ADD(ret, dec_ref());
+    }
+    if (buf.offset) lease_credit(slots, pages);
+
+    CHK_I(cache_check(),==,0);
+    return R_I(ret);
+}
+
+void *MemMgr_AllocRing(bytes_t len)
+{
+    IN;
+    void *bufPtr = NULL;
+    struct tiler_buf_info buf;
+
+    if (NOT_I(len,>,0) || NOT_I(len & (PAGE_SIZE - 1),==,0) ||
+        NOT_I(inc_ref(),==,0)) goto DONE;
+
+    /* the aperture maps each buffer once, at a fixed offset */
+    if (NOT_I(aperture,==,0)) goto FAIL;
+
+    ZERO(buf);
+    buf.num_blocks = 1;
+    buf.blocks[0].fmt = TILFMT_PAGE;
+    buf.blocks[0].dim.len = len;
+    bytes_t size = tiler_alloc_buf(&buf);
+    if (NOT_I(size,>,0)) goto FAIL;
+
+    uint32_t pages, slots = buf_slots(buf.blocks, 1, &pages);
+    if (NOT_I(lease_charge(slots, pages),==,0)) goto FAIL_LEASE;
+
+    bufPtr = tiler_mmap(&buf, size, BUF_ALLOCED, false, true);
+    if (A_P(bufPtr,!=,0)) goto DONE;
+
+    lease_credit(slots, pages);
+FAIL_LEASE:
+    tiler_free(buf.blocks);
+FAIL:
+    A_I(dec_ref(),==,0);
+DONE:
+    CHK_I(cache_check(),==,0);
+    return R_P(bufPtr);
+}
+
+/**
+ * Maps a user buffer into tiler space - see MemMgr_Map().
+ *
+ * @param blocks      Block information
+ * @param num_blocks  Number of blocks
+ * @param lock        TRUE (non-0) to try to lock the user pages
+ *                    while they are mapped.  Only for mappings
+ *                    owned by the memory allocator, as the pages
+ *                    are unlocked on unmapping.
+ *
+ * @return Pointer to the tiler mapping, or NULL on failure.
+ */
+static void *map_buf(MemAllocBlock blocks[], int num_blocks, bool lock)
+{
+    IN;
+    void *bufPtr = NULL;
+    bool locked = false;
+
+    /* need to access ssptrs */
+    struct tiler_block_info *blks = (tiler_block_info *) blocks;
+
+    /* check block params, and state */
+    if (check_blocks(blks, num_blocks, num_blocks) ||
+        NOT_I(inc_ref(),==,0)) goto DONE;
+
+    /* we only map 1 page aligned 1D buffer for now */
+    if (NOT_I(num_blocks,==,1) ||
+        NOT_I(blocks[0].pixelFormat,==,PIXEL_FMT_PAGE) ||
+        NOT_I(blocks[0].dim.len & (PAGE_SIZE - 1),==,0) ||
+        NOT_I((uintptr_t)blocks[0].ptr & (PAGE_SIZE - 1),==,0))
+        goto FAIL;
+
+    /* keep page cache pages resident while tiler maps them.  This is
+       best effort: beyond RLIMIT_MEMLOCK the pages are mapped unlocked. */
+    if (lock) locked = !mlock(blocks[0].ptr, blocks[0].dim.len);
+
+    /* ----- begin recoverable portion ----- */
+    struct tiler_buf_info buf;
+    buf.num_blocks = num_blocks;
+    memcpy(buf.blocks, blks, sizeof(*blks) * num_blocks);
+    int ix;
+
+    /* map each buffer using tiler driver */
+    for (ix = 0; ix < num_blocks; ix++)
+    {
+        if (NOT_P(buf.blocks[ix].ptr,!=,NULL) ||
+            NOT_I(tiler_map(buf.blocks + ix),>,0)) goto FAIL_MAP;
+    }
+
+    /* charge the blocks against the lease in lease mode */
+    uint32_t pages, slots = buf_slots(buf.blocks, num_blocks, &pages);
+    if (NOT_I(lease_charge(slots, pages),==,0)) goto FAIL_MAP;
+
+    /* map bufer into tiler space and register with tiler manager */
+    bufPtr = tiler_mmap(&buf, tiler_size(buf.blocks, num_blocks), BUF_MAPPED,
+                        false, false);
+    if (A_P(bufPtr,!=,0))
+    {
+        if (locked)
+        {
+            LOCK(che_mutex);
+            _AllocData *ad = buf_cache_find(bufPtr, BUF_MAPPED);
+            if (A_P(ad,!=,NULL)) ad->locked = blocks[0].ptr;
+            UNLOCK(che_mutex);
+        }
+        memcpy(blks, buf.blocks, sizeof(*blks) * num_blocks);
+        goto DONE;
+    }
+
+    /* ------ error handling ------ */
+    lease_credit(slots, pages);
+FAIL_MAP:
+    while (ix)
+    {
+        tiler_unmap(buf.blocks + --ix);
+    }
+
+FAIL:
+    if (locked) A_I(munlock(blocks[0].ptr, blocks[0].dim.len),==,0);
+
+    /* clear ssptr and ptr fields for all blocks */
+    reset_blocks(blks, num_blocks);
+
+    A_I(dec_ref(),==,0);
+DONE:
+    CHK_I(cache_check(),==,0);
+    return R_P(bufPtr);
+}
+
+void *MemMgr_Map(MemAllocBlock blocks[], int num_blocks)
+{
+    return map_buf(blocks, num_blocks, false);
+}
+
+/**
+ * Unmaps a mapped buffer - see MemMgr_UnMap().  Called once the
+ * last reference to the buffer is dropped.
+ *
+ * @param bufPtr  Pointer to the buffer
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int buf_unmap(void *bufPtr)
+{
+    IN;
+
+    int ret = MEMMGR_ERR_GENERIC;
+    struct tiler_buf_info buf;
+    ZERO(buf);
+
+    /* user pages to unlock after unmapping */
+    void *locked = NULL;
+    bytes_t locked_len = 0;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(bufPtr, BUF_MAPPED);
+    if (ad && ad->bufPtr == bufPtr && ad->locked)
+    {
+        locked = ad->locked;
+        locked_len = ad->size;
+    }
+    UNLOCK(che_mutex);
+
+    /* retrieve registered buffers from vsptr */
+    /* :NOTE: if this succeeds, Memory Allocator stops tracking this buffer */
+    uint32_t slots, pages;
+    buf.offset = buf_cache_del(bufPtr, BUF_MAPPED, NULL, &slots, &pages);
+
+    if (A_L(buf.offset,!=,0))
+    {
+        /* get block information for the buffer */
+        dump_buf(&buf, "==(QBUF)=>");
+        ret = A_I(ioctl(td, TILIOC_QBUF, &buf),==,0);
+        dump_buf(&buf, "<=(QBUF)==");
+
+        /* unregister buffer, and free tiler chunks even if there is an
+           error */
+        if (!ret)
+        {
+            dump_buf(&buf, "==(URBUF)=>");
+            ret = A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
+            dump_buf(&buf, "<=(URBUF)==");
+
+            /* unmap each block */
+            int ix;
+            for (ix = 0; ix < buf.num_blocks; ix++)
+            {
+                ERR_ADD(ret, tiler_unmap(buf.blocks + ix));
+            }
+
+            /* unmap buffer (unless it is in the aperture) */
+            if (!ap_ssptr(bufPtr))
+            {
+                bytes_t size = tiler_size(buf.blocks, buf.num_blocks);
+                bufPtr = (void *)((uintptr_t)bufPtr & ~(PAGE_SIZE - 1));
+                ERR_ADD(ret, munmap(bufPtr, size));
+            }
+        }
+        if (locked) ERR_ADD(ret, munlock(locked, locked_len));
+        ERR_ADD(ret, dec_ref());
+        lease_credit(slots, pages);
+    }
+
+    CHK_I(cache_check(),==,0);
+    return R_I(ret);
+}
+
+/**
+ * Unpins the first sources of a concatenated view.  Must be
+ * called with che_mutex held.
+ *
+ * @param cv    Pointer to the view record
+ * @param num   Number of sources to unpin
+ */
+static void concat_unpin(_Concat *cv, int num)
+{
+    int ix;
+    for (ix = 0; ix < num; ix++)
+    {
+        _AllocData *ad = buf_cache_find(cv->parts[ix].bufPtr, BUF_ALLOCED);
+        if (A_P(ad,!=,NULL) && A_I(ad->pins,>,0))
+        {
+            ad->pins--;
+            ad->last_use = now_us();
+        }
+    }
+}
+
+/**
+ * Unmaps the first parts of a concatenated view, and the rest
+ * of its reserved range.
+ *
+ * @param cv    Pointer to the view record
+ * @param num   Number of mapped parts
+ * @param len   Length of the reserved range
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int concat_munmap(_Concat *cv, int num, bytes_t len)
+{
+    int ret = 0, ix;
+    bytes_t offs;
+    for (offs = ix = 0; ix < num; offs += cv->parts[ix++].len)
+    {
+        ERR_ADD(ret, munmap(cv->ptr + offs, cv->parts[ix].len));
+    }
+    if (offs < len) ERR_ADD(ret, munmap(cv->ptr + offs, len - offs));
+    return ret;
+}
+
+void *MemMgr_MapConcat(void *bufs[], int num_bufs)
+{
+    IN;
+    bytes_t len = 0, offs;
+    int ix, num_pinned = 0;
+
+    if (NOT_P(bufs,!=,NULL) || NOT_I(num_bufs,>,0)) return R_P(NULL);
+    _Concat *cv = NEW(_Concat);
+    if (NOT_P(cv,!=,NULL)) return R_P(NULL);
+    cv->parts = NEWN(_ConcatPart, num_bufs);
+
+    LOCK(che_mutex);
+    init();
+
+    /* the aperture maps each buffer once, at a fixed offset */
+    if (NOT_P(cv->parts,!=,NULL) || NOT_I(aperture,==,0)) goto FAIL;
+
+    /* sources must be whole page-aligned 1D buffers, and all but the
+       last must end on a page boundary.  They are pinned, so that they
+       are not demoted while they are viewed. */
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        _AllocData *ad = buf_cache_use(bufs[ix], BUF_ALLOCED);
+        if (NOT_P(ad,!=,NULL) || NOT_P(ad->bufPtr,==,bufs[ix]) ||
+            NOT_I(ad->formats,==,1 << TILFMT_PAGE) || NOT_I(ad->ring,==,0) ||
+            NOT_I((uintptr_t) bufs[ix] & (PAGE_SIZE - 1),==,0) ||
+            (ix + 1 < num_bufs && NOT_I(ad->size & (PAGE_SIZE - 1),==,0)))
+        {
+            goto FAIL_PIN;
+        }
+        ad->pins++;
+        num_pinned++;
+        cv->parts[ix].bufPtr = bufs[ix];
+        cv->parts[ix].tiler_id = ad->tiler_id;
+        cv->parts[ix].len = ROUND_UP_TO2POW(ad->size, PAGE_SIZE);
+        len += cv->parts[ix].len;
+    }
+
+    /* reserve the view, then replace it part by part with another
+       mapping of each source */
+    cv->ptr = mmap(NULL, len, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (NOT_P(cv->ptr,!=,MAP_FAILED)) goto FAIL_PIN;
+    for (offs = ix = 0; ix < num_bufs; offs += cv->parts[ix++].len)
+    {
+        if (NOT_P(mmap(cv->ptr + offs, cv->parts[ix].len,
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, td,
+                       cv->parts[ix].tiler_id),==,cv->ptr + offs)) break;
+    }
+    if (ix == num_bufs)
+    {
+        cv->num_parts = num_bufs;
+        DLIST_MADD_BEFORE(concats, cv, link);
+        UNLOCK(che_mutex);
+        return R_P(cv->ptr);
+    }
+    A_I(concat_munmap(cv, ix, len),==,0);
+
+FAIL_PIN:
+    concat_unpin(cv, num_pinned);
+FAIL:
+    UNLOCK(che_mutex);
+    FREE(cv->parts);
+    FREE(cv);
+    return R_P(NULL);
+}
+
+int MemMgr_UnMapConcat(void *ptr)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC, ix;
+    bytes_t len = 0;
+    _Concat *cv, *found = NULL;
+
+    LOCK(che_mutex);
+    init();
+    DLIST_MLOOP(concats, cv, link) {
+        if (cv->ptr == ptr) {
+            found = cv;
+            break;
+        }
+    }
+    if (A_P(found,!=,NULL))
+    {
+        DLIST_REMOVE(found->link);
+        for (ix = 0; ix < found->num_parts; ix++)
+        {
+            len += found->parts[ix].len;
+        }
+        ret = A_I(concat_munmap(found, found->num_parts, len),==,0);
+        concat_unpin(found, found->num_parts);
+    }
+    UNLOCK(che_mutex);
+
+    if (found)
+    {
+        FREE(found->parts);
+        FREE(found);
+    }
+    return R_I(ret);
+}
+
+/**
+ * Unmaps the current window of a stream.
+ *
+ * @param s      Pointer to the stream
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int stream_release(MemMgrStream *s)
+{
+    int ret = 0;
+    if (s->bufPtr) ERR_ADD(ret, MemMgr_UnMap(s->bufPtr));
+    if (s->src) ERR_ADD(ret, munmap(s->src, ROUND_UP_TO2POW(s->len, PAGE_SIZE)));
+    s->bufPtr = s->src = NULL;
+    s->len = 0;
+    return ret;
+}
+
+int MemMgr_StreamOpen(MemMgrStream *s, int fd, bytes_t window,
+                      bytes_t readahead)
+{
+    IN;
+    struct stat st;
+
+    if (NOT_P(s,!=,NULL) || NOT_I(window,>,0) ||
+        NOT_I(window & (PAGE_SIZE - 1),==,0) ||
+        NOT_I(fstat(fd, &st),==,0)) return R_I(MEMMGR_ERR_GENERIC);
+
+    ZERO(*s);
+    s->fd = fd;
+    s->file_len = st.st_size;
+    s->window = window;
+    s->readahead = readahead;
+
+    /* the stream reads ahead by itself */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    return R_I(MEMMGR_ERR_NONE);
+}
+
+void *MemMgr_StreamNext(MemMgrStream *s, bytes_t *len)
+{
+    IN;
+    MemAllocBlock block;
+
+    *len = 0;
+    if (NOT_P(s,!=,NULL) || NOT_I(stream_release(s),==,0) ||
+        s->offset >= s->file_len) return R_P(NULL);
+
+    s->len = s->file_len - s->offset < s->window ?
+             s->file_len - s->offset : s->window;
+    bytes_t map_len = ROUND_UP_TO2POW(s->len, PAGE_SIZE);
+    s->src = mmap(NULL, map_len, PROT_READ, MAP_SHARED, s->fd, s->offset);
+    if (NOT_P(s->src,!=,MAP_FAILED))
+    {
+        s->src = NULL;
+        s->len = 0;
+        return R_P(NULL);
+    }
+
+    /* start reading ahead before the window is locked, which reads it */
+    if (s->readahead)
+    {
+        posix_fadvise(s->fd, s->offset + map_len, s->readahead,
+                      POSIX_FADV_WILLNEED);
+    }
+
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_PAGE;
+    block.dim.len = map_len;
+    block.ptr = s->src;
+    s->bufPtr = map_buf(&block, 1, true);
+    if (NOT_P(s->bufPtr,!=,NULL))
+    {
+        stream_release(s);
+        return R_P(NULL);
+    }
+    s->offset += s->len;
+    *len = s->len;
+    return R_P(s->bufPtr);
+}
+
+int MemMgr_StreamClose(MemMgrStream *s)
+{
+    IN;
+    if (NOT_P(s,!=,NULL)) return R_I(MEMMGR_ERR_GENERIC);
+    return R_I(stream_release(s));
+}
+
+bool MemMgr_Is1DBlock(void *ptr)
+{
+    IN;
+
+    SSPtr ssptr = TilerMem_VirtToPhys(ptr);
+    enum tiler_fmt fmt = tiler_get_fmt(ssptr);
+    return R_I(fmt == TILFMT_PAGE);
+}
+
+bool MemMgr_Is2DBlock(void *ptr)
+{
+    IN;
+
+    SSPtr ssptr = TilerMem_VirtToPhys(ptr);
+    enum tiler_fmt fmt = tiler_get_fmt(ssptr);
+    return R_I(fmt == TILFMT_8BIT || fmt == TILFMT_16BIT ||
+               fmt == TILFMT_32BIT);
+}
+
+bool MemMgr_IsMapped(void *ptr)
+{
+    IN;
+    SSPtr ssptr = TilerMem_VirtToPhys(ptr);
+    enum tiler_fmt fmt = tiler_get_fmt(ssptr);
+    return R_I(fmt == TILFMT_8BIT || fmt == TILFMT_16BIT ||
+               fmt == TILFMT_32BIT || fmt == TILFMT_PAGE);
+}
+
+bytes_t MemMgr_GetStride(void *ptr)
+{
+    IN;
+    struct tiler_buf_info buf;
+    ZERO(buf);
+
+    /* in aperture mode the record and the block are found directly */
+    SSPtr ssptr = ap_ssptr(ptr);
+    if (ssptr)
+    {
+        bytes_t stride = 0;
+        int ix;
+        LOCK(che_mutex);
+        _AllocData *ad = ap_lookup(ptr);
+        for (ix = 0; ad && ix < ad->num_blocks; ix++)
+        {
+            struct tiler_block_info *blk = ad->blocks + ix;
+            /* all 2D blocks of a format share the container stride */
+            if (tiler_get_fmt(ssptr) == blk->fmt &&
+                (blk->fmt != TILFMT_PAGE ||
+                 (ap_entry(blk->ssptr) <= ap_entry(ssptr) &&
+                  ap_entry(ssptr) <= ap_entry(blk->ssptr + blk->dim.len - 1))))
+            {
+                stride = ad->blk_stride[ix];
+                break;
+            }
+        }
+        UNLOCK(che_mutex);
+        return R_UP(stride);
+    }
+
+    /* find block that this buffer belongs to */
+    void *bufPtr = NULL;
+    buf.offset = buf_cache_query(ptr, BUF_ALLOCED | BUF_MAPPED, &bufPtr);
+
+    A_I(inc_ref(),==,0);
+
+    /* for tiler mapped buffers, get saved stride information */
+    if (buf.offset)
+    {
+        /* get block information for the buffer */
+        dump_buf(&buf, "==(QBUF)=>");
+        int ix, ret = A_I(ioctl(td, TILIOC_QBUF, &buf),==,0);
+        dump_buf(&buf, "<=(QBUF)==");
+        if (ret) return 0;
+
+        /* walk through block to determine which stride we need.  The
+           record has the row pitch of planes allocated as 1D blocks. */
+        void *blkPtr = bufPtr;
+        for (ix = 0; ix < buf.num_blocks; ix++)
+        {
+            bytes_t size = def_size(buf.blocks + ix);
+            if (blkPtr <= ptr && ptr < blkPtr + size) {
+                bytes_t stride = buf.blocks[ix].stride;
+                LOCK(che_mutex);
+                _AllocData *ad = buf_cache_find(bufPtr, BUF_ANY);
+                if (ad && ix < ad->num_blocks) stride = ad->blk_stride[ix];
+                UNLOCK(che_mutex);
+                A_I(dec_ref(),==,0);
+                return R_UP(stride);
+            }
+            blkPtr += size;
+        }
+        A_I(dec_ref(),==,0);
+        DP("assert: should not ever get here");
+        return R_UP(0);
+    }
+    /* see if pointer is valid */
+    else if (TilerMem_VirtToPhys(ptr) == 0)
+    {
+        A_I(dec_ref(),==,0);
+        return R_UP(0);
+    }
+    A_I(dec_ref(),==,0);
+    return R_UP(PAGE_SIZE);
+}
+
+pixel_fmt_t MemMgr_GetFormat(void *ptr)
+{
+    IN;
+    enum tiler_fmt fmt = tiler_get_fmt(TilerMem_VirtToPhys(ptr));
+    return R_I(fmt > TILFMT_NONE ? (pixel_fmt_t) fmt : 0);
+}
+
+/**
+ * Finds the record of a buffer for a fence operation, and checks
+ * the fence slot.  Must be called with che_mutex held.
  *
- * @return pointer to the mapped buffer.
+ * @param ptr    Pointer within the buffer
+ * @param slot   Fence slot
+ *
+ * @return Pointer to the record, or NULL on error.
+ */
+static _AllocData *fence_find(void *ptr, int slot)
+{
+    if (NOT_I(slot,>=,0) || NOT_I(slot,<,MEMMGR_FENCE_SLOTS)) return NULL;
+    _AllocData *ad = buf_cache_use(ptr, BUF_ANY);
+    return R_P(ad);
+}
+
+int MemMgr_FenceSignal(void *bufPtr, int slot)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(che_mutex);
+    _AllocData *ad = fence_find(bufPtr, slot);
+    if (ad)
+    {
+        __sync_fetch_and_add(ad->fence + slot, 1);
+        fence_wake(ad, slot);
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+int MemMgr_FenceValue(void *bufPtr, int slot, uint32_t *value)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(che_mutex);
+    _AllocData *ad = fence_find(bufPtr, slot);
+    if (ad && A_P(value,!=,NULL))
+    {
+        *value = ad->fence[slot];
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+int MemMgr_FenceWait(void *bufPtr, int slot, uint32_t value, int timeout_ms)
+{
+    IN;
+    struct timespec end, now, left;
+    int ret = MEMMGR_ERR_GENERIC;
+
+    LOCK(che_mutex);
+    _AllocData *ad = fence_find(bufPtr, slot);
+    uint32_t gen = ad ? ad->gen : 0;
+    if (ad)
+    {
+        __sync_fetch_and_add(ad->waiters + slot, 1);
+    }
+    UNLOCK(che_mutex);
+    if (!ad) return R_I(ret);
+
+    if (timeout_ms >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        end.tv_sec += timeout_ms / 1000;
+        end.tv_nsec += (timeout_ms % 1000) * 1000000;
+        if (end.tv_nsec >= 1000000000)
+        {
+            end.tv_sec++;
+            end.tv_nsec -= 1000000000;
+        }
+    }
+
+    /* records are never freed, so the fence word stays valid even if the
+       buffer is freed meanwhile - which is detected by the generation */
+    for (;;)
+    {
+        uint32_t cur = ad->fence[slot];
+        __sync_synchronize();
+        if (ad->gen != gen) break;
+        if ((int32_t) (cur - value) >= 0)
+        {
+            ret = MEMMGR_ERR_NONE;
+            break;
+        }
+
+        if (timeout_ms >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = end.tv_sec - now.tv_sec;
+            left.tv_nsec = end.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0)
+            {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000;
+            }
+            if (left.tv_sec < 0)
+            {
+                ret = -ETIMEDOUT;
+                break;
+            }
+        }
+        syscall(SYS_futex, ad->fence + slot, FUTEX_WAIT_PRIVATE, cur,
+                timeout_ms >= 0 ? &left : NULL, NULL, 0);
+    }
+
+    __sync_fetch_and_sub(ad->waiters + slot, 1);
+    return R_I(ret);
+}
+
+int MemMgr_FenceExport(void *bufPtr, int slot)
+{
+    IN;
+    int fd = -1;
+    LOCK(che_mutex);
+    _AllocData *ad = fence_find(bufPtr, slot);
+    if (ad)
+    {
+        if (ad->fence_fd[slot] < 0)
+        {
+            ad->fence_fd[slot] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        fd = ad->fence_fd[slot];
+    }
+    UNLOCK(che_mutex);
+    return R_I(fd);
+}
+
+/**
+ * Adds a range to the dirty ranges of a buffer, coalescing it
+ * with the ranges it overlaps or touches.  If there is no room
+ * for a new range, the two closest ranges are merged.  Must be
+ * called with che_mutex held.
+ *
+ * @param ad     Pointer to the record
+ * @param start  Start of the range
+ * @param end    End of the range
+ *
+ * @return 0 on success, -ENOMEM on memory allocation failure
+ */
+static int dirty_add(_AllocData *ad, void *start, void *end)
+{
+    _DirtyRange *d;
+    int ix, jx, n = ad->num_dirty;
+
+    if (!ad->dirty)
+    {
+        ad->dirty = NEWN(_DirtyRange, MAX_DIRTY + 1);
+        if (!ad->dirty) return -ENOMEM;
+    }
+    d = ad->dirty;
+
+    /* find the first range that does not end before the new one, and
+       absorb all ranges that it overlaps or touches */
+    for (ix = 0; ix < n && d[ix].end < start; ix++);
+    for (jx = ix; jx < n && d[jx].start <= end; jx++)
+    {
+        if (d[jx].start < start) start = d[jx].start;
+        if (d[jx].end > end) end = d[jx].end;
+    }
+    memmove(d + ix + 1, d + jx, (n - jx) * sizeof(*d));
+    d[ix].start = start;
+    d[ix].end = end;
+    n += 1 - (jx - ix);
+
+    /* merge the closest ranges if there are too many */
+    if (n > MAX_DIRTY)
+    {
+        for (jx = 0, ix = 1; ix < n - 1; ix++)
+        {
+            if (d[ix + 1].start - d[ix].end < d[jx + 1].start - d[jx].end) jx = ix;
+        }
+        d[jx].end = d[jx + 1].end;
+        memmove(d + jx + 1, d + jx + 2, (n - jx - 2) * sizeof(*d));
+        n--;
+    }
+    ad->num_dirty = n;
+    return 0;
+}
+
+/**
+ * Performs cache maintenance on a range for DMA.  Only the tiler
+ * stub implements it: the tiler driver has no cache maintenance
+ * ioctl, and user space cannot reach the outer cache.
+ *
+ * @param ptr         Start of the range
+ * @param len         Length of the range
+ * @param for_device  TRUE (non-0) to prepare for device access,
+ *                    FALSE (0) for CPU access
+ *
+ * @return 0 on success, -ENOSYS if cache maintenance is not
+ *         available
+ */
+static int cache_sync(void *ptr, bytes_t len, bool for_device)
+{
+#ifdef STUB_TILER
+    TilerStub_CacheSync(ptr, len, for_device);
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+int MemMgr_MarkDirty(void *ptr, bytes_t len)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_use(ptr, BUF_ANY);
+    if (A_P(ad,!=,NULL))
+    {
+        /* 2D blocks are not cacheable */
+        ret = MEMMGR_ERR_NONE;
+        if (len && (ad->formats & (1 << PIXEL_FMT_PAGE)))
+        {
+            void *start = (void *)((uintptr_t)ptr & ~(CACHE_LINE_SIZE - 1));
+            void *end = (void *)ROUND_UP_TO2POW((uintptr_t)ptr + len,
+                                                CACHE_LINE_SIZE);
+            ret = dirty_add(ad, start, end);
+        }
+    }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+/**
+ * Performs cache maintenance on the dirty ranges of a buffer,
+ * and clears them.  Ranges that could not be maintained stay
+ * dirty.
+ *
+ * @param bufPtr      Pointer within the buffer
+ * @param for_device  TRUE (non-0) to prepare for device access,
+ *                    FALSE (0) for CPU access
+ *
+ * @return 0 on success, non-0 error value on failure
  */
-static void *tiler_mmap(struct tiler_block_info *blks, int num_blocks,
-                        int buf_type)
+static int dirty_sync(void *bufPtr, bool for_device)
+{
+    _DirtyRange d[MAX_DIRTY];
+    int ix, n = 0, ret = MEMMGR_ERR_NONE;
+
+    /* take the ranges, and maintain them without holding the lock */
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_use(bufPtr, BUF_ANY);
+    if (ad)
+    {
+        n = ad->num_dirty;
+        if (n) memcpy(d, ad->dirty, n * sizeof(*d));
+        ad->num_dirty = 0;
+    }
+    UNLOCK(che_mutex);
+    if (NOT_P(ad,!=,NULL)) return MEMMGR_ERR_GENERIC;
+
+    for (ix = 0; ix < n; ix++)
+    {
+        ret = cache_sync(d[ix].start, d[ix].end - d[ix].start, for_device);
+        if (NOT_I(ret,==,0)) break;
+    }
+
+    /* put back what was not maintained */
+    if (ix < n)
+    {
+        LOCK(che_mutex);
+        ad = buf_cache_find(bufPtr, BUF_ANY);
+        for (; ad && ix < n; ix++)
+        {
+            dirty_add(ad, d[ix].start, d[ix].end);
+        }
+        UNLOCK(che_mutex);
+    }
+    return ret;
+}
+
+int MemMgr_SyncForDevice(void *bufPtr)
+{
+    IN;
+    return R_I(dirty_sync(bufPtr, true));
+}
+
+int MemMgr_SyncForCpu(void *bufPtr)
+{
+    IN;
+    return R_I(dirty_sync(bufPtr, false));
+}
+
+int MemMgr_SetApertureMode(bool enable)
+{
+    IN;
+    int ret = MEMMGR_ERR_NONE, ix = 0;
+    void *base = ap_base;
+
+    LOCK(ref_mutex);
+    if (!enable == !aperture)
+    {
+        /* nothing to do */
+    }
+    else if (NOT_I(refCnt,==,0))
+    {
+        ret = MEMMGR_ERR_GENERIC;
+    }
+    else if (enable)
+    {
+#ifdef STUB_TILER
+        /* reserve one window for all regions, and map each region into it.
+           The mappings stay after the device is closed. */
+        ap_index = NEWN(_AllocData *, AP_NUM_ENTRIES);
+        base = mmap(NULL, TILER_MEM_END - TILER_MEM_8BIT, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        td = open("/dev/tiler", O_RDWR | O_SYNC);
+        if (NOT_P(ap_index,!=,NULL) || NOT_P(base,!=,MAP_FAILED) ||
+            NOT_I(td,>=,0)) ret = MEMMGR_ERR_GENERIC;
+
+        for (ix = 0; !ret && ix < AP_NUM_REGIONS; ix++)
+        {
+            void *win = base + ix * AP_REGION_SIZE;
+            if (NOT_P(mmap(win, AP_REGION_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_FIXED, td,
+                           TILER_MEM_8BIT + ix * AP_REGION_SIZE),==,win))
+                ret = MEMMGR_ERR_GENERIC;
+        }
+        if (td >= 0) close(td);
+        td = -1;
+
+        if (!ret)
+        {
+            ap_base = base;
+            aperture = true;
+        }
+        else
+        {
+            /* ix is the number of regions mapped (+1 if one failed) */
+            while (--ix >= 0)
+            {
+                munmap(base + ix * AP_REGION_SIZE, AP_REGION_SIZE);
+            }
+            if (base != MAP_FAILED)
+            {
+                munmap(base, TILER_MEM_END - TILER_MEM_8BIT);
+            }
+            FREE(ap_index);
+        }
+#else
+        /* the tiler driver does not map the tiler regions at their system
+           space offsets, so only the tiler stub provides the aperture */
+        ret = MEMMGR_ERR_GENERIC;
+#endif
+    }
+    else
+    {
+        aperture = false;
+        ap_base = NULL;
+        for (ix = 0; ix < AP_NUM_REGIONS; ix++)
+        {
+            ERR_ADD(ret, munmap(base + ix * AP_REGION_SIZE, AP_REGION_SIZE));
+        }
+        ERR_ADD(ret, munmap(base, TILER_MEM_END - TILER_MEM_8BIT));
+        FREE(ap_index);
+    }
+    UNLOCK(ref_mutex);
+    return R_I(ret);
+}
+
+bool MemMgr_InApertureMode()
+{
+    return aperture;
+}
+
+int MemMgr_DemoteIdle(uint32_t idle_ms)
+{
+    IN;
+    _AllocData *ad;
+    uint32_t slots = 0, pages = 0;
+    int num = 0;
+
+    LOCK(che_mutex);
+    init();
+    uint64_t now = now_us();
+    DLIST_MLOOP(bufs, ad, link) {
+        if (!aperture && ad->buf_type == BUF_ALLOCED && ad->demotable &&
+            !ad->pins && !ad->keep_id && !ad->ring && !ad->demoted &&
+            now - ad->last_use >= idle_ms * 1000ULL && !buf_demote(ad))
+        {
+            slots += ad->slots;
+            pages += ad->pages;
+            num++;
+        }
+    }
+    UNLOCK(che_mutex);
+
+    if (num) lease_credit(slots, pages);
+    return R_I(num);
+}
+
+int MemMgr_SetDemotable(void *bufPtr, bool demotable)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(bufPtr, BUF_ALLOCED);
+    if (A_P(ad,!=,NULL))
+    {
+        ad->demotable = demotable;
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+int MemMgr_Pin(void *bufPtr)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_use(bufPtr, BUF_ANY);
+    if (A_P(ad,!=,NULL))
+    {
+        ad->pins++;
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+int MemMgr_Unpin(void *bufPtr)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(bufPtr, BUF_ANY);
+    if (A_P(ad,!=,NULL) && A_I(ad->pins,>,0))
+    {
+        ad->pins--;
+        ad->last_use = now_us();
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+bool MemMgr_IsDemoted(void *bufPtr)
 {
     IN;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(bufPtr, BUF_ANY);
+    bool demoted = ad && ad->demoted;
+    UNLOCK(che_mutex);
+    return R_I(demoted);
+}
 
-    /* get size */
-    bytes_t size = tiler_size(blks, num_blocks);
-    int ix;
-
-    /* register buffer with tiler */
-    struct tiler_buf_info buf;
-    buf.num_blocks = num_blocks;
-    /* memcpy(buf.blocks, blks, sizeof(tiler_block_info) * num_blocks); */
-    for (ix = 0; ix < num_blocks; ix++) memcpy(buf.blocks + ix, blks + ix, sizeof(tiler_block_info));
-#ifndef STUB_TILER
-    dump_buf(&buf, "==(RBUF)=>");
-    int ret = ioctl(td, TILIOC_RBUF, &buf);
-    dump_buf(&buf, "<=(RBUF)==");
-    if (NOT_I(ret,==,0)) return NULL;
+void MemMgr_GetDemoteStats(MemMgrDemoteStats *stats, bool reset)
+{
+    LOCK(che_mutex);
+    *stats = demote_stats;
+    if (reset) ZERO(demote_stats);
+    UNLOCK(che_mutex);
+}
 
-#else
-    /* save buffer in stub */
-    struct tiler_buf_info *buf_c = NEWN(struct tiler_buf_info,2);
-    buf.offset = (uint32_t) buf_c;
-#endif
-    if (NOT_P(buf.offset,!=,0)) return NULL;
+int MemMgr_SetUserData(void *ptr, bytes_t offset, const void *data,
+                       bytes_t len)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
 
-    /* map blocks to process space */
-#ifndef STUB_TILER
-    void *bufPtr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                        td, buf.offset);
-    if (bufPtr == MAP_FAILED){
-        bufPtr = NULL;
-    } else {
-        bufPtr += buf.blocks[0].ssptr & (PAGE_SIZE - 1);
-    }
-    if(0) DP("ptr=%p", bufPtr);
-#else
-    void *bufPtr = malloc(size + PAGE_SIZE - 1);
-    buf_c[1].blocks[0].ptr = bufPtr;
-    bufPtr = (void *)((PAGE_SIZE - 1 + (uint32_t)bufPtr) &~ (PAGE_SIZE - 1));
-    /* P("<= [0x%x]", size); */
+    if (NOT_I(offset,<=,MEMMGR_USER_DATA_SIZE) ||
+        NOT_I(len,<=,MEMMGR_USER_DATA_SIZE - offset) ||
+        (len && NOT_P(data,!=,NULL))) return R_I(ret);
 
-    /* fill out pointers - this is needed for caching 1D/2D type */
-    for (size = ix = 0; ix < num_blocks; ix++)
+    /* metadata lives in the record, so demoted buffers are not restored */
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(ptr, BUF_ANY);
+    if (A_P(ad,!=,NULL))
     {
-        buf.blocks[ix].ptr = bufPtr ? bufPtr + size : bufPtr;
-        size += def_size(blks + ix);
+        memcpy(ad->user_data + offset, data, len);
+        ret = MEMMGR_ERR_NONE;
     }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
 
-    memcpy(buf_c, &buf, sizeof(struct tiler_buf_info));
-#endif
+int MemMgr_GetUserData(void *ptr, bytes_t offset, void *data, bytes_t len)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
 
-    /* if failed to map: unregister buffer */
-    if (NOT_P(bufPtr,!=,NULL) ||
-	/* or failed to cache tiler ID for buffer */
-        NOT_I(buf_cache_add(bufPtr, size, buf.offset, buf_type),==,0))
+    if (NOT_I(offset,<=,MEMMGR_USER_DATA_SIZE) ||
+        NOT_I(len,<=,MEMMGR_USER_DATA_SIZE - offset) ||
+        (len && NOT_P(data,!=,NULL))) return R_I(ret);
+
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(ptr, BUF_ANY);
+    if (A_P(ad,!=,NULL))
     {
-#ifndef STUB_TILER
-        A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
-#else
-        FREE(buf_c);
-        buf.offset = 0;
-#endif
+        memcpy(data, ad->user_data + offset, len);
+        ret = MEMMGR_ERR_NONE;
     }
-    /* otherwise, fill out pointers */
-    else
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
+
+/**
+ * Drops references on the record of a buffer, and frees or
+ * unmaps the buffer if they were the last ones.
+ *
+ * @param ad     Pointer to the record
+ * @param num    Number of references to drop
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static int ref_put(_AllocData *ad, int num)
+{
+    int refs;
+    do
+    {
+        refs = ad->refs;
+        /* the buffer was freed under its owners */
+        if (NOT_I(refs,>=,num)) return MEMMGR_ERR_GENERIC;
+    } while (!__sync_bool_compare_and_swap(&ad->refs, refs, refs - num));
+
+    /* the record is not recycled until the buffer is freed */
+    if (refs > num) return MEMMGR_ERR_NONE;
+    return ad->buf_type == BUF_MAPPED ? buf_unmap(ad->bufPtr) :
+                                        buf_free(ad->bufPtr);
+}
+
+/**
+ * Takes a temporary reference on the record of a buffer without
+ * locking.  The bucket is walked like snapshots walk the list,
+ * and the lookup is retried if the registry changed meanwhile.
+ * As records are recycled, the record is checked to still
+ * belong to the buffer once the reference is taken.
+ *
+ * @param bufPtr  Pointer to the buffer
+ *
+ * @return Pointer to the record, or NULL if bufPtr is not a
+ *         buffer, or its last reference is being dropped.
+ */
+static _AllocData *ref_get(void *bufPtr)
+{
+    for (;;)
     {
-        /* fill out pointers */
-        for (size = ix = 0; ix < num_blocks; ix++)
+        uint32_t seq = bufs_view.seq;
+        _AllocData *ad = NULL;
+        int refs, steps = num_ads;
+
+        if (!(seq & 1))
         {
-            blks[ix].ptr = bufPtr + size;
-            /* P("   [0x%p]", blks[ix].ptr); */
-            size += def_size(blks + ix);
-#ifdef STUB_TILER
-            blks[ix].ssptr = (uint32_t) blks[ix].ptr;
-#else
-            blks[ix].ptr = (void *)((((uint32_t)blks[ix].ptr) & ~(PAGE_SIZE - 1)) | (blks[ix].ssptr & (PAGE_SIZE - 1)));
-#endif
+            __sync_synchronize();
+            for (ad = *buf_hash_bucket(bufPtr);
+                 ad && ad->bufPtr != bufPtr && steps--; ad = ad->hash_next);
+            __sync_synchronize();
+            if (seq == bufs_view.seq)
+            {
+                if (!ad) return NULL;
+                do
+                {
+                    refs = ad->refs;
+                } while (refs > 0 &&
+                         !__sync_bool_compare_and_swap(&ad->refs, refs,
+                                                       refs + 1));
+                if (refs > 0 && ad->bufPtr == bufPtr) return ad;
+                if (refs > 0) ref_put(ad, 1);
+                else if (seq == bufs_view.seq) return NULL;
+            }
         }
+        sched_yield();
     }
+}
 
-    return R_P(bufPtr);
+int MemMgr_Ref(void *bufPtr)
+{
+    IN;
+    _AllocData *ad = ref_get(bufPtr);
+    return R_I(A_P(ad,!=,NULL) ? MEMMGR_ERR_NONE : MEMMGR_ERR_GENERIC);
+}
+
+int MemMgr_Unref(void *bufPtr)
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    _AllocData *ad = ref_get(bufPtr);
+    if (A_P(ad,!=,NULL))
+    {
+        /* drop the temporary reference along with the caller's */
+        ret = ref_put(ad, 2);
+    }
+    return R_I(ret);
 }
 
 /**
- * Checks whether the tiler_block_info is filled in correctly.
- * Verifies the pixel format, correct length, width and or
- * height, the length/stride relationship for 1D buffers, and
- * the correct stride for 2D buffers.  Also verifies block size
- * to be page sized if desired.
+ * Drops the reference of the owner that allocated or mapped a
+ * buffer, which releases the buffer unless others still hold
+ * references.
  *
- * @author a0194118 (9/4/2009)
+ * @param bufPtr    Pointer to the buffer
+ * @param buf_type  Type of buffer the caller expects
  *
- * @param blk            Pointer to the tiler_block_info struct
- * @param is_page_sized  Whether the block needs to be page
- *                       sized (fit on whole pages).
  * @return 0 on success, non-0 error value on failure.
  */
-static int check_block(tiler_block_info *blk, bool is_page_sized)
+static int owner_put(void *bufPtr, int buf_type)
 {
-    /* check pixelformat */
-    if (NOT_I(blk->fmt,>=,PIXEL_FMT_MIN) ||
-        NOT_I(blk->fmt,<=,PIXEL_FMT_MAX)) return MEMMGR_ERR_GENERIC;
+    _AllocData *ad = ref_get(bufPtr);
+    if (NOT_P(ad,!=,NULL)) return MEMMGR_ERR_GENERIC;
+    if (NOT_I(ad->buf_type,==,buf_type))
+    {
+        ref_put(ad, 1);
+        return MEMMGR_ERR_GENERIC;
+    }
 
+    /* drop the temporary reference along with the owner's */
+    return ref_put(ad, 2);
+}
 
-    if (blk->fmt == PIXEL_FMT_PAGE)
-    {   /* check 1D buffers */
+int MemMgr_Free(void *bufPtr)
+{
+    IN;
+    return R_I(owner_put(bufPtr, BUF_ALLOCED));
+}
 
-        /* length must be multiple of stride if stride > 0 */
-        if (NOT_I(blk->dim.len,>,0) ||
-            (blk->stride && NOT_I(blk->dim.len % blk->stride,==,0)))
-            return MEMMGR_ERR_GENERIC;
+int MemMgr_UnMap(void *bufPtr)
+{
+    IN;
+    return R_I(owner_put(bufPtr, BUF_MAPPED));
+}
+
+int MemMgr_RefCount(void *bufPtr)
+{
+    IN;
+    _AllocData *ad = ref_get(bufPtr);
+    int refs = 0;
+    if (ad)
+    {
+        refs = ad->refs - 1;
+        ref_put(ad, 1);
     }
-    else
-    {   /* check 2D buffers */
+    return R_I(refs);
+}
 
-        /* check width, height and stride (must be the default stride or 0) */
-        bytes_t stride = def_stride(blk->dim.area.width * def_bpp(blk->fmt));
-        if (NOT_I(blk->dim.area.width,>,0) ||
-            NOT_I(blk->dim.area.height,>,0) ||
-            (blk->stride && NOT_I(blk->stride,==,stride)))
-            return MEMMGR_ERR_GENERIC;
+#if MEMMGR_MAX_BLOCKS != TILER_MAX_NUM_BLOCKS
+#error maximum number of blocks does not match
+#endif
+
+void *MemMgr_AllocUsage(MemAllocBlock blocks[], int num_blocks,
+                        uint32_t usage)
+{
+    IN;
+    MemAllocBlock blks[MEMMGR_MAX_BLOCKS];
+    bytes_t pitch[MEMMGR_MAX_BLOCKS];
+    int ix;
+
+    if (NOT_I(num_blocks,>,0) || NOT_I(num_blocks,<=,MEMMGR_MAX_BLOCKS) ||
+        NOT_I(usage & ~MEMMGR_USAGE_ALL,==,0)) return R_P(NULL);
+
+    /* buffers accessed by devices only are not accessed by the CPU */
+    uint32_t cpu = usage & (MEMMGR_USAGE_CPU_READ_OFTEN |
+                            MEMMGR_USAGE_CPU_WRITE_OFTEN);
+    if (NOT_I(cpu && (usage & MEMMGR_USAGE_DMA_ONLY),==,0)) return R_P(NULL);
+
+    /* rotation and scan-out need 2D blocks, otherwise CPU access wants
+       the cache */
+    bool linear = cpu && !(usage & (MEMMGR_USAGE_ROTATE |
+                                    MEMMGR_USAGE_DISPLAY));
+
+    /* planes become 1D blocks of cache line aligned rows.  Blocks other
+       than the last must be page sized. */
+    memcpy(blks, blocks, sizeof(*blks) * num_blocks);
+    for (ix = 0; ix < num_blocks; ix++)
+    {
+        MemAllocBlock *blk = blks + ix;
+        pitch[ix] = 0;
+        if (!linear || blk->pixelFormat == PIXEL_FMT_PAGE ||
+            check_block((tiler_block_info *) blk, false)) continue;
+
+        pitch[ix] = ROUND_UP_TO2POW(blk->dim.area.width *
+                                    def_bpp((enum tiler_fmt) blk->pixelFormat),
+                                    CACHE_LINE_SIZE);
+        bytes_t len = pitch[ix] * blk->dim.area.height;
+        blk->pixelFormat = PIXEL_FMT_PAGE;
+        blk->dim.len = ix < num_blocks - 1 ?
+                       ROUND_UP_TO2POW(len, PAGE_SIZE) : len;
+        blk->stride = 0;
     }
 
-    if (is_page_sized && NOT_I(def_size(blk) & (PAGE_SIZE - 1),==,0))
-        return MEMMGR_ERR_GENERIC;
+    void *bufPtr = MemMgr_Alloc(blks, num_blocks);
+    if (bufPtr)
+    {
+        /* the view and MemMgr_GetStride() report the row pitch of
+           planes allocated as 1D blocks */
+        LOCK(che_mutex);
+        _AllocData *ad = buf_cache_find(bufPtr, BUF_ALLOCED);
+        bufs_change_begin();
+        for (ix = 0; ad && ix < num_blocks; ix++)
+        {
+            if (!pitch[ix]) continue;
+            ad->blk_stride[ix] = pitch[ix];
+            view_set_stride(bufPtr, blks[ix].ptr, pitch[ix]);
+        }
+        bufs_change_end();
+        if (ad) ad->usage = usage;
+        UNLOCK(che_mutex);
 
-    return MEMMGR_ERR_NONE;
+        for (ix = 0; ix < num_blocks; ix++)
+        {
+            if (pitch[ix]) blks[ix].stride = pitch[ix];
+        }
+        memcpy(blocks, blks, sizeof(*blks) * num_blocks);
+    }
+    return R_P(bufPtr);
 }
 
-/**
- * Checks whether the block information is correct for map and
- * alloc operations.  Checks the number of blocks, and validity
- * of each block.  Warns if reserved member is not 0.
- *
- * @author a0194118 (9/7/2009)
- *
- * @param blks                 Pointer to the block info array.
- * @param num_blocks           Number of blocks.
- * @param num_pagesize_blocks  Number of blocks that must be
- *                             page sized (these must be in
- *                             front)
- *
- * @return 0 on success, non-0 error value on failure.
- */
-static int check_blocks(struct tiler_block_info *blks, int num_blocks,
-                 int num_pagesize_blocks)
+int MemMgr_GetLayout(void *ptr, MemMgrLayout *layout)
 {
-    /* check arguments */
-    if (NOT_I(num_blocks,>,0) ||
-        NOT_I(num_blocks,<=,TILER_MAX_NUM_BLOCKS)) return MEMMGR_ERR_GENERIC;
+    IN;
+    int ix, ret = MEMMGR_ERR_GENERIC;
+    if (NOT_P(layout,!=,NULL)) return R_I(ret);
 
-    /* check block allocation params */
-    int ix;
-    for (ix = 0; ix < num_blocks; ix++)
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(ptr, BUF_ANY);
+    if (A_P(ad,!=,NULL))
     {
-        struct tiler_block_info *blk = blks + ix;
-        CHK_I(blk->ssptr,==,0);
-        int ret = check_block(blk, ix < num_pagesize_blocks);
-        if (ret)
+        ZERO(*layout);
+        layout->usage = ad->usage;
+        layout->num_blocks = ad->num_blocks;
+        for (ix = 0; ix < ad->num_blocks; ix++)
         {
-            DP("for block[%d]", ix);
-            return ret;
+            layout->layout[ix] = ad->blk_fmt[ix] == TILFMT_PAGE ?
+                                 MEMMGR_LAYOUT_1D : MEMMGR_LAYOUT_2D;
+            layout->stride[ix] = ad->blk_stride[ix];
         }
+        ret = MEMMGR_ERR_NONE;
     }
+    UNLOCK(che_mutex);
+    return R_I(ret);
+}
 
-    return MEMMGR_ERR_NONE;
+int MemMgr_LeaseConnect(const char *path, int priority, uint32_t chunk)
+{
+    IN;
+    struct sockaddr_un addr;
+    struct tiler_arb_msg msg;
+    int ret = MEMMGR_ERR_GENERIC;
+
+    if (!path) path = TILER_ARB_SOCKET;
+    if (NOT_I(strlen(path),<,sizeof(addr.sun_path)) ||
+        NOT_I(chunk,>,0)) return R_I(ret);
+    ZERO(addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    LOCK(ref_mutex);
+    LOCK(arb_mutex);
+    if (NOT_I(refCnt,==,0) || NOT_I(arb_fd,<,0)) goto DONE;
+
+    arb_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (NOT_I(arb_fd,>=,0)) goto DONE;
+    ZERO(lease);
+    ZERO(msg);
+    msg.cmd = TILER_ARB_HELLO;
+    msg.arg = priority;
+    if (NOT_I(connect(arb_fd, (struct sockaddr *) &addr, sizeof(addr)),==,0) ||
+        NOT_I(arb_request(&msg),==,0))
+    {
+        close(arb_fd);
+        arb_fd = -1;
+        goto DONE;
+    }
+    arb_chunk = chunk;
+    ret = MEMMGR_ERR_NONE;
+
+DONE:
+    UNLOCK(arb_mutex);
+    UNLOCK(ref_mutex);
+    return R_I(ret);
 }
 
-/**
- * Resets the ptr and reserved fields of the block info
- * structures.
- *
- * @author a0194118 (9/7/2009)
- *
- * @param blks                 Pointer to the block info array.
- * @param num_blocks           Number of blocks.
- */
-static void reset_blocks(struct tiler_block_info *blks, int num_blocks)
+int MemMgr_LeaseDisconnect()
 {
-    int ix;
-    for (ix = 0; ix < num_blocks; ix++)
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(arb_mutex);
+    if (!NOT_I(arb_fd,>=,0))
     {
-        blks[ix].ssptr = 0;
-        blks[ix].ptr = NULL;
+        ret = close(arb_fd);
+        arb_fd = -1;
+        ZERO(lease);
     }
+    UNLOCK(arb_mutex);
+    return R_I(ret);
+}
 
+void MemMgr_GetLeaseStats(MemMgrLeaseStats *stats)
+{
+    LOCK(arb_mutex);
+    *stats = lease;
+    UNLOCK(arb_mutex);
 }
 
-bytes_t MemMgr_PageSize()
+int MemMgr_GetArbStats(MemMgrArbStats *stats)
 {
-    return PAGE_SIZE;
+    IN;
+    struct tiler_arb_msg msg;
+    int ret = MEMMGR_ERR_GENERIC;
+
+    LOCK(arb_mutex);
+    ZERO(msg);
+    msg.cmd = TILER_ARB_STATS;
+    if (!NOT_I(arb_fd,>=,0) && !arb_request(&msg))
+    {
+        stats->clients = msg.clients;
+        stats->slots = msg.slots;
+        stats->pages = msg.pages;
+        stats->max_slots = msg.max_slots;
+        stats->max_pages = msg.max_pages;
+        stats->requests = msg.requests;
+        stats->denied = msg.denied;
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(arb_mutex);
+    return R_I(ret);
 }
 
-void *MemMgr_Alloc(MemAllocBlock blocks[], int num_blocks)
+int MemMgr_KeeperConnect(const char *path)
 {
     IN;
-    void *bufPtr = NULL;
+    struct sockaddr_un addr;
+    struct tiler_keep_msg msg;
+    int ret = MEMMGR_ERR_GENERIC;
 
-    /* need to access ssptrs */
-    struct tiler_block_info *blks = (tiler_block_info *) blocks;
+    if (!path) path = TILER_KEEP_SOCKET;
+    if (NOT_I(strlen(path),<,sizeof(addr.sun_path))) return R_I(ret);
+    ZERO(addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    LOCK(keep_mutex);
+    if (NOT_I(keep_sock,<,0)) goto DONE;
+
+    keep_sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (NOT_I(keep_sock,>=,0)) goto DONE;
+    ZERO(msg);
+    msg.cmd = TILER_KEEP_STATS;
+    if (NOT_I(connect(keep_sock, (struct sockaddr *) &addr, sizeof(addr)),==,0) ||
+        NOT_I(keep_request(&msg, -1, NULL),==,0))
+    {
+        close(keep_sock);
+        keep_sock = -1;
+        goto DONE;
+    }
+    ret = MEMMGR_ERR_NONE;
 
-    /* check block allocation params, and state */
-    if (NOT_I(check_blocks(blks, num_blocks, num_blocks - 1),==,0) ||
+DONE:
+    UNLOCK(keep_mutex);
+    return R_I(ret);
+}
+
+int MemMgr_KeeperDisconnect()
+{
+    IN;
+    int ret = MEMMGR_ERR_GENERIC;
+    LOCK(keep_mutex);
+    if (!NOT_I(keep_sock,>=,0))
+    {
+        ret = close(keep_sock);
+        keep_sock = -1;
+    }
+    UNLOCK(keep_mutex);
+    return R_I(ret);
+}
+
+int MemMgr_Keep(void *bufPtr, uint32_t id)
+{
+    IN;
+#ifdef STUB_TILER
+    struct tiler_keep_msg msg;
+    int fd = -1, ret = MEMMGR_ERR_GENERIC;
+
+    /* the keeper needs the memory of the buffer itself, which the shared
+       aperture mappings do not give */
+    if (NOT_I(id,!=,0) || NOT_I(aperture,==,false)) return R_I(ret);
+
+    /* claim the buffer under the ID, so that it is neither kept twice nor
+       demoted, and a concurrent free drops it from the keeper */
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_use(bufPtr, BUF_ALLOCED);
+    if (NOT_P(ad,!=,NULL) || NOT_P(ad->bufPtr,==,bufPtr) ||
+        NOT_I(ad->keep_id,==,0))
+    {
+        UNLOCK(che_mutex);
+        return R_I(ret);
+    }
+    ZERO(msg);
+    msg.cmd = TILER_KEEP_PUT;
+    msg.id = id;
+    msg.buf.offset = ad->tiler_id;
+    if (!NOT_I(ioctl(td, TILIOC_QBUF, &msg.buf),==,0))
+        fd = TilerStub_ExportBuf(td, msg.buf.offset);
+    if (!NOT_I(fd,>=,0)) ad->keep_id = id;
+    UNLOCK(che_mutex);
+    if (fd < 0) return R_I(ret);
+
+    /* the keeper is a round trip away, so do not hold che_mutex */
+    LOCK(keep_mutex);
+    if (!NOT_I(keep_sock,>=,0) && !keep_request(&msg, fd, NULL))
+        ret = MEMMGR_ERR_NONE;
+    UNLOCK(keep_mutex);
+    close(fd);
+
+    /* release the claim on failure, unless the buffer is gone */
+    LOCK(che_mutex);
+    ad = buf_cache_find(bufPtr, BUF_ALLOCED);
+    bool kept = ad && ad->bufPtr == bufPtr && ad->keep_id == id &&
+                ad->tiler_id == msg.buf.offset;
+    if (kept && ret) ad->keep_id = 0;
+    UNLOCK(che_mutex);
+
+    /* a buffer freed meanwhile may have been dropped before it was kept */
+    if (!kept && !ret)
+    {
+        keep_drop(id);
+        ret = MEMMGR_ERR_GENERIC;
+    }
+    return R_I(ret);
+#else
+    /* the tiler driver cannot hand the blocks of a buffer to another
+       process, so only the tiler stub can keep buffers */
+    return R_I(MEMMGR_ERR_GENERIC);
+#endif
+}
+
+int MemMgr_Unkeep(void *bufPtr)
+{
+    IN;
+    uint32_t id = 0;
+    LOCK(che_mutex);
+    _AllocData *ad = buf_cache_find(bufPtr, BUF_ALLOCED);
+    if (A_P(ad,!=,NULL) && !NOT_P(ad->bufPtr,==,bufPtr))
+    {
+        id = ad->keep_id;
+        ad->keep_id = 0;
+    }
+    UNLOCK(che_mutex);
+
+    if (NOT_I(id,!=,0)) return R_I(MEMMGR_ERR_GENERIC);
+    keep_drop(id);
+    return R_I(MEMMGR_ERR_NONE);
+}
+
+void *MemMgr_Attach(uint32_t id, MemAllocBlock blocks[], int *num_blocks)
+{
+    IN;
+#ifdef STUB_TILER
+    struct tiler_keep_msg msg;
+    void *bufPtr = NULL;
+    int ix, fd = -1;
+
+    ZERO(msg);
+    msg.cmd = TILER_KEEP_GET;
+    msg.id = id;
+    LOCK(keep_mutex);
+    if (!NOT_I(keep_sock,>=,0)) keep_request(&msg, -1, &fd);
+    UNLOCK(keep_mutex);
+    if (NOT_I(fd,>=,0) || NOT_I(aperture,==,false) ||
         NOT_I(inc_ref(),==,0)) goto DONE;
 
     /* ----- begin recoverable portion ----- */
-    int ix;
 
-    /* allocate each buffer using tiler driver and initialize block info */
-    for (ix = 0; ix < num_blocks; ix++)
+    /* take over the blocks and the registration of the buffer */
+    struct tiler_buf_info buf = msg.buf;
+    if (NOT_I(TilerStub_AdoptBuf(td, &buf, fd),==,0)) goto FAIL;
+
+    /* charge the blocks against the lease in lease mode */
+    uint32_t pages, slots = buf_slots(buf.blocks, buf.num_blocks, &pages);
+    if (NOT_I(lease_charge(slots, pages),==,0))
     {
-        CHK_I(blks[ix].ptr,==,NULL);
-        if (NOT_I(tiler_alloc(blks + ix),>=,0)) goto FAIL_ALLOC;
+        A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
+        goto FAIL_LEASE;
     }
 
-    bufPtr = tiler_mmap(blks, num_blocks, BUF_ALLOCED);
-    if (A_P(bufPtr,!=,0)) goto DONE;
+    bufPtr = tiler_mmap(&buf, tiler_size(buf.blocks, buf.num_blocks),
+                        BUF_ALLOCED, true, false);
+    if (A_P(bufPtr,!=,NULL))
+    {
+        LOCK(che_mutex);
+        buf_cache_find(bufPtr, BUF_ALLOCED)->keep_id = id;
+        UNLOCK(che_mutex);
+
+        /* return the blocks that fit */
+        if (blocks && num_blocks)
+        {
+            ix = *num_blocks < buf.num_blocks ? *num_blocks : buf.num_blocks;
+            memcpy(blocks, buf.blocks, sizeof(*buf.blocks) * ix);
+        }
+        if (num_blocks) *num_blocks = buf.num_blocks;
+        goto DONE;
+    }
 
     /* ------ error handling ------ */
-FAIL_ALLOC:
-    while (ix)
+    lease_credit(slots, pages);
+FAIL_LEASE:
+    for (ix = 0; ix < buf.num_blocks; ix++)
     {
-        tiler_free(blks + --ix);
+        tiler_free(buf.blocks + ix);
     }
 
-    /* clear ssptr and ptr fields for all blocks */
-    reset_blocks(blks, num_blocks);
-
+FAIL:
     A_I(dec_ref(),==,0);
 DONE:
+    if (fd >= 0) close(fd);
     CHK_I(cache_check(),==,0);
     return R_P(bufPtr);
+#else
+    /* only the tiler stub can take over the blocks of another process */
+    return R_P(NULL);
+#endif
 }
 
-int MemMgr_Free(void *bufPtr)
+/* executor of MemMgr_ParallelFor2D jobs */
+static Exec *exec = NULL;
+static int exec_workers = 0;
+static Lock exec_mutex = LOCK_INITIALIZER("exec_mutex");
+
+/* a MemMgr_ParallelFor2D job */
+struct _TileJob {
+    char        *ptr;
+    bytes_t      stride;
+    bytes_t      bpp;
+    pixels_t     width, height;
+    pixels_t     tile_w, tile_h;
+    int          cols;
+    MemMgrTileFn fn;
+    void        *arg;
+};
+
+/* processes a tile of a MemMgr_ParallelFor2D job */
+static void tile_run(void *arg, int item, int worker)
 {
-    IN;
+    struct _TileJob *job = (struct _TileJob *) arg;
+    pixels_t x = (item % job->cols) * job->tile_w;
+    pixels_t y = (item / job->cols) * job->tile_h;
+    pixels_t w = job->width - x < job->tile_w ? job->width - x : job->tile_w;
+    pixels_t h = job->height - y < job->tile_h ? job->height - y : job->tile_h;
+    job->fn(job->arg, job->ptr + y * job->stride + x * job->bpp, job->stride,
+            x, y, w, h);
+}
 
-    int ret = MEMMGR_ERR_GENERIC;
+/**
+ * Gets the block information of a block of a buffer.
+ *
+ * @param ptr    Pointer to the start of the block
+ * @param blk    Pointer to the block information to fill out
+ *
+ * @return 0 on success, -EINVAL if ptr is not the start of a
+ *         block.
+ */
+static int block_find(void *ptr, struct tiler_block_info *blk)
+{
     struct tiler_buf_info buf;
-    ZERO(buf);
-
-    /* retrieve registered buffers from vsptr */
-    /* :NOTE: if this succeeds, Memory Allocator stops tracking this buffer */
-    buf.offset = buf_cache_del(bufPtr, BUF_ALLOCED);
+    void *bufPtr = NULL;
+    int ix, ret = -EINVAL;
 
-    if (A_L(buf.offset,!=,0))
+    /* in aperture mode the blocks are in the record */
+    if (ap_ssptr(ptr))
     {
-#ifndef STUB_TILER
-        /* get block information for the buffer */
-        dump_buf(&buf, "==(QBUF)=>");
-        ret = A_I(ioctl(td, TILIOC_QBUF, &buf),==,0);
-        dump_buf(&buf, "<=(QBUF)==");
-
-        /* unregister buffer, and free tiler chunks even if there is an
-           error */
-        if (!ret)
+        LOCK(che_mutex);
+        _AllocData *ad = ap_lookup(ptr);
+        for (ix = 0; ad && ix < ad->num_blocks; ix++)
         {
-            dump_buf(&buf, "==(URBUF)=>");
-            ret = A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
-            dump_buf(&buf, "<=(URBUF)==");
-
-            /* free each block */
-            int ix;
-            for (ix = 0; ix < buf.num_blocks; ix++)
+            if (ap_ptr(ad->blocks[ix].ssptr) == ptr)
             {
-                ERR_ADD(ret, tiler_free(buf.blocks + ix));
+                *blk = ad->blocks[ix];
+                ret = 0;
+                break;
             }
+        }
+        UNLOCK(che_mutex);
+        return ret;
+    }
 
-            /* unmap buffer */
-            bytes_t size = tiler_size(buf.blocks, buf.num_blocks);
-            bufPtr = (void *)((uint32_t)bufPtr & ~(PAGE_SIZE - 1));
-            ERR_ADD(ret, munmap(bufPtr, size));
+    ZERO(buf);
+    buf.offset = buf_cache_query(ptr, BUF_ALLOCED | BUF_MAPPED, &bufPtr);
+    if (!buf.offset || inc_ref()) return ret;
+    if (!A_I(ioctl(td, TILIOC_QBUF, &buf),==,0))
+    {
+        for (ix = 0; ix < buf.num_blocks && bufPtr <= ptr; ix++)
+        {
+            if (bufPtr == ptr)
+            {
+                *blk = buf.blocks[ix];
+                ret = 0;
+                break;
+            }
+            bufPtr += def_size(buf.blocks + ix);
         }
-#else
-        void *ptr = (void *) buf.offset;
-        FREE(ptr);
-        ret = MEMMGR_ERR_NONE;
-#endif
-        ERR_ADD(ret, dec_ref());
     }
+    A_I(dec_ref(),==,0);
+    return ret;
+}
 
-    CHK_I(cache_check(),==,0);
-    return R_I(ret);
+/**
+ * Returns the executor of MemMgr_ParallelFor2D jobs, and starts
+ * it if needed.  Must be called with exec_mutex held.
+ *
+ * @return Pointer to the executor, or NULL on failure.
+ */
+static Exec *exec_get()
+{
+    if (!exec)
+    {
+        if (!exec_workers)
+        {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            exec_workers = n > 0 ? n : 1;
+        }
+        exec = Exec_Create(exec_workers);
+    }
+    return exec;
 }
 
-void *MemMgr_Map(MemAllocBlock blocks[], int num_blocks)
+int MemMgr_SetParallelism(int num_workers)
 {
     IN;
-    void *bufPtr = NULL;
-
-    /* need to access ssptrs */
-    struct tiler_block_info *blks = (tiler_block_info *) blocks;
+    if (NOT_I(num_workers,>=,0)) return R_I(MEMMGR_ERR_GENERIC);
+
+    LOCK(exec_mutex);
+    Exec_Destroy(exec);
+    exec = NULL;
+    exec_workers = num_workers;
+    UNLOCK(exec_mutex);
+    return R_I(MEMMGR_ERR_NONE);
+}
 
-    /* check block params, and state */
-    if (check_blocks(blks, num_blocks, num_blocks) ||
-        NOT_I(inc_ref(),==,0)) goto DONE;
+int MemMgr_ParallelFor2D(void *ptr, pixels_t tile_w, pixels_t tile_h,
+                         MemMgrTileFn fn, void *arg)
+{
+    IN;
+    struct tiler_block_info blk;
+    struct _TileJob job;
+    int ret = MEMMGR_ERR_GENERIC;
 
-    /* we only map 1 page aligned 1D buffer for now */
-    if (NOT_I(num_blocks,==,1) ||
-        NOT_I(blocks[0].pixelFormat,==,PIXEL_FMT_PAGE) ||
-        NOT_I(blocks[0].dim.len & (PAGE_SIZE - 1),==,0) ||
-#ifdef STUB_TILER
-        NOT_I(MemMgr_IsMapped(blocks[0].ptr),==,0) ||
-#endif
-        NOT_I((uint32_t)blocks[0].ptr & (PAGE_SIZE - 1),==,0))
-        goto FAIL;
+    ZERO(blk);
+    if (NOT_P(fn,!=,NULL) ||
+        NOT_I(block_find(ptr, &blk),==,0) ||
+        NOT_I(blk.fmt,!=,TILFMT_PAGE)) return R_I(ret);
+
+    /* split into slot aligned tiles */
+    pixel_fmt_t fmt = (pixel_fmt_t) blk.fmt;
+    ZERO(job);
+    job.ptr = ptr;
+    job.stride = MemMgr_GetStride(ptr);
+    job.bpp = TILER_PIXEL_SIZE(fmt);
+    job.width = blk.dim.area.width;
+    job.height = blk.dim.area.height;
+    job.tile_w = tile_w ? ROUND_UP_TO(tile_w, TILER_SLOT_WIDTH(fmt)) :
+                 TILER_SLOT_WIDTH(fmt);
+    job.tile_h = tile_h ? ROUND_UP_TO(tile_h, TILER_SLOT_HEIGHT(fmt)) :
+                 TILER_SLOT_HEIGHT(fmt);
+    job.cols = (job.width + job.tile_w - 1) / job.tile_w;
+    job.fn = fn;
+    job.arg = arg;
+    if (NOT_I(job.stride,>,0)) return R_I(ret);
+
+    LOCK(exec_mutex);
+    Exec *ex = exec_get();
+    if (A_P(ex,!=,NULL) &&
+        !A_I(Exec_Run(ex, job.cols * ((job.height + job.tile_h - 1) /
+                                      job.tile_h), tile_run, &job),==,0))
+    {
+        ret = MEMMGR_ERR_NONE;
+    }
+    UNLOCK(exec_mutex);
+    return R_I(ret);
+}
 
-    /* ----- begin recoverable portion ----- */
-    int ix;
+void MemMgr_GetParallelStats(MemMgrParallelStats *stats)
+{
+    ExecStats st;
 
-    /* allocate each buffer using tiler driver */
-    for (ix = 0; ix < num_blocks; ix++)
+    ZERO(*stats);
+    LOCK(exec_mutex);
+    if (exec)
     {
-        if (NOT_I(blks[ix].ptr,!=,NULL) ||
-            NOT_I(tiler_map(blks + ix),>,0)) goto FAIL_MAP;
+        Exec_GetStats(exec, &st);
+        stats->workers = Exec_Workers(exec);
+        stats->jobs = st.jobs;
+        stats->tiles = st.items;
+        stats->steals = st.steals;
     }
+    UNLOCK(exec_mutex);
+}
 
-    /* map bufer into tiler space and register with tiler manager */
-    bufPtr = tiler_mmap(blks, num_blocks, BUF_MAPPED);
-    if (A_P(bufPtr,!=,0)) goto DONE;
+/* planes of at least this many bytes are checksummed in parallel */
+#define DIGEST_PAR_MIN  (1 << 20)
+/* single row planes are split into pieces of this many bytes */
+#define DIGEST_PIECE    (64 << 10)
+/* bands of a parallel digest per thread */
+#define DIGEST_BANDS    4
+
+/* a parallel digest: the plane is checksummed in bands of rows */
+struct _DigestJob {
+    const char *ptr;
+    bytes_t     row_len;
+    bytes_t     stride;
+    uint32_t    rows;
+    uint32_t    band_rows;
+    uint32_t   *crcs;
+};
 
-    /* ------ error handling ------ */
-FAIL_MAP:
-    while (ix)
+/* returns the checksum of some rows of a plane */
+static uint32_t digest_rows(const char *ptr, bytes_t row_len, uint32_t rows,
+                            bytes_t stride)
+{
+    uint32_t crc = 0;
+    if (stride == row_len) return CRC32C_Update(0, ptr, row_len * rows);
+    while (rows--)
     {
-        tiler_unmap(blks + --ix);
+        crc = CRC32C_Update(crc, ptr, row_len);
+        ptr += stride;
     }
+    return crc;
+}
 
-FAIL:
-    /* clear ssptr and ptr fields for all blocks */
-    reset_blocks(blks, num_blocks);
-
-    A_I(dec_ref(),==,0);
-DONE:
-    CHK_I(cache_check(),==,0);
-    return R_P(bufPtr);
+/* checksums a band of a parallel digest */
+static void digest_band(void *arg, int item, int worker)
+{
+    struct _DigestJob *job = (struct _DigestJob *) arg;
+    uint32_t row = item * job->band_rows;
+    uint32_t rows = job->rows - row < job->band_rows ?
+                    job->rows - row : job->band_rows;
+    job->crcs[item] = digest_rows(job->ptr + row * job->stride, job->row_len,
+                                  rows, job->stride);
 }
 
-int MemMgr_UnMap(void *bufPtr)
+uint32_t MemMgr_DigestPlane(const void *ptr, bytes_t row_len, uint32_t rows,
+                            bytes_t stride)
 {
     IN;
+    LOCK_SITE(exec_site);
+    struct _DigestJob job;
+    uint32_t crc = 0, tail = 0;
+    int ix, num_bands = 0;
 
-    int ret = MEMMGR_ERR_GENERIC;
-    struct tiler_buf_info buf;
-    ZERO(buf);
-
-    /* retrieve registered buffers from vsptr */
-    /* :NOTE: if this succeeds, Memory Allocator stops tracking this buffer */
-    buf.offset = buf_cache_del(bufPtr, BUF_MAPPED);
+    if (rows == 1) stride = row_len;
+    if (NOT_I(stride,>=,row_len)) return R_UP(0);
 
-    if (A_L(buf.offset,!=,0))
+    /* split a single row into pieces that can be checksummed in parallel */
+    if (rows == 1 && row_len >= DIGEST_PAR_MIN)
     {
-#ifndef STUB_TILER
-        /* get block information for the buffer */
-        dump_buf(&buf, "==(QBUF)=>");
-        ret = A_I(ioctl(td, TILIOC_QBUF, &buf),==,0);
-        dump_buf(&buf, "<=(QBUF)==");
+        tail = row_len % DIGEST_PIECE;
+        rows = row_len / DIGEST_PIECE;
+        stride = row_len = DIGEST_PIECE;
+    }
 
-        /* unregister buffer, and free tiler chunks even if there is an
-           error */
-        if (!ret)
-        {
-            dump_buf(&buf, "==(URBUF)=>");
-            ret = A_I(ioctl(td, TILIOC_URBUF, &buf),==,0);
-            dump_buf(&buf, "<=(URBUF)==");
+    ZERO(job);
+    job.ptr = ptr;
+    job.row_len = row_len;
+    job.stride = stride;
+    job.rows = rows;
 
-            /* unmap each block */
-            int ix;
-            for (ix = 0; ix < buf.num_blocks; ix++)
+    /* the threads may be busy, e.g. if called from a MemMgr_ParallelFor2D
+       tile.  Then the plane is checksummed on this thread. */
+    if ((uint64_t) row_len * rows >= DIGEST_PAR_MIN &&
+        !Lock_TryAcquire(&exec_mutex, &exec_site))
+    {
+        Exec *ex = exec_get();
+        if (ex && Exec_Workers(ex) > 1)
+        {
+            num_bands = Exec_Workers(ex) * DIGEST_BANDS;
+            if (num_bands > (int) rows) num_bands = rows;
+            job.band_rows = (rows + num_bands - 1) / num_bands;
+            num_bands = (rows + job.band_rows - 1) / job.band_rows;
+            ALLOCN(job.crcs, num_bands);
+            if (job.crcs && Exec_Run(ex, num_bands, digest_band, &job))
             {
-                ERR_ADD(ret, tiler_unmap(buf.blocks + ix));
+                FREE(job.crcs);
             }
+        }
+        UNLOCK(exec_mutex);
+    }
 
-            /* unmap buffer */
-            bytes_t size = tiler_size(buf.blocks, buf.num_blocks);
-            bufPtr = (void *)((uint32_t)bufPtr & ~(PAGE_SIZE - 1));
-            ERR_ADD(ret, munmap(bufPtr, size));
+    if (job.crcs)
+    {
+        for (ix = 0; ix < num_bands; ix++)
+        {
+            uint32_t band = rows - ix * job.band_rows < job.band_rows ?
+                            rows - ix * job.band_rows : job.band_rows;
+            crc = CRC32C_Combine(crc, job.crcs[ix], band * row_len);
         }
-#else
-        struct tiler_buf_info *ptr = (struct tiler_buf_info *) buf.offset;
-        FREE(ptr[1].blocks[0].ptr);
-        FREE(ptr);
-        ret = MEMMGR_ERR_NONE;
-#endif
-        ERR_ADD(ret, dec_ref());
+        FREE(job.crcs);
+    }
+    else
+    {
+        crc = digest_rows(ptr, row_len, rows, stride);
     }
 
-    CHK_I(cache_check(),==,0);
-    return R_I(ret);
+    if (tail) crc = CRC32C_Update(crc, (const char *) ptr + rows * row_len, tail);
+    return R_UP(crc);
 }
 
-bool MemMgr_Is1DBlock(void *ptr)
+int MemMgr_DigestBlock(void *ptr, uint32_t *digest)
 {
     IN;
+    struct tiler_block_info blk;
 
-    SSPtr ssptr = TilerMem_VirtToPhys(ptr);
-    enum tiler_fmt fmt = tiler_get_fmt(ssptr);
-    return R_I(fmt == TILFMT_PAGE);
+    ZERO(blk);
+    if (NOT_P(digest,!=,NULL) ||
+        NOT_I(block_find(ptr, &blk),==,0)) return R_I(MEMMGR_ERR_GENERIC);
+
+    if (blk.fmt == TILFMT_PAGE)
+    {
+        *digest = MemMgr_DigestPlane(ptr, blk.dim.len, 1, 0);
+    }
+    else
+    {
+        bytes_t stride = MemMgr_GetStride(ptr);
+        if (NOT_I(stride,>,0)) return R_I(MEMMGR_ERR_GENERIC);
+        *digest = MemMgr_DigestPlane(ptr, blk.dim.area.width *
+                                     TILER_PIXEL_SIZE((pixel_fmt_t) blk.fmt),
+                                     blk.dim.area.height, stride);
+    }
+    return R_I(MEMMGR_ERR_NONE);
 }
 
-bool MemMgr_Is2DBlock(void *ptr)
+#if MEMMGR_LOCK_BUCKETS != LOCK_BUCKETS
+#error lock statistics buckets do not match
+#endif
+
+bool MemMgr_SetLockStats(bool enable)
+{
+    return Lock_SetStats(enable);
+}
+
+int MemMgr_GetLockStats(MemMgrLockStats stats[], int max_stats)
 {
     IN;
+    LockInfo *info = NULL;
+    int ix, num;
 
-    SSPtr ssptr = TilerMem_VirtToPhys(ptr);
-    enum tiler_fmt fmt = tiler_get_fmt(ssptr);
-    return R_I(fmt == TILFMT_8BIT || fmt == TILFMT_16BIT ||
-               fmt == TILFMT_32BIT);
+    if (NOT_I(max_stats,>=,0) ||
+        (max_stats && NOT_P(stats,!=,NULL))) return R_I(-1);
+
+    if (max_stats)
+    {
+        ALLOCN(info, max_stats);
+        if (NOT_P(info,!=,NULL)) return R_I(-1);
+    }
+    num = Lock_Query(info, max_stats);
+    for (ix = 0; ix < num && ix < max_stats; ix++)
+    {
+        stats[ix].lock = info[ix].name;
+        stats[ix].func = info[ix].func;
+        stats[ix].line = info[ix].line;
+        stats[ix].acquisitions = info[ix].stats.acquisitions;
+        stats[ix].contended = info[ix].stats.contended;
+        stats[ix].wait_ns = info[ix].stats.wait_ns;
+        stats[ix].hold_ns = info[ix].stats.hold_ns;
+        memcpy(stats[ix].wait_hist, info[ix].stats.wait_hist,
+               sizeof(stats[ix].wait_hist));
+        memcpy(stats[ix].hold_hist, info[ix].stats.hold_hist,
+               sizeof(stats[ix].hold_hist));
+    }
+    FREE(info);
+    return R_I(num);
 }
 
-bool MemMgr_IsMapped(void *ptr)
+void MemMgr_ResetLockStats()
 {
-    IN;
-    SSPtr ssptr = TilerMem_VirtToPhys(ptr);
-    enum tiler_fmt fmt = tiler_get_fmt(ssptr);
-    return R_I(fmt == TILFMT_8BIT || fmt == TILFMT_16BIT ||
-               fmt == TILFMT_32BIT || fmt == TILFMT_PAGE);
+    Lock_Reset();
 }
 
-bytes_t MemMgr_GetStride(void *ptr)
+void MemMgr_DumpLockStats()
 {
-    IN;
-#ifndef STUB_TILER
-    struct tiler_buf_info buf;
-    ZERO(buf);
+    Lock_Dump();
+}
 
-    /* find block that this buffer belongs to */
-    void *bufPtr = NULL;
-    buf.offset = buf_cache_query(ptr, BUF_ALLOCED | BUF_MAPPED, &bufPtr);
+const MemMgrView *MemMgr_GetView()
+{
+    return &bufs_view;
+}
 
-    A_I(inc_ref(),==,0);
+int MemMgr_Snapshot(MemMgrBufInfo entries[], int max_entries,
+                    uint32_t *version)
+{
+    IN;
+    if (NOT_I(max_entries,>=,0) ||
+        (max_entries && NOT_P(entries,!=,NULL))) return R_I(-1);
 
-    /* for tiler mapped buffers, get saved stride information */
-    if (buf.offset)
+    /* walk the list without locking, and retry if it changed meanwhile.
+       Records are never freed, so the walk is safe even then, but it
+       may end up in the free list, or - in theory - loop. */
+    for (;;)
     {
-        /* get block information for the buffer */
-        dump_buf(&buf, "==(QBUF)=>");
-        int ix, ret = A_I(ioctl(td, TILIOC_QBUF, &buf),==,0);
-        dump_buf(&buf, "<=(QBUF)==");
-        if (ret) return 0;
+        uint32_t seq = bufs_view.seq;
+        int num_bufs = 0, max_bufs = num_ads;
+        _AllocData *ad = NULL;
 
-        /* walk through block to determine which stride we need */
-        for (ix = 0; ix < buf.num_blocks; ix++)
+        if (!(seq & 1))
         {
-            bytes_t size = def_size(buf.blocks + ix);
-            if (bufPtr <= ptr && ptr < bufPtr + size) {
-                A_I(dec_ref(),==,0);
-                return R_UP(buf.blocks[ix].stride);
+            __sync_synchronize();
+            if (bufs_inited)
+            {
+                for (ad = bufs.next->me; ad && num_bufs <= max_bufs;
+                     ad = ad->link.next->me, num_bufs++)
+                {
+                    if (num_bufs < max_entries)
+                    {
+                        MemMgrBufInfo *e = entries + num_bufs;
+                        e->bufPtr = ad->bufPtr;
+                        e->size = ad->size;
+                        e->type = ad->buf_type;
+                        e->num_blocks = ad->num_blocks;
+                        e->formats = ad->formats;
+                    }
+                }
+            }
+            __sync_synchronize();
+            if (!ad && seq == bufs_view.seq)
+            {
+                if (version) *version = seq >> 1;
+                return R_I(num_bufs);
             }
-            bufPtr += size;
         }
-        A_I(dec_ref(),==,0);
-        DP("assert: should not ever get here");
-        return R_UP(0);
+        sched_yield();
     }
-    /* see if pointer is valid */
-    else if (TilerMem_VirtToPhys(ptr) == 0)
+}
+
+void MemMgr_IterInit(MemMgrBufIter *it, const MemMgrBufInfo entries[],
+                     int num_entries, const MemMgrBufFilter *filter)
+{
+    it->entries = entries;
+    it->num_entries = num_entries;
+    it->ix = 0;
+    if (filter)
     {
-        A_I(dec_ref(),==,0);
-        return R_UP(0);
+        it->filter = *filter;
     }
-    A_I(dec_ref(),==,0);
-#else
-    /* if emulating, we need to get through all allocated memory segments */
-    pthread_mutex_lock(&che_mutex);
-    init();
+    else
+    {
+        ZERO(it->filter);
+    }
+}
 
-    _AllocData *ad;
-    if (!ptr) return R_UP(0);
-    DLIST_MLOOP(bufs, ad, link) {
-        int ix;
-        struct tiler_buf_info *buf = (struct tiler_buf_info *) ad->tiler_id;
-        for (ix = 0; ix < buf->num_blocks; ix++)
-        {
-            if (ptr >= buf->blocks[ix].ptr &&
-                ptr < buf->blocks[ix].ptr + def_size(buf->blocks + ix))
-            {
-                bytes_t stride = buf->blocks[ix].stride;
-                pthread_mutex_unlock(&che_mutex);
-                return R_UP(stride);
-            }
-        }
+const MemMgrBufInfo *MemMgr_IterNext(MemMgrBufIter *it)
+{
+    MemMgrBufFilter *f = &it->filter;
+    while (it->ix < it->num_entries)
+    {
+        const MemMgrBufInfo *e = it->entries + it->ix++;
+        if ((!f->type_mask || (e->type & f->type_mask)) &&
+            (!f->formats || (e->formats & f->formats)) &&
+            e->size >= f->min_size &&
+            (!f->max_size || e->size <= f->max_size)) return e;
     }
-    pthread_mutex_unlock(&che_mutex);
-#endif
-    return R_UP(PAGE_SIZE);
+    return NULL;
 }
 
 bytes_t TilerMem_GetStride(SSPtr ssptr)
@@ -1018,17 +3801,31 @@ bytes_t TilerMem_GetStride(SSPtr ssptr)
 
 SSPtr TilerMem_VirtToPhys(void *ptr)
 {
-#ifndef STUB_TILER
-    SSPtr ssptr = 0;
+    SSPtr ssptr = ap_ssptr(ptr);
+
+    /* aperture addresses translate by arithmetic, if they are in a buffer */
+    if (ssptr)
+    {
+        LOCK(che_mutex);
+        if (!ap_lookup(ptr)) ssptr = 0;
+        UNLOCK(che_mutex);
+        return ssptr;
+    }
+
+    /* demoted buffers are restored first */
+    if (num_demoted)
+    {
+        LOCK(che_mutex);
+        buf_cache_use(ptr, BUF_ALLOCED);
+        UNLOCK(che_mutex);
+    }
+
     if(!NOT_I(inc_ref(),==,0))
     {
         ssptr = ioctl(td, TILIOC_GSSP, (unsigned long) ptr);
         A_I(dec_ref(),==,0);
     }
     return (SSPtr)R_P(ssptr);
-#else
-    return (SSPtr)ptr;
-#endif
 }
 
 /**
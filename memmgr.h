@@ -157,6 +157,10 @@ void *MemMgr_Alloc(MemAllocBlock blocks[], int num_blocks);
  * This function unmaps the processor's virtual address to the
  * tiler address for all blocks allocated, unregisters the
  * buffer, and frees all of its tiler blocks.
+ * <p>
+ * If other owners hold references (see MemMgr_Ref()), only the
+ * reference of the allocator is dropped, and the buffer is freed
+ * when the last one is.
  *
  * @author a0194118 (9/1/2009)
  *
@@ -167,6 +171,25 @@ void *MemMgr_Alloc(MemAllocBlock blocks[], int num_blocks);
  */
 int MemMgr_Free(void *bufPtr);
 
+/**
+ * Allocates a ring buffer: a 1D block that is mapped twice,
+ * back to back, so that reads and writes across the end of the
+ * ring continue at its start without splitting or copying.
+ * The block itself is a single PIXEL_FMT_PAGE range for
+ * devices.  The ring is freed with MemMgr_Free().  See
+ * memmgr_ring.h for producer/consumer helpers.
+ * <p>
+ * Rings are not available in aperture mode, and are not
+ * demoted.  Queries of the ring should use the first mapping.
+ *
+ * @param len    Length of the ring.  Must be a multiple of the
+ *               page size.
+ *
+ * @return Pointer to the first mapping of the ring, or NULL on
+ *         failure.  The second mapping follows at len bytes.
+ */
+void *MemMgr_AllocRing(bytes_t len);
+
 /**
  * This function maps the user provided data buffer to the tiler
  * space as blocks, and maps that area into the process space
@@ -206,7 +229,8 @@ void *MemMgr_Map(MemAllocBlock blocks[], int num_blocks);
  * space that was mapped to the tiler space in paged mode using
  * MemMgr_Map().  It also unmaps the buffer itself from the
  * process space.  Trying to unmap a previously unmapped buffer
- * will fail.
+ * will fail.  If other owners hold references, only the
+ * reference of the mapper is dropped, as for MemMgr_Free().
  *
  * @author a0194118 (9/1/2009)
  *
@@ -217,6 +241,109 @@ void *MemMgr_Map(MemAllocBlock blocks[], int num_blocks);
  */
 int MemMgr_UnMap(void *bufPtr);
 
+/**
+ * Maps several 1D buffers back to back into a new, virtually
+ * contiguous range, so that they can be processed as one
+ * buffer without copying.  The view is another mapping of the
+ * same pages: writes through the view are visible in the
+ * sources, and vice versa.
+ * <p>
+ * The sources keep ownership of their memory, and are pinned
+ * while they are viewed.  They must not be freed before the
+ * view is unmapped.  Devices still see each source at its own
+ * tiler address: TilerMem_VirtToPhys() of a pointer in the view
+ * returns the address within the corresponding source.
+ * <p>
+ * Views are not available in aperture mode.
+ *
+ * @param bufs      Array of buffer pointers returned by
+ *                  MemMgr_Alloc() for buffers with only 1D
+ *                  blocks.  Each must be page aligned, and all
+ *                  but the last must have a size that is a
+ *                  multiple of the page size.
+ * @param num_bufs  Number of buffers
+ *
+ * @return Pointer to the view, or NULL on failure.  Source ix
+ *         starts at the sum of the sizes of the preceding
+ *         sources.
+ */
+void *MemMgr_MapConcat(void *bufs[], int num_bufs);
+
+/**
+ * Unmaps a view created by MemMgr_MapConcat(), and unpins its
+ * sources.  The sources are not affected otherwise.
+ *
+ * @param ptr   Pointer to the view as returned by
+ *              MemMgr_MapConcat()
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_UnMapConcat(void *ptr);
+
+/**
+ * Stream of successive windows of a file, each mapped into
+ * tiler space in page mode - see MemMgr_StreamOpen().
+ */
+struct MemMgrStream {
+    int       fd;
+    uint64_t  file_len;     /* length of the file */
+    bytes_t   window;       /* length of full windows */
+    bytes_t   readahead;    /* bytes to read ahead of the window */
+    uint64_t  offset;       /* file offset of the next window */
+    void     *src;          /* file mapping of the current window */
+    void     *bufPtr;       /* tiler mapping of the current window */
+    bytes_t   len;          /* length of the current window */
+};
+
+typedef struct MemMgrStream MemMgrStream;
+
+/**
+ * Starts streaming a file through tiler space without copying
+ * it.  Each window is mapped from the file, its page cache
+ * pages are locked if RLIMIT_MEMLOCK allows, and they are mapped
+ * into tiler space with MemMgr_Map().  Windows are read-only.
+ * <p>
+ * Readahead is controlled by the stream: the kernel's own
+ * readahead is turned off, and the readahead bytes following
+ * each window are requested when the window is mapped, so that
+ * they are read while the window is processed.
+ *
+ * @param s          Pointer to the stream
+ * @param fd         File descriptor of a file opened for
+ *                   reading
+ * @param window     Length of the windows.  Must be a multiple
+ *                   of the page size.
+ * @param readahead  Number of bytes to read ahead, or 0 to
+ *                   read each window when it is mapped
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_StreamOpen(MemMgrStream *s, int fd, bytes_t window,
+                      bytes_t readahead);
+
+/**
+ * Maps the next window of a stream, and unmaps the previous
+ * one.  All windows but the last have the window length.
+ *
+ * @param s      Pointer to the stream
+ * @param len    Pointer to store the length of the window, or
+ *               0 at the end of the file or on failure
+ *
+ * @return Pointer to the tiler mapping of the window, or NULL
+ *         at the end of the file or on failure.
+ */
+void *MemMgr_StreamNext(MemMgrStream *s, bytes_t *len);
+
+/**
+ * Unmaps the current window of a stream.  The file descriptor
+ * is not closed.
+ *
+ * @param s      Pointer to the stream
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_StreamClose(MemMgrStream *s);
+
 /**
  * Checks if a given virtual address is mapped by tiler manager
  * to tiler space.
@@ -283,8 +410,9 @@ bool MemMgr_Is2DBlock(void *ptr);
 /**
  * Returns the stride corresponding to a virtual address.  For
  * 1D and 2D buffers it returns the stride supplied
- * with/acquired during the allocation/mapping.  For non-tiler
- * buffers it returns the page size.
+ * with/acquired during the allocation/mapping, and for planes
+ * allocated as 1D blocks by MemMgr_AllocUsage() their row pitch.
+ * For non-tiler buffers it returns the page size.
  * <p>
  * NOTE: on Ducati phase 1, stride should return 16K for 8-bit
  * 2D buffers, 32K for 16-bit and 32-bit 2D buffers, the stride
@@ -304,4 +432,884 @@ bool MemMgr_Is2DBlock(void *ptr);
  */
 bytes_t MemMgr_GetStride(void *ptr);
 
+/**
+ * Returns the pixel format of the block that contains a virtual
+ * address.
+ *
+ * @param ptr    pointer to a virtual address
+ *
+ * @return Pixel format of the block, or 0 if the address is
+ *         not in tiler space.
+ */
+pixel_fmt_t MemMgr_GetFormat(void *ptr);
+
+/* buffer fence slots */
+#define MEMMGR_FENCE_WRITE 0   /* signalled when writes to a buffer are done */
+#define MEMMGR_FENCE_READ  1   /* signalled when reads of a buffer are done */
+#define MEMMGR_FENCE_SLOTS 2
+
+/**
+ * Signals a fence slot of a buffer.
+ * <p>
+ * Each allocated or mapped buffer has a write and a read fence
+ * slot, so that a producer (e.g. a DMA engine or a CPU thread)
+ * and its consumers can hand the buffer back and forth without
+ * external condition variables.  A slot counts the signals it
+ * received since the buffer was allocated or mapped, starting
+ * from 0.  Waiting is futex based, so signalling a fence that
+ * nobody waits for costs no system call.
+ *
+ * @param bufPtr  Pointer within the buffer
+ * @param slot    MEMMGR_FENCE_WRITE or MEMMGR_FENCE_READ
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_FenceSignal(void *bufPtr, int slot);
+
+/**
+ * Returns the number of signals a fence slot of a buffer
+ * received.  A waiter typically reads this before starting an
+ * operation, and then waits for the value + 1.
+ *
+ * @param bufPtr  Pointer within the buffer
+ * @param slot    MEMMGR_FENCE_WRITE or MEMMGR_FENCE_READ
+ * @param value   Pointer to store the signal count
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_FenceValue(void *bufPtr, int slot, uint32_t *value);
+
+/**
+ * Waits until a fence slot of a buffer has received value
+ * signals.  The comparison takes wrapping of the count into
+ * account.
+ *
+ * @param bufPtr      Pointer within the buffer
+ * @param slot        MEMMGR_FENCE_WRITE or MEMMGR_FENCE_READ
+ * @param value       Signal count to wait for
+ * @param timeout_ms  Timeout in milliseconds, or -1 to wait
+ *                    forever
+ *
+ * @return 0 on success, -ETIMEDOUT on timeout.  Other non-0
+ *         error value on failure, e.g. if the buffer is freed
+ *         while waiting.
+ */
+int MemMgr_FenceWait(void *bufPtr, int slot, uint32_t value, int timeout_ms);
+
+/**
+ * Exports a fence slot of a buffer as an eventfd, so that it can
+ * be used with poll/select.  The eventfd is incremented on each
+ * signal.  It is owned by the memory allocator, and is closed
+ * when the buffer is freed or unmapped.  Exporting the same
+ * slot again returns the same eventfd.
+ *
+ * @param bufPtr  Pointer within the buffer
+ * @param slot    MEMMGR_FENCE_WRITE or MEMMGR_FENCE_READ
+ *
+ * @return The eventfd, or -1 on failure.
+ */
+int MemMgr_FenceExport(void *bufPtr, int slot);
+
+/**
+ * Marks a range of a buffer dirty, e.g. after the CPU or a
+ * device wrote it.  The next MemMgr_SyncForDevice() or
+ * MemMgr_SyncForCpu() call on the buffer maintains the cache
+ * for the dirty ranges only, instead of for the whole buffer.
+ * <p>
+ * Ranges are tracked at cache line granularity, and overlapping
+ * or adjacent ranges are coalesced.  Only a limited number of
+ * ranges are kept per buffer: beyond that, the closest ranges
+ * are merged, so a sync may maintain somewhat more than what
+ * was marked, but never less.  Buffers that only have 2D blocks
+ * are not cacheable, so nothing is tracked for them.
+ *
+ * @param ptr    Start of the range.  It must lie in an allocated
+ *               or mapped buffer.
+ * @param len    Length of the range
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_MarkDirty(void *ptr, bytes_t len);
+
+/**
+ * Prepares a buffer for device access by cleaning the caches for
+ * its dirty ranges (see MemMgr_MarkDirty), and clears the dirty
+ * ranges.  Cache maintenance is only implemented by the tiler
+ * stub for now, as the tiler driver offers none: on the device
+ * this fails for buffers with dirty ranges, which stay dirty.
+ *
+ * @param bufPtr  Pointer within the buffer
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         cache maintenance is not available.
+ */
+int MemMgr_SyncForDevice(void *bufPtr);
+
+/**
+ * Prepares a buffer for CPU access by invalidating the caches
+ * for its dirty ranges (see MemMgr_MarkDirty), e.g. after a
+ * device wrote them, and clears the dirty ranges.  Like
+ * MemMgr_SyncForDevice, this is only implemented by the tiler
+ * stub.
+ *
+ * @param bufPtr  Pointer within the buffer
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         cache maintenance is not available.
+ */
+int MemMgr_SyncForCpu(void *bufPtr);
+
+/**
+ * Enables or disables aperture mode.  The mode can only be
+ * changed while no buffers are allocated or mapped.
+ * <p>
+ * By default each buffer is mapped into the process space
+ * separately, and its blocks are packed consecutively.  In
+ * aperture mode the memory allocator maps each tiler region
+ * (the 8, 16 and 32-bit views and the page-mode area) once into
+ * a single virtual window, and blocks are accessed at their
+ * fixed offset in that window.  Allocating and mapping buffers
+ * then creates no process mappings, and translating between
+ * pointers and system space addresses, as well as looking up
+ * buffers, is done by arithmetic.
+ * <p>
+ * In aperture mode the blocks of a buffer are not consecutive,
+ * so each block must be accessed through its ptr field.  The
+ * stride of 2D blocks is that of the container view: 16K for
+ * 8-bit, and 32K for 16 and 32-bit blocks.  The buffer pointer
+ * is the pointer to the first block.
+ * <p>
+ * Aperture mode requires a tiler driver that can map the tiler
+ * regions directly at their system space offsets.  The tiler
+ * driver cannot, so aperture mode is only available with the
+ * tiler stub, and enabling it fails otherwise.
+ *
+ * @param enable  TRUE (non-0) to enable aperture mode
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         there are buffers, the regions could not be mapped,
+ *         or the tiler stub is not used.
+ */
+int MemMgr_SetApertureMode(bool enable);
+
+/**
+ * Returns whether aperture mode is enabled.
+ *
+ * @return TRUE (non-0) in aperture mode
+ */
+bool MemMgr_InApertureMode();
+
+/**
+ * Demotes allocated buffers that have not been used for a while
+ * out of the tiler container.  The contents of each such buffer
+ * are compressed into system memory, and its blocks are freed,
+ * but the buffer keeps its pointer: the address range stays
+ * reserved, yet inaccessible.
+ * <p>
+ * A demoted buffer is restored into newly allocated blocks on
+ * the next memory allocator call that takes a pointer within it
+ * (e.g. MemMgr_GetStride, TilerMem_VirtToPhys, the fence and
+ * cache maintenance calls, or MemMgr_Pin).  The blocks may
+ * receive different system space addresses, so ssptrs must be
+ * queried again after a restore.  Accessing a demoted buffer
+ * directly faults, so a buffer must be pinned while the CPU
+ * accesses it without going through the memory allocator.
+ * Freeing a demoted buffer simply drops its contents.
+ * <p>
+ * A buffer is used when it is allocated, restored, unpinned, or
+ * passed to MemMgr_GetStride, MemMgr_Pin, or the fence or cache
+ * maintenance calls.  Only buffers marked with
+ * MemMgr_SetDemotable are demoted.  Pinned buffers, mapped
+ * buffers, and buffers in aperture mode are never demoted.
+ * <p>
+ * In lease mode, the capacity of demoted buffers is credited
+ * back to the lease, and is charged again on restore, so a
+ * restore fails if the service denies the lease.
+ *
+ * @param idle_ms  Minimum time since the last use of a buffer
+ *                 in milliseconds
+ *
+ * @return the number of buffers demoted.
+ */
+int MemMgr_DemoteIdle(uint32_t idle_ms);
+
+/**
+ * Marks whether an allocated buffer may be demoted when idle.
+ * Buffers are not demotable when allocated, as devices may hold
+ * the ssptrs returned by MemMgr_Alloc or TilerMem_VirtToPhys,
+ * which change when a demoted buffer is restored.  A buffer
+ * should only be marked demotable while no device holds its
+ * ssptrs.
+ *
+ * @param bufPtr     Pointer within the buffer
+ * @param demotable  Whether the buffer may be demoted
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         ptr is not in an allocated buffer.
+ */
+int MemMgr_SetDemotable(void *bufPtr, bool demotable);
+
+/**
+ * Pins a buffer, so that it is not demoted.  If the buffer is
+ * demoted, it is restored first.  Pins are counted.
+ *
+ * @param bufPtr  Pointer within the buffer
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         the buffer could not be restored.
+ */
+int MemMgr_Pin(void *bufPtr);
+
+/**
+ * Releases a pin of a buffer.
+ *
+ * @param bufPtr  Pointer within the buffer
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         the buffer is not pinned.
+ */
+int MemMgr_Unpin(void *bufPtr);
+
+/**
+ * Returns whether a buffer is demoted.
+ *
+ * @param bufPtr  Pointer within the buffer
+ *
+ * @return TRUE (non-0) if the buffer is demoted
+ */
+bool MemMgr_IsDemoted(void *bufPtr);
+
+/**
+ * Demotion statistics, accumulated since the last reset.
+ */
+struct MemMgrDemoteStats {
+    uint32_t demoted;       /* buffers demoted */
+    uint32_t restored;      /* buffers restored */
+    uint32_t slots;         /* container slots and pages reclaimed */
+    uint64_t bytes;         /* bytes demoted */
+    uint64_t compressed;    /* compressed size of the bytes demoted */
+    uint64_t demote_us;     /* time spent demoting in microseconds */
+    uint64_t restore_us;    /* time spent restoring in microseconds */
+};
+
+typedef struct MemMgrDemoteStats MemMgrDemoteStats;
+
+/**
+ * Returns the demotion statistics.
+ *
+ * @param stats  Pointer to the statistics to fill out
+ * @param reset  TRUE (non-0) to reset the statistics afterwards
+ */
+void MemMgr_GetDemoteStats(MemMgrDemoteStats *stats, bool reset);
+
+/**
+ * Per-buffer user metadata.  Each buffer carries
+ * MEMMGR_USER_DATA_SIZE bytes for the client, e.g. the
+ * timestamp, frame ID, crop and colorspace of a frame, so that
+ * clients need not keep a map of their own next to the
+ * allocator's.  The metadata is cleared when a buffer is
+ * allocated or mapped, and dropped when it is freed or unmapped.
+ */
+#define MEMMGR_USER_DATA_SIZE 64
+
+/**
+ * Stores user metadata of a buffer.
+ *
+ * @param ptr     Pointer within the buffer
+ * @param offset  Offset into the metadata
+ * @param data    Data to store
+ * @param len     Number of bytes to store.  offset + len must
+ *                not exceed MEMMGR_USER_DATA_SIZE.
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         ptr is not in a buffer.
+ */
+int MemMgr_SetUserData(void *ptr, bytes_t offset, const void *data,
+                       bytes_t len);
+
+/**
+ * Retrieves user metadata of a buffer.
+ *
+ * @param ptr     Pointer within the buffer
+ * @param offset  Offset into the metadata
+ * @param data    Pointer to store the data at
+ * @param len     Number of bytes to retrieve.  offset + len must
+ *                not exceed MEMMGR_USER_DATA_SIZE.
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         ptr is not in a buffer.
+ */
+int MemMgr_GetUserData(void *ptr, bytes_t offset, void *data, bytes_t len);
+
+/**
+ * Shared ownership.  A buffer starts out with one reference,
+ * held by whoever allocated or mapped it.  MemMgr_Ref() adds a
+ * reference for each further owner, and the MemMgr_Unref() that
+ * drops the last one frees (or unmaps) the buffer.  Both find
+ * the buffer in constant time and never take the registry
+ * lock, so they may be called from any thread at frame rate.
+ * <p>
+ * MemMgr_Free() and MemMgr_UnMap() drop the reference of the
+ * allocator or mapper, just like MemMgr_Unref().
+ */
+
+/**
+ * Adds a reference to a buffer.
+ *
+ * @param bufPtr  Pointer to the buffer (as returned by
+ *                MemMgr_Alloc() or MemMgr_Map())
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         bufPtr is not a buffer, or its last reference is
+ *         being dropped.
+ */
+int MemMgr_Ref(void *bufPtr);
+
+/**
+ * Drops a reference to a buffer, and frees (or unmaps) the
+ * buffer if it was the last one.
+ *
+ * @param bufPtr  Pointer to the buffer (as returned by
+ *                MemMgr_Alloc() or MemMgr_Map())
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         bufPtr is not a buffer, or the buffer could not be
+ *         freed.
+ */
+int MemMgr_Unref(void *bufPtr);
+
+/**
+ * Returns the number of references to a buffer.
+ *
+ * @param bufPtr  Pointer to the buffer
+ *
+ * @return Reference count, or 0 if bufPtr is not a buffer.
+ */
+int MemMgr_RefCount(void *bufPtr);
+
+/**
+ * Usage bits for MemMgr_AllocUsage().  They describe how a
+ * buffer is going to be accessed, and select the block type, and
+ * with it the layout and cacheability, of its blocks:
+ * <ul>
+ * <li>Rotation (and mirroring) needs the 2D views of the tiler
+ * container, and scan-out needs 2D blocks, so MEMMGR_USAGE_ROTATE
+ * and MEMMGR_USAGE_DISPLAY always select 2D blocks.
+ * <li>Otherwise frequent CPU access selects cacheable 1D blocks.
+ * <li>Otherwise (DMA only) 2D blocks are selected, which are not
+ * cacheable, and need no cache maintenance.
+ * </ul>
+ * MEMMGR_USAGE_DMA_ONLY contradicts the MEMMGR_USAGE_CPU_* bits,
+ * and cannot be combined with them.
+ */
+#define MEMMGR_USAGE_CPU_READ_OFTEN   0x01  /* CPU reads often */
+#define MEMMGR_USAGE_CPU_WRITE_OFTEN  0x02  /* CPU writes often */
+#define MEMMGR_USAGE_ROTATE           0x04  /* rotated or mirrored */
+#define MEMMGR_USAGE_DISPLAY          0x08  /* scanned out */
+#define MEMMGR_USAGE_DMA_ONLY         0x10  /* accessed by devices only */
+#define MEMMGR_USAGE_ALL              0x1f
+
+/* block layouts */
+#define MEMMGR_LAYOUT_1D    1   /* linear rows, cacheable */
+#define MEMMGR_LAYOUT_2D    2   /* tiler container, not cacheable */
+
+/* maximum number of blocks of a buffer */
+#define MEMMGR_MAX_BLOCKS   16
+
+/**
+ * Layout of a buffer, as returned by MemMgr_GetLayout().
+ */
+struct MemMgrLayout {
+    uint32_t usage;                     /* usage bits the buffer was
+                                           allocated for, or 0 */
+    int      num_blocks;                /* number of blocks */
+    int      layout[MEMMGR_MAX_BLOCKS]; /* MEMMGR_LAYOUT_* of each block */
+    bytes_t  stride[MEMMGR_MAX_BLOCKS]; /* row pitch of each block, or 0
+                                           for 1D blocks without rows */
+};
+
+typedef struct MemMgrLayout MemMgrLayout;
+
+/**
+ * Allocates a buffer for a usage.  The blocks are specified as
+ * for MemMgr_Alloc(), with 2D blocks describing the planes of
+ * the buffer.  The usage bits select whether they are
+ * allocated as 2D blocks, or as cacheable 1D blocks of
+ * height rows of the same width.  1D blocks are passed
+ * through.
+ * <p>
+ * On success, the block specification is updated as by
+ * MemMgr_Alloc() to describe the blocks allocated: planes
+ * allocated as 1D blocks are turned into PIXEL_FMT_PAGE blocks,
+ * and stride is set to the row pitch of each plane.  This is
+ * also the stride MemMgr_GetStride() and the registry view
+ * return for the plane.
+ *
+ * @param blocks     Block specification information
+ * @param num_blocks Number of blocks
+ * @param usage      Mask of MEMMGR_USAGE_* bits
+ *
+ * @return Pointer to the buffer, or NULL on failure, e.g. if
+ *         usage has unknown or contradictory bits.
+ */
+void *MemMgr_AllocUsage(MemAllocBlock blocks[], int num_blocks,
+                        uint32_t usage);
+
+/**
+ * Retrieves the layout of a buffer: the usage it was allocated
+ * for, and the layout and row pitch of each of its blocks.
+ *
+ * @param ptr     Pointer within the buffer
+ * @param layout  Pointer to store the layout at
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         ptr is not in a buffer.
+ */
+int MemMgr_GetLayout(void *ptr, MemMgrLayout *layout);
+
+/* lease priorities */
+#define MEMMGR_LEASE_NORMAL     0
+#define MEMMGR_LEASE_BACKGROUND 1
+
+/**
+ * Enters lease mode.  The memory allocator connects to the TILER
+ * arbitration service (tiler_arbd), which arbitrates container
+ * capacity between the processes sharing the tiler.  Capacity is
+ * leased in chunks of container slots (for 2D blocks) and pages
+ * (for 1D blocks), and each allocation or mapping is charged
+ * against the lease of the process.  The service is only
+ * contacted when the lease runs out, or when more than two
+ * chunks of it are unused, so most allocations need no
+ * round-trip.  Allocations that the service denies fail.
+ * <p>
+ * Demoted buffers return their capacity to the lease, and
+ * restoring them charges it again, so restores can be denied
+ * like allocations.  The mode can only be entered while no
+ * buffers are allocated or mapped.
+ *
+ * @param path      Socket path of the service, or NULL for the
+ *                  default
+ * @param priority  MEMMGR_LEASE_NORMAL, or
+ *                  MEMMGR_LEASE_BACKGROUND for clients that
+ *                  cannot lease the capacity the service keeps
+ *                  in reserve.  The service only grants normal
+ *                  priority to processes whose user it trusts.
+ * @param chunk     Lease chunk in slots and pages
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         there are buffers, the service is not running, or it
+ *         does not trust the process with normal priority.
+ */
+int MemMgr_LeaseConnect(const char *path, int priority, uint32_t chunk);
+
+/**
+ * Leaves lease mode.  The service reclaims the lease of the
+ * process.
+ *
+ * @return 0 on success.  Non-0 error value if not in lease mode.
+ */
+int MemMgr_LeaseDisconnect();
+
+/**
+ * Lease statistics of the process.
+ */
+struct MemMgrLeaseStats {
+    uint32_t slots;         /* container slots leased */
+    uint32_t pages;         /* page-mode pages leased */
+    uint32_t used_slots;    /* leased slots in use */
+    uint32_t used_pages;    /* leased pages in use */
+    uint32_t round_trips;   /* requests sent to the service */
+    uint32_t denied;        /* allocations denied by the service */
+};
+
+typedef struct MemMgrLeaseStats MemMgrLeaseStats;
+
+/**
+ * Returns the lease statistics of the process.
+ *
+ * @param stats  Pointer to the statistics to fill out
+ */
+void MemMgr_GetLeaseStats(MemMgrLeaseStats *stats);
+
+/**
+ * System-wide statistics of the arbitration service.
+ */
+struct MemMgrArbStats {
+    uint32_t clients;       /* connected processes */
+    uint32_t slots;         /* container slots leased */
+    uint32_t pages;         /* page-mode pages leased */
+    uint32_t max_slots;     /* container slots */
+    uint32_t max_pages;     /* page-mode pages */
+    uint32_t requests;      /* lease requests */
+    uint32_t denied;        /* lease requests denied */
+};
+
+typedef struct MemMgrArbStats MemMgrArbStats;
+
+/**
+ * Queries the system-wide statistics of the arbitration service.
+ * Requires lease mode.
+ *
+ * @param stats  Pointer to the statistics to fill out
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_GetArbStats(MemMgrArbStats *stats);
+
+/**
+ * Connects to the TILER buffer keeper (tiler_keepd).  The keeper
+ * holds buffers handed to it with MemMgr_Keep() across restarts
+ * of the process, so that after a restart the process can
+ * attach to its existing buffers with MemMgr_Attach() instead of
+ * allocating and filling them again.
+ * <p>
+ * Kept buffers require the driver to let the blocks of a buffer
+ * outlive the process.  Only the TILER emulation does this, with
+ * shareable memory, so MemMgr_Keep() and MemMgr_Attach() always
+ * fail with the tiler driver.
+ *
+ * @param path   Socket path of the keeper, or NULL for the
+ *               default
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         already connected, or the keeper is not running.
+ */
+int MemMgr_KeeperConnect(const char *path);
+
+/**
+ * Disconnects from the buffer keeper.  Kept buffers stay with
+ * the keeper.
+ *
+ * @return 0 on success.  Non-0 error value if not connected.
+ */
+int MemMgr_KeeperDisconnect();
+
+/**
+ * Hands an allocated buffer to the keeper under an ID.  The
+ * buffer stays usable, and it is dropped from the keeper when
+ * it is freed.  Kept buffers are never demoted.  Only available
+ * with the tiler stub, and not in aperture mode.
+ *
+ * @param bufPtr Pointer to the buffer
+ * @param id     Non-0 ID that is unique among the kept buffers
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         the ID is taken, or the buffer is already kept.
+ */
+int MemMgr_Keep(void *bufPtr, uint32_t id);
+
+/**
+ * Drops a buffer from the keeper without freeing it.
+ *
+ * @param bufPtr Pointer to the buffer
+ *
+ * @return 0 on success.  Non-0 error value if the buffer is not
+ *         kept.
+ */
+int MemMgr_Unkeep(void *bufPtr);
+
+/**
+ * Attaches to a kept buffer, usually one that a previous
+ * instance of the process allocated.  The buffer keeps its
+ * blocks and contents; it is mapped again, but not allocated.
+ * It is freed with MemMgr_Free(), and stays kept until then.
+ * Only available with the tiler stub.
+ *
+ * @param id          ID of the buffer
+ * @param blocks      Optional array to return the blocks of the
+ *                    buffer in, as MemMgr_Alloc() does
+ * @param num_blocks  Optional pointer to the number of elements
+ *                    of the blocks array.  It is set to the
+ *                    number of blocks of the buffer on success.
+ *
+ * @return Pointer to the buffer, or NULL on failure, e.g. if
+ *         there is no such buffer, or the process is already
+ *         attached to it.
+ */
+void *MemMgr_Attach(uint32_t id, MemAllocBlock blocks[], int *num_blocks);
+
+/**
+ * Function processing a tile of a 2D block for
+ * MemMgr_ParallelFor2D().
+ *
+ * @param arg     Argument passed to MemMgr_ParallelFor2D
+ * @param ptr     Pointer to the top-left pixel of the tile
+ * @param stride  Stride of the block
+ * @param x       Column of the tile in the block
+ * @param y       Row of the tile in the block
+ * @param width   Width of the tile
+ * @param height  Height of the tile
+ */
+typedef void (*MemMgrTileFn)(void *arg, void *ptr, bytes_t stride,
+                             pixels_t x, pixels_t y,
+                             pixels_t width, pixels_t height);
+
+/**
+ * Sets the number of threads that run MemMgr_ParallelFor2D
+ * jobs, including the calling thread.  The worker threads are
+ * started on the first job.
+ *
+ * @param num_workers  Number of threads, or 0 for the number of
+ *                     online CPUs
+ *
+ * @return 0 on success.  Non-0 error value on failure.
+ */
+int MemMgr_SetParallelism(int num_workers);
+
+/**
+ * Splits a 2D block into tiles, and processes the tiles in
+ * parallel.  The tiles are aligned to container slots, so no two
+ * threads write the same DMM page or cache line.  They are
+ * assigned to the threads in contiguous bands, and idle threads
+ * steal tiles from busy ones.  The calling thread takes part,
+ * and the call returns when all tiles are processed.
+ * <p>
+ * The tiles at the right and bottom edges are cropped to the
+ * block.  fn must not call MemMgr_ParallelFor2D.
+ *
+ * @param ptr      Pointer to the start of a 2D block (e.g. the
+ *                 ptr field of the block after MemMgr_Alloc)
+ * @param tile_w   Tile width in pixels.  It is rounded up to a
+ *                 multiple of the slot width: 64 pixels for
+ *                 8- and 16-bit, and 32 pixels for 32-bit
+ *                 blocks.  0 uses one slot.
+ * @param tile_h   Tile height in pixels.  It is rounded up to a
+ *                 multiple of the slot height: 64 pixels for
+ *                 8-bit, and 32 pixels for 16- and 32-bit
+ *                 blocks.  0 uses one slot.
+ * @param fn       Function processing a tile
+ * @param arg      Argument passed to fn
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         ptr is not the start of a 2D block.
+ */
+int MemMgr_ParallelFor2D(void *ptr, pixels_t tile_w, pixels_t tile_h,
+                         MemMgrTileFn fn, void *arg);
+
+/**
+ * Statistics of MemMgr_ParallelFor2D.
+ */
+struct MemMgrParallelStats {
+    uint32_t workers;       /* threads running jobs */
+    uint64_t jobs;          /* jobs run */
+    uint64_t tiles;         /* tiles processed */
+    uint64_t steals;        /* tile ranges stolen by idle threads */
+};
+
+typedef struct MemMgrParallelStats MemMgrParallelStats;
+
+/**
+ * Returns the statistics of MemMgr_ParallelFor2D since the last
+ * MemMgr_SetParallelism.
+ *
+ * @param stats  Pointer to the statistics to fill out
+ */
+void MemMgr_GetParallelStats(MemMgrParallelStats *stats);
+
+/**
+ * Returns the digest of an image plane: the CRC32C checksum of
+ * its rows, without the padding past the row width.  Planes with
+ * the same contents have the same digest regardless of their
+ * stride, so a digest can be compared with one computed on a
+ * packed copy (e.g. a golden image).  Large planes are
+ * checksummed in parallel on the MemMgr_ParallelFor2D threads,
+ * unless they are busy.
+ * <p>
+ * This can be used on any memory, not only tiler buffers.
+ *
+ * @param ptr      Pointer to the first pixel of the plane
+ * @param row_len  Length of a row in bytes (width * bytes per
+ *                 pixel)
+ * @param rows     Number of rows
+ * @param stride   Stride of the plane in bytes.  Ignored if rows
+ *                 is 1.
+ *
+ * @return Digest of the plane.
+ */
+uint32_t MemMgr_DigestPlane(const void *ptr, bytes_t row_len, uint32_t rows,
+                            bytes_t stride);
+
+/**
+ * Returns the digest of a block of a buffer (see
+ * MemMgr_DigestPlane).  2D blocks are checksummed row by row
+ * using their stride, 1D blocks as a single row.
+ *
+ * @param ptr     Pointer to the start of a block (e.g. the ptr
+ *                field of the block after MemMgr_Alloc)
+ * @param digest  Pointer to store the digest
+ *
+ * @return 0 on success.  Non-0 error value on failure, e.g. if
+ *         ptr is not the start of a block.
+ */
+int MemMgr_DigestBlock(void *ptr, uint32_t *digest);
+
+/**
+ * Lock statistics.  While enabled, the locks of the memory
+ * allocator (che_mutex, ref_mutex, arb_mutex, keep_mutex and
+ * exec_mutex) record how long threads wait for them and how
+ * long they are held, in total and for each call site, as
+ * histograms with power-of-2 nanosecond buckets: bucket 0
+ * counts times below 2 ns, bucket b times in [2^b, 2^(b+1)) ns,
+ * and the last bucket all longer times.  Disabled statistics
+ * cost a branch per lock operation.
+ * <p>
+ * Statistics are disabled by default.  If MEMMGR_LOCK_STATS is
+ * set in the environment, they are enabled when the library is
+ * loaded, and printed to stderr at exit.
+ */
+#define MEMMGR_LOCK_BUCKETS 24
+
+struct MemMgrLockStats {
+    const char *lock;           /* name of the lock, e.g. "che_mutex" */
+    const char *func;           /* function of the call site, or NULL
+                                   for the totals of the lock */
+    int         line;           /* source line of the call site */
+    uint64_t    acquisitions;
+    uint64_t    contended;      /* acquisitions that had to wait */
+    uint64_t    wait_ns;        /* total wait time */
+    uint64_t    hold_ns;        /* total hold time */
+    uint64_t    wait_hist[MEMMGR_LOCK_BUCKETS];
+    uint64_t    hold_hist[MEMMGR_LOCK_BUCKETS];
+};
+
+typedef struct MemMgrLockStats MemMgrLockStats;
+
+/**
+ * Enables or disables lock statistics.
+ *
+ * @param enable  TRUE (non-0) to enable the statistics
+ *
+ * @return the previous setting
+ */
+bool MemMgr_SetLockStats(bool enable);
+
+/**
+ * Copies the lock statistics accumulated since the last reset.
+ * For each lock that was taken with statistics enabled, the
+ * totals of the lock are followed by its call sites.
+ * <p>
+ * If there are more entries than max_stats, only the first
+ * max_stats are copied, but the number of all entries is
+ * returned, so that the caller can retry with a larger array.
+ *
+ * @param stats      Array of at least max_stats elements.  Can
+ *                   be NULL if max_stats is 0.
+ * @param max_stats  Number of entries that fit into the array
+ *
+ * @return number of available entries
+ */
+int MemMgr_GetLockStats(MemMgrLockStats stats[], int max_stats);
+
+/**
+ * Resets the lock statistics.
+ */
+void MemMgr_ResetLockStats();
+
+/**
+ * Prints the lock statistics to stderr: for each lock and call
+ * site the acquisitions, the contended acquisitions, and the
+ * mean and 99th percentile wait and hold times.
+ */
+void MemMgr_DumpLockStats();
+
+/* buffer types tracked by the memory allocator */
+#define MEMMGR_BUF_ALLOCED 1
+#define MEMMGR_BUF_MAPPED  2
+#define MEMMGR_BUF_ANY     ~0
+
+/**
+ * Registry entry of a buffer tracked by the memory allocator,
+ * as returned by MemMgr_Snapshot().
+ */
+struct MemMgrBufInfo {
+    void    *bufPtr;     /* pointer to the buffer */
+    bytes_t  size;       /* size of the buffer */
+    int      type;       /* MEMMGR_BUF_ALLOCED or MEMMGR_BUF_MAPPED */
+    int      num_blocks; /* number of blocks in the buffer */
+    uint32_t formats;    /* pixel formats of the blocks, as a mask of
+                            (1 << pixel format) bits */
+};
+
+typedef struct MemMgrBufInfo MemMgrBufInfo;
+
+/**
+ * Filter for iterating through a registry snapshot.  Set a
+ * member to 0 to not filter on that property.
+ */
+struct MemMgrBufFilter {
+    int      type_mask;  /* mask of buffer types, e.g.
+                            MEMMGR_BUF_MAPPED */
+    uint32_t formats;    /* mask of (1 << pixel format) bits.  Buffers
+                            with at least one such block match. */
+    bytes_t  min_size;   /* minimum buffer size */
+    bytes_t  max_size;   /* maximum buffer size */
+};
+
+typedef struct MemMgrBufFilter MemMgrBufFilter;
+
+/**
+ * Iterator over a registry snapshot.  Initialize with
+ * MemMgr_IterInit(), and advance with MemMgr_IterNext().
+ */
+struct MemMgrBufIter {
+    const MemMgrBufInfo *entries;
+    int                  num_entries;
+    int                  ix;
+    MemMgrBufFilter      filter;
+};
+
+typedef struct MemMgrBufIter MemMgrBufIter;
+
+/**
+ * Copies the registry of buffers tracked by the memory
+ * allocator into a caller supplied array.
+ * <p>
+ * The copy is consistent: it reflects the registry at a single
+ * registry version.  The registry is read without taking the
+ * allocator's locks, so allocations, frees, maps and unmaps
+ * never wait for a snapshot.  Instead, the snapshot is retried
+ * if the registry changed while it was copied.
+ * <p>
+ * If there are more buffers than max_entries, only the first
+ * max_entries are copied, but the number of all buffers is
+ * returned, so that the caller can retry with a larger array.
+ *
+ * @param entries      Array of at least max_entries elements.
+ *                     Can be NULL if max_entries is 0.
+ * @param max_entries  Number of entries that fit into the array
+ * @param version      Optional pointer to store the registry
+ *                     version of the snapshot.  The version
+ *                     increases on every registry change.
+ *
+ * @return number of buffers in the registry, or -1 on invalid
+ *         arguments.
+ */
+int MemMgr_Snapshot(MemMgrBufInfo entries[], int max_entries,
+                    uint32_t *version);
+
+/**
+ * Initializes an iterator over the entries of a registry
+ * snapshot.
+ *
+ * @param it           Pointer to the iterator
+ * @param entries      Snapshot entries
+ * @param num_entries  Number of entries (at most the number of
+ *                     entries copied by MemMgr_Snapshot)
+ * @param filter       Optional filter (NULL iterates through all
+ *                     entries)
+ */
+void MemMgr_IterInit(MemMgrBufIter *it, const MemMgrBufInfo entries[],
+                     int num_entries, const MemMgrBufFilter *filter);
+
+/**
+ * Returns the next snapshot entry that matches the iterator's
+ * filter.
+ *
+ * @param it     Pointer to the iterator
+ *
+ * @return Pointer to the next matching entry, or NULL if there
+ *         are no more matching entries.
+ */
+const MemMgrBufInfo *MemMgr_IterNext(MemMgrBufIter *it);
+
 #endif
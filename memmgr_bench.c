@@ -0,0 +1,2953 @@
+/*
+ *  memmgr_bench.c
+ *
+ *  Memory Allocator Interface benchmarks.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* retrieve type definitions */
+#define __DEBUG__
+#undef __DEBUG_ENTRY__
+#define __DEBUG_ASSERT__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include <utils.h>
+#include <debug_utils.h>
+#include <memmgr.h>
+#include <memmgr_view.h>
+#include <memmgr_ring.h>
+#include <tilermem.h>
+#include <tilermem_utils.h>
+#include <tilermem_iter.h>
+#include <testlib.h>
+#include <benchlib.h>
+#ifdef STUB_TILER
+    #include <tiler_stub.h>
+#endif
+
+#define NUM_ITERS 200
+#define NUM_SCANS 10
+#define NUM_BUFS  64
+#define NUM_HANDOFFS 10000
+#define NUM_STEPS 4000
+#define NUM_PROCS 4
+#define MAX_PROCS 16
+
+/* simulated L1 data cache for access statistics: 32K, direct mapped */
+#define CACHE_LINE  64
+#define CACHE_LINES 512
+
+#define TESTS\
+    T(alloc_bench(1, PIXEL_FMT_PAGE, NUM_ITERS))\
+    T(alloc_bench(2, PIXEL_FMT_PAGE, NUM_ITERS))\
+    T(alloc_bench(16, PIXEL_FMT_PAGE, NUM_ITERS))\
+    T(alloc_bench(1, PIXEL_FMT_8BIT, NUM_ITERS))\
+    T(alloc_bench(2, PIXEL_FMT_8BIT, NUM_ITERS))\
+    T(alloc_bench(16, PIXEL_FMT_8BIT, NUM_ITERS))\
+    T(pat_bench(1, PIXEL_FMT_8BIT, 1, NUM_ITERS))\
+    T(pat_bench(16, PIXEL_FMT_8BIT, 0, NUM_ITERS))\
+    T(pat_bench(16, PIXEL_FMT_8BIT, 1, NUM_ITERS))\
+    T(pat_bench(16, PIXEL_FMT_PAGE, 0, NUM_ITERS))\
+    T(pat_bench(16, PIXEL_FMT_PAGE, 1, NUM_ITERS))\
+    T(pat_map_bench(1920 * 1080 * 2, NUM_ITERS))\
+    T(rotate_bench(1920, 1080, PIXEL_FMT_8BIT, 0, NUM_SCANS))\
+    T(rotate_bench(1920, 1080, PIXEL_FMT_8BIT, 90, NUM_SCANS))\
+    T(rotate_bench(1920, 1080, PIXEL_FMT_8BIT, 270, NUM_SCANS))\
+    T(rotate_bench(1920, 1080, PIXEL_FMT_32BIT, 0, NUM_SCANS))\
+    T(rotate_bench(1920, 1080, PIXEL_FMT_32BIT, 90, NUM_SCANS))\
+    T(rotate_bench(1920, 1080, PIXEL_FMT_32BIT, 270, NUM_SCANS))\
+    T(aperture_bench(NUM_BUFS, PIXEL_FMT_PAGE, 0))\
+    T(aperture_bench(NUM_BUFS, PIXEL_FMT_PAGE, 1))\
+    T(aperture_bench(NUM_BUFS, PIXEL_FMT_8BIT, 0))\
+    T(aperture_bench(NUM_BUFS, PIXEL_FMT_8BIT, 1))\
+    T(fence_bench(0, NUM_HANDOFFS))\
+    T(fence_bench(1, NUM_HANDOFFS))\
+    T(dirty_bench(1920, 1080, 1080, 0, NUM_ITERS))\
+    T(dirty_bench(1920, 1080, 8, 0, NUM_ITERS))\
+    T(dirty_bench(1920, 1080, 8, 1, NUM_ITERS))\
+    T(dirty_bench(1920, 1080, 256, 1, NUM_ITERS))\
+    T(demote_bench(NUM_BUFS, PIXEL_FMT_PAGE, 0))\
+    T(demote_bench(NUM_BUFS, PIXEL_FMT_16BIT, 0))\
+    T(demote_bench(NUM_BUFS, PIXEL_FMT_16BIT, 1))\
+    T(partition_bench(0, NUM_STEPS))\
+    T(partition_bench(1, NUM_STEPS))\
+    T(lease_bench(NUM_PROCS, 0, NUM_STEPS))\
+    T(lease_bench(NUM_PROCS, 1, NUM_STEPS))\
+    T(lease_bench(NUM_PROCS, 16, NUM_STEPS))\
+    T(lease_bench(NUM_PROCS, 256, NUM_STEPS))\
+    T(box_bench(1920, 1080, 0, NUM_SCANS))\
+    T(box_bench(1920, 1080, 1, NUM_SCANS))\
+    T(transpose_bench(1920, 1080, 0, NUM_SCANS))\
+    T(transpose_bench(1920, 1080, 1, NUM_SCANS))\
+    T(parallel_bench(1920, 1080, NUM_SCANS))\
+    T(parallel_bench(3840, 2160, NUM_SCANS))\
+    T(digest_bench(1920, 1080, 1, NUM_ITERS))\
+    T(digest_bench(3840, 2160, 1, NUM_ITERS))\
+    T(digest_bench(3840, 2160, 0, NUM_ITERS))\
+    T(restart_bench(96, 320, 240, 0))\
+    T(restart_bench(96, 320, 240, 1))\
+    T(restart_bench(32, 1280, 720, 0))\
+    T(restart_bench(32, 1280, 720, 1))\
+    T(dma_bench(1, 256, 0, NUM_ITERS))\
+    T(dma_bench(1, 4096, 0, NUM_ITERS))\
+    T(dma_bench(4, 4096, 0, NUM_ITERS))\
+    T(dma_bench(1, 4096, 1, NUM_ITERS))\
+    T(dma_bench(4, 4096, 1, NUM_ITERS))\
+    T(lock_bench(1, 0, NUM_HANDOFFS))\
+    T(lock_bench(1, 1, NUM_HANDOFFS))\
+    T(lock_bench(NUM_PROCS, 0, NUM_HANDOFFS))\
+    T(lock_bench(NUM_PROCS, 1, NUM_HANDOFFS))\
+    T(user_data_bench(16, 0, NUM_HANDOFFS / 16))\
+    T(user_data_bench(256, 0, NUM_HANDOFFS / 256))\
+    T(user_data_bench(16, 1, NUM_HANDOFFS / 16))\
+    T(user_data_bench(256, 1, NUM_HANDOFFS / 256))\
+    T(ref_bench(1, 0, NUM_HANDOFFS * 10))\
+    T(ref_bench(1, 1, NUM_HANDOFFS * 10))\
+    T(ref_bench(NUM_PROCS, 0, NUM_HANDOFFS * 10))\
+    T(ref_bench(NUM_PROCS, 1, NUM_HANDOFFS * 10))\
+    T(usage_bench(MEMMGR_USAGE_CPU_READ_OFTEN, 1280, 720, NUM_ITERS))\
+    T(usage_bench(MEMMGR_USAGE_CPU_WRITE_OFTEN, 1280, 720, NUM_ITERS))\
+    T(usage_bench(MEMMGR_USAGE_ROTATE, 1280, 720, NUM_ITERS))\
+    T(usage_bench(MEMMGR_USAGE_DISPLAY, 1280, 720, NUM_ITERS))\
+    T(usage_bench(MEMMGR_USAGE_DMA_ONLY, 1280, 720, NUM_ITERS))\
+    T(view_bench(8, NUM_HANDOFFS / 8))\
+    T(view_bench(NUM_BUFS, NUM_HANDOFFS / NUM_BUFS))\
+    T(ring_bench(0, 16 * PAGE_SIZE, 1316, 3000, NUM_ITERS * 10))\
+    T(ring_bench(1, 16 * PAGE_SIZE, 1316, 3000, NUM_ITERS * 10))\
+    T(ring_bench(0, 2 * PAGE_SIZE, 1316, 6000, NUM_ITERS * 80))\
+    T(ring_bench(1, 2 * PAGE_SIZE, 1316, 6000, NUM_ITERS * 80))\
+    T(concat_bench(0, 4, PAGE_SIZE, NUM_ITERS * 10))\
+    T(concat_bench(1, 4, PAGE_SIZE, NUM_ITERS * 10))\
+    T(concat_bench(0, 4, 16 * PAGE_SIZE, NUM_ITERS * 10))\
+    T(concat_bench(1, 4, 16 * PAGE_SIZE, NUM_ITERS * 10))\
+    T(concat_bench(0, 4, 64 * PAGE_SIZE, NUM_ITERS))\
+    T(concat_bench(1, 4, 64 * PAGE_SIZE, NUM_ITERS))\
+    T(stream_bench(0, 1024 * PAGE_SIZE, 16 * PAGE_SIZE, NUM_ITERS / 10))\
+    T(stream_bench(1, 1024 * PAGE_SIZE, 16 * PAGE_SIZE, NUM_ITERS / 10))\
+    T(stream_bench(0, 1024 * PAGE_SIZE, 256 * PAGE_SIZE, NUM_ITERS / 10))\
+    T(stream_bench(1, 1024 * PAGE_SIZE, 256 * PAGE_SIZE, NUM_ITERS / 10))\
+    T(registry_bench(8, NUM_HANDOFFS / 8))\
+    T(registry_bench(NUM_BUFS, NUM_HANDOFFS / NUM_BUFS))\
+    T(fill_bench(1920, 1080, PIXEL_FMT_8BIT, NUM_SCANS))\
+    T(fill_bench(1920, 1080, PIXEL_FMT_PAGE, NUM_SCANS))\
+
+/**
+ * Returns the current monotonic time in microseconds.
+ *
+ * @return time in microseconds
+ */
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Prints the result of a benchmark as total time and time per
+ * operation.
+ *
+ * @param what     Description of the measured operation
+ * @param num_ops  Number of operations performed
+ * @param time_us  Total time in microseconds
+ */
+static void report(const char *what, int num_ops, uint64_t time_us)
+{
+    printf("%s: %d ops in %llu us (%.2f us/op)\n", what, num_ops,
+           (unsigned long long) time_us,
+           num_ops ? (double) time_us / num_ops : 0.);
+}
+
+/**
+ * Prints a per-operation count.
+ *
+ * @param what     Description of the counted item
+ * @param num_ops  Number of operations performed
+ * @param count    Total count
+ */
+static void report_count(const char *what, int num_ops, uint64_t count)
+{
+    printf("%s: %llu in %d ops (%.2f/op)\n", what,
+           (unsigned long long) count, num_ops,
+           num_ops ? (double) count / num_ops : 0.);
+}
+
+/**
+ * Fills out the block specification of a buffer consisting of
+ * num_blocks identical blocks.  1D blocks are 4 pages long,
+ * while 2D blocks are 176x144 pixels.  Both of these are page
+ * sized, so they can be stacked in a single buffer.
+ *
+ * @param blocks      Block specification array
+ * @param num_blocks  Number of blocks
+ * @param fmt         Pixel format of the blocks
+ */
+static void init_blocks(MemAllocBlock *blocks, int num_blocks,
+                        pixel_fmt_t fmt)
+{
+    int ix;
+    memset(blocks, 0, sizeof(*blocks) * num_blocks);
+    for (ix = 0; ix < num_blocks; ix++)
+    {
+        blocks[ix].pixelFormat = fmt;
+        if (fmt == PIXEL_FMT_PAGE)
+        {
+            blocks[ix].dim.len = 4 * PAGE_SIZE;
+        }
+        else
+        {
+            blocks[ix].dim.area.width = 176;
+            blocks[ix].dim.area.height = 144;
+        }
+    }
+}
+
+/* buffers allocated and freed by alloc_bench */
+struct alloc_job {
+    int         num_blocks;
+    pixel_fmt_t fmt;
+};
+
+/* allocates and frees num_ops buffers */
+static int alloc_op(void *arg, int num_ops)
+{
+    struct alloc_job *job = arg;
+    MemAllocBlock blocks[TILER_MAX_NUM_BLOCKS];
+    int ix;
+
+    for (ix = 0; ix < num_ops; ix++)
+    {
+        init_blocks(blocks, job->num_blocks, job->fmt);
+        void *bufPtr = MemMgr_Alloc(blocks, job->num_blocks);
+        if (NOT_P(bufPtr,!=,NULL) ||
+            NOT_I(MemMgr_Free(bufPtr),==,0)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Measures the time it takes to allocate and free a buffer of
+ * num_blocks blocks with the benchmark harness.
+ *
+ * @param num_blocks  Number of blocks in the buffer
+ * @param fmt         Pixel format of the blocks
+ * @param num_iters   Number of alloc/free pairs per sample
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int alloc_bench(int num_blocks, pixel_fmt_t fmt, int num_iters)
+{
+    const char *type = fmt == PIXEL_FMT_PAGE ? "1D" : "2D";
+    printf("Alloc & Free %d-block %s buffers\n", num_blocks, type);
+
+    struct alloc_job job;
+    char name[64];
+
+    job.num_blocks = num_blocks;
+    job.fmt = fmt;
+    sprintf(name, "alloc+free %d-block %s", num_blocks, type);
+    return BenchLib_Measure(name, alloc_op, &job, num_iters, NULL);
+}
+
+#ifdef STUB_TILER
+/**
+ * Prints the DMM PAT work done since a previous PAT statistics
+ * snapshot.
+ *
+ * @param num_ops  Number of operations performed
+ * @param st0      PAT statistics before the operations
+ */
+static void report_pat(int num_ops, TilerStubPatStats *st0)
+{
+    TilerStubPatStats st;
+    TilerStub_GetPatStats(&st);
+    report_count("PAT entries", num_ops, st.entries - st0->entries);
+    report_count("refill descriptors", num_ops,
+                 st.descriptors - st0->descriptors);
+    report_count("refill passes", num_ops, st.refills - st0->refills);
+}
+#endif
+
+/**
+ * Counts the DMM PAT refill work of allocating a buffer of
+ * num_blocks blocks, with or without batching the refills.  It
+ * is only available with the tiler stub.
+ *
+ * @param num_blocks  Number of blocks in the buffer
+ * @param fmt         Pixel format of the blocks
+ * @param batched     Whether PAT refills are batched
+ * @param num_iters   Number of alloc/free pairs
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int pat_bench(int num_blocks, pixel_fmt_t fmt, int batched, int num_iters)
+{
+    printf("PAT refills for %d-block %s buffers (%s)\n", num_blocks,
+           fmt == PIXEL_FMT_PAGE ? "1D" : "2D",
+           batched ? "batched" : "unbatched");
+#ifdef STUB_TILER
+    MemAllocBlock blocks[TILER_MAX_NUM_BLOCKS];
+    TilerStubPatStats st0;
+    uint64_t t_alloc = 0, t;
+    int ix, res = 0;
+
+    int was_batched = TilerStub_SetPatBatching(batched);
+    TilerStub_GetPatStats(&st0);
+    for (ix = 0; !res && ix < num_iters; ix++)
+    {
+        init_blocks(blocks, num_blocks, fmt);
+
+        t = now_us();
+        void *bufPtr = MemMgr_Alloc(blocks, num_blocks);
+        t_alloc += now_us() - t;
+        if (NOT_P(bufPtr,!=,NULL)) { res = 1; break; }
+
+        res = NOT_I(MemMgr_Free(bufPtr),==,0);
+    }
+    TilerStub_SetPatBatching(was_batched);
+
+    report("alloc", ix, t_alloc);
+    report_pat(ix, &st0);
+    return res;
+#else
+    return TESTLIB_UNAVAILABLE;
+#endif
+}
+
+/**
+ * Counts the DMM PAT refill work of mapping a 1D buffer.  It is
+ * only available with the tiler stub.
+ *
+ * @param length     Length of the buffer
+ * @param num_iters  Number of map/unmap pairs
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int pat_map_bench(bytes_t length, int num_iters)
+{
+    printf("PAT refills for mapping %u-byte buffers\n", length);
+#ifdef STUB_TILER
+    MemAllocBlock block;
+    TilerStubPatStats st0;
+    uint64_t t_map = 0, t;
+    int ix, res = 0;
+
+    length = ROUND_UP_TO2POW(length, PAGE_SIZE);
+    void *buffer = malloc(length + PAGE_SIZE - 1);
+    if (NOT_P(buffer,!=,NULL)) return 1;
+    void *dataPtr = (void *)ROUND_UP_TO2POW((uintptr_t) buffer, PAGE_SIZE);
+
+    TilerStub_GetPatStats(&st0);
+    for (ix = 0; !res && ix < num_iters; ix++)
+    {
+        ZERO(block);
+        block.pixelFormat = PIXEL_FMT_PAGE;
+        block.dim.len = length;
+        block.ptr = dataPtr;
+
+        t = now_us();
+        void *bufPtr = MemMgr_Map(&block, 1);
+        t_map += now_us() - t;
+        if (NOT_P(bufPtr,!=,NULL)) { res = 1; break; }
+
+        res = NOT_I(MemMgr_UnMap(bufPtr),==,0);
+    }
+    FREE(buffer);
+
+    report("map", ix, t_map);
+    report_pat(ix, &st0);
+    return res;
+#else
+    return TESTLIB_UNAVAILABLE;
+#endif
+}
+
+/**
+ * Scans a rotated view of a 2D buffer row by row.  Counts the
+ * page and cache-line touches of the scan in the natural view
+ * (changes of the page or cache line between consecutive pixel
+ * reads), as well as the misses of a simulated direct-mapped
+ * cache, and times the scans.  It is only available with the
+ * tiler stub.
+ *
+ * @param width      Width of the buffer
+ * @param height     Height of the buffer
+ * @param fmt        Pixel format of the buffer
+ * @param rotation   Clockwise rotation of the view
+ * @param num_scans  Number of scans to time
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int rotate_bench(pixels_t width, pixels_t height, pixel_fmt_t fmt,
+                 int rotation, int num_scans)
+{
+    printf("Row scan of %dx%d %d-bit buffer rotated by %d\n", width, height,
+           fmt == PIXEL_FMT_32BIT ? 32 : fmt == PIXEL_FMT_16BIT ? 16 : 8,
+           rotation);
+#ifdef STUB_TILER
+    MemAllocBlock block;
+    TilerStubView view;
+    uint64_t pages = 0, lines = 0, misses = 0, t;
+    uintptr_t page = 0, line = 0, *cache;
+    uint32_t x, y, sum = 0;
+    int ix, res = 0;
+
+    ZERO(block);
+    block.pixelFormat = fmt;
+    block.dim.area.width = width;
+    block.dim.area.height = height;
+    void *bufPtr = MemMgr_Alloc(&block, 1);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ALLOCN(cache, CACHE_LINES);
+    if (NOT_P(cache,!=,NULL) ||
+        NOT_I(TilerStub_GetView(bufPtr, rotation, &view),==,0))
+    {
+        res = 1;
+        goto DONE;
+    }
+
+    /* count touches */
+    for (y = 0; y < view.height; y++)
+    {
+        for (x = 0; x < view.width; x++)
+        {
+            uintptr_t addr = (uintptr_t) TilerStub_ViewPixel(&view, x, y);
+            if (addr / PAGE_SIZE != page) { page = addr / PAGE_SIZE; pages++; }
+            if (addr / CACHE_LINE != line)
+            {
+                line = addr / CACHE_LINE;
+                lines++;
+                if (cache[line % CACHE_LINES] != line)
+                {
+                    cache[line % CACHE_LINES] = line;
+                    misses++;
+                }
+            }
+        }
+    }
+
+    /* time the scans */
+    t = now_us();
+    for (ix = 0; ix < num_scans; ix++)
+    {
+        for (y = 0; y < view.height; y++)
+        {
+            for (x = 0; x < view.width; x++)
+            {
+                void *p = TilerStub_ViewPixel(&view, x, y);
+                sum += (view.bpp == 4 ? *(uint32_t *) p :
+                        view.bpp == 2 ? *(uint16_t *) p : *(uint8_t *) p);
+            }
+        }
+    }
+    t = now_us() - t;
+
+    report("scan", num_scans, t);
+    report_count("page touches per row", view.height, pages);
+    report_count("cache-line touches per row", view.height, lines);
+    report_count("cache misses per row", view.height, misses);
+    P("(checksum %u)", sum);
+
+DONE:
+    FREE(cache);
+    res |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return res;
+#else
+    return TESTLIB_UNAVAILABLE;
+#endif
+}
+
+/**
+ * Returns the number of mappings (VMAs) of this process.
+ *
+ * @return number of lines in /proc/self/maps, or 0 if it cannot
+ *         be read.
+ */
+static int count_vmas()
+{
+    FILE *f = fopen("/proc/self/maps", "r");
+    int c, num_vmas = 0;
+    if (!f) return 0;
+    while ((c = fgetc(f)) != EOF)
+    {
+        if (c == '\n') num_vmas++;
+    }
+    fclose(f);
+    return num_vmas;
+}
+
+/**
+ * Measures the allocation, lookup and free rates of num_bufs
+ * live 2-block buffers, and the number of process mappings they
+ * take, with or without aperture mode.  Aperture mode is only
+ * available if the tiler driver supports it.
+ *
+ * @param num_bufs  Number of buffers
+ * @param fmt       Pixel format of the blocks
+ * @param aperture  Whether to use aperture mode
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int aperture_bench(int num_bufs, pixel_fmt_t fmt, int aperture)
+{
+    printf("%d live 2-block %s buffers (%s)\n", num_bufs,
+           fmt == PIXEL_FMT_PAGE ? "1D" : "2D",
+           aperture ? "aperture" : "per-buffer mmap");
+
+    MemAllocBlock blocks[2];
+    void **bufs;
+    uint64_t t;
+    int ix, num_allocs, res = 0;
+
+    if (aperture && MemMgr_SetApertureMode(1)) return TESTLIB_UNAVAILABLE;
+    int vmas = count_vmas();
+
+    ALLOCN(bufs, num_bufs);
+    if (NOT_P(bufs,!=,NULL)) { res = 1; goto DONE; }
+
+    t = now_us();
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        init_blocks(blocks, 2, fmt);
+        bufs[ix] = MemMgr_Alloc(blocks, 2);
+        if (NOT_P(bufs[ix],!=,NULL)) { res = 1; break; }
+    }
+    num_allocs = ix;
+    report("alloc", num_allocs, now_us() - t);
+    report_count("new mappings", num_allocs, count_vmas() - vmas);
+
+    /* look up every buffer: GetStride needs the registry entry */
+    bytes_t stride = 0;
+    t = now_us();
+    for (ix = 0; ix < num_allocs; ix++)
+    {
+        stride |= MemMgr_GetStride(bufs[ix]);
+    }
+    if (fmt != PIXEL_FMT_PAGE) res |= NOT_I(stride,!=,0);
+    report("lookup", num_allocs, now_us() - t);
+
+    t = now_us();
+    for (ix = 0; ix < num_allocs; ix++)
+    {
+        res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    report("free", num_allocs, now_us() - t);
+
+DONE:
+    FREE(bufs);
+    if (aperture) res |= NOT_I(MemMgr_SetApertureMode(0),==,0);
+    return res;
+}
+
+/* buffer handoff between a producer and a consumer thread */
+struct handoff {
+    void           *bufPtr;
+    int             num_handoffs;
+    int             use_fence;
+    /* condition variable handoff */
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             written, read;
+};
+
+/* consumer: waits for each write, and acknowledges it with a read */
+static void *handoff_consumer(void *arg)
+{
+    struct handoff *h = arg;
+    int ix, ret = 0;
+    for (ix = 1; !ret && ix <= h->num_handoffs; ix++)
+    {
+        if (h->use_fence)
+        {
+            ret = MemMgr_FenceWait(h->bufPtr, MEMMGR_FENCE_WRITE, ix, -1);
+            if (!ret) ret = MemMgr_FenceSignal(h->bufPtr, MEMMGR_FENCE_READ);
+        }
+        else
+        {
+            pthread_mutex_lock(&h->mutex);
+            while (h->written < ix) pthread_cond_wait(&h->cond, &h->mutex);
+            h->read = ix;
+            pthread_cond_broadcast(&h->cond);
+            pthread_mutex_unlock(&h->mutex);
+        }
+    }
+    return (void *)(intptr_t) ret;
+}
+
+/**
+ * Measures the round trip time of handing a buffer to another
+ * thread and back, using buffer fences or a condition variable.
+ *
+ * @param use_fence     Whether to use buffer fences
+ * @param num_handoffs  Number of round trips
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int fence_bench(int use_fence, int num_handoffs)
+{
+    printf("Buffer handoff round trips (%s)\n",
+           use_fence ? "fences" : "condition variable");
+
+    MemAllocBlock block;
+    struct handoff h;
+    pthread_t thread;
+    void *res;
+    int ix, ret = 0;
+
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_PAGE;
+    block.dim.len = PAGE_SIZE;
+    ZERO(h);
+    h.bufPtr = MemMgr_Alloc(&block, 1);
+    if (NOT_P(h.bufPtr,!=,NULL)) return 1;
+    h.num_handoffs = num_handoffs;
+    h.use_fence = use_fence;
+    pthread_mutex_init(&h.mutex, NULL);
+    pthread_cond_init(&h.cond, NULL);
+    if (NOT_I(pthread_create(&thread, NULL, handoff_consumer, &h),==,0))
+    {
+        ret = 1;
+        goto DONE;
+    }
+
+    uint64_t t = now_us();
+    for (ix = 1; !ret && ix <= num_handoffs; ix++)
+    {
+        if (use_fence)
+        {
+            ret = MemMgr_FenceSignal(h.bufPtr, MEMMGR_FENCE_WRITE);
+            if (!ret) ret = MemMgr_FenceWait(h.bufPtr, MEMMGR_FENCE_READ, ix, -1);
+        }
+        else
+        {
+            pthread_mutex_lock(&h.mutex);
+            h.written = ix;
+            pthread_cond_broadcast(&h.cond);
+            while (h.read < ix) pthread_cond_wait(&h.cond, &h.mutex);
+            pthread_mutex_unlock(&h.mutex);
+        }
+    }
+    report("round trip", ix - 1, now_us() - t);
+
+    ret |= NOT_I(pthread_join(thread, &res),==,0);
+    ret |= NOT_P(res,==,NULL);
+
+DONE:
+    pthread_cond_destroy(&h.cond);
+    pthread_mutex_destroy(&h.mutex);
+    ret |= NOT_I(MemMgr_Free(h.bufPtr),==,0);
+    return ret;
+}
+
+/**
+ * Measures the cache maintenance of handing a partially updated
+ * 1D buffer to a device.  Each iteration updates num_rows rows
+ * of a 16-bit width x height image spread over the buffer, and
+ * prepares the buffer for the device.  Without tracking the
+ * whole buffer is marked dirty, like cleaning all of it.  The
+ * bytes maintained are only counted with the tiler stub.
+ *
+ * @param width      Image width
+ * @param height     Image height
+ * @param num_rows   Rows updated per iteration
+ * @param tracked    Whether to mark only the updated rows dirty
+ * @param num_iters  Number of iterations
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int dirty_bench(pixels_t width, pixels_t height, int num_rows, int tracked,
+                int num_iters)
+{
+    printf("Sync %d*%d*16 1D buffer after updating %d rows (%s)\n",
+           width, height, num_rows, tracked ? "dirty rows" : "whole buffer");
+
+    MemAllocBlock block;
+    bytes_t stride = width * 2;
+    uint64_t t_sync = 0, t;
+    int ix, row, res = 0;
+
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_PAGE;
+    block.dim.len = stride * height;
+    uint8_t *bufPtr = MemMgr_Alloc(&block, 1);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+
+#ifdef STUB_TILER
+    TilerStubCacheStats st0, st;
+    TilerStub_GetCacheStats(&st0);
+#endif
+    for (ix = 0; !res && ix < num_iters; ix++)
+    {
+        for (row = 0; row < num_rows; row++)
+        {
+            uint8_t *p = bufPtr + (row * height / num_rows) * stride;
+            memset(p, ix, stride);
+            if (tracked) res |= MemMgr_MarkDirty(p, stride);
+        }
+        if (!tracked) res |= MemMgr_MarkDirty(bufPtr, block.dim.len);
+
+        t = now_us();
+        res |= NOT_I(MemMgr_SyncForDevice(bufPtr),==,0);
+        t_sync += now_us() - t;
+    }
+
+    report("sync", ix, t_sync);
+#ifdef STUB_TILER
+    TilerStub_GetCacheStats(&st);
+    report_count("bytes cleaned", ix, st.cleaned - st0.cleaned);
+    report_count("maintenance ops", ix, st.ops - st0.ops);
+#endif
+    res |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return res;
+}
+
+/**
+ * Measures demoting idle buffers and restoring them.  Buffers
+ * of a single block (see init_blocks) are filled with either a
+ * blocky image, or noise, demoted at once, and then restored one
+ * by one by pinning them.  Reports the slots reclaimed, the
+ * demotion and restore latencies, and the compression ratio.
+ *
+ * @param num_bufs   Number of buffers
+ * @param fmt        Pixel format of the buffers
+ * @param noise      Whether to fill the buffers with noise
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int demote_bench(int num_bufs, pixel_fmt_t fmt, int noise)
+{
+    printf("Demote and restore %d %s buffers (%s)\n", num_bufs,
+           fmt == PIXEL_FMT_PAGE ? "1D" : "2D", noise ? "noise" : "image");
+
+    MemAllocBlock block;
+    MemMgrDemoteStats st;
+    void *bufs[NUM_BUFS];
+    uint32_t sums[NUM_BUFS];
+    int ix, row, col, res = 0;
+
+    init_blocks(&block, 1, fmt);
+    int rows = fmt == PIXEL_FMT_PAGE ? 1 : block.dim.area.height;
+    bytes_t width = fmt == PIXEL_FMT_PAGE ? block.dim.len :
+                    block.dim.area.width * (fmt == PIXEL_FMT_8BIT ? 1 :
+                                            fmt == PIXEL_FMT_16BIT ? 2 : 4);
+    srand(num_bufs);
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        init_blocks(&block, 1, fmt);
+        bufs[ix] = MemMgr_Alloc(&block, 1);
+        if (NOT_P(bufs[ix],!=,NULL)) break;
+        MemMgr_SetDemotable(bufs[ix], true);
+        bytes_t stride = fmt == PIXEL_FMT_PAGE ? width : block.stride;
+        for (sums[ix] = row = 0; row < rows; row++)
+        {
+            uint8_t *p = (uint8_t *) bufs[ix] + row * stride;
+            for (col = 0; col < (int) width; col++)
+            {
+                p[col] = noise ? rand() : ((col / 16 + row / 16 + ix) & 0xff);
+                sums[ix] = sums[ix] * 31 + p[col];
+            }
+        }
+    }
+    if (ix < num_bufs) res = 1;
+
+    MemMgr_GetDemoteStats(&st, true);
+    res |= NOT_I(MemMgr_DemoteIdle(0),==,ix);
+    MemMgr_GetDemoteStats(&st, true);
+    report("demote", st.demoted, st.demote_us);
+    report_count("slots reclaimed", st.demoted, st.slots);
+    printf("compression ratio: %.2f (%llu -> %llu bytes)\n",
+           st.compressed ? (double) st.bytes / st.compressed : 0.,
+           (unsigned long long) st.bytes, (unsigned long long) st.compressed);
+
+    while (ix--)
+    {
+        res |= NOT_I(MemMgr_Pin(bufs[ix]),==,0);
+        bytes_t stride = fmt == PIXEL_FMT_PAGE ? width :
+                         MemMgr_GetStride(bufs[ix]);
+        uint32_t sum = 0;
+        for (row = 0; row < rows; row++)
+        {
+            uint8_t *p = (uint8_t *) bufs[ix] + row * stride;
+            for (col = 0; col < (int) width; col++) sum = sum * 31 + p[col];
+        }
+        res |= NOT_I(sum,==,sums[ix]);
+        res |= NOT_I(MemMgr_Unpin(bufs[ix]),==,0);
+        res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    MemMgr_GetDemoteStats(&st, true);
+    report("restore", st.restored, st.restore_us);
+    return res;
+}
+
+#ifdef STUB_TILER
+/* tenants of the partitioning benchmark */
+#define DISPLAY_BUFS 6
+#define CODEC_BUFS   96
+
+struct tenant {
+    const char *name;
+    int   part;                 /* partition, or 0 for the shared one */
+    int   max_bufs;
+    int   num_bufs;
+    void *bufs[CODEC_BUFS];
+    int   allocs, fails, frag_fails;
+};
+
+/**
+ * Allocates a buffer for a tenant of the partitioning benchmark,
+ * and counts the failures.  A failure is due to fragmentation if
+ * the partition had enough free slots or pages for the block.
+ *
+ * @param t      Pointer to the tenant
+ * @param block  Block specification
+ *
+ * @return 0 (failures are part of the measurement)
+ */
+static int tenant_alloc(struct tenant *t, MemAllocBlock *block)
+{
+    TilerStubPartStats st;
+    uint32_t need;
+
+    TilerStub_UsePartition(t->part);
+    void *bufPtr = MemMgr_Alloc(block, 1);
+    TilerStub_UsePartition(0);
+    t->allocs++;
+    if (bufPtr)
+    {
+        t->bufs[t->num_bufs++] = bufPtr;
+        return 0;
+    }
+
+    t->fails++;
+    TilerStub_GetPartitionStats(t->part, &st);
+    if (block->pixelFormat == PIXEL_FMT_PAGE)
+    {
+        need = (block->dim.len + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (need <= st.free_pages) t->frag_fails++;
+    }
+    else
+    {
+        uint32_t sw = block->pixelFormat == PIXEL_FMT_32BIT ? 32 : 64;
+        uint32_t sh = block->pixelFormat == PIXEL_FMT_8BIT ? 64 : 32;
+        need = ((block->dim.area.width + sw - 1) / sw) *
+               ((block->dim.area.height + sh - 1) / sh);
+        if (need <= st.free_slots) t->frag_fails++;
+    }
+    return 0;
+}
+
+static void tenant_report(struct tenant *t)
+{
+    printf("%s: %d allocs, %d failed (%d with enough free space)\n",
+           t->name, t->allocs, t->fails, t->frag_fails);
+}
+#endif
+
+/**
+ * Measures container fragmentation under a randomized workload
+ * of two tenants.  The display tenant keeps a few 1280x720 8-bit
+ * frames, while the codec tenant churns 2D blocks of random
+ * format and size, and 1D blocks of random length.  At each step
+ * a tenant either allocates or frees a random buffer.  Without
+ * partitions both tenants share the container.  With partitions
+ * the display tenant gets a band of 36 slot rows, and the codec
+ * tenant the rest of the container and the page-mode area.
+ * Reports the failed allocations of each tenant, and how many of
+ * them failed despite enough free space.  Only available with
+ * the tiler stub.
+ *
+ * @param partitioned  Whether to partition the container
+ * @param num_steps    Number of steps
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int partition_bench(int partitioned, int num_steps)
+{
+    printf("Mixed-tenant fragmentation (%s)\n",
+           partitioned ? "partitioned" : "shared");
+#ifdef STUB_TILER
+    struct tenant display = { "display", 0, DISPLAY_BUFS };
+    struct tenant codec = { "codec", 0, CODEC_BUFS };
+    MemAllocBlock block;
+    int ix, res = 0;
+
+    if (partitioned)
+    {
+        display.part = TilerStub_CreatePartition("display", 0, 36, 0, 0);
+        codec.part = TilerStub_CreatePartition("codec", 36, TILER_HEIGHT - 36,
+                                               0, TILER_LENGTH / PAGE_SIZE);
+        if (NOT_I(display.part,>,0) || NOT_I(codec.part,>,0)) res = 1;
+    }
+
+    srand(partitioned + 1);
+    for (ix = 0; !res && ix < num_steps; ix++)
+    {
+        struct tenant *t = rand() % 4 ? &codec : &display;
+        if (t->num_bufs && (t->num_bufs == t->max_bufs || !(rand() % 3)))
+        {
+            int jx = rand() % t->num_bufs;
+            res |= NOT_I(MemMgr_Free(t->bufs[jx]),==,0);
+            t->bufs[jx] = t->bufs[--t->num_bufs];
+            continue;
+        }
+
+        ZERO(block);
+        if (t == &display)
+        {
+            block.pixelFormat = PIXEL_FMT_8BIT;
+            block.dim.area.width = 1920;
+            block.dim.area.height = 1080;
+        }
+        else if (rand() % 3)
+        {
+            block.pixelFormat = PIXEL_FMT_8BIT + rand() % 3;
+            block.dim.area.width = 64 + rand() % 1920;
+            block.dim.area.height = 32 + rand() % 1088;
+        }
+        else
+        {
+            block.pixelFormat = PIXEL_FMT_PAGE;
+            block.dim.len = (1 + rand() % 256) * PAGE_SIZE;
+        }
+        res |= tenant_alloc(t, &block);
+    }
+
+    tenant_report(&display);
+    tenant_report(&codec);
+    while (display.num_bufs)
+    {
+        res |= NOT_I(MemMgr_Free(display.bufs[--display.num_bufs]),==,0);
+    }
+    while (codec.num_bufs)
+    {
+        res |= NOT_I(MemMgr_Free(codec.bufs[--codec.num_bufs]),==,0);
+    }
+    if (display.part > 0) TilerStub_DeletePartition(display.part);
+    if (codec.part > 0) TilerStub_DeletePartition(codec.part);
+    return res;
+#else
+    return TESTLIB_UNAVAILABLE;
+#endif
+}
+
+/* results of a lease benchmark process */
+struct lease_result {
+    uint64_t time_us;
+    uint32_t round_trips;
+    uint32_t denied;
+    int res;
+};
+
+/**
+ * Runs the workload of a lease benchmark process: keeps up to 16
+ * buffers of 1 to 16 pages, and allocates or frees one at each
+ * step.
+ *
+ * @param sock       Socket path of the arbitration service, or
+ *                   NULL to run without lease mode
+ * @param chunk      Lease chunk
+ * @param num_steps  Number of steps
+ * @param r          Pointer to store the results
+ */
+static void lease_worker(const char *sock, uint32_t chunk, int num_steps,
+                         struct lease_result *r)
+{
+    MemMgrLeaseStats ls;
+    void *bufs[16];
+    int ix, num_bufs = 0;
+
+    ZERO(*r);
+    if (sock && NOT_I(MemMgr_LeaseConnect(sock, MEMMGR_LEASE_NORMAL,
+                                          chunk),==,0))
+    {
+        r->res = 1;
+        return;
+    }
+
+    srand(getpid());
+    uint64_t t0 = now_us();
+    for (ix = 0; ix < num_steps; ix++)
+    {
+        if (num_bufs && (num_bufs == 16 || rand() % 2))
+        {
+            int jx = rand() % num_bufs;
+            r->res |= NOT_I(MemMgr_Free(bufs[jx]),==,0);
+            bufs[jx] = bufs[--num_bufs];
+        }
+        else
+        {
+            MemAllocBlock block;
+            ZERO(block);
+            block.pixelFormat = PIXEL_FMT_PAGE;
+            block.dim.len = (1 + rand() % 16) * PAGE_SIZE;
+            bufs[num_bufs] = MemMgr_Alloc(&block, 1);
+            if (bufs[num_bufs]) num_bufs++;
+        }
+    }
+    while (num_bufs)
+    {
+        r->res |= NOT_I(MemMgr_Free(bufs[--num_bufs]),==,0);
+    }
+    r->time_us = now_us() - t0;
+
+    if (sock)
+    {
+        MemMgr_GetLeaseStats(&ls);
+        r->round_trips = ls.round_trips;
+        r->denied = ls.denied;
+        r->res |= NOT_I(MemMgr_LeaseDisconnect(),==,0);
+    }
+}
+
+/**
+ * Measures the overhead of lease mode.  Runs num_procs processes
+ * that allocate and free 1D buffers in parallel, each leasing
+ * capacity from a shared arbitration service in chunks of chunk
+ * pages.  Reports the alloc/free time and the round trips to the
+ * service per operation.  The service is run from $TILER_ARBD,
+ * or ./tiler_arbd.
+ *
+ * @param num_procs  Number of processes
+ * @param chunk      Lease chunk, or 0 to run without lease mode
+ * @param num_steps  Number of alloc or free steps per process
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int lease_bench(int num_procs, uint32_t chunk, int num_steps)
+{
+    if (chunk)
+        printf("Alloc/free of 1D buffers in %d processes (lease chunk %u)\n",
+               num_procs, chunk);
+    else
+        printf("Alloc/free of 1D buffers in %d processes (no lease)\n",
+               num_procs);
+    struct lease_result r, total;
+    const char *path = getenv("TILER_ARBD");
+    char sock[64];
+    pid_t arbd = 0, pids[MAX_PROCS];
+    int ix, fds[2], res = 0;
+
+    if (NOT_I(num_procs,<=,MAX_PROCS)) return 1;
+    sprintf(sock, "/tmp/tiler_arb_bench.%d", getpid());
+    if (chunk)
+    {
+        if (!path) path = "./tiler_arbd";
+        if (access(path, X_OK)) return TESTLIB_UNAVAILABLE;
+        arbd = fork();
+        if (!arbd)
+        {
+            execl(path, path, "-s", sock, NULL);
+            _exit(127);
+        }
+        for (ix = 0; arbd > 0 && access(sock, F_OK) && ix < 100; ix++)
+        {
+            usleep(10000);
+        }
+        if (NOT_I(arbd,>,0) || NOT_I(access(sock, F_OK),==,0)) res = 1;
+    }
+    if (res || NOT_I(pipe(fds),==,0)) goto DONE;
+
+    /* do not duplicate buffered output in the processes */
+    fflush(stdout);
+    for (ix = 0; ix < num_procs; ix++)
+    {
+        pids[ix] = fork();
+        if (!pids[ix])
+        {
+            lease_worker(chunk ? sock : NULL, chunk, num_steps, &r);
+            _exit(write(fds[1], &r, sizeof(r)) != sizeof(r));
+        }
+        res |= NOT_I(pids[ix],>,0);
+    }
+    close(fds[1]);
+
+    ZERO(total);
+    for (ix = 0; ix < num_procs; ix++)
+    {
+        if (NOT_I(read(fds[0], &r, sizeof(r)),==,sizeof(r)))
+        {
+            res = 1;
+            break;
+        }
+        total.time_us += r.time_us;
+        total.round_trips += r.round_trips;
+        total.denied += r.denied;
+        total.res |= r.res;
+    }
+    close(fds[0]);
+    for (ix = 0; ix < num_procs; ix++)
+    {
+        if (pids[ix] > 0) waitpid(pids[ix], NULL, 0);
+    }
+
+    report("alloc/free (per process)", num_procs * num_steps, total.time_us);
+    if (chunk)
+    {
+        report_count("round trips", num_procs * num_steps, total.round_trips);
+        report_count("denied", num_procs * num_steps, total.denied);
+    }
+    res |= total.res;
+
+DONE:
+    if (arbd > 0)
+    {
+        kill(arbd, SIGTERM);
+        waitpid(arbd, NULL, 0);
+    }
+    return res;
+}
+
+/* number of recent slots that an access stream can touch again
+   without a new page touch, like a small DMM micro-TLB */
+#define TOUCH_SLOTS 4
+
+/* DMM page (slot) touches of an access stream to an 8-bit buffer */
+struct slot_touches {
+    uint32_t slots[TOUCH_SLOTS];    /* recent slots, most recent first */
+    uint64_t count;
+};
+
+/**
+ * Counts a pixel access to an 8-bit 2D buffer as a page touch
+ * if it is not in one of the TOUCH_SLOTS most recently accessed
+ * slots of the stream.
+ *
+ * @param t   Pointer to the touches of the stream, or NULL if
+ *            not counting
+ * @param x   Column of the pixel
+ * @param y   Row of the pixel
+ */
+static __inline__ void touch(struct slot_touches *t, uint32_t x, uint32_t y)
+{
+    if (t)
+    {
+        uint32_t slot = (y / TILER_SLOT_HEIGHT(PIXEL_FMT_8BIT)) << 16 |
+                        x / TILER_SLOT_WIDTH(PIXEL_FMT_8BIT);
+        int ix;
+        for (ix = 0; ix < TOUCH_SLOTS - 1 && t->slots[ix] != slot; ix++);
+        if (t->slots[ix] != slot) t->count++;
+        for (; ix; ix--)
+        {
+            t->slots[ix] = t->slots[ix - 1];
+        }
+        t->slots[0] = slot;
+    }
+}
+
+/**
+ * Returns the 3x3 box filtered value of a pixel of an 8-bit
+ * buffer.  Pixels outside the buffer are clamped to the edge.
+ */
+static __inline__ uint8_t box3(const uint8_t *src, uint32_t stride,
+                               uint32_t width, uint32_t height,
+                               uint32_t x, uint32_t y, struct slot_touches *t)
+{
+    uint32_t x0 = x ? x - 1 : x, x1 = x + 1 < width ? x + 1 : x;
+    uint32_t y0 = y ? y - 1 : y, y1 = y + 1 < height ? y + 1 : y;
+    uint32_t sum = 0, xx, yy;
+    for (yy = y0; yy <= y1; yy++)
+    {
+        for (xx = x0; xx <= x1; xx++)
+        {
+            touch(t, xx, yy);
+            sum += src[yy * stride + xx];
+        }
+    }
+    return sum / ((x1 - x0 + 1) * (y1 - y0 + 1));
+}
+
+/**
+ * Box filters an 8-bit buffer into another in raster or slot
+ * order.
+ *
+ * @param src     Source buffer
+ * @param dst     Destination buffer
+ * @param stride  Stride of both buffers
+ * @param width   Width of the buffers
+ * @param height  Height of the buffers
+ * @param tiled   Whether to traverse in slot order
+ * @param ts      Source touches, or NULL if not counting
+ * @param td      Destination touches, or NULL if not counting
+ */
+static void box_filter(uint8_t *src, uint8_t *dst, uint32_t stride,
+                       uint32_t width, uint32_t height, int tiled,
+                       struct slot_touches *ts, struct slot_touches *td)
+{
+    TilerTileIter it;
+    uint32_t x, y;
+
+    if (tiled)
+    {
+        TILER_FOR_EACH_TILE(it, dst, stride, width, height, PIXEL_FMT_8BIT)
+        {
+            uint32_t x1 = it.x + it.width, y1 = it.y + it.height;
+            for (y = it.y; y < y1; y++)
+            {
+                for (x = it.x; x < x1; x++)
+                {
+                    touch(td, x, y);
+                    dst[y * stride + x] = box3(src, stride, width, height,
+                                               x, y, ts);
+                }
+            }
+        }
+        return;
+    }
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            touch(td, x, y);
+            dst[y * stride + x] = box3(src, stride, width, height, x, y, ts);
+        }
+    }
+}
+
+/**
+ * Transposes an 8-bit buffer into another in raster or slot
+ * order.  The destination is height x width.
+ *
+ * @param src        Source buffer
+ * @param dst        Destination buffer
+ * @param stride     Stride of both buffers
+ * @param width      Width of the source buffer
+ * @param height     Height of the source buffer
+ * @param tiled      Whether to traverse in slot order
+ * @param ts         Source touches, or NULL if not counting
+ * @param td         Destination touches, or NULL if not
+ *                   counting
+ */
+static void transpose(uint8_t *src, uint8_t *dst, uint32_t stride,
+                      uint32_t width, uint32_t height, int tiled,
+                      struct slot_touches *ts, struct slot_touches *td)
+{
+    TilerTileIter it;
+    uint32_t x, y;
+
+    if (tiled)
+    {
+        TILER_FOR_EACH_TILE(it, src, stride, width, height, PIXEL_FMT_8BIT)
+        {
+            uint32_t x1 = it.x + it.width, y1 = it.y + it.height;
+            for (y = it.y; y < y1; y++)
+            {
+                for (x = it.x; x < x1; x++)
+                {
+                    touch(ts, x, y);
+                    touch(td, y, x);
+                    dst[x * stride + y] = src[y * stride + x];
+                }
+            }
+        }
+        return;
+    }
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            touch(ts, x, y);
+            touch(td, y, x);
+            dst[x * stride + y] = src[y * stride + x];
+        }
+    }
+}
+
+/**
+ * Runs a kernel over a pair of 8-bit 2D buffers.  Counts the
+ * DMM page touches of the source and destination accesses (see
+ * touch), and times the kernel.
+ *
+ * @param what       Name of the kernel
+ * @param kernel     Kernel
+ * @param width      Width of the source buffer
+ * @param height     Height of the source buffer
+ * @param transpose  Whether the destination is transposed
+ * @param tiled      Whether to traverse in slot order
+ * @param num_scans  Number of runs to time
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+static int kernel_bench(const char *what,
+                        void (*kernel)(uint8_t *, uint8_t *, uint32_t,
+                                       uint32_t, uint32_t, int,
+                                       struct slot_touches *,
+                                       struct slot_touches *),
+                        pixels_t width, pixels_t height, int transposed,
+                        int tiled, int num_scans)
+{
+    struct slot_touches ts, td;
+    MemAllocBlock src, dst;
+    uint32_t ix;
+    int res = 0;
+
+    ZERO(src);
+    src.pixelFormat = PIXEL_FMT_8BIT;
+    src.dim.area.width = width;
+    src.dim.area.height = height;
+    dst = src;
+    if (transposed)
+    {
+        dst.dim.area.width = height;
+        dst.dim.area.height = width;
+    }
+    uint8_t *srcPtr = MemMgr_Alloc(&src, 1);
+    uint8_t *dstPtr = MemMgr_Alloc(&dst, 1);
+    if (NOT_P(srcPtr,!=,NULL) || NOT_P(dstPtr,!=,NULL))
+    {
+        res = 1;
+        goto DONE;
+    }
+    bytes_t stride = MemMgr_GetStride(srcPtr);
+    if (NOT_I(MemMgr_GetStride(dstPtr),==,stride))
+    {
+        res = 1;
+        goto DONE;
+    }
+    for (ix = 0; ix < height; ix++)
+    {
+        memset(srcPtr + ix * stride, ix, width);
+    }
+
+    /* count touches */
+    memset(&ts, ~0, sizeof(ts.slots));
+    memset(&td, ~0, sizeof(td.slots));
+    ts.count = td.count = 0;
+    kernel(srcPtr, dstPtr, stride, width, height, tiled, &ts, &td);
+
+    /* time the kernel */
+    uint64_t t = now_us();
+    for (ix = 0; ix < (uint32_t) num_scans; ix++)
+    {
+        kernel(srcPtr, dstPtr, stride, width, height, tiled, NULL, NULL);
+    }
+    t = now_us() - t;
+
+    report(what, num_scans, t);
+    printf("throughput: %.1f Mpixel/s\n",
+           t ? (double) width * height * num_scans / t : 0.);
+    report_count("source page touches", num_scans ? 1 : 0, ts.count);
+    report_count("destination page touches", num_scans ? 1 : 0, td.count);
+
+DONE:
+    if (srcPtr) res |= NOT_I(MemMgr_Free(srcPtr),==,0);
+    if (dstPtr) res |= NOT_I(MemMgr_Free(dstPtr),==,0);
+    return res;
+}
+
+/**
+ * Measures a 3x3 box filter of an 8-bit buffer in raster and in
+ * slot order (see tilermem_iter.h).  Prints the DMM page touches
+ * of one pass and the throughput.
+ *
+ * @param width      Width of the buffer
+ * @param height     Height of the buffer
+ * @param tiled      Whether to traverse in slot order
+ * @param num_scans  Number of passes to time
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int box_bench(pixels_t width, pixels_t height, int tiled, int num_scans)
+{
+    printf("3x3 box filter of %dx%d 8-bit buffer in %s order\n", width,
+           height, tiled ? "slot" : "raster");
+    return kernel_bench("box filter", box_filter, width, height, 0, tiled,
+                        num_scans);
+}
+
+/**
+ * Measures transposing an 8-bit buffer in raster and in slot
+ * order (see tilermem_iter.h).  Prints the DMM page touches of
+ * one pass and the throughput.
+ *
+ * @param width      Width of the buffer
+ * @param height     Height of the buffer
+ * @param tiled      Whether to traverse in slot order
+ * @param num_scans  Number of passes to time
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int transpose_bench(pixels_t width, pixels_t height, int tiled, int num_scans)
+{
+    printf("Transpose of %dx%d 8-bit buffer in %s order\n", width, height,
+           tiled ? "slot" : "raster");
+    return kernel_bench("transpose", transpose, width, height, 1, tiled,
+                        num_scans);
+}
+
+/* a parallel box filter job */
+struct par_box {
+    uint8_t *src, *dst;
+    bytes_t  stride;
+    pixels_t width, height;
+};
+
+/* box filters a tile of the destination */
+static void par_box_tile(void *arg, void *ptr, bytes_t stride, pixels_t x,
+                         pixels_t y, pixels_t width, pixels_t height)
+{
+    struct par_box *b = (struct par_box *) arg;
+    uint32_t ix, iy;
+    for (iy = y; iy < (uint32_t) y + height; iy++)
+    {
+        uint8_t *row = (uint8_t *) ptr + (iy - y) * stride;
+        for (ix = x; ix < (uint32_t) x + width; ix++)
+        {
+            row[ix - x] = box3(b->src, b->stride, b->width, b->height, ix, iy,
+                               NULL);
+        }
+    }
+}
+
+/**
+ * Measures the scaling of MemMgr_ParallelFor2D.  Runs a 3x3 box
+ * filter of an 8-bit buffer on 1 thread, and on twice as many
+ * threads each step up to the number of online CPUs (at least
+ * 4).  Prints the time per pass, the speedup over 1 thread and
+ * the tile ranges stolen per pass.
+ *
+ * @param width      Width of the buffer
+ * @param height     Height of the buffer
+ * @param num_scans  Number of passes to time for each thread
+ *                   count
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int parallel_bench(pixels_t width, pixels_t height, int num_scans)
+{
+    printf("Parallel 3x3 box filter of %dx%d 8-bit buffer\n", width, height);
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    MemMgrParallelStats st;
+    MemAllocBlock src, dst;
+    struct par_box b;
+    uint64_t t1 = 0;
+    int ix, num_workers, res = 0;
+
+    ZERO(src);
+    src.pixelFormat = PIXEL_FMT_8BIT;
+    src.dim.area.width = width;
+    src.dim.area.height = height;
+    dst = src;
+    ZERO(b);
+    b.width = width;
+    b.height = height;
+    b.src = MemMgr_Alloc(&src, 1);
+    b.dst = MemMgr_Alloc(&dst, 1);
+    if (NOT_P(b.src,!=,NULL) || NOT_P(b.dst,!=,NULL))
+    {
+        res = 1;
+        goto DONE;
+    }
+    b.stride = MemMgr_GetStride(b.src);
+    for (ix = 0; ix < height; ix++)
+    {
+        memset(b.src + ix * b.stride, ix, width);
+    }
+
+    printf("(%ld online CPUs)\n", num_cpus);
+    for (num_workers = 1; !res && (num_workers <= num_cpus || num_workers <= 4);
+         num_workers *= 2)
+    {
+        res |= NOT_I(MemMgr_SetParallelism(num_workers),==,0);
+
+        /* warm up: start the threads and fault in the buffers */
+        res |= NOT_I(MemMgr_ParallelFor2D(b.dst, 0, 0, par_box_tile, &b),==,0);
+
+        uint64_t t = now_us();
+        for (ix = 0; !res && ix < num_scans; ix++)
+        {
+            res |= NOT_I(MemMgr_ParallelFor2D(b.dst, 0, 0, par_box_tile, &b),
+                         ==,0);
+        }
+        t = now_us() - t;
+        if (num_workers == 1) t1 = t;
+
+        MemMgr_GetParallelStats(&st);
+        printf("%d threads: %.1f us/pass, speedup %.2f, %.1f steals/pass\n",
+               num_workers, (double) t / num_scans,
+               t ? (double) t1 / t : 0., (double) st.steals / (num_scans + 1));
+    }
+    res |= NOT_I(MemMgr_SetParallelism(0),==,0);
+
+DONE:
+    if (b.src) res |= NOT_I(MemMgr_Free(b.src),==,0);
+    if (b.dst) res |= NOT_I(MemMgr_Free(b.dst),==,0);
+    return res;
+}
+
+/**
+ * Measures verifying an 8-bit 2D buffer against golden contents,
+ * by comparing its digest with the golden digest, and by
+ * comparing it with a packed golden copy row by row.  Prints the
+ * time per frame and the throughput of both.
+ *
+ * @param width        Width of the buffer
+ * @param height       Height of the buffer
+ * @param num_workers  Number of digest threads, or 0 for the
+ *                     number of online CPUs
+ * @param num_iters    Number of verifications to time
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int digest_bench(pixels_t width, pixels_t height, int num_workers,
+                 int num_iters)
+{
+    printf("Verify %dx%d 8-bit buffer (%d digest threads)\n", width, height,
+           num_workers ? num_workers : (int) sysconf(_SC_NPROCESSORS_ONLN));
+    MemAllocBlock block;
+    uint32_t golden;
+    uint64_t t;
+    int ix, iy, res = 0;
+
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_8BIT;
+    block.dim.area.width = width;
+    block.dim.area.height = height;
+    uint8_t *bufPtr = MemMgr_Alloc(&block, 1);
+    uint8_t *copy = malloc((size_t) width * height);
+    if (NOT_P(bufPtr,!=,NULL) || NOT_P(copy,!=,NULL))
+    {
+        res = 1;
+        goto DONE;
+    }
+    bytes_t stride = MemMgr_GetStride(bufPtr);
+    for (iy = 0; iy < height; iy++)
+    {
+        for (ix = 0; ix < width; ix++)
+        {
+            bufPtr[iy * stride + ix] = copy[iy * width + ix] = rand();
+        }
+    }
+    golden = MemMgr_DigestPlane(copy, width, height, width);
+    res |= NOT_I(MemMgr_SetParallelism(num_workers),==,0);
+
+    t = now_us();
+    for (ix = 0; !res && ix < num_iters; ix++)
+    {
+        res |= NOT_I(MemMgr_DigestPlane(bufPtr, width, height, stride),==,
+                     golden);
+    }
+    t = now_us() - t;
+    report("digest", num_iters, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) width * height * num_iters / t : 0.);
+
+    t = now_us();
+    for (ix = 0; !res && ix < num_iters; ix++)
+    {
+        for (iy = 0; iy < height; iy++)
+        {
+            res |= NOT_I(memcmp(bufPtr + iy * stride, copy + iy * width,
+                                width),==,0);
+        }
+    }
+    t = now_us() - t;
+    report("compare with golden copy", num_iters, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) width * height * num_iters / t : 0.);
+    res |= NOT_I(MemMgr_SetParallelism(0),==,0);
+
+DONE:
+    FREE(copy);
+    if (bufPtr) res |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return res;
+}
+
+#ifdef STUB_TILER
+/* client instances of the restart benchmark */
+#define RESTART_COLD 0      /* allocates and fills its buffers */
+#define RESTART_KEEP 1      /* same, then keeps them and exits */
+#define RESTART_HOT  2      /* attaches to the kept buffers */
+
+struct restart_result {
+    uint64_t time_us;
+    int      res;
+};
+
+/**
+ * Runs an instance of the client of the restart benchmark in
+ * a new process.  The client gets num_bufs NV12 frame buffers,
+ * and checks the first frame.  Except for RESTART_KEEP, it
+ * frees its buffers before exiting.
+ *
+ * @param sock      Socket path of the keeper, or NULL
+ * @param num_bufs  Number of buffers
+ * @param width     Frame width
+ * @param height    Frame height
+ * @param mode      RESTART_COLD, RESTART_KEEP or RESTART_HOT
+ * @param time_us   Pointer to store the time from the start of
+ *                  the client until its first frame
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+static int restart_run(const char *sock, int num_bufs, pixels_t width,
+                       pixels_t height, int mode, uint64_t *time_us)
+{
+    struct restart_result r;
+    int fds[2];
+
+    if (NOT_I(pipe(fds),==,0)) return 1;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        MemAllocBlock blocks[2];
+        void **bufs = NEWN(void *, num_bufs);
+        int ix, num;
+
+        ZERO(r);
+        uint64_t t0 = now_us();
+        r.res = NOT_P(bufs,!=,NULL) ||
+                (sock && NOT_I(MemMgr_KeeperConnect(sock),==,0));
+        for (ix = 0; !r.res && ix < num_bufs; ix++)
+        {
+            if (mode == RESTART_HOT)
+            {
+                num = 2;
+                bufs[ix] = MemMgr_Attach(ix + 1, blocks, &num);
+                if (NOT_P(bufs[ix],!=,NULL)) r.res = 1;
+                continue;
+            }
+
+            ZERO(blocks);
+            blocks[0].pixelFormat = PIXEL_FMT_8BIT;
+            blocks[0].dim.area.width = width;
+            blocks[0].dim.area.height = height;
+            blocks[1].pixelFormat = PIXEL_FMT_16BIT;
+            blocks[1].dim.area.width = width / 2;
+            blocks[1].dim.area.height = height / 2;
+            bufs[ix] = MemMgr_Alloc(blocks, 2);
+            if (NOT_P(bufs[ix],!=,NULL))
+            {
+                r.res = 1;
+                break;
+            }
+            memset(bufs[ix], ix, blocks[0].stride * height +
+                                 blocks[1].stride * height / 2);
+            if (mode == RESTART_KEEP)
+                r.res = NOT_I(MemMgr_Keep(bufs[ix], ix + 1),==,0);
+        }
+        if (!r.res) r.res = NOT_I(*(uint8_t *) bufs[0],==,0);
+        r.time_us = now_us() - t0;
+
+        /* the kept buffers outlive the process */
+        while (mode != RESTART_KEEP && ix)
+        {
+            r.res |= NOT_I(MemMgr_Free(bufs[--ix]),==,0);
+        }
+        _exit(write(fds[1], &r, sizeof(r)) != sizeof(r));
+    }
+    close(fds[1]);
+    if (NOT_I(pid,>,0) ||
+        NOT_I(read(fds[0], &r, sizeof(r)),==,sizeof(r))) r.res = 1;
+    close(fds[0]);
+    if (pid > 0) waitpid(pid, NULL, 0);
+    *time_us = r.time_us;
+    return r.res;
+}
+#endif
+
+/**
+ * Measures the time from the start of a client to its first
+ * frame, when the client needs num_bufs NV12 frame buffers.  On
+ * a cold start the client allocates and clears the buffers.
+ * With the buffer keeper, a previous instance of the client
+ * kept its buffers, and the restarted client attaches to them.
+ * The keeper is run from $TILER_KEEPD, or ./tiler_keepd.
+ *
+ * @param num_bufs  Number of buffers
+ * @param width     Frame width
+ * @param height    Frame height
+ * @param kept      Whether to restart with kept buffers
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int restart_bench(int num_bufs, pixels_t width, pixels_t height, int kept)
+{
+    printf("Start with %d %dx%d NV12 buffers (%s)\n", num_bufs, width,
+           height, kept ? "restart with kept buffers" : "cold start");
+#ifdef STUB_TILER
+    const char *path = getenv("TILER_KEEPD");
+    char sock[64];
+    pid_t keepd;
+    uint64_t t;
+    int ix, res = 0;
+
+    if (!kept)
+    {
+        res = restart_run(NULL, num_bufs, width, height, RESTART_COLD, &t);
+        report("start to first frame", num_bufs, t);
+        return res;
+    }
+
+    sprintf(sock, "/tmp/tiler_keep_bench.%d", getpid());
+    if (!path) path = "./tiler_keepd";
+    if (access(path, X_OK)) return TESTLIB_UNAVAILABLE;
+    keepd = fork();
+    if (!keepd)
+    {
+        execl(path, path, "-s", sock, NULL);
+        _exit(127);
+    }
+    for (ix = 0; keepd > 0 && access(sock, F_OK) && ix < 100; ix++)
+    {
+        usleep(10000);
+    }
+    if (NOT_I(keepd,>,0) || NOT_I(access(sock, F_OK),==,0)) res = 1;
+
+    if (!res)
+    {
+        res = restart_run(sock, num_bufs, width, height, RESTART_KEEP, &t);
+        report("start and keep buffers", num_bufs, t);
+    }
+    if (!res)
+    {
+        res = restart_run(sock, num_bufs, width, height, RESTART_HOT, &t);
+        report("restart to first frame", num_bufs, t);
+    }
+
+    if (keepd > 0)
+    {
+        kill(keepd, SIGTERM);
+        waitpid(keepd, NULL, 0);
+    }
+    return res;
+#else
+    return TESTLIB_UNAVAILABLE;
+#endif
+}
+
+#ifdef STUB_TILER
+#define DMA_LIST_LEN 64     /* descriptors per list */
+#define DMA_TILES    30     /* 2D tiles per band of a 1920 wide buffer */
+
+/* waits for completed DMA lists, and returns their number */
+static int dma_reap(int efd)
+{
+    struct pollfd pfd = { efd, POLLIN, 0 };
+    uint64_t n;
+    if (poll(&pfd, 1, 5000) != 1 || read(efd, &n, sizeof(n)) != sizeof(n))
+        return -1;
+    return (int) n;
+}
+
+/* offsets of the ix-th region of a DMA benchmark in the system space and
+   in the mapping of a buffer */
+static void dma_region(int ix, bytes_t desc_len, int two_d, bytes_t stride,
+                       uint32_t *ss_offs, bytes_t *offs)
+{
+    if (two_d)
+    {
+        uint32_t x = ix % DMA_TILES * 64, y = ix / DMA_TILES * (desc_len / 64);
+        *ss_offs = y * TILER_STRIDE_8BIT + x;
+        *offs = y * stride + x;
+    }
+    else
+    {
+        *ss_offs = *offs = ix * desc_len;
+    }
+}
+#endif
+
+/**
+ * Measures the descriptor throughput and the completion latency
+ * of the DMA engine of the stub, and compares them with the
+ * CPU doing the same copies.  Lists of DMA_LIST_LEN descriptors
+ * copy between two buffers.  For throughput, as many lists are
+ * kept in flight as the engine takes.  For latency, lists of a
+ * single descriptor are submitted one at a time, and waited for
+ * on the eventfd.
+ *
+ * @param num_workers  Number of DMA worker threads
+ * @param desc_len     Bytes copied by a descriptor
+ * @param two_d        Whether to copy 64 byte wide 2D tiles
+ *                     between 1920x1080 8-bit buffers, instead
+ *                     of 1D ranges between 1D buffers
+ * @param num_lists    Number of lists to time
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int dma_bench(int num_workers, bytes_t desc_len, int two_d, int num_lists)
+{
+    printf("DMA %s descriptors of %d bytes (%d workers)\n",
+           two_d ? "2D copy" : "1D copy", desc_len, num_workers);
+#ifdef STUB_TILER
+    TilerStubDmaDesc descs[DMA_LIST_LEN];
+    TilerStubDmaStats st;
+    MemAllocBlock blocks[2];
+    uint8_t *bufs[2];
+    uint32_t ss_offs;
+    bytes_t offs;
+    uint64_t t;
+    int ix, n, submitted, done, res = 0;
+
+    ZERO(blocks);
+    for (ix = 0; ix < 2; ix++)
+    {
+        if (two_d)
+        {
+            blocks[ix].pixelFormat = PIXEL_FMT_8BIT;
+            blocks[ix].dim.area.width = 1920;
+            blocks[ix].dim.area.height = 1080;
+        }
+        else
+        {
+            blocks[ix].pixelFormat = PIXEL_FMT_PAGE;
+            blocks[ix].dim.len = DMA_LIST_LEN * desc_len;
+        }
+        bufs[ix] = MemMgr_Alloc(blocks + ix, 1);
+    }
+    TilerStubDma *dma = TilerStub_DmaCreate(num_workers);
+    if (NOT_P(bufs[0],!=,NULL) || NOT_P(bufs[1],!=,NULL) ||
+        NOT_P(dma,!=,NULL))
+    {
+        res = 1;
+        goto DONE;
+    }
+    int efd = TilerStub_DmaGetFd(dma);
+    bytes_t stride = blocks[0].stride;
+    uint32_t src = TilerMem_VirtToPhys(bufs[0]);
+    uint32_t dst = TilerMem_VirtToPhys(bufs[1]);
+
+    memset(descs, 0, sizeof(descs));
+    for (ix = 0; ix < DMA_LIST_LEN; ix++)
+    {
+        dma_region(ix, desc_len, two_d, stride, &ss_offs, &offs);
+        memset(bufs[0] + offs, ix + 1, two_d ? 64 : desc_len);
+        descs[ix].op = two_d ? TILER_STUB_DMA_COPY_2D : TILER_STUB_DMA_COPY;
+        descs[ix].src = src + ss_offs;
+        descs[ix].dst = dst + ss_offs;
+        descs[ix].width = two_d ? 64 : desc_len;
+        descs[ix].height = two_d ? desc_len / 64 : 1;
+        descs[ix].src_stride = descs[ix].dst_stride = TILER_STRIDE_8BIT;
+    }
+
+    /* throughput: keep the engine busy */
+    t = now_us();
+    for (submitted = done = 0; !res && done < num_lists; done += n)
+    {
+        while (submitted < num_lists &&
+               TilerStub_DmaSubmit(dma, descs, DMA_LIST_LEN) > 0)
+        {
+            submitted++;
+        }
+        n = dma_reap(efd);
+        res |= NOT_I(n,>,0);
+    }
+    t = now_us() - t;
+    report("descriptor", num_lists * DMA_LIST_LEN, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) desc_len * DMA_LIST_LEN * num_lists / t : 0.);
+    dma_region(DMA_LIST_LEN - 1, desc_len, two_d, stride, &ss_offs, &offs);
+    res |= NOT_I(bufs[1][offs],==,DMA_LIST_LEN);
+
+    /* latency: one descriptor in flight */
+    t = now_us();
+    for (ix = 0; !res && ix < num_lists; ix++)
+    {
+        res |= NOT_I(TilerStub_DmaSubmit(dma, descs + ix % DMA_LIST_LEN, 1),
+                     >,0);
+        res |= NOT_I(dma_reap(efd),==,1);
+    }
+    t = now_us() - t;
+    report("completion latency", num_lists, t);
+    TilerStub_DmaGetStats(dma, &st);
+    res |= NOT_I(st.faults,==,0);
+
+    /* reference: the CPU doing the same copies */
+    t = now_us();
+    for (n = 0; n < num_lists; n++)
+    {
+        for (ix = 0; ix < DMA_LIST_LEN; ix++)
+        {
+            dma_region(ix, desc_len, two_d, stride, &ss_offs, &offs);
+            if (two_d)
+            {
+                bytes_t row;
+                for (row = 0; row < desc_len / 64; row++)
+                    memcpy(bufs[1] + offs + row * stride,
+                           bufs[0] + offs + row * stride, 64);
+            }
+            else
+            {
+                memcpy(bufs[1] + offs, bufs[0] + offs, desc_len);
+            }
+        }
+    }
+    t = now_us() - t;
+    report("CPU copy", num_lists * DMA_LIST_LEN, t);
+
+DONE:
+    TilerStub_DmaDestroy(dma);
+    for (ix = 0; ix < 2; ix++)
+    {
+        if (bufs[ix]) res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    return res;
+#else
+    return TESTLIB_UNAVAILABLE;
+#endif
+}
+
+/* buffers of the lock benchmark */
+struct lock_job {
+    void   *bufs[NUM_BUFS];
+    bytes_t strides[NUM_BUFS];
+    int     num_iters;
+};
+
+/* queries the strides of the buffers of the lock benchmark */
+static void *lock_query(void *arg)
+{
+    struct lock_job *job = arg;
+    int ix, ret = 0;
+
+    for (ix = 0; !ret && ix < job->num_iters; ix++)
+    {
+        ret = MemMgr_GetStride(job->bufs[ix % NUM_BUFS]) !=
+              job->strides[ix % NUM_BUFS];
+    }
+    return (void *)(intptr_t) ret;
+}
+
+/**
+ * Measures the cost of lock statistics, and prints the lock
+ * contention of concurrent buffer queries.  Each thread queries
+ * the strides of NUM_BUFS 1D and 2D buffers.  (Allocations are
+ * not run concurrently, as their consistency check assumes a
+ * single thread.)
+ *
+ * @param num_threads  Number of threads
+ * @param enabled      Whether lock statistics are enabled
+ * @param num_iters    Number of queries per thread
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int lock_bench(int num_threads, int enabled, int num_iters)
+{
+    printf("Query buffers on %d threads (lock statistics %s)\n",
+           num_threads, enabled ? "enabled" : "disabled");
+    MemMgrLockStats stats[64];
+    pthread_t threads[MAX_PROCS];
+    MemAllocBlock block;
+    struct lock_job job;
+    void *res;
+    int ix, num, ret = 0;
+
+    if (NOT_I(num_threads,<=,MAX_PROCS)) return 1;
+    ZERO(job);
+    job.num_iters = num_iters;
+    for (ix = 0; ix < NUM_BUFS; ix++)
+    {
+        ZERO(block);
+        block.pixelFormat = ix & 1 ? PIXEL_FMT_8BIT : PIXEL_FMT_PAGE;
+        if (ix & 1)
+        {
+            block.dim.area.width = 176;
+            block.dim.area.height = 144;
+        }
+        else
+        {
+            block.dim.len = PAGE_SIZE;
+        }
+        job.bufs[ix] = MemMgr_Alloc(&block, 1);
+        job.strides[ix] = MemMgr_GetStride(job.bufs[ix]);
+        if (NOT_P(job.bufs[ix],!=,NULL))
+        {
+            ret = 1;
+            goto DONE;
+        }
+    }
+
+    bool prev = MemMgr_SetLockStats(enabled);
+    MemMgr_ResetLockStats();
+    uint64_t t = now_us();
+    for (ix = 0; ix < num_threads; ix++)
+    {
+        if (NOT_I(pthread_create(threads + ix, NULL, lock_query, &job),
+                  ==,0)) break;
+    }
+    while (ix--)
+    {
+        ret |= NOT_I(pthread_join(threads[ix], &res),==,0);
+        ret |= NOT_P(res,==,NULL);
+    }
+    t = now_us() - t;
+    MemMgr_SetLockStats(prev);
+    report("query", num_threads * num_iters, t);
+
+    num = MemMgr_GetLockStats(stats, 64);
+    for (ix = 0; ix < num && ix < 64; ix++)
+    {
+        MemMgrLockStats *st = stats + ix;
+        if (st->func || !st->acquisitions) continue;
+        printf("%s: %llu acquisitions, %.2f%% contended, wait %.3f us, "
+               "hold %.3f us\n", st->lock,
+               (unsigned long long) st->acquisitions,
+               100. * st->contended / st->acquisitions,
+               (double) st->wait_ns / st->acquisitions / 1000,
+               (double) st->hold_ns / st->acquisitions / 1000);
+    }
+
+DONE:
+    for (ix = 0; ix < NUM_BUFS; ix++)
+    {
+        if (job.bufs[ix]) ret |= NOT_I(MemMgr_Free(job.bufs[ix]),==,0);
+    }
+    return ret;
+}
+
+/* frame metadata of the user data benchmark */
+struct frame_meta {
+    uint64_t timestamp;
+    uint32_t frame_id;
+    uint32_t colorspace;
+    uint16_t crop[4];
+};
+
+/* client-side maps, as clients keep next to the allocator: open
+   addressing keyed by buffer pointer, with a lock of their own */
+#define META_MAP_SIZE 1024
+
+struct meta_map {
+    pthread_mutex_t   mutex;
+    void             *keys[META_MAP_SIZE];
+    struct frame_meta vals[META_MAP_SIZE];
+};
+
+/* finds (or adds) the slot of a buffer in the keys of a map.  Must be
+   called with the map mutex held.  Returns -1 if not found. */
+static int map_slot(void *keys[], void *ptr, int add)
+{
+    uint32_t ix = (uint32_t) (((uintptr_t) ptr >> 12) * 0x9E3779B1u) >> 22;
+    for (; keys[ix] != ptr; ix = (ix + 1) & (META_MAP_SIZE - 1))
+    {
+        if (!keys[ix])
+        {
+            if (!add) return -1;
+            keys[ix] = ptr;
+            break;
+        }
+    }
+    return ix;
+}
+
+/* finds (or adds) the metadata of a buffer */
+static struct frame_meta *meta_find(struct meta_map *m, void *ptr, int add)
+{
+    int ix = map_slot(m->keys, ptr, add);
+    return ix < 0 ? NULL : m->vals + ix;
+}
+
+/**
+ * Measures retrieving per-frame metadata: from a client-side
+ * map keyed by buffer pointer, and from the allocator's registry
+ * (MemMgr_GetUserData).  The registry is a list unless in
+ * aperture mode.
+ *
+ * @param num_bufs   Number of 1D buffers (at most
+ *                   META_MAP_SIZE / 2)
+ * @param aperture   Whether to use aperture mode
+ * @param num_iters  Number of passes over the buffers
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int user_data_bench(int num_bufs, int aperture, int num_iters)
+{
+    printf("Frame metadata of %d buffers (%s)\n", num_bufs,
+           aperture ? "aperture" : "per-buffer mmap");
+    struct frame_meta meta, *mp;
+    struct meta_map *map = NULL;
+    MemAllocBlock block;
+    void **bufs = NULL;
+    uint64_t t, sum = 0;
+    int ix, iter, res = 0;
+
+    if (NOT_I(num_bufs,<=,META_MAP_SIZE / 2)) return 1;
+    if (aperture && MemMgr_SetApertureMode(1)) return TESTLIB_UNAVAILABLE;
+    ALLOCN(bufs, num_bufs);
+    ALLOC(map);
+    if (NOT_P(bufs,!=,NULL) || NOT_P(map,!=,NULL))
+    {
+        res = 1;
+        goto DONE;
+    }
+    pthread_mutex_init(&map->mutex, NULL);
+
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        ZERO(block);
+        block.pixelFormat = PIXEL_FMT_PAGE;
+        block.dim.len = PAGE_SIZE;
+        bufs[ix] = MemMgr_Alloc(&block, 1);
+        if (NOT_P(bufs[ix],!=,NULL))
+        {
+            res = 1;
+            goto DONE;
+        }
+        ZERO(meta);
+        meta.timestamp = ix * 33333;
+        meta.frame_id = ix;
+        *meta_find(map, bufs[ix], 1) = meta;
+        res |= NOT_I(MemMgr_SetUserData(bufs[ix], 0, &meta, sizeof(meta)),
+                     ==,0);
+    }
+
+    t = now_us();
+    for (iter = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < num_bufs; ix++)
+        {
+            pthread_mutex_lock(&map->mutex);
+            mp = meta_find(map, bufs[ix], 0);
+            if (mp) meta = *mp;
+            pthread_mutex_unlock(&map->mutex);
+            sum += mp ? meta.frame_id : ~0;
+        }
+    }
+    report("client map lookup", num_iters * num_bufs, now_us() - t);
+
+    t = now_us();
+    for (iter = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < num_bufs; ix++)
+        {
+            res |= MemMgr_GetUserData(bufs[ix], 0, &meta, sizeof(meta));
+            sum -= meta.frame_id;
+        }
+    }
+    report("registry lookup", num_iters * num_bufs, now_us() - t);
+    res |= NOT_L(sum,==,0);
+
+DONE:
+    for (ix = 0; bufs && ix < num_bufs && bufs[ix]; ix++)
+    {
+        res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    if (map) pthread_mutex_destroy(&map->mutex);
+    FREE(map);
+    FREE(bufs);
+    if (aperture) res |= NOT_I(MemMgr_SetApertureMode(0),==,0);
+    return res;
+}
+
+/* client-side reference table of the shared ownership benchmark */
+struct ref_map {
+    pthread_mutex_t mutex;
+    void           *keys[META_MAP_SIZE];
+    int             refs[META_MAP_SIZE];
+};
+
+/* buffers of the shared ownership benchmark */
+struct ref_job {
+    void           *bufs[NUM_BUFS];
+    struct ref_map *map;                /* client table, or NULL */
+    int             num_iters;
+};
+
+/* hands out and drops references to the buffers of the shared
+   ownership benchmark, as a frame fanned out to several consumers */
+static void *ref_hand(void *arg)
+{
+    struct ref_job *job = arg;
+    struct ref_map *m = job->map;
+    int ix, slot, ret = 0;
+
+    for (ix = 0; !ret && ix < job->num_iters; ix++)
+    {
+        void *bufPtr = job->bufs[ix % NUM_BUFS];
+        if (!m)
+        {
+            ret = MemMgr_Ref(bufPtr) || MemMgr_Unref(bufPtr);
+            continue;
+        }
+        pthread_mutex_lock(&m->mutex);
+        slot = map_slot(m->keys, bufPtr, 0);
+        if (slot >= 0) m->refs[slot]++;
+        pthread_mutex_unlock(&m->mutex);
+
+        pthread_mutex_lock(&m->mutex);
+        slot = map_slot(m->keys, bufPtr, 0);
+        ret = slot < 0 || --m->refs[slot] <= 0;
+        pthread_mutex_unlock(&m->mutex);
+    }
+    return (void *)(intptr_t) ret;
+}
+
+/**
+ * Measures taking and dropping a reference to a buffer on
+ * concurrent threads: with MemMgr_Ref/MemMgr_Unref, and with a
+ * client-side reference table keyed by buffer pointer.  Each
+ * buffer is finally released by its last reference.
+ *
+ * @param num_threads  Number of threads
+ * @param external     Whether to use the client-side table
+ * @param num_iters    Number of reference pairs per thread
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int ref_bench(int num_threads, int external, int num_iters)
+{
+    printf("Reference buffers on %d threads (%s)\n", num_threads,
+           external ? "client table" : "MemMgr_Ref");
+    pthread_t threads[MAX_PROCS];
+    MemAllocBlock block;
+    struct ref_job job;
+    void *res;
+    int ix, slot, ret = 0;
+
+    if (NOT_I(num_threads,<=,MAX_PROCS)) return 1;
+    ZERO(job);
+    job.num_iters = num_iters;
+    if (external)
+    {
+        ALLOC(job.map);
+        if (NOT_P(job.map,!=,NULL)) return 1;
+        pthread_mutex_init(&job.map->mutex, NULL);
+    }
+    for (ix = 0; ix < NUM_BUFS; ix++)
+    {
+        ZERO(block);
+        block.pixelFormat = PIXEL_FMT_PAGE;
+        block.dim.len = PAGE_SIZE;
+        job.bufs[ix] = MemMgr_Alloc(&block, 1);
+        if (NOT_P(job.bufs[ix],!=,NULL))
+        {
+            ret = 1;
+            goto DONE;
+        }
+        if (external)
+        {
+            job.map->refs[map_slot(job.map->keys, job.bufs[ix], 1)] = 1;
+        }
+    }
+
+    uint64_t t = now_us();
+    for (ix = 0; ix < num_threads; ix++)
+    {
+        if (NOT_I(pthread_create(threads + ix, NULL, ref_hand, &job),
+                  ==,0)) break;
+    }
+    while (ix--)
+    {
+        ret |= NOT_I(pthread_join(threads[ix], &res),==,0);
+        ret |= NOT_P(res,==,NULL);
+    }
+    report("ref+unref", num_threads * num_iters, now_us() - t);
+
+DONE:
+    for (ix = 0; ix < NUM_BUFS && job.bufs[ix]; ix++)
+    {
+        if (!external)
+        {
+            ret |= NOT_I(MemMgr_Unref(job.bufs[ix]),==,0);
+            continue;
+        }
+        slot = map_slot(job.map->keys, job.bufs[ix], 0);
+        ret |= NOT_I(job.map->refs[slot],==,1);
+        ret |= NOT_I(MemMgr_Free(job.bufs[ix]),==,0);
+    }
+    if (job.map) pthread_mutex_destroy(&job.map->mutex);
+    FREE(job.map);
+    return ret;
+}
+
+/**
+ * Measures CPU writes and reads of an NV12 buffer allocated for
+ * a usage.  Writes of 1D (cacheable) layouts include marking
+ * the planes dirty and syncing them for the device.
+ *
+ * @param usage      Usage bits
+ * @param width      Width of the buffer
+ * @param height     Height of the buffer
+ * @param num_iters  Number of passes over the buffer
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int usage_bench(uint32_t usage, pixels_t width, pixels_t height,
+                int num_iters)
+{
+    MemAllocBlock blocks[2];
+    MemMgrLayout lay;
+    uint64_t t, sum = 0;
+    int ix, iy, iter, res = 0;
+
+    printf("CPU access of %dx%d NV12 buffer for usage 0x%x\n", width,
+           height, usage);
+    ZERO(blocks);
+    blocks[0].pixelFormat = PIXEL_FMT_8BIT;
+    blocks[0].dim.area.width  = width;
+    blocks[0].dim.area.height = height;
+    blocks[1].pixelFormat = PIXEL_FMT_16BIT;
+    blocks[1].dim.area.width  = width / 2;
+    blocks[1].dim.area.height = height / 2;
+    void *bufPtr = MemMgr_AllocUsage(blocks, 2, usage);
+    if (NOT_P(bufPtr,!=,NULL) ||
+        NOT_I(MemMgr_GetLayout(bufPtr, &lay),==,0))
+    {
+        if (bufPtr) MemMgr_Free(bufPtr);
+        return 1;
+    }
+    bool linear = lay.layout[0] == MEMMGR_LAYOUT_1D;
+    printf("layout: %s, stride %u\n", linear ? "1D" : "2D", lay.stride[0]);
+
+    t = now_us();
+    for (iter = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < 2; ix++)
+        {
+            for (iy = 0; iy < (height >> ix); iy++)
+            {
+                memset(blocks[ix].ptr + iy * lay.stride[ix], iter, width);
+            }
+            if (linear)
+            {
+                res |= MemMgr_MarkDirty(blocks[ix].ptr,
+                                        lay.stride[ix] * (height >> ix));
+            }
+        }
+        if (linear) res |= MemMgr_SyncForDevice(bufPtr);
+    }
+    t = now_us() - t;
+    report("write", num_iters, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) width * height * 3 / 2 * num_iters / t : 0.);
+
+    t = now_us();
+    for (iter = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < 2; ix++)
+        {
+            for (iy = 0; iy < (height >> ix); iy++)
+            {
+                uint32_t *row = blocks[ix].ptr + iy * lay.stride[ix];
+                int iw;
+                for (iw = 0; iw < width / 4; iw++)
+                {
+                    sum += row[iw];
+                }
+            }
+        }
+    }
+    t = now_us() - t;
+    report("read", num_iters, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) width * height * 3 / 2 * num_iters / t : 0.);
+
+    /* the last pass wrote num_iters - 1 everywhere */
+    res |= NOT_L(sum,==,(uint64_t) (num_iters - 1) * 0x01010101 *
+                 (width / 4) * height * 3 / 2 * num_iters);
+    res |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return res;
+}
+
+/**
+ * Measures the per-query cost of the inline queries on the
+ * registry view against the functions of memmgr.h, for
+ * pointers within 1D and 2D buffers.
+ *
+ * @param num_bufs   Number of buffers (at most NUM_BUFS)
+ * @param num_iters  Number of passes over the buffers
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int view_bench(int num_bufs, int num_iters)
+{
+    printf("Query %d buffers through the registry view\n", num_bufs);
+    const MemMgrView *view = MemMgr_GetView();
+    MemAllocBlock block;
+    void *bufs[NUM_BUFS], *ptrs[NUM_BUFS];
+    bytes_t strides[NUM_BUFS];
+    uint64_t t;
+    int ix, iter, num, res = 0;
+
+    if (NOT_I(num_bufs,<=,NUM_BUFS)) return 1;
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        ZERO(block);
+        block.pixelFormat = ix & 1 ? PIXEL_FMT_8BIT : PIXEL_FMT_PAGE;
+        if (ix & 1)
+        {
+            block.dim.area.width = 176;
+            block.dim.area.height = 144;
+        }
+        else
+        {
+            block.dim.len = 4 * PAGE_SIZE;
+        }
+        bufs[ix] = MemMgr_Alloc(&block, 1);
+        if (NOT_P(bufs[ix],!=,NULL))
+        {
+            num_bufs = ix;
+            res = 1;
+            goto DONE;
+        }
+        /* query an interior pointer */
+        ptrs[ix] = bufs[ix] + (ix & 1 ? 100 * block.stride + 50 :
+                                        2 * PAGE_SIZE + 50);
+        strides[ix] = MemMgr_GetStride(ptrs[ix]);
+    }
+
+    t = now_us();
+    for (iter = num = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < num_bufs; ix++)
+        {
+            num += MemMgr_GetStride(ptrs[ix]) != strides[ix];
+        }
+    }
+    report("MemMgr_GetStride", num_iters * num_bufs, now_us() - t);
+    res |= NOT_I(num,==,0);
+
+    t = now_us();
+    for (iter = num = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < num_bufs; ix++)
+        {
+            num += MemMgrView_GetStride(view, ptrs[ix]) != strides[ix];
+        }
+    }
+    report("MemMgrView_GetStride", num_iters * num_bufs, now_us() - t);
+    res |= NOT_I(num,==,0);
+
+    t = now_us();
+    for (iter = num = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < num_bufs; ix++)
+        {
+            num += !MemMgr_IsMapped(ptrs[ix]);
+        }
+    }
+    report("MemMgr_IsMapped", num_iters * num_bufs, now_us() - t);
+    res |= NOT_I(num,==,0);
+
+    t = now_us();
+    for (iter = num = 0; iter < num_iters; iter++)
+    {
+        for (ix = 0; ix < num_bufs; ix++)
+        {
+            num += !MemMgrView_IsMapped(view, ptrs[ix]);
+        }
+    }
+    report("MemMgrView_IsMapped", num_iters * num_bufs, now_us() - t);
+    res |= NOT_I(num,==,0);
+
+DONE:
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    return res;
+}
+
+/* sums the 32-bit words of a unit read from a ring */
+static uint32_t ring_sum(const void *ptr, uint32_t len)
+{
+    const uint32_t *p = ptr;
+    uint32_t sum = 0;
+    for (len /= 4; len--; ) sum += *p++;
+    return sum;
+}
+
+/**
+ * Measures passing a stream through a ring: written in chunks
+ * of in_len bytes, and parsed in units of out_len bytes.  The
+ * double-mapped ring of MemMgr_AllocRing() is written and
+ * parsed in place; the copying ring splits writes at the wrap
+ * point, and copies units across it into a scratch buffer
+ * before parsing them.
+ *
+ * @param copying    Whether to use a copying ring
+ * @param len        Length of the ring
+ * @param in_len     Size of the written chunks (multiple of 4)
+ * @param out_len    Size of the parsed units (multiple of 4)
+ * @param num_iters  Number of times the stream fills the ring
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int ring_bench(int copying, bytes_t len, uint32_t in_len, uint32_t out_len,
+               int num_iters)
+{
+    printf("Stream %d-byte chunks as %d-byte units through a %s ring\n",
+           in_len, out_len, copying ? "copying" : "double-mapped");
+    uint32_t ix, avail, first, off, sum = 0, expected = 0;
+    uint32_t num_chunks = (uint64_t) len * num_iters / in_len;
+    uint64_t produced = 0, consumed = 0, total;
+    uint8_t *src = NULL, *scratch = NULL;
+    MemMgrRing ring;
+    int res = 0;
+
+    char *bufPtr = copying ? malloc(len) : MemMgr_AllocRing(len);
+    ALLOCN(src, in_len);
+    ALLOCN(scratch, out_len);
+    if (NOT_P(bufPtr,!=,NULL) || NOT_P(src,!=,NULL) ||
+        NOT_P(scratch,!=,NULL) || NOT_I(out_len,<=,len))
+    {
+        res = 1;
+        goto DONE;
+    }
+    for (ix = 0; ix < in_len; ix++) src[ix] = rand();
+    expected = ring_sum(src, in_len) * num_chunks;
+    total = (uint64_t) in_len * num_chunks;
+    MemMgrRing_Init(&ring, bufPtr, len);
+
+    uint64_t t = now_us();
+    while (consumed < total)
+    {
+        char *w = MemMgrRing_WritePtr(&ring, &avail);
+        while (produced < total && avail >= in_len)
+        {
+            off = w - bufPtr;
+            first = copying && off + in_len > len ? len - off : in_len;
+            memcpy(w, src, first);
+            if (first < in_len) memcpy(bufPtr, src + first, in_len - first);
+            MemMgrRing_Produce(&ring, in_len);
+            produced += in_len;
+            w = MemMgrRing_WritePtr(&ring, &avail);
+        }
+
+        const char *r = MemMgrRing_ReadPtr(&ring, &avail);
+        while (avail >= out_len || (produced == total && avail))
+        {
+            uint32_t num = avail < out_len ? avail : out_len;
+            off = r - bufPtr;
+            if (copying && off + num > len)
+            {
+                memcpy(scratch, r, len - off);
+                memcpy(scratch + len - off, bufPtr, num - (len - off));
+                sum += ring_sum(scratch, num);
+            }
+            else
+            {
+                sum += ring_sum(r, num);
+            }
+            MemMgrRing_Consume(&ring, num);
+            consumed += num;
+            r = MemMgrRing_ReadPtr(&ring, &avail);
+        }
+    }
+    t = now_us() - t;
+    report("stream", num_iters, t);
+    printf("throughput: %.1f MB/s\n", t ? (double) total / t : 0.);
+    res |= NOT_I(sum,==,expected);
+
+DONE:
+    if (copying) free(bufPtr);
+    else if (bufPtr) res |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    FREE(src);
+    FREE(scratch);
+    return res;
+}
+
+/**
+ * Measures assembling an access unit that is split across
+ * several 1D buffers into one contiguous range, and parsing it
+ * once.  The view of MemMgr_MapConcat() maps the buffers back
+ * to back, and is unmapped after parsing; the copy gathers them
+ * into a preallocated buffer.  Parsing is included, as the view
+ * takes its page faults on first access.
+ *
+ * @param copying    Whether to copy instead of mapping a view
+ * @param num_bufs   Number of buffers per unit
+ * @param len        Length of each buffer (multiple of the page
+ *                   size)
+ * @param num_iters  Number of units to assemble
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int concat_bench(int copying, int num_bufs, bytes_t len, int num_iters)
+{
+    printf("Assemble %d x %d-byte buffers by %s\n", num_bufs, len,
+           copying ? "copying" : "concatenated view");
+    MemAllocBlock block;
+    void **bufs = NULL;
+    char *copy = NULL;
+    uint32_t sum = 0, expected = 0;
+    int ix, iter, res = 0;
+
+    if (!copying && MemMgr_InApertureMode()) return TESTLIB_UNAVAILABLE;
+
+    ALLOCN(bufs, num_bufs);
+    if (NOT_P(bufs,!=,NULL)) return 1;
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        memset(&block, 0, sizeof(block));
+        block.pixelFormat = PIXEL_FMT_PAGE;
+        block.dim.len = len;
+        bufs[ix] = MemMgr_Alloc(&block, 1);
+        if (NOT_P(bufs[ix],!=,NULL)) res = 1;
+        else expected += ring_sum(memset(bufs[ix], ix + 1, len), len);
+    }
+    if (copying)
+    {
+        copy = malloc(num_bufs * len);
+        if (NOT_P(copy,!=,NULL)) res = 1;
+    }
+    if (res) goto DONE;
+
+    uint64_t t = now_us();
+    for (iter = 0; iter < num_iters && !res; iter++)
+    {
+        char *unit = copy;
+        if (copying)
+        {
+            for (ix = 0; ix < num_bufs; ix++)
+            {
+                memcpy(copy + ix * len, bufs[ix], len);
+            }
+        }
+        else
+        {
+            unit = MemMgr_MapConcat(bufs, num_bufs);
+            res |= NOT_P(unit,!=,NULL);
+        }
+        if (unit) sum = ring_sum(unit, num_bufs * len);
+        if (unit && !copying) res |= NOT_I(MemMgr_UnMapConcat(unit),==,0);
+        res |= NOT_I(sum,==,expected);
+    }
+    t = now_us() - t;
+    report("assemble", num_iters, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) num_bufs * len * num_iters / t : 0.);
+
+DONE:
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        if (bufs[ix]) res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    FREE(copy);
+    FREE(bufs);
+    return res;
+}
+
+/**
+ * Measures passing a file to a tiler consumer in windows, and
+ * parsing each window once.  Reading copies each window into
+ * a 1D buffer with pread(); streaming maps each window with
+ * MemMgr_StreamNext(), reading ahead by one window.  The file
+ * is in the page cache after the first pass, so only the
+ * mapping and copying costs show.
+ *
+ * @param mapped     Whether to stream instead of reading
+ * @param file_len   Length of the file
+ * @param window     Length of the windows (multiple of the page
+ *                   size)
+ * @param num_iters  Number of passes through the file
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int stream_bench(int mapped, bytes_t file_len, bytes_t window,
+                 int num_iters)
+{
+    printf("Pass a %d-byte file in %d-byte windows by %s\n", file_len,
+           window, mapped ? "streaming" : "reading");
+    MemAllocBlock block;
+    MemMgrStream stream;
+    uint32_t sum, expected = 0;
+    bytes_t len, offs;
+    char *data = NULL, *bufPtr = NULL, *ptr;
+    int ix, res = 0;
+
+    FILE *file = tmpfile();
+    if (NOT_P(file,!=,NULL)) return 1;
+    int fd = fileno(file);
+    ALLOCN(data, file_len);
+    if (NOT_P(data,!=,NULL))
+    {
+        res = 1;
+        goto DONE;
+    }
+    for (ix = 0; ix < file_len; ix++) data[ix] = rand();
+    expected = ring_sum(data, file_len);
+    if (NOT_I(write(fd, data, file_len),==,file_len))
+    {
+        res = 1;
+        goto DONE;
+    }
+    if (!mapped)
+    {
+        memset(&block, 0, sizeof(block));
+        block.pixelFormat = PIXEL_FMT_PAGE;
+        block.dim.len = window;
+        bufPtr = MemMgr_Alloc(&block, 1);
+        if (NOT_P(bufPtr,!=,NULL))
+        {
+            res = 1;
+            goto DONE;
+        }
+    }
+
+    uint64_t t = now_us();
+    for (ix = 0; ix < num_iters && !res; ix++)
+    {
+        sum = 0;
+        if (mapped)
+        {
+            res |= NOT_I(MemMgr_StreamOpen(&stream, fd, window, window),==,0);
+            while (!res && (ptr = MemMgr_StreamNext(&stream, &len)))
+            {
+                sum += ring_sum(ptr, len);
+            }
+            res |= NOT_I(MemMgr_StreamClose(&stream),==,0);
+        }
+        else
+        {
+            for (offs = 0; !res && offs < file_len; offs += len)
+            {
+                len = file_len - offs < window ? file_len - offs : window;
+                res |= NOT_I(pread(fd, bufPtr, len, offs),==,len);
+                sum += ring_sum(bufPtr, len);
+            }
+        }
+        res |= NOT_I(sum,==,expected);
+    }
+    t = now_us() - t;
+    report("pass", num_iters, t);
+    printf("throughput: %.1f MB/s\n",
+           t ? (double) file_len * num_iters / t : 0.);
+
+DONE:
+    if (bufPtr) res |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    FREE(data);
+    fclose(file);
+    return res;
+}
+
+/* buffers queried by registry_bench */
+struct registry_job {
+    int         num_bufs;
+    void       *ptrs[NUM_BUFS];     /* interior pointers */
+    bytes_t     strides[NUM_BUFS];
+    MemMgrBufInfo entries[NUM_BUFS];
+};
+
+/* looks up the strides of all buffers num_ops times */
+static int registry_lookup_op(void *arg, int num_ops)
+{
+    struct registry_job *job = arg;
+    int ix, num = 0;
+
+    while (num_ops--)
+    {
+        for (ix = 0; ix < job->num_bufs; ix++)
+        {
+            num += MemMgr_GetStride(job->ptrs[ix]) != job->strides[ix];
+        }
+    }
+    return NOT_I(num,==,0);
+}
+
+/* takes num_ops snapshots of the registry */
+static int registry_snapshot_op(void *arg, int num_ops)
+{
+    struct registry_job *job = arg;
+    while (num_ops--)
+    {
+        if (NOT_I(MemMgr_Snapshot(job->entries, NUM_BUFS, NULL),>=,
+                  job->num_bufs)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Measures registry queries with the benchmark harness: looking
+ * up the strides of num_bufs live 1D and 2D buffers by interior
+ * pointers, and taking snapshots of the registry.
+ *
+ * @param num_bufs   Number of buffers (at most NUM_BUFS)
+ * @param num_iters  Number of passes over the buffers, and of
+ *                   snapshots, per sample
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int registry_bench(int num_bufs, int num_iters)
+{
+    printf("Query the registry of %d buffers\n", num_bufs);
+    struct registry_job job;
+    MemAllocBlock block;
+    void *bufs[NUM_BUFS];
+    char name[64];
+    int ix, res = 0;
+
+    if (NOT_I(num_bufs,<=,NUM_BUFS)) return 1;
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        init_blocks(&block, 1, ix & 1 ? PIXEL_FMT_8BIT : PIXEL_FMT_PAGE);
+        bufs[ix] = MemMgr_Alloc(&block, 1);
+        if (NOT_P(bufs[ix],!=,NULL))
+        {
+            num_bufs = ix;
+            res = 1;
+            goto DONE;
+        }
+        job.ptrs[ix] = bufs[ix] + (ix & 1 ? 100 * block.stride + 50 :
+                                            2 * PAGE_SIZE + 50);
+        job.strides[ix] = MemMgr_GetStride(job.ptrs[ix]);
+    }
+    job.num_bufs = num_bufs;
+
+    sprintf(name, "registry lookup %d bufs", num_bufs);
+    res = BenchLib_Measure(name, registry_lookup_op, &job, num_iters, NULL);
+    sprintf(name, "registry snapshot %d bufs", num_bufs);
+    if (!res)
+    {
+        res = BenchLib_Measure(name, registry_snapshot_op, &job, num_iters,
+                               NULL);
+    }
+
+DONE:
+    for (ix = 0; ix < num_bufs; ix++)
+    {
+        res |= NOT_I(MemMgr_Free(bufs[ix]),==,0);
+    }
+    return res;
+}
+
+/* buffer filled and checked by fill_bench */
+struct fill_job {
+    uint8_t    *bufPtr;
+    bytes_t     stride;
+    bytes_t     width;      /* bytes per row */
+    pixels_t    height;
+    uint8_t     seed;
+};
+
+/* fills the buffer with a pattern and checks it, num_ops times */
+static int fill_op(void *arg, int num_ops)
+{
+    struct fill_job *job = arg;
+    bytes_t x;
+    pixels_t y;
+
+    while (num_ops--)
+    {
+        uint8_t seed = job->seed++;
+        for (y = 0; y < job->height; y++)
+        {
+            uint8_t *row = job->bufPtr + y * job->stride;
+            for (x = 0; x < job->width; x++) row[x] = seed + x + y;
+        }
+        for (y = 0; y < job->height; y++)
+        {
+            const uint8_t *row = job->bufPtr + y * job->stride;
+            for (x = 0; x < job->width; x++)
+            {
+                if (row[x] != (uint8_t)(seed + x + y))
+                    return NOT_I(row[x],==,(uint8_t)(seed + x + y));
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Measures filling a buffer with a pattern row by row and
+ * checking it with the benchmark harness, for an 8-bit 2D buffer
+ * and a 1D buffer of the same size.
+ *
+ * @param width      Width of the buffer in pixels
+ * @param height     Height of the buffer
+ * @param fmt        PIXEL_FMT_8BIT or PIXEL_FMT_PAGE
+ * @param num_iters  Number of fills per sample
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int fill_bench(pixels_t width, pixels_t height, pixel_fmt_t fmt,
+               int num_iters)
+{
+    const char *type = fmt == PIXEL_FMT_PAGE ? "1D" : "2D";
+    printf("Fill & Check a %ux%u %s buffer\n", width, height, type);
+    struct fill_job job;
+    MemAllocBlock block;
+    BenchLib_Result r;
+    char name[64];
+    int res;
+
+    ZERO(block);
+    block.pixelFormat = fmt;
+    if (fmt == PIXEL_FMT_PAGE)
+    {
+        block.dim.len = width * height;
+    }
+    else
+    {
+        block.dim.area.width = width;
+        block.dim.area.height = height;
+    }
+    job.bufPtr = MemMgr_Alloc(&block, 1);
+    if (NOT_P(job.bufPtr,!=,NULL)) return 1;
+    job.stride = fmt == PIXEL_FMT_PAGE ? width : block.stride;
+    job.width = width;
+    job.height = height;
+    job.seed = 0;
+
+    sprintf(name, "fill+check %ux%u %s", width, height, type);
+    res = BenchLib_Measure(name, fill_op, &job, num_iters, &r);
+    if (!res)
+    {
+        printf("throughput: %.1f MB/s\n",
+               r.median_us ? 2. * width * height / r.median_us : 0.);
+    }
+    res |= NOT_I(MemMgr_Free(job.bufPtr),==,0);
+    return res;
+}
+
+DEFINE_TESTS(TESTS)
+
+/**
+ * Main benchmark function. Checks arguments for benchmark
+ * ranges, runs benchmarks and prints usage or benchmark list if
+ * required.
+ *
+ * @param argc   Number of arguments
+ * @param argv   Arguments
+ *
+ * @return -1 on usage or benchmark list, otherwise # of failed
+ *         benchmarks.
+ */
+int main(int argc, char **argv)
+{
+    return TestLib_Run(argc, argv, nullfn, nullfn, NULL);
+}
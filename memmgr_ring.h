@@ -0,0 +1,162 @@
+/*
+ *  memmgr_ring.h
+ *
+ *  Producer/consumer helpers for double-mapped ring buffers.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MEMMGR_RING_H_
+#define _MEMMGR_RING_H_
+
+#include <stdint.h>
+#include "memmgr.h"
+
+/**
+ * Single-producer, single-consumer state of a ring allocated
+ * by MemMgr_AllocRing().  head and tail run from 0 to twice the
+ * length of the ring, so that a full ring can be told from an
+ * empty one.  As the ring is mapped twice, the data between
+ * tail and head, and the space after head, are contiguous in
+ * memory whatever their position.
+ * <p>
+ * A device writing or reading the ring sees one linear range
+ * starting at the system space address of the ring, so a
+ * transfer across the end must be split, at
+ * MemMgrRing_Offset() of the index.
+ */
+struct MemMgrRing {
+    char             *base;     /* first mapping of the ring */
+    uint32_t          len;      /* length of the ring */
+    volatile uint32_t head;     /* producer index */
+    volatile uint32_t tail;     /* consumer index */
+};
+
+typedef struct MemMgrRing MemMgrRing;
+
+/**
+ * Initializes the state of an empty ring.
+ *
+ * @param ring    Pointer to the ring state
+ * @param bufPtr  Pointer to the ring, as returned by
+ *                MemMgr_AllocRing()
+ * @param len     Length of the ring
+ */
+static __inline__ void MemMgrRing_Init(MemMgrRing *ring, void *bufPtr,
+                                       uint32_t len)
+{
+    ring->base = (char *) bufPtr;
+    ring->len = len;
+    ring->head = ring->tail = 0;
+}
+
+/**
+ * Returns the offset of an index within the ring.
+ *
+ * @param ring   Pointer to the ring state
+ * @param index  Producer or consumer index
+ *
+ * @return Offset from the start of the ring
+ */
+static __inline__ uint32_t MemMgrRing_Offset(const MemMgrRing *ring,
+                                             uint32_t index)
+{
+    return index >= ring->len ? index - ring->len : index;
+}
+
+/**
+ * Returns where the producer can write, and how much.
+ *
+ * @param ring   Pointer to the ring state
+ * @param avail  Pointer to store the number of free bytes at
+ *
+ * @return Pointer to the free space, which is contiguous for
+ *         avail bytes.
+ */
+static __inline__ void *MemMgrRing_WritePtr(MemMgrRing *ring,
+                                            uint32_t *avail)
+{
+    uint32_t head = ring->head, tail = ring->tail;
+    *avail = ring->len - (head >= tail ? head - tail :
+                          head + 2 * ring->len - tail);
+    return ring->base + MemMgrRing_Offset(ring, head);
+}
+
+/**
+ * Publishes data written by the producer.
+ *
+ * @param ring   Pointer to the ring state
+ * @param num    Number of bytes written.  Must not exceed the
+ *               free space.
+ */
+static __inline__ void MemMgrRing_Produce(MemMgrRing *ring, uint32_t num)
+{
+    uint32_t head = ring->head + num;
+    /* data must be visible before the index that covers it */
+    __sync_synchronize();
+    ring->head = head >= 2 * ring->len ? head - 2 * ring->len : head;
+}
+
+/**
+ * Returns where the consumer can read, and how much.
+ *
+ * @param ring   Pointer to the ring state
+ * @param avail  Pointer to store the number of bytes available
+ *               at
+ *
+ * @return Pointer to the data, which is contiguous for avail
+ *         bytes.
+ */
+static __inline__ const void *MemMgrRing_ReadPtr(MemMgrRing *ring,
+                                                 uint32_t *avail)
+{
+    uint32_t head = ring->head, tail = ring->tail;
+    *avail = head >= tail ? head - tail : head + 2 * ring->len - tail;
+    /* data must not be read before the index that covers it */
+    __sync_synchronize();
+    return ring->base + MemMgrRing_Offset(ring, tail);
+}
+
+/**
+ * Releases data read by the consumer.
+ *
+ * @param ring   Pointer to the ring state
+ * @param num    Number of bytes read.  Must not exceed the
+ *               bytes available.
+ */
+static __inline__ void MemMgrRing_Consume(MemMgrRing *ring, uint32_t num)
+{
+    uint32_t tail = ring->tail + num;
+    /* reads must be done before the space is handed back */
+    __sync_synchronize();
+    ring->tail = tail >= 2 * ring->len ? tail - 2 * ring->len : tail;
+}
+
+#endif
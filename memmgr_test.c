@@ -46,6 +46,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 
 #ifdef HAVE_CONFIG_H
     #include "config.h"
@@ -53,10 +60,17 @@
 #include <utils.h>
 #include <list_utils.h>
 #include <debug_utils.h>
+#include <crc_utils.h>
 #include <memmgr.h>
+#include <memmgr_view.h>
+#include <memmgr_ring.h>
 #include <tilermem.h>
 #include <tilermem_utils.h>
+#include <tilermem_iter.h>
 #include <testlib.h>
+#ifdef STUB_TILER
+    #include <tiler_stub.h>
+#endif
 
 #define FALSE 0
 #define TESTERR_NOTIMPLEMENTED -65378
@@ -110,6 +124,34 @@
     T(neg_map_tests())\
     T(neg_unmap_tests())\
     T(neg_check_tests())\
+    T(snapshot_test())\
+    T(pat_test())\
+    T(rotated_view_test(100, 60, PIXEL_FMT_8BIT))\
+    T(rotated_view_test(100, 60, PIXEL_FMT_32BIT))\
+    T(aperture_test())\
+    T(fence_test())\
+    T(dirty_test())\
+    T(demote_test())\
+    T(partition_test())\
+    T(lease_test())\
+    T(keeper_test())\
+    T(dma_test())\
+    T(tile_iter_test(130, 70, PIXEL_FMT_8BIT))\
+    T(tile_iter_test(64, 32, PIXEL_FMT_16BIT))\
+    T(tile_iter_test(97, 33, PIXEL_FMT_32BIT))\
+    T(parallel_test(1920, 1080, PIXEL_FMT_8BIT, 0, 0, 4))\
+    T(parallel_test(176, 144, PIXEL_FMT_16BIT, 100, 40, 3))\
+    T(parallel_test(97, 33, PIXEL_FMT_32BIT, 0, 0, 1))\
+    T(digest_test())\
+    T(lock_stats_test())\
+    T(user_data_test())\
+    T(ref_test())\
+    T(usage_test())\
+    T(view_test(0))\
+    T(view_test(1))\
+    T(ring_test())\
+    T(concat_test())\
+    T(stream_test())\
     T(page_size_test())\
     T(maxalloc_2D_test(2500, 32, PIXEL_FMT_8BIT, MAX_ALLOCS))\
     T(maxalloc_2D_test(2500, 16, PIXEL_FMT_16BIT, MAX_ALLOCS))\
@@ -201,6 +243,64 @@ static bytes_t def_bpp(pixel_fmt_t pixelFormat)
             pixelFormat == PIXEL_FMT_16BIT ? 2 : 1);
 }
 
+/* digests of the fill patterns of the blocks filled by fill_mem, so that
+   check_mem can compare digests instead of the contents */
+#define NUM_GOLDEN 1024
+
+struct golden {
+    void       *ptr;
+    uint16_t    start;
+    pixel_fmt_t fmt;
+    bytes_t     row_len, rows, stride;
+    uint32_t    digest;
+};
+
+static struct golden golden[NUM_GOLDEN];
+static pthread_mutex_t golden_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* returns the golden digest slot of a block */
+static struct golden *golden_slot(void *ptr)
+{
+    return golden + ((uintptr_t) ptr / PAGE_SIZE) % NUM_GOLDEN;
+}
+
+/**
+ * Returns the digest that MemMgr_DigestPlane gives for a block
+ * filled by fill_mem.  The fill pattern is generated row by row
+ * into a scratch row, so the digest depends only on the pattern,
+ * not on the block.  32-bit blocks are filled with the same
+ * series of 16-bit values as the others.
+ *
+ * @param start   start value
+ * @param width   row length in bytes
+ * @param rows    number of rows
+ *
+ * @return Digest of the pattern, or 0 if out of memory.
+ */
+static uint32_t pattern_digest(uint16_t start, bytes_t width, bytes_t rows)
+{
+    uint16_t *row = NULL, delta = 1, step = 1;
+    bytes_t n = (width + 1) / sizeof(uint16_t), i;
+    uint32_t crc = 0;
+
+    ALLOCN(row, n);
+    if (NOT_P(row,!=,NULL)) return 0;
+    while (rows--)
+    {
+        for (i = 0; i < n; i++)
+        {
+            row[i] = start;
+            start += delta;
+            delta += step;
+            /* increase step if overflown */
+            if (delta < step) delta = ++step;
+        }
+        crc = CRC32C_Update(crc, row, width);
+    }
+    FREE(row);
+    return crc;
+}
+
 /**
  * This method fills up a range of memory using a start address
  * and start value.  The method of filling ensures that
@@ -236,7 +336,8 @@ void fill_mem(uint16_t start, MemAllocBlock *block)
         stride = block->stride;
     }
     width *= def_bpp(block->pixelFormat);
-    bytes_t size = height * stride;
+    bytes_t size = height * stride, rows = height;
+    uint16_t start0 = start;
 
     P("(%p,0x%x*0x%x,s=0x%x)=0x%x", block->ptr, width, height, stride, start);
 
@@ -260,7 +361,7 @@ void fill_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && (height || ((PAGE_SIZE - 1) & (uint32_t)ptr32)))
+            while (i < stride && (height || ((PAGE_SIZE - 1) & (uintptr_t)ptr32)))
             {
                 *ptr32++ = 0;
                 i += sizeof(uint32_t);
@@ -280,7 +381,7 @@ void fill_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && (height || ((PAGE_SIZE - 1) & (uint32_t)ptr)))
+            while (i < stride && (height || ((PAGE_SIZE - 1) & (uintptr_t)ptr)))
             {
                 *ptr++ = 0;
                 i += sizeof(uint16_t);
@@ -293,6 +394,14 @@ void fill_mem(uint16_t start, MemAllocBlock *block)
     }
     CHK_P((block->pixelFormat == PIXEL_FMT_32BIT ? (void *)ptr32 : (void *)ptr),==,
           (block->ptr + size));
+
+    /* record the digest of the pattern the block should now hold */
+    struct golden g = { block->ptr, start0, block->pixelFormat, width,
+                        rows, stride, 0 };
+    g.digest = pattern_digest(start0, width, rows);
+    pthread_mutex_lock(&golden_mutex);
+    *golden_slot(block->ptr) = g;
+    pthread_mutex_unlock(&golden_mutex);
     OUT;
 }
 
@@ -325,6 +434,22 @@ int check_mem(uint16_t start, MemAllocBlock *block)
     }
     width *= def_bpp(block->pixelFormat);
 
+#ifndef __WRITE_IN_STRIDE__
+    /* if the block was filled with the same pattern, compare digests.
+       Otherwise, or if they differ, check the contents to find the
+       first difference. */
+    pthread_mutex_lock(&golden_mutex);
+    struct golden g = *golden_slot(block->ptr);
+    pthread_mutex_unlock(&golden_mutex);
+    if (g.ptr == block->ptr && g.start == start &&
+        g.fmt == block->pixelFormat && g.row_len == width &&
+        g.rows == height && g.stride == stride &&
+        MemMgr_DigestPlane(block->ptr, width, height, stride) == g.digest)
+    {
+        return R_I(MEMMGR_ERR_NONE);
+    }
+#endif
+
     CHK_I(width,<=,stride);
     uint32_t *ptr32 = (uint32_t *)ptr;
     for (r = 0; r < height; r++)
@@ -348,7 +473,7 @@ int check_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uint32_t)ptr32)))
+            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uintptr_t)ptr32)))
             {
                 if (*ptr32++) {
                     DP("assert: val[%u,%u] (=0x%x) != 0", r, i, *--ptr32);
@@ -374,7 +499,7 @@ int check_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uint32_t)ptr)))
+            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uintptr_t)ptr)))
             {
                 if (*ptr++) {
                     DP("assert: val[%u,%u] (=0x%x) != 0", r, i, *--ptr);
@@ -426,7 +551,7 @@ void *alloc_1D(bytes_t length, bytes_t stride, uint16_t val)
             NOT_I(MemMgr_Is1DBlock(bufPtr),!=,0) ||
             NOT_I(MemMgr_Is2DBlock(bufPtr),==,0) ||
             NOT_I(MemMgr_GetStride(bufPtr),==,block.stride) ||
-            NOT_P(TilerMem_VirtToPhys(bufPtr),==,block.reserved) ||
+            NOT_L(TilerMem_VirtToPhys(bufPtr),==,block.reserved) ||
             NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(bufPtr)),==,PAGE_SIZE) ||
             NOT_L((PAGE_SIZE - 1) & (long)bufPtr,==,(PAGE_SIZE - 1) & block.reserved))
         {
@@ -513,7 +638,7 @@ void *alloc_2D(pixels_t width, pixels_t height, pixel_fmt_t fmt, bytes_t stride,
             NOT_I(MemMgr_Is2DBlock(bufPtr),!=,0) ||
             NOT_I(block.stride,!=,0) ||
             NOT_I(MemMgr_GetStride(bufPtr),==,block.stride) ||
-            NOT_P(TilerMem_VirtToPhys(bufPtr),==,block.reserved) ||
+            NOT_L(TilerMem_VirtToPhys(bufPtr),==,block.reserved) ||
             NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(bufPtr)),==,cstride) ||
             NOT_L((PAGE_SIZE - 1) & (long)bufPtr,==,(PAGE_SIZE - 1) & block.reserved))
         {
@@ -606,8 +731,8 @@ void *alloc_NV12(pixels_t width, pixels_t height, uint16_t val)
             NOT_I(blocks[1].stride,!=,0) ||
             NOT_I(MemMgr_GetStride(bufPtr),==,blocks[0].stride) ||
             NOT_I(MemMgr_GetStride(buf2),==,blocks[1].stride) ||
-            NOT_P(TilerMem_VirtToPhys(bufPtr),==,blocks[0].reserved) ||
-            NOT_P(TilerMem_VirtToPhys(buf2),==,blocks[1].reserved) ||
+            NOT_L(TilerMem_VirtToPhys(bufPtr),==,blocks[0].reserved) ||
+            NOT_L(TilerMem_VirtToPhys(buf2),==,blocks[1].reserved) ||
             NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(bufPtr)),==,TILER_STRIDE_8BIT) ||
             NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(buf2)),==,TILER_STRIDE_16BIT) ||
             NOT_L((PAGE_SIZE - 1) & (long)blocks[0].ptr,==,(PAGE_SIZE - 1) & blocks[0].reserved) ||
@@ -705,7 +830,7 @@ void *map_1D(void *dataPtr, bytes_t length, bytes_t stride, uint16_t val)
             NOT_I(MemMgr_Is1DBlock(bufPtr),!=,0) ||
             NOT_I(MemMgr_Is2DBlock(bufPtr),==,0) ||
             NOT_I(MemMgr_GetStride(bufPtr),==,block.stride) ||
-            NOT_P(TilerMem_VirtToPhys(bufPtr),==,block.reserved) ||
+            NOT_L(TilerMem_VirtToPhys(bufPtr),==,block.reserved) ||
             NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(bufPtr)),==,PAGE_SIZE) ||
             NOT_L((PAGE_SIZE - 1) & (long)bufPtr,==,0) ||
             NOT_L((PAGE_SIZE - 1) & block.reserved,==,0))
@@ -848,7 +973,7 @@ int map_1D_test(bytes_t length, bytes_t stride)
 #ifdef __MAP_OK__
     /* allocate aligned buffer */
     void *buffer = malloc(length + PAGE_SIZE - 1);
-    void *dataPtr = (void *)(((uint32_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
     uint16_t val = (uint16_t) rand();
     void *ptr = map_1D(dataPtr, length, stride, val);
     if (!ptr) return 1;
@@ -1030,7 +1155,7 @@ int maxmap_1D_test(bytes_t length, int max_maps)
         if (ptr)
         {
             void *buffer = ptr;
-            void *dataPtr = (void *)(((uint32_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+            void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
             uint16_t val = (uint16_t) rand();
             ptr = map_1D(dataPtr, length, 0, val);
             if (ptr)
@@ -1156,7 +1281,7 @@ int star_test(uint32_t num_ops, uint16_t num_slots)
                 mem[ix].buffer = malloc(mem[ix].length + PAGE_SIZE - 1);
                 if (mem[ix].buffer)
                 {
-                    mem[ix].dataPtr = (void *)(((uint32_t)mem[ix].buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+                    mem[ix].dataPtr = (void *)(((uintptr_t)mem[ix].buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
                     mem[ix].bufPtr = map_1D(mem[ix].dataPtr, mem[ix].length, 0, mem[ix].val);
                     if (!mem[ix].bufPtr) FREE(mem[ix].buffer);
                 }
@@ -1350,7 +1475,7 @@ int star_tiler_test(uint32_t num_ops, uint16_t num_slots)
                 mem[ix].buffer = malloc(length + PAGE_SIZE - 1);
                 if (mem[ix].buffer)
                 {
-                    mem[ix].dataPtr = (void *)(((uint32_t)mem[ix].buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+                    mem[ix].dataPtr = (void *)(((uintptr_t)mem[ix].buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
                     mem[ix].ssptr = TilerMgr_Map(mem[ix].dataPtr, length);
                     if (!mem[ix].ssptr) FREE(mem[ix].buffer);
                 }
@@ -1495,7 +1620,7 @@ int neg_free_tests()
 
     P("/* free mapped buffer */");
     void *buffer = malloc(PAGE_SIZE * 2);
-    void *dataPtr = (void *)(((uint32_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
     ptr = map_1D(dataPtr, PAGE_SIZE, 0, 0);
     ret |= NOT_I(MemMgr_Free(ptr),!=,0);
 
@@ -1576,7 +1701,7 @@ int neg_map_tests()
 
     P("/* 1 1D buffer with not aligned start address */");
     void *buffer = malloc(3 * PAGE_SIZE);
-    void *dataPtr = (void *)(((uint32_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
     block[0].ptr = dataPtr + 3;
     ret |= NEGM(MemMgr_Map(block, 1));
 
@@ -1588,7 +1713,7 @@ int neg_map_tests()
 #if 0 /* TODO: it's possible that our va falls within the TILER addr range */
     P("/* Mapping a tiled 1D buffer */");
     void *ptr = alloc_1D(PAGE_SIZE * 2, 0, 0);
-    dataPtr = (void *)(((uint32_t)ptr + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    dataPtr = (void *)(((uintptr_t)ptr + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
     block[0].ptr = dataPtr;
     block[0].dim.len = PAGE_SIZE;
     ret |= NEGM(MemMgr_Map(block, 1));
@@ -1619,7 +1744,7 @@ int neg_unmap_tests()
     MemMgr_Free(ptr);
 
     void *buffer = malloc(PAGE_SIZE * 2);
-    void *dataPtr = (void *)(((uint32_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
     ptr = map_1D(dataPtr, PAGE_SIZE, 0, 0);
     MemMgr_UnMap(ptr);
 
@@ -1663,9 +1788,9 @@ int neg_check_tests()
     ret |= NOT_I(MemMgr_GetStride((void *)0x12345678),==,0);
     ret |= NOT_I(MemMgr_GetStride(ptr),==,PAGE_SIZE);
 
-    ret |= NOT_P(TilerMem_VirtToPhys(NULL),==,0);
-    ret |= NOT_P(TilerMem_VirtToPhys((void *)0x12345678),==,0);
-    ret |= NOT_P(TilerMem_VirtToPhys(ptr),!=,0);
+    ret |= NOT_L(TilerMem_VirtToPhys(NULL),==,0);
+    ret |= NOT_L(TilerMem_VirtToPhys((void *)0x12345678),==,0);
+    ret |= NOT_L(TilerMem_VirtToPhys(ptr),!=,0);
 
     ret |= NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(NULL)),==,0);
     ret |= NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys((void *)0x12345678)),==,0);
@@ -1676,6 +1801,1987 @@ int neg_check_tests()
     return ret;
 }
 
+/**
+ * Tests the registry snapshot and iterator.  Allocates a 1D, an
+ * NV12 and a mapped buffer, and verifies that the snapshot
+ * contains exactly these buffers, and that filtering by type,
+ * format and size finds the right ones.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int snapshot_test()
+{
+    printf("Registry snapshot tests\n");
+
+    MemMgrBufInfo entries[4];
+    MemMgrBufFilter filter;
+    MemMgrBufIter it;
+    uint32_t version, version2;
+    int ret = 0;
+
+    ret |= NOT_I(MemMgr_Snapshot(NULL, 0, &version),==,0);
+    ret |= NOT_I(MemMgr_Snapshot(NULL, 1, NULL),==,-1);
+
+    void *buf1d = alloc_1D(4 * PAGE_SIZE, 0, 0);
+    void *bufnv12 = alloc_NV12(176, 144, 0);
+    void *buffer = malloc(PAGE_SIZE * 3);
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    void *bufmap = map_1D(dataPtr, 2 * PAGE_SIZE, 0, 0);
+    if (NOT_P(buf1d,!=,NULL) || NOT_P(bufnv12,!=,NULL) || NOT_P(bufmap,!=,NULL))
+    {
+        ret = 1;
+        goto DONE;
+    }
+
+    /* not enough room */
+    ret |= NOT_I(MemMgr_Snapshot(entries, 1, &version2),==,3);
+    ret |= NOT_I(version2,==,version + 3);
+
+    int n = MemMgr_Snapshot(entries, 4, &version2);
+    ret |= NOT_I(n,==,3);
+    ret |= NOT_I(version2,==,version + 3);
+
+    /* all entries */
+    int num = 0;
+    const MemMgrBufInfo *e;
+    MemMgr_IterInit(&it, entries, n, NULL);
+    while ((e = MemMgr_IterNext(&it)) != NULL)
+    {
+        num++;
+        if (e->bufPtr == buf1d)
+        {
+            ret |= NOT_I(e->type,==,MEMMGR_BUF_ALLOCED);
+            ret |= NOT_I(e->size,==,4 * PAGE_SIZE);
+            ret |= NOT_I(e->formats,==,1 << PIXEL_FMT_PAGE);
+        }
+        else if (e->bufPtr == bufnv12)
+        {
+            ret |= NOT_I(e->type,==,MEMMGR_BUF_ALLOCED);
+            ret |= NOT_I(e->num_blocks,==,2);
+            ret |= NOT_I(e->formats,==,(1 << PIXEL_FMT_8BIT) | (1 << PIXEL_FMT_16BIT));
+        }
+        else
+        {
+            ret |= NOT_P(e->bufPtr,==,bufmap);
+            ret |= NOT_I(e->type,==,MEMMGR_BUF_MAPPED);
+        }
+    }
+    ret |= NOT_I(num,==,3);
+
+    /* filter by type */
+    ZERO(filter);
+    filter.type_mask = MEMMGR_BUF_MAPPED;
+    MemMgr_IterInit(&it, entries, n, &filter);
+    e = MemMgr_IterNext(&it);
+    ret |= NOT_P(e ? e->bufPtr : NULL,==,bufmap);
+    ret |= NOT_P(MemMgr_IterNext(&it),==,NULL);
+
+    /* filter by format */
+    ZERO(filter);
+    filter.formats = 1 << PIXEL_FMT_16BIT;
+    MemMgr_IterInit(&it, entries, n, &filter);
+    e = MemMgr_IterNext(&it);
+    ret |= NOT_P(e ? e->bufPtr : NULL,==,bufnv12);
+    ret |= NOT_P(MemMgr_IterNext(&it),==,NULL);
+
+    /* filter by type and size */
+    ZERO(filter);
+    filter.type_mask = MEMMGR_BUF_ALLOCED;
+    filter.max_size = 4 * PAGE_SIZE;
+    MemMgr_IterInit(&it, entries, n, &filter);
+    e = MemMgr_IterNext(&it);
+    ret |= NOT_P(e ? e->bufPtr : NULL,==,buf1d);
+    ret |= NOT_P(MemMgr_IterNext(&it),==,NULL);
+
+DONE:
+    if (bufmap) ret |= unmap_1D(dataPtr, 2 * PAGE_SIZE, 0, 0, bufmap);
+    if (bufnv12) ret |= free_NV12(176, 144, 0, bufnv12);
+    if (buf1d) ret |= free_1D(4 * PAGE_SIZE, 0, 0, buf1d);
+    FREE(buffer);
+
+    /* everything was freed */
+    ret |= NOT_I(MemMgr_Snapshot(entries, 4, &version2),==,0);
+    ret |= NOT_I(version2,==,version + 6);
+
+    return ret;
+}
+
+/**
+ * Tests the DMM PAT emulation of the tiler stub.  Verifies that
+ * the blocks of a buffer are refilled in a single pass with one
+ * entry per page, that unbatched refills take one pass per
+ * block, that mapped buffers are refilled, and that blocks freed
+ * before their refill do not write the PAT.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int pat_test()
+{
+    printf("DMM PAT refill tests\n");
+#ifdef STUB_TILER
+    TilerStubPatStats st0, st;
+    MemAllocBlock blocks[2];
+    int ret = 0;
+
+    /* NV12 176x144 uses 3x3 8-bit and 2x3 16-bit slots */
+    ZERO(blocks);
+    blocks[0].pixelFormat = PIXEL_FMT_8BIT;
+    blocks[0].dim.area.width  = 176;
+    blocks[0].dim.area.height = 144;
+    blocks[1].pixelFormat = PIXEL_FMT_16BIT;
+    blocks[1].dim.area.width  = 88;
+    blocks[1].dim.area.height = 72;
+
+    TilerStub_GetPatStats(&st0);
+    void *bufPtr = MemMgr_Alloc(blocks, 2);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    TilerStub_GetPatStats(&st);
+    ret |= NOT_I(st.entries - st0.entries,==,15);
+    ret |= NOT_I(st.descriptors - st0.descriptors,==,2);
+    ret |= NOT_I(st.refills - st0.refills,==,1);
+    ret |= NOT_I(TilerStub_GetPatEntry(blocks[0].reserved),!=,0);
+    ret |= NOT_I(TilerStub_GetPatEntry(blocks[1].reserved),!=,0);
+    SSPtr ssptr = blocks[0].reserved;
+    ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    ret |= NOT_I(TilerStub_GetPatEntry(ssptr),==,0);
+
+    /* without batching every block is refilled separately */
+    int batching = TilerStub_SetPatBatching(0);
+    blocks[0].reserved = blocks[1].reserved = 0;
+    blocks[0].ptr = blocks[1].ptr = NULL;
+    TilerStub_GetPatStats(&st0);
+    bufPtr = MemMgr_Alloc(blocks, 2);
+    TilerStub_SetPatBatching(batching);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    TilerStub_GetPatStats(&st);
+    ret |= NOT_I(st.entries - st0.entries,==,15);
+    ret |= NOT_I(st.refills - st0.refills,==,2);
+    ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+
+    /* mapped buffers use one entry per page */
+    void *buffer = malloc(PAGE_SIZE * 3);
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    TilerStub_GetPatStats(&st0);
+    bufPtr = map_1D(dataPtr, 2 * PAGE_SIZE, 0, 0);
+    TilerStub_GetPatStats(&st);
+    ret |= NOT_I(st.entries - st0.entries,==,2);
+    ret |= NOT_I(st.refills - st0.refills,==,1);
+    if (bufPtr)
+    {
+        ret |= NOT_I(TilerStub_GetPatEntry(TilerMem_VirtToPhys(bufPtr)),!=,0);
+        ret |= unmap_1D(dataPtr, 2 * PAGE_SIZE, 0, 0, bufPtr);
+    }
+    else
+    {
+        ret = 1;
+    }
+    FREE(buffer);
+
+    /* blocks freed before being accessed are never refilled */
+    ret |= NOT_I(TilerMgr_Open(),==,0);
+    TilerStub_GetPatStats(&st0);
+    ssptr = TilerMgr_Alloc(PIXEL_FMT_8BIT, 1920, 1080);
+    ret |= NOT_I(ssptr,!=,0);
+    ret |= NOT_I(TilerMgr_Free(ssptr),==,0);
+    TilerStub_GetPatStats(&st);
+    ret |= NOT_I(st.entries - st0.entries,==,0);
+    ret |= NOT_I(TilerMgr_Close(),==,0);
+
+    return ret;
+#else
+    return TESTERR_NOTIMPLEMENTED;
+#endif
+}
+
+/**
+ * Tests the rotated views of the tiler stub.  Fills a 2D buffer
+ * and verifies every pixel of its 90, 180 and 270 degree views.
+ * Also checks that views are only given for the start of 2D
+ * blocks.
+ *
+ * @param width    Buffer width
+ * @param height   Buffer height
+ * @param fmt      Pixel format
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int rotated_view_test(pixels_t width, pixels_t height, pixel_fmt_t fmt)
+{
+    printf("Rotated views of %d*%d*%d buffer\n", width, height,
+           def_bpp(fmt) * 8);
+#ifdef STUB_TILER
+    MemAllocBlock block;
+    TilerStubView view;
+    int ret = 0, rot;
+    uint32_t x, y;
+
+    ZERO(block);
+    block.pixelFormat = fmt;
+    block.dim.area.width = width;
+    block.dim.area.height = height;
+    uint8_t *bufPtr = MemMgr_Alloc(&block, 1);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+
+    /* first byte of each pixel is (x + 3 * y) */
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            bufPtr[y * block.stride + x * def_bpp(fmt)] = (uint8_t) (x + 3 * y);
+
+    for (rot = 0; rot < 360 && !ret; rot += 90)
+    {
+        if (NOT_I(TilerStub_GetView(bufPtr, rot, &view),==,0)) { ret = 1; break; }
+        ret |= NOT_I(view.width,==,rot % 180 ? height : width);
+        ret |= NOT_I(view.height,==,rot % 180 ? width : height);
+        for (y = 0; y < view.height && !ret; y++)
+        {
+            for (x = 0; x < view.width && !ret; x++)
+            {
+                uint32_t nx = (rot == 0 ? x : rot == 90 ? y :
+                               rot == 180 ? width - 1 - x : width - 1 - y);
+                uint32_t ny = (rot == 0 ? y : rot == 90 ? height - 1 - x :
+                               rot == 180 ? height - 1 - y : x);
+                ret |= NOT_I(*(uint8_t *) TilerStub_ViewPixel(&view, x, y),==,
+                             (uint8_t) (nx + 3 * ny));
+            }
+        }
+    }
+
+    ret |= NOT_I(TilerStub_GetView(bufPtr, 45, &view),!=,0);
+    ret |= NOT_I(TilerStub_GetView(bufPtr + 1, 90, &view),!=,0);
+    ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+
+    void *buf1d = alloc_1D(PAGE_SIZE, 0, 0);
+    if (buf1d)
+    {
+        ret |= NOT_I(TilerStub_GetView(buf1d, 90, &view),!=,0);
+        ret |= free_1D(PAGE_SIZE, 0, 0, buf1d);
+    }
+    return ret;
+#else
+    return TESTERR_NOTIMPLEMENTED;
+#endif
+}
+
+/**
+ * Tests aperture mode.  Allocates an NV12 buffer and a 1D
+ * buffer, and maps a 1D buffer.  Verifies that the blocks are
+ * at their fixed offset in the aperture, that 2D blocks use the
+ * container stride, that addresses translate both ways, and
+ * that the buffers can be filled, checked and freed.  Also
+ * verifies that the mode cannot be changed while there are
+ * buffers.  It is only available if the tiler driver supports
+ * aperture mode.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int aperture_test()
+{
+    printf("Aperture mode tests\n");
+
+    MemAllocBlock blocks[2], block;
+    int ret = 0;
+
+    if (MemMgr_SetApertureMode(1)) return TESTERR_NOTIMPLEMENTED;
+    ret |= NOT_I(MemMgr_InApertureMode(),!=,0);
+
+    ZERO(blocks);
+    blocks[0].pixelFormat = PIXEL_FMT_8BIT;
+    blocks[0].dim.area.width  = 176;
+    blocks[0].dim.area.height = 144;
+    blocks[1].pixelFormat = PIXEL_FMT_16BIT;
+    blocks[1].dim.area.width  = 88;
+    blocks[1].dim.area.height = 72;
+    void *bufnv12 = MemMgr_Alloc(blocks, 2);
+    void *buf1d = alloc_1D(4 * PAGE_SIZE, 0, 0);
+    void *buffer = malloc(PAGE_SIZE * 3);
+    void *dataPtr = (void *)(((uintptr_t)buffer + PAGE_SIZE - 1) &~ (PAGE_SIZE - 1));
+    void *bufmap = map_1D(dataPtr, 2 * PAGE_SIZE, 0, 0);
+    if (NOT_P(bufnv12,!=,NULL) || NOT_P(buf1d,!=,NULL) || NOT_P(bufmap,!=,NULL))
+    {
+        ret = 1;
+        goto DONE;
+    }
+
+    /* blocks are at their fixed offsets, and use the container stride */
+    ret |= NOT_P(blocks[0].ptr,==,bufnv12);
+    ret |= NOT_L(blocks[1].ptr - blocks[0].ptr,==,blocks[1].reserved - blocks[0].reserved);
+    ret |= NOT_L(blocks[0].stride,==,TILER_STRIDE_8BIT);
+    ret |= NOT_L(blocks[1].stride,==,TILER_STRIDE_16BIT);
+    ret |= NOT_L(MemMgr_GetStride(blocks[1].ptr + 5 * blocks[1].stride),==,TILER_STRIDE_16BIT);
+    ret |= NOT_L(MemMgr_GetStride(buf1d + PAGE_SIZE),==,0);
+    ret |= NOT_L(TilerMem_VirtToPhys(blocks[0].ptr + 3 * blocks[0].stride + 5),==,
+                 blocks[0].reserved + 3 * TILER_STRIDE_8BIT + 5);
+    ret |= NOT_L(TilerMem_VirtToPhys(buf1d + PAGE_SIZE),==,
+                 TilerMem_VirtToPhys(buf1d) + PAGE_SIZE);
+    ret |= NOT_I(MemMgr_Is2DBlock(blocks[1].ptr),!=,0);
+    ret |= NOT_I(MemMgr_Is1DBlock(bufmap),!=,0);
+
+    /* the aperture between buffers is not mapped */
+    ret |= NOT_L(TilerMem_VirtToPhys(blocks[0].ptr + 200 * blocks[0].stride),==,0);
+    ret |= NOT_I(MemMgr_IsMapped(bufmap + 2 * PAGE_SIZE),==,0);
+
+    fill_mem(1, blocks);
+    fill_mem(2, blocks + 1);
+    ret |= check_mem(1, blocks);
+    ret |= check_mem(2, blocks + 1);
+
+    /* mode cannot change while there are buffers */
+    ret |= NOT_I(MemMgr_SetApertureMode(0),!=,0);
+    ret |= NOT_I(MemMgr_InApertureMode(),!=,0);
+
+    /* buffers are found by their first block only */
+    ret |= NOT_I(MemMgr_Free(blocks[1].ptr),!=,0);
+
+DONE:
+    if (bufmap) ret |= unmap_1D(dataPtr, 2 * PAGE_SIZE, 0, 0, bufmap);
+    if (buf1d) ret |= free_1D(4 * PAGE_SIZE, 0, 0, buf1d);
+    if (bufnv12) ret |= NOT_I(MemMgr_Free(bufnv12),==,0);
+    FREE(buffer);
+
+    ret |= NOT_I(MemMgr_SetApertureMode(0),==,0);
+    ret |= NOT_I(MemMgr_InApertureMode(),==,0);
+
+    /* buffers are mapped separately again */
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_PAGE;
+    block.dim.len = PAGE_SIZE;
+    void *bufPtr = MemMgr_Alloc(&block, 1);
+    ret |= NOT_P(bufPtr,!=,NULL);
+    if (bufPtr) ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return ret;
+}
+
+/* write fence count the fence waiter thread waits for */
+static uint32_t fence_value;
+
+/* fence waiter thread: waits for the write fence, then signals the read
+   fence */
+static void *fence_waiter(void *bufPtr)
+{
+    int ret = MemMgr_FenceWait(bufPtr, MEMMGR_FENCE_WRITE, fence_value, 5000);
+    if (!ret) ret = MemMgr_FenceSignal(bufPtr, MEMMGR_FENCE_READ);
+    return (void *)(intptr_t) ret;
+}
+
+/**
+ * Tests buffer fences.  Verifies signal counts, waiting with and
+ * without timeout, the separation of the read and write slots,
+ * eventfd export, handing a buffer between two threads, and that
+ * freeing a buffer wakes up its waiters.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int fence_test()
+{
+    printf("Buffer fence tests\n");
+
+    pthread_t thread;
+    uint32_t value;
+    uint64_t count;
+    void *res;
+    int ret = 0;
+
+    void *bufPtr = alloc_1D(4 * PAGE_SIZE, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+
+    /* counts start at 0 and are per slot */
+    ret |= NOT_I(MemMgr_FenceValue(bufPtr, MEMMGR_FENCE_WRITE, &value),==,0);
+    ret |= NOT_I(value,==,0);
+    ret |= NOT_I(MemMgr_FenceWait(bufPtr, MEMMGR_FENCE_WRITE, 0, 0),==,0);
+    ret |= NOT_I(MemMgr_FenceWait(bufPtr, MEMMGR_FENCE_WRITE, 1, 10),==,-ETIMEDOUT);
+    ret |= NOT_I(MemMgr_FenceSignal(bufPtr + PAGE_SIZE, MEMMGR_FENCE_WRITE),==,0);
+    ret |= NOT_I(MemMgr_FenceWait(bufPtr, MEMMGR_FENCE_WRITE, 1, -1),==,0);
+    ret |= NOT_I(MemMgr_FenceWait(bufPtr, MEMMGR_FENCE_READ, 1, 0),==,-ETIMEDOUT);
+    ret |= NOT_I(MemMgr_FenceValue(bufPtr, MEMMGR_FENCE_READ, &value),==,0);
+    ret |= NOT_I(value,==,0);
+
+    /* eventfd export */
+    int fd = MemMgr_FenceExport(bufPtr, MEMMGR_FENCE_READ);
+    ret |= NOT_I(fd,>=,0);
+    ret |= NOT_I(MemMgr_FenceExport(bufPtr, MEMMGR_FENCE_READ),==,fd);
+    ret |= NOT_I(MemMgr_FenceSignal(bufPtr, MEMMGR_FENCE_READ),==,0);
+    ret |= NOT_I(MemMgr_FenceSignal(bufPtr, MEMMGR_FENCE_READ),==,0);
+    ret |= NOT_I(read(fd, &count, sizeof(count)),==,sizeof(count));
+    ret |= NOT_I(count,==,2);
+
+    /* bad arguments */
+    ret |= NOT_I(MemMgr_FenceSignal(bufPtr, MEMMGR_FENCE_SLOTS),!=,0);
+    ret |= NOT_I(MemMgr_FenceSignal(&value, MEMMGR_FENCE_WRITE),!=,0);
+    ret |= NOT_I(MemMgr_FenceExport(&value, MEMMGR_FENCE_WRITE),==,-1);
+    ret |= free_1D(4 * PAGE_SIZE, 0, 0, bufPtr);
+
+    /* hand a buffer over to another thread and back */
+    bufPtr = alloc_1D(PAGE_SIZE, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    fence_value = 1;
+    ret |= NOT_I(pthread_create(&thread, NULL, fence_waiter, bufPtr),==,0);
+    ret |= NOT_I(MemMgr_FenceSignal(bufPtr, MEMMGR_FENCE_WRITE),==,0);
+    ret |= NOT_I(MemMgr_FenceWait(bufPtr, MEMMGR_FENCE_READ, 1, 5000),==,0);
+    ret |= NOT_I(pthread_join(thread, &res),==,0);
+    ret |= NOT_P(res,==,NULL);
+
+    /* freeing the buffer wakes up the waiter with an error */
+    fence_value = 2;
+    ret |= NOT_I(pthread_create(&thread, NULL, fence_waiter, bufPtr),==,0);
+    usleep(10000);
+    ret |= free_1D(PAGE_SIZE, 0, 0, bufPtr);
+    ret |= NOT_I(pthread_join(thread, &res),==,0);
+    ret |= NOT_P(res,!=,NULL);
+    return ret;
+}
+
+/**
+ * Tests dirty range tracking using the cache statistics of the
+ * tiler stub.  Verifies that only the marked ranges are
+ * maintained, rounded to cache lines, that adjacent ranges are
+ * coalesced, that too many ranges are merged without losing
+ * any, that syncing clears the ranges, and that 2D buffers are
+ * not maintained.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int dirty_test()
+{
+    printf("Dirty range tracking tests\n");
+#ifdef STUB_TILER
+    TilerStubCacheStats st0, st;
+    int ret = 0, ix;
+
+    void *bufPtr = alloc_1D(64 * PAGE_SIZE, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+
+    /* nothing is dirty */
+    TilerStub_GetCacheStats(&st0);
+    ret |= NOT_I(MemMgr_SyncForDevice(bufPtr),==,0);
+    TilerStub_GetCacheStats(&st);
+    ret |= NOT_I(st.ops - st0.ops,==,0);
+
+    /* partial cache lines are rounded, adjacent ranges are coalesced */
+    ret |= NOT_I(MemMgr_MarkDirty(bufPtr + 10, 20),==,0);
+    ret |= NOT_I(MemMgr_MarkDirty(bufPtr + 64, 64),==,0);
+    ret |= NOT_I(MemMgr_MarkDirty(bufPtr + 32, 32),==,0);
+    ret |= NOT_I(MemMgr_MarkDirty(bufPtr + PAGE_SIZE, 100),==,0);
+    TilerStub_GetCacheStats(&st0);
+    ret |= NOT_I(MemMgr_SyncForDevice(bufPtr + 5),==,0);
+    TilerStub_GetCacheStats(&st);
+    ret |= NOT_I(st.ops - st0.ops,==,2);
+    ret |= NOT_I(st.cleaned - st0.cleaned,==,128 + 128);
+    ret |= NOT_I(st.invalidated - st0.invalidated,==,0);
+
+    /* syncing clears the ranges */
+    ret |= NOT_I(MemMgr_SyncForCpu(bufPtr),==,0);
+    TilerStub_GetCacheStats(&st0);
+    ret |= NOT_I(st0.ops - st.ops,==,0);
+
+    /* too many ranges get merged, but nothing is lost */
+    for (ix = 0; ix < 64; ix++)
+    {
+        ret |= NOT_I(MemMgr_MarkDirty(bufPtr + ix * PAGE_SIZE, 32),==,0);
+        ret |= NOT_I(MemMgr_MarkDirty(bufPtr + ix * PAGE_SIZE + 1024, 32),==,0);
+    }
+    ret |= NOT_I(MemMgr_SyncForCpu(bufPtr),==,0);
+    TilerStub_GetCacheStats(&st);
+    ret |= NOT_I(st.ops - st0.ops,==,64);
+    ret |= NOT_I(st.invalidated - st0.invalidated,>=,128 * 32);
+    ret |= NOT_I(st.invalidated - st0.invalidated,<,64 * PAGE_SIZE);
+
+    /* bad pointers */
+    ret |= NOT_I(MemMgr_MarkDirty(&ix, 4),!=,0);
+    ret |= NOT_I(MemMgr_SyncForDevice(&ix),!=,0);
+    ret |= free_1D(64 * PAGE_SIZE, 0, 0, bufPtr);
+
+    /* 2D buffers are not cacheable */
+    bufPtr = alloc_2D(64, 64, PIXEL_FMT_8BIT, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    TilerStub_GetCacheStats(&st0);
+    ret |= NOT_I(MemMgr_MarkDirty(bufPtr, 64),==,0);
+    ret |= NOT_I(MemMgr_SyncForDevice(bufPtr),==,0);
+    TilerStub_GetCacheStats(&st);
+    ret |= NOT_I(st.ops - st0.ops,==,0);
+    ret |= free_2D(64, 64, PIXEL_FMT_8BIT, 0, 0, bufPtr);
+    return ret;
+#else
+    return TESTERR_NOTIMPLEMENTED;
+#endif
+}
+
+/**
+ * Tests buffer demotion.  Verifies that only idle, unpinned
+ * buffers marked demotable are demoted, that the reclaimed slots are reported,
+ * that pinning or passing a demoted buffer to the memory
+ * allocator restores its contents, and that a demoted buffer
+ * can be freed without restoring it.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int demote_test()
+{
+    printf("Buffer demotion tests\n");
+    MemMgrDemoteStats st;
+    int ret = 0;
+
+    MemMgr_GetDemoteStats(&st, true);
+    void *buf1d = alloc_1D(16 * PAGE_SIZE, 0, 0x1234);
+    void *buf2d = alloc_2D(176, 144, PIXEL_FMT_16BIT, 0, 0x2345);
+    void *bufpin = alloc_1D(4 * PAGE_SIZE, 0, 0x3456);
+    if (NOT_P(buf1d,!=,NULL) || NOT_P(buf2d,!=,NULL) ||
+        NOT_P(bufpin,!=,NULL)) return 1;
+
+    /* buffers are only demoted once marked demotable */
+    ret |= NOT_I(MemMgr_DemoteIdle(0),==,0);
+    ret |= NOT_I(MemMgr_SetDemotable(buf1d + PAGE_SIZE, true),==,0);
+    ret |= NOT_I(MemMgr_SetDemotable(buf2d, true),==,0);
+    ret |= NOT_I(MemMgr_SetDemotable(bufpin, true),==,0);
+
+    /* recently used and pinned buffers are not demoted */
+    ret |= NOT_I(MemMgr_Pin(bufpin),==,0);
+    ret |= NOT_I(MemMgr_DemoteIdle(60000),==,0);
+    ret |= NOT_I(MemMgr_DemoteIdle(0),==,2);
+    ret |= NOT_I(MemMgr_IsDemoted(buf1d + PAGE_SIZE),!=,0);
+    ret |= NOT_I(MemMgr_IsDemoted(buf2d),!=,0);
+    ret |= NOT_I(MemMgr_IsDemoted(bufpin),==,0);
+
+    /* 176x144 16-bit pixels take up 3x5 slots */
+    MemMgr_GetDemoteStats(&st, false);
+    ret |= NOT_I(st.demoted,==,2);
+    ret |= NOT_I(st.slots,==,16 + 15);
+    ret |= NOT_L(st.bytes,==,16 * PAGE_SIZE + 144 * PAGE_SIZE);
+    ret |= NOT_L(st.compressed,<,st.bytes);
+
+    /* memory allocator calls restore the buffers */
+    ret |= NOT_L(MemMgr_GetStride(buf2d),==,PAGE_SIZE);
+    ret |= NOT_I(MemMgr_IsDemoted(buf2d),==,0);
+    ret |= free_2D(176, 144, PIXEL_FMT_16BIT, 0, 0x2345, buf2d);
+    ret |= NOT_I(MemMgr_Pin(buf1d + PAGE_SIZE),==,0);
+    ret |= NOT_I(MemMgr_IsDemoted(buf1d),==,0);
+    ret |= NOT_I(MemMgr_Unpin(buf1d),==,0);
+    ret |= NOT_I(MemMgr_Unpin(buf1d),!=,0);
+    ret |= free_1D(16 * PAGE_SIZE, 0, 0x1234, buf1d);
+    MemMgr_GetDemoteStats(&st, false);
+    ret |= NOT_I(st.restored,==,2);
+
+    /* demoted buffers are freed without restoring them */
+    ret |= NOT_I(MemMgr_Unpin(bufpin),==,0);
+    ret |= NOT_I(MemMgr_DemoteIdle(0),==,1);
+    ret |= NOT_I(MemMgr_Free(bufpin),==,0);
+    MemMgr_GetDemoteStats(&st, true);
+    ret |= NOT_I(st.demoted,==,3);
+    ret |= NOT_I(st.restored,==,2);
+    return ret;
+}
+
+/**
+ * Tests container partitions of the tiler stub.  Verifies that
+ * partitions cannot overlap, that blocks are allocated in the
+ * partition selected by the thread, that a full partition does
+ * not spill over, and that only empty partitions can be resized
+ * or deleted.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int partition_test()
+{
+    printf("Container partition tests\n");
+#ifdef STUB_TILER
+    TilerStubPartStats st;
+    int ret = 0;
+
+    int id = TilerStub_CreatePartition("display", 64, 32, 4096, 1024);
+    if (NOT_I(id,>,0)) return 1;
+    ret |= NOT_I(TilerStub_CreatePartition("display", 0, 1, 0, 0),==,-EEXIST);
+    ret |= NOT_I(TilerStub_CreatePartition("codec", 80, 8, 0, 0),==,-EBUSY);
+    ret |= NOT_I(TilerStub_CreatePartition("codec", 120, 16, 0, 0),==,-EINVAL);
+    ret |= NOT_I(TilerStub_FindPartition("display"),==,id);
+    ret |= NOT_I(TilerStub_FindPartition("codec"),==,-ENOENT);
+
+    /* blocks are allocated at the start of the partition */
+    ret |= NOT_I(TilerStub_UsePartition(id),==,0);
+    void *buf2d = alloc_2D(64, 64, PIXEL_FMT_8BIT, 0, 0x11);
+    void *buf1d = alloc_1D(PAGE_SIZE, 0, 0x22);
+    ret |= NOT_I(TilerStub_UsePartition(0),==,id);
+    if (NOT_P(buf2d,!=,NULL) || NOT_P(buf1d,!=,NULL)) return 1;
+    ret |= NOT_L(TilerMem_VirtToPhys(buf2d),==,
+                 TILER_MEM_8BIT + 64 * 64 * TILER_STRIDE_8BIT);
+    ret |= NOT_L(TilerMem_VirtToPhys(buf1d),==,
+                 TILER_MEM_PAGED + 4096 * PAGE_SIZE);
+
+    ret |= NOT_I(TilerStub_GetPartitionStats(id, &st),==,0);
+    ret |= NOT_I(st.slots,==,32 * TILER_WIDTH);
+    ret |= NOT_I(st.free_slots,==,32 * TILER_WIDTH - 1);
+    ret |= NOT_I(st.pages,==,1024);
+    ret |= NOT_I(st.free_pages,==,1023);
+    ret |= NOT_I(st.max_free_pages,==,1023);
+    ret |= NOT_I(st.blocks,==,2);
+    ret |= NOT_I(TilerStub_GetPartitionStats(0, &st),==,0);
+    ret |= NOT_I(st.slots,==,(TILER_HEIGHT - 32) * TILER_WIDTH);
+    ret |= NOT_I(st.pages,==,TILER_LENGTH / PAGE_SIZE - 1024);
+
+    /* a full partition does not spill into the shared partition */
+    TilerStub_UsePartition(id);
+    void *buf = alloc_1D(1024 * PAGE_SIZE, 0, 0);
+    TilerStub_UsePartition(0);
+    ret |= NOT_P(buf,==,NULL);
+
+    /* only empty partitions can be resized or deleted */
+    ret |= NOT_I(TilerStub_ResizePartition(id, 0, 16, 0, 16),==,-EBUSY);
+    ret |= NOT_I(TilerStub_DeletePartition(id),==,-EBUSY);
+    ret |= free_2D(64, 64, PIXEL_FMT_8BIT, 0, 0x11, buf2d);
+    ret |= free_1D(PAGE_SIZE, 0, 0x22, buf1d);
+    ret |= NOT_I(TilerStub_ResizePartition(id, 0, 16, 0, 16),==,0);
+    ret |= NOT_I(TilerStub_GetPartitionStats(id, &st),==,0);
+    ret |= NOT_I(st.slots,==,16 * TILER_WIDTH);
+    ret |= NOT_I(st.pages,==,16);
+    ret |= NOT_I(TilerStub_DeletePartition(id),==,0);
+    ret |= NOT_I(TilerStub_UsePartition(id),==,-EINVAL);
+    ret |= NOT_I(TilerStub_GetPartitionStats(0, &st),==,0);
+    ret |= NOT_I(st.slots,==,TILER_HEIGHT * TILER_WIDTH);
+    return ret;
+#else
+    return TESTERR_NOTIMPLEMENTED;
+#endif
+}
+
+/**
+ * Starts the arbitration service, and enters lease mode.  The
+ * service is run from $TILER_ARBD, or ./tiler_arbd.
+ *
+ * @param sock   Socket path for the service
+ * @param quota  Quota of each client (slots:pages)
+ * @param chunk  Lease chunk
+ *
+ * @return process ID of the service, or -1 if it is not
+ *         available.
+ */
+static pid_t start_arbd(const char *sock, const char *quota, uint32_t chunk)
+{
+    const char *path = getenv("TILER_ARBD");
+    int ix;
+
+    if (!path) path = "./tiler_arbd";
+    if (access(path, X_OK)) return -1;
+    pid_t pid = fork();
+    if (!pid)
+    {
+        execl(path, path, "-s", sock, "-q", quota, NULL);
+        _exit(127);
+    }
+
+    /* wait for the service to come up */
+    for (ix = 0; pid > 0 && ix < 100; ix++)
+    {
+        if (!access(sock, F_OK) &&
+            !MemMgr_LeaseConnect(sock, MEMMGR_LEASE_NORMAL, chunk)) return pid;
+        usleep(10000);
+    }
+    if (pid > 0) kill(pid, SIGKILL);
+    return -1;
+}
+
+/* stops the arbitration service */
+static void stop_arbd(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * Tests lease mode.  Verifies that lease mode can only be
+ * entered without buffers, that capacity is leased in chunks,
+ * that the quota of the service is enforced, and that unused
+ * capacity is returned.  Requires the arbitration service.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int lease_test()
+{
+    printf("Lease mode tests\n");
+    MemMgrLeaseStats ls;
+    MemMgrArbStats as;
+    char sock[64];
+    int ret = 0;
+
+    /* lease mode needs no buffers */
+    void *buf1 = alloc_1D(PAGE_SIZE, 0, 0);
+    if (NOT_P(buf1,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_LeaseConnect(NULL, MEMMGR_LEASE_NORMAL, 16),!=,0);
+    ret |= free_1D(PAGE_SIZE, 0, 0, buf1);
+
+    sprintf(sock, "/tmp/tiler_arb_test.%d", getpid());
+    pid_t pid = start_arbd(sock, "1024:64", 16);
+    if (pid < 0) return TESTERR_NOTIMPLEMENTED;
+
+    /* capacity is leased in chunks */
+    buf1 = alloc_1D(4 * PAGE_SIZE, 0, 0x11);
+    void *buf2 = alloc_1D(8 * PAGE_SIZE, 0, 0x22);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.pages,==,16);
+    ret |= NOT_I(ls.used_pages,==,12);
+    ret |= NOT_I(ls.slots,==,0);
+    ret |= NOT_I(ls.round_trips,==,2);
+
+    /* the quota is enforced, but the rest of a chunk is not needed */
+    void *buf3 = alloc_1D(64 * PAGE_SIZE, 0, 0);
+    ret |= NOT_P(buf3,==,NULL);
+    buf3 = alloc_1D(52 * PAGE_SIZE, 0, 0x33);
+    ret |= NOT_P(buf3,!=,NULL);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.pages,==,64);
+    ret |= NOT_I(ls.denied,==,1);
+    ret |= NOT_I(MemMgr_GetArbStats(&as),==,0);
+    ret |= NOT_I(as.clients,==,1);
+    ret |= NOT_I(as.pages,==,64);
+    ret |= NOT_I(as.max_pages,==,TILER_LENGTH / PAGE_SIZE);
+    ret |= NOT_I(as.denied,==,2);
+
+    /* 2D blocks lease slots */
+    void *buf4 = alloc_2D(176, 144, PIXEL_FMT_8BIT, 0, 0x44);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.slots,==,16);
+    ret |= NOT_I(ls.used_slots,==,3 * 3);
+
+    /* demoted buffers return their capacity, and take it back on restore */
+    ret |= NOT_I(MemMgr_SetDemotable(buf4, true),==,0);
+    ret |= NOT_I(MemMgr_DemoteIdle(0),==,1);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.used_slots,==,0);
+    ret |= NOT_I(MemMgr_Pin(buf4),==,0);
+    ret |= NOT_I(MemMgr_Unpin(buf4),==,0);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.used_slots,==,3 * 3);
+
+    /* spare capacity beyond two chunks is returned, keeping one */
+    ret |= free_1D(52 * PAGE_SIZE, 0, 0x33, buf3);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.pages,==,12 + 16);
+    ret |= free_1D(8 * PAGE_SIZE, 0, 0x22, buf2);
+    ret |= free_1D(4 * PAGE_SIZE, 0, 0x11, buf1);
+    ret |= free_2D(176, 144, PIXEL_FMT_8BIT, 0, 0x44, buf4);
+    MemMgr_GetLeaseStats(&ls);
+    ret |= NOT_I(ls.used_pages,==,0);
+    ret |= NOT_I(ls.pages,==,28);
+    ret |= NOT_I(ls.slots,==,16);
+
+    ret |= NOT_I(MemMgr_LeaseDisconnect(),==,0);
+    ret |= NOT_I(MemMgr_LeaseDisconnect(),!=,0);
+    stop_arbd(pid);
+    return ret;
+}
+
+/**
+ * Starts the buffer keeper, and connects to it.  The keeper is
+ * run from $TILER_KEEPD, or ./tiler_keepd.
+ *
+ * @param sock   Socket path for the keeper
+ *
+ * @return process ID of the keeper, or -1 if it is not
+ *         available.
+ */
+static pid_t start_keepd(const char *sock)
+{
+    const char *path = getenv("TILER_KEEPD");
+    int ix;
+
+    if (!path) path = "./tiler_keepd";
+    if (access(path, X_OK)) return -1;
+    pid_t pid = fork();
+    if (!pid)
+    {
+        execl(path, path, "-s", sock, NULL);
+        _exit(127);
+    }
+
+    /* wait for the keeper to come up */
+    for (ix = 0; pid > 0 && ix < 100; ix++)
+    {
+        if (!access(sock, F_OK) && !MemMgr_KeeperConnect(sock)) return pid;
+        usleep(10000);
+    }
+    if (pid > 0) kill(pid, SIGKILL);
+    return -1;
+}
+
+/* disconnects from the buffer keeper, and stops it */
+static void stop_keepd(pid_t pid)
+{
+    MemMgr_KeeperDisconnect();
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * Tests the buffer keeper.  A child process allocates and fills
+ * buffers, hands some of them to the keeper, and exits without
+ * freeing them.  Verifies that the parent can attach to the
+ * kept buffers, and only to those, with their blocks and
+ * contents intact, and that freed or unkept buffers are dropped
+ * from the keeper.  Requires the TILER emulation and the
+ * keeper.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int keeper_test()
+{
+#ifdef STUB_TILER
+    printf("Buffer keeper tests\n");
+    MemAllocBlock blocks[3];
+    char sock[64];
+    int num, status, ret = 0;
+
+    /* buffers cannot be kept without the keeper */
+    void *buf1 = alloc_1D(PAGE_SIZE, 0, 0);
+    if (NOT_P(buf1,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_Keep(buf1, 1),!=,0);
+    ret |= free_1D(PAGE_SIZE, 0, 0, buf1);
+
+    sprintf(sock, "/tmp/tiler_keep_test.%d", getpid());
+    pid_t pid = start_keepd(sock);
+    if (pid < 0) return TESTERR_NOTIMPLEMENTED;
+
+    /* the previous instance of the client */
+    fflush(stdout);
+    pid_t child = fork();
+    if (!child)
+    {
+        MemMgr_KeeperDisconnect();
+        if (MemMgr_KeeperConnect(sock)) _exit(1);
+        buf1 = alloc_1D(176 * 144 * 2, 0, 0x11);
+        void *buf2 = alloc_NV12(176, 144, 0x22);
+        void *buf3 = alloc_2D(64, 64, PIXEL_FMT_32BIT, 0, 0x33);
+        _exit(!buf1 || !buf2 || !buf3 ||
+              MemMgr_Keep(buf1, 1) || MemMgr_Keep(buf2, 2) ||
+              !MemMgr_Keep(buf2, 4) || !MemMgr_Keep(buf3, 1) ||
+              !MemMgr_Keep(buf3, 0));
+    }
+    ret |= NOT_I(waitpid(child, &status, 0),==,child);
+    ret |= NOT_I(WIFEXITED(status) && !WEXITSTATUS(status),!=,0);
+
+    /* the restarted client attaches to the kept buffers */
+    ZERO(blocks);
+    num = 3;
+    void *buf2 = MemMgr_Attach(2, blocks, &num);
+    ret |= NOT_P(buf2,!=,NULL);
+    ret |= NOT_I(num,==,2);
+    ret |= NOT_P(blocks[0].ptr,==,buf2);
+    ret |= NOT_I(blocks[0].pixelFormat,==,PIXEL_FMT_8BIT);
+    ret |= NOT_I(blocks[1].pixelFormat,==,PIXEL_FMT_16BIT);
+    ret |= NOT_I(blocks[1].dim.area.width,==,176 / 2);
+    ret |= NOT_I(MemMgr_Is2DBlock(buf2),!=,0);
+    ret |= NOT_I(MemMgr_GetStride(buf2),==,blocks[0].stride);
+    ret |= NOT_L(TilerMem_VirtToPhys(buf2),==,blocks[0].reserved);
+    buf1 = MemMgr_Attach(1, NULL, NULL);
+    ret |= NOT_P(buf1,!=,NULL);
+    ret |= NOT_I(MemMgr_Is1DBlock(buf1),!=,0);
+
+    /* buffers can be attached once, and only if they were kept */
+    ret |= NOT_P(MemMgr_Attach(1, NULL, NULL),==,NULL);
+    ret |= NOT_P(MemMgr_Attach(3, NULL, NULL),==,NULL);
+
+    /* unkept and freed buffers are dropped */
+    ret |= NOT_I(MemMgr_Unkeep(buf1),==,0);
+    ret |= NOT_I(MemMgr_Unkeep(buf1),!=,0);
+    if (buf1) ret |= free_1D(176 * 144 * 2, 0, 0x11, buf1);
+    if (buf2) ret |= free_NV12(176, 144, 0x22, buf2);
+    ret |= NOT_P(MemMgr_Attach(1, NULL, NULL),==,NULL);
+    ret |= NOT_P(MemMgr_Attach(2, NULL, NULL),==,NULL);
+
+    stop_keepd(pid);
+    return ret;
+#else
+    return TESTERR_NOTIMPLEMENTED;
+#endif
+}
+
+#ifdef STUB_TILER
+/* waits for completions on a DMA eventfd, and returns their number */
+static int dma_wait(int efd)
+{
+    struct pollfd pfd = { efd, POLLIN, 0 };
+    uint64_t n;
+    if (poll(&pfd, 1, 5000) != 1 || read(efd, &n, sizeof(n)) != sizeof(n))
+        return -1;
+    return (int) n;
+}
+#endif
+
+/**
+ * Tests the DMA engine of the stub.  Verifies 1D copies, 2D
+ * copies between and within 1D and 2D buffers, including rows
+ * that are not consecutive in the container view, and fills,
+ * that completion is signaled through the eventfd, and that
+ * unmapped addresses fault the list.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int dma_test()
+{
+#ifdef STUB_TILER
+    printf("DMA engine tests\n");
+    MemAllocBlock blocks[4];
+    TilerStubDmaDesc d[5];
+    TilerStubDmaStats st;
+    int ix, x, y, ret = 0;
+
+    TilerStubDma *dma = TilerStub_DmaCreate(2);
+    if (NOT_P(dma,!=,NULL)) return 1;
+    int efd = TilerStub_DmaGetFd(dma);
+
+    ZERO(blocks);
+    for (ix = 0; ix < 2; ix++)
+    {
+        blocks[ix].pixelFormat = PIXEL_FMT_PAGE;
+        blocks[ix].dim.len = 16 * PAGE_SIZE;
+        blocks[ix + 2].pixelFormat = PIXEL_FMT_8BIT;
+        blocks[ix + 2].dim.area.width = 200;
+        blocks[ix + 2].dim.area.height = 100;
+    }
+    uint8_t *src1d = MemMgr_Alloc(blocks, 1);
+    uint8_t *dst1d = MemMgr_Alloc(blocks + 1, 1);
+    uint8_t *src2d = MemMgr_Alloc(blocks + 2, 1);
+    uint8_t *dst2d = MemMgr_Alloc(blocks + 3, 1);
+    if (NOT_P(src1d,!=,NULL) || NOT_P(dst1d,!=,NULL) ||
+        NOT_P(src2d,!=,NULL) || NOT_P(dst2d,!=,NULL)) return 1;
+    bytes_t stride = blocks[2].stride;
+    for (ix = 0; ix < 16 * PAGE_SIZE; ix++) src1d[ix] = ix * 7;
+    for (y = 0; y < 100; y++)
+    {
+        for (x = 0; x < 200; x++) src2d[y * stride + x] = x ^ y;
+        memset(dst2d + y * stride, 0, 200);
+    }
+    uint32_t s1 = TilerMem_VirtToPhys(src1d), d1 = TilerMem_VirtToPhys(dst1d);
+    uint32_t s2 = TilerMem_VirtToPhys(src2d), d2 = TilerMem_VirtToPhys(dst2d);
+
+    memset(d, 0, sizeof(d));
+    d[0].op = TILER_STUB_DMA_COPY;          /* 1D -> 1D */
+    d[0].src = s1;
+    d[0].dst = d1;
+    d[0].width = 16 * PAGE_SIZE;
+    d[1].op = TILER_STUB_DMA_COPY_2D;       /* 2D (10,5) -> 2D (20,7) */
+    d[1].src = s2 + 5 * TILER_STRIDE_8BIT + 10;
+    d[1].dst = d2 + 7 * TILER_STRIDE_8BIT + 20;
+    d[1].width = 100;
+    d[1].height = 50;
+    d[1].src_stride = d[1].dst_stride = TILER_STRIDE_8BIT;
+    d[2].op = TILER_STUB_DMA_FILL;          /* fill at (0,60) */
+    d[2].dst = d2 + 60 * TILER_STRIDE_8BIT;
+    d[2].width = 50;
+    d[2].height = 30;
+    d[2].dst_stride = TILER_STRIDE_8BIT;
+    d[2].value = 0xA5;
+    d[3].op = TILER_STUB_DMA_COPY_2D;       /* 1D -> 2D (120,60) */
+    d[3].src = s1;
+    d[3].dst = d2 + 60 * TILER_STRIDE_8BIT + 120;
+    d[3].width = 64;
+    d[3].height = 20;
+    d[3].src_stride = 64;
+    d[3].dst_stride = TILER_STRIDE_8BIT;
+    d[4].op = TILER_STUB_DMA_COPY_2D;       /* every other row at (0,0) */
+    d[4].src = s2;
+    d[4].dst = d2;
+    d[4].width = 16;
+    d[4].height = 3;
+    d[4].src_stride = TILER_STRIDE_8BIT;
+    d[4].dst_stride = 2 * TILER_STRIDE_8BIT;
+
+    int seq = TilerStub_DmaSubmit(dma, d, 5);
+    ret |= NOT_I(seq,>,0);
+    ret |= NOT_I(dma_wait(efd),==,1);
+    ret |= NOT_I(TilerStub_DmaResult(dma, seq),==,0);
+
+    ret |= NOT_I(memcmp(src1d, dst1d, 16 * PAGE_SIZE),==,0);
+    for (y = 0; y < 100; y++)
+    {
+        for (x = 0; x < 200; x++)
+        {
+            uint8_t exp = 0;
+            if (x >= 20 && x < 120 && y >= 7 && y < 57)
+                exp = (x - 10) ^ (y - 2);
+            else if (x < 50 && y >= 60 && y < 90) exp = 0xA5;
+            else if (x >= 120 && x < 184 && y >= 60 && y < 80)
+                exp = ((y - 60) * 64 + x - 120) * 7;
+            else if (x < 16 && y < 5 && !(y & 1)) exp = x ^ (y / 2);
+            if (dst2d[y * stride + x] != exp)
+            {
+                ret |= NOT_I(dst2d[y * stride + x],==,exp);
+                y = 100;
+                break;
+            }
+        }
+    }
+
+    /* unmapped addresses fault the list, but earlier descriptors are
+       done */
+    d[0].dst = TILER_MEM_32BIT + 64 * TILER_STRIDE_32BIT;
+    seq = TilerStub_DmaSubmit(dma, d + 2, 1);
+    ret |= NOT_I(TilerStub_DmaSubmit(dma, d, 1),==,seq + 1);
+    for (ix = 0; ix < 2 && (x = dma_wait(efd)) > 0; ix += x);
+    ret |= NOT_I(ix,==,2);
+    ret |= NOT_I(TilerStub_DmaResult(dma, 2),==,0);
+    ret |= NOT_I(TilerStub_DmaResult(dma, 3),==,-EFAULT);
+    ret |= NOT_I(TilerStub_DmaResult(dma, 4),==,-ENOENT);
+
+    /* invalid descriptors are rejected */
+    d[0].dst = d1;
+    d[0].width = 0;
+    ret |= NOT_I(TilerStub_DmaSubmit(dma, d, 1),==,-EINVAL);
+    d[0].op = 0;
+    d[0].width = 1;
+    ret |= NOT_I(TilerStub_DmaSubmit(dma, d, 1),==,-EINVAL);
+    d[1].src = 0xFFFFFF00;
+    ret |= NOT_I(TilerStub_DmaSubmit(dma, d + 1, 1),==,-EINVAL);
+
+    TilerStub_DmaGetStats(dma, &st);
+    ret |= NOT_I(st.lists,==,3);
+    ret |= NOT_I(st.descriptors,==,6);
+    ret |= NOT_I(st.faults,==,1);
+    TilerStub_DmaDestroy(dma);
+
+    for (ix = 0; ix < 4; ix++)
+        ret |= NOT_I(MemMgr_Free(blocks[ix].ptr),==,0);
+    return ret;
+#else
+    return TESTERR_NOTIMPLEMENTED;
+#endif
+}
+
+/**
+ * Tests slot-order traversal of a 2D buffer.  Verifies that the
+ * tiles are slot aligned, lie within a slot and the buffer, and
+ * point to their top-left pixel, that every pixel is visited
+ * exactly once, and that the tiles are visited in slot order.
+ *
+ * @param width   Width of the buffer
+ * @param height  Height of the buffer
+ * @param fmt     Pixel format of the buffer
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int tile_iter_test(pixels_t width, pixels_t height, pixel_fmt_t fmt)
+{
+    printf("Slot-order traversal of %dx%d %d-bit buffer\n", width, height,
+           TILER_PIXEL_SIZE(fmt) * 8);
+    uint32_t sw = TILER_SLOT_WIDTH(fmt), sh = TILER_SLOT_HEIGHT(fmt);
+    uint32_t x, y, num_tiles = 0, num_pixels = 0, last = 0;
+    TilerTileIter it;
+    uint8_t *seen;
+    int ret = 0;
+
+    void *bufPtr = alloc_2D(width, height, fmt, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    bytes_t stride = MemMgr_GetStride(bufPtr);
+    ALLOCN(seen, width * height);
+    if (NOT_P(seen,!=,NULL))
+    {
+        ret = 1;
+        goto DONE;
+    }
+
+    TILER_FOR_EACH_TILE(it, bufPtr, stride, width, height, fmt)
+    {
+        uint32_t slot = (it.y / sh) * ((width + sw - 1) / sw) + it.x / sw;
+        if (NOT_I(it.x % sw,==,0) || NOT_I(it.y % sh,==,0) ||
+            NOT_I(it.width,<=,sw) || NOT_I(it.height,<=,sh) ||
+            NOT_I(it.x + it.width,<=,width) ||
+            NOT_I(it.y + it.height,<=,height) ||
+            NOT_P(it.ptr,==,(char *) bufPtr + it.y * stride +
+                  it.x * TILER_PIXEL_SIZE(fmt)) ||
+            NOT_I(slot,==,num_tiles))
+        {
+            ret = 1;
+            break;
+        }
+        num_tiles++;
+    }
+    ret |= NOT_I(num_tiles,==,((width + sw - 1) / sw) *
+                              ((height + sh - 1) / sh));
+
+    TILER_FOR_EACH_PIXEL(it, x, y, bufPtr, stride, width, height, fmt)
+    {
+        uint32_t tile = (y / sh) * ((width + sw - 1) / sw) + x / sw;
+        ret |= NOT_P(TILER_TILE_PIXEL(it, x, y),==,(char *) bufPtr +
+                     y * stride + x * TILER_PIXEL_SIZE(fmt));
+        ret |= NOT_I(tile,>=,last);
+        last = tile;
+        seen[y * width + x]++;
+        num_pixels++;
+    }
+    ret |= NOT_I(num_pixels,==,width * height);
+    for (x = 0; x < width * height; x++)
+    {
+        if (NOT_I(seen[x],==,1))
+        {
+            ret = 1;
+            break;
+        }
+    }
+
+DONE:
+    FREE(seen);
+    ret |= free_2D(width, height, fmt, 0, 0, bufPtr);
+    return ret;
+}
+
+/* tile checks of parallel_test */
+struct par_check {
+    void    *ptr;
+    bytes_t  stride;
+    pixel_fmt_t fmt;
+    pixels_t width, height, tile_w, tile_h;
+    uint8_t *seen;
+    int      errors;
+};
+
+static void par_tile(void *arg, void *ptr, bytes_t stride, pixels_t x,
+                     pixels_t y, pixels_t width, pixels_t height)
+{
+    struct par_check *c = (struct par_check *) arg;
+    pixels_t ix, iy;
+
+    if (NOT_I(x % c->tile_w,==,0) || NOT_I(y % c->tile_h,==,0) ||
+        NOT_I(width,<=,c->tile_w) || NOT_I(height,<=,c->tile_h) ||
+        NOT_I(x + width,<=,c->width) || NOT_I(y + height,<=,c->height) ||
+        NOT_I(stride,==,c->stride) ||
+        NOT_P(ptr,==,(char *) c->ptr + y * stride +
+              x * TILER_PIXEL_SIZE(c->fmt)))
+    {
+        __sync_fetch_and_add(&c->errors, 1);
+        return;
+    }
+
+    /* tiles do not overlap, so there are no races on seen */
+    for (iy = y; iy < y + height; iy++)
+    {
+        for (ix = x; ix < x + width; ix++)
+        {
+            c->seen[iy * c->width + ix]++;
+        }
+    }
+}
+
+/**
+ * Tests MemMgr_ParallelFor2D.  Verifies that the tiles are slot
+ * aligned, lie within the block and point to their top-left
+ * pixel, that every pixel is covered exactly once, and that 1D
+ * blocks are rejected.
+ *
+ * @param width        Width of the buffer
+ * @param height       Height of the buffer
+ * @param fmt          Pixel format of the buffer
+ * @param tile_w       Requested tile width
+ * @param tile_h       Requested tile height
+ * @param num_workers  Number of threads
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int parallel_test(pixels_t width, pixels_t height, pixel_fmt_t fmt,
+                  pixels_t tile_w, pixels_t tile_h, int num_workers)
+{
+    printf("Parallel tiles of %dx%d %d-bit buffer on %d threads\n", width,
+           height, TILER_PIXEL_SIZE(fmt) * 8, num_workers);
+    uint32_t sw = TILER_SLOT_WIDTH(fmt), sh = TILER_SLOT_HEIGHT(fmt);
+    MemMgrParallelStats st;
+    struct par_check c;
+    uint32_t ix;
+    int ret = 0;
+
+    ZERO(c);
+    c.fmt = fmt;
+    c.width = width;
+    c.height = height;
+    c.tile_w = tile_w ? (tile_w + sw - 1) / sw * sw : sw;
+    c.tile_h = tile_h ? (tile_h + sh - 1) / sh * sh : sh;
+    c.ptr = alloc_2D(width, height, fmt, 0, 0);
+    void *buf1D = alloc_1D(PAGE_SIZE, 0, 0);
+    ALLOCN(c.seen, width * height);
+    if (NOT_P(c.ptr,!=,NULL) || NOT_P(buf1D,!=,NULL) ||
+        NOT_P(c.seen,!=,NULL))
+    {
+        ret = 1;
+        goto DONE;
+    }
+    c.stride = MemMgr_GetStride(c.ptr);
+
+    ret |= NOT_I(MemMgr_SetParallelism(num_workers),==,0);
+    ret |= NOT_I(MemMgr_ParallelFor2D(c.ptr, tile_w, tile_h, par_tile, &c),
+                 ==,0);
+    ret |= NOT_I(c.errors,==,0);
+    for (ix = 0; ix < (uint32_t) width * height; ix++)
+    {
+        if (NOT_I(c.seen[ix],==,1))
+        {
+            ret = 1;
+            break;
+        }
+    }
+    MemMgr_GetParallelStats(&st);
+    ret |= NOT_I(st.workers,==,num_workers);
+    ret |= NOT_I(st.jobs,==,1);
+    ret |= NOT_I(st.tiles,==,((width + c.tile_w - 1) / c.tile_w) *
+                             ((height + c.tile_h - 1) / c.tile_h));
+
+    /* only 2D blocks can be split */
+    ret |= NOT_I(MemMgr_ParallelFor2D(buf1D, 0, 0, par_tile, &c),!=,0);
+    ret |= NOT_I(MemMgr_ParallelFor2D((char *) c.ptr + 64, 0, 0, par_tile,
+                                      &c),!=,0);
+    ret |= NOT_I(MemMgr_SetParallelism(0),==,0);
+
+DONE:
+    FREE(c.seen);
+    if (buf1D) ret |= free_1D(PAGE_SIZE, 0, 0, buf1D);
+    if (c.ptr) ret |= free_2D(width, height, fmt, 0, 0, c.ptr);
+    return ret;
+}
+
+/**
+ * Tests frame digests.  Verifies the CRC32C check value, that
+ * the padding past the row width is ignored, that block digests
+ * match plane digests of the same contents, that any changed
+ * pixel changes the digest, and that parallel digests match.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int digest_test()
+{
+    printf("Frame digest tests\n");
+    MemAllocBlock block;
+    uint32_t digest, seq, x, y;
+    int ret = 0;
+
+    /* CRC32C check value */
+    ret |= NOT_I(MemMgr_DigestPlane("123456789", 9, 1, 0),==,0xE3069283);
+
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_16BIT;
+    block.dim.area.width = 1920;
+    block.dim.area.height = 1080;
+    void *bufPtr = MemMgr_Alloc(&block, 1);
+    void *buf1D = alloc_1D(3 * (1 << 20) + 100, 0, 0x1D);
+    bytes_t row_len = 1920 * 2;
+    uint8_t *packed = malloc(row_len * 1080);
+    if (NOT_P(bufPtr,!=,NULL) || NOT_P(buf1D,!=,NULL) ||
+        NOT_P(packed,!=,NULL))
+    {
+        ret = 1;
+        goto DONE;
+    }
+    block.stride = MemMgr_GetStride(bufPtr);
+    fill_mem(0x2D, &block);
+
+    /* the digest of a packed copy is the same */
+    for (y = 0; y < 1080; y++)
+    {
+        memcpy(packed + y * row_len, (char *) bufPtr + y * block.stride,
+               row_len);
+    }
+    ret |= NOT_I(MemMgr_DigestBlock(bufPtr, &digest),==,0);
+    ret |= NOT_I(MemMgr_DigestPlane(packed, row_len, 1080, row_len),==,digest);
+    ret |= NOT_I(MemMgr_DigestPlane(packed, row_len * 1080, 1, 0),==,digest);
+
+    /* parallel digests are the same */
+    ret |= NOT_I(MemMgr_SetParallelism(1),==,0);
+    ret |= NOT_I(MemMgr_DigestPlane(bufPtr, row_len, 1080, block.stride),==,
+                 digest);
+    seq = MemMgr_DigestPlane(buf1D, 3 * (1 << 20) + 100, 1, 0);
+    ret |= NOT_I(MemMgr_SetParallelism(4),==,0);
+    ret |= NOT_I(MemMgr_DigestPlane(bufPtr, row_len, 1080, block.stride),==,
+                 digest);
+    ret |= NOT_I(MemMgr_DigestPlane(buf1D, 3 * (1 << 20) + 100, 1, 0),==,seq);
+    ret |= NOT_I(MemMgr_DigestBlock(buf1D, &digest),==,0);
+    ret |= NOT_I(digest,==,seq);
+    ret |= NOT_I(MemMgr_SetParallelism(0),==,0);
+
+    /* padding is ignored, but any pixel counts */
+    ret |= NOT_I(MemMgr_DigestBlock(bufPtr, &digest),==,0);
+    if (block.stride > row_len)
+    {
+        ((uint8_t *) bufPtr)[row_len] ^= 1;
+        ret |= NOT_I(MemMgr_DigestPlane(bufPtr, row_len, 1080, block.stride),
+                     ==,digest);
+        ((uint8_t *) bufPtr)[row_len] ^= 1;
+    }
+    for (x = 0; x < 4; x++)
+    {
+        uint8_t *p = (uint8_t *) bufPtr + (rand() % 1080) * block.stride +
+                     rand() % row_len, val = *p;
+        *p ^= 1 << (rand() % 8);
+        ret |= NOT_I(MemMgr_DigestPlane(bufPtr, row_len, 1080, block.stride),
+                     !=,digest);
+        ret |= NOT_I(check_mem(0x2D, &block),!=,0);
+        *p = val;
+    }
+    ret |= NOT_I(check_mem(0x2D, &block),==,0);
+
+    /* only blocks have digests */
+    ret |= NOT_I(MemMgr_DigestBlock((char *) bufPtr + 64, &digest),!=,0);
+
+DONE:
+    FREE(packed);
+    if (buf1D) ret |= free_1D(3 * (1 << 20) + 100, 0, 0x1D, buf1D);
+    if (bufPtr) ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return ret;
+}
+
+/* queries the stride of a 64x64 8-bit buffer */
+static void *lock_worker(void *bufPtr)
+{
+    int ix, failed = 0;
+    for (ix = 0; ix < 100; ix++)
+    {
+        failed |= MemMgr_GetStride(bufPtr) != PAGE_SIZE;
+    }
+    return (void *)(intptr_t) failed;
+}
+
+/**
+ * Tests lock statistics.  Verifies that the locks taken by
+ * concurrent allocations are reported with their call sites,
+ * that the call sites and histograms add up to the totals of a
+ * lock, and that nothing is recorded while disabled.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int lock_stats_test()
+{
+    printf("Lock statistics tests\n");
+    MemMgrLockStats stats[64];
+    pthread_t threads[2];
+    uint64_t acq = 0, sites = 0, waits, holds;
+    int ix, b, num, found = 0, ret = 0;
+    void *res;
+
+    void *bufPtr = alloc_2D(64, 64, PIXEL_FMT_8BIT, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_SetLockStats(1),==,0);
+    MemMgr_ResetLockStats();
+    for (ix = 0; ix < 2; ix++)
+    {
+        ret |= NOT_I(pthread_create(threads + ix, NULL, lock_worker,
+                                    bufPtr),==,0);
+    }
+    for (ix = 0; ix < 2; ix++)
+    {
+        pthread_join(threads[ix], &res);
+        ret |= NOT_P(res,==,NULL);
+    }
+    ret |= NOT_I(MemMgr_SetLockStats(0),==,1);
+
+    num = MemMgr_GetLockStats(stats, 64);
+    ret |= NOT_I(MemMgr_GetLockStats(NULL, 0),==,num);
+    ret |= NOT_I(MemMgr_GetLockStats(NULL, 1),==,-1);
+    if (NOT_I(num,>,0) || NOT_I(num,<=,64)) return 1;
+    for (ix = 0; ix < num; ix++)
+    {
+        if (strcmp(stats[ix].lock, "che_mutex")) continue;
+        if (!stats[ix].func)
+        {
+            acq = stats[ix].acquisitions;
+            found++;
+        }
+        else
+        {
+            sites += stats[ix].acquisitions;
+            found += !strcmp(stats[ix].func, "buf_cache_query");
+        }
+        ret |= NOT_I(stats[ix].contended,<=,stats[ix].acquisitions);
+        for (b = 0, waits = holds = 0; b < MEMMGR_LOCK_BUCKETS; b++)
+        {
+            waits += stats[ix].wait_hist[b];
+            holds += stats[ix].hold_hist[b];
+        }
+        ret |= NOT_L(waits,==,stats[ix].acquisitions);
+        ret |= NOT_L(holds,==,stats[ix].acquisitions);
+    }
+    ret |= NOT_I(found,==,2);
+    ret |= NOT_L(acq,>=,200);
+    ret |= NOT_L(sites,==,acq);
+
+    /* nothing is recorded while disabled */
+    ret |= NOT_P(lock_worker(bufPtr),==,NULL);
+    ret |= NOT_I(MemMgr_GetLockStats(stats, 64),==,num);
+    for (ix = 0; ix < num; ix++)
+    {
+        if (!strcmp(stats[ix].lock, "che_mutex") && !stats[ix].func)
+            ret |= NOT_L(stats[ix].acquisitions,==,acq);
+    }
+    MemMgr_ResetLockStats();
+    MemMgr_GetLockStats(stats, 1);
+    ret |= NOT_L(stats[0].acquisitions,==,0);
+    ret |= free_2D(64, 64, PIXEL_FMT_8BIT, 0, 0, bufPtr);
+    return ret;
+}
+
+/**
+ * Tests per-buffer user metadata.  Verifies that the metadata is
+ * cleared on allocation, can be stored and retrieved in parts
+ * through any pointer within the buffer, is kept per buffer,
+ * and that out-of-bounds accesses and unknown pointers fail.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int user_data_test()
+{
+    printf("User metadata tests\n");
+    uint8_t data[MEMMGR_USER_DATA_SIZE], zero[MEMMGR_USER_DATA_SIZE];
+    uint32_t frame_id = 1234;
+    int ix, ret = 0;
+
+    void *buf1d = alloc_1D(PAGE_SIZE, 0, 0);
+    void *nv12 = alloc_NV12(176, 144, 0);
+    if (NOT_P(buf1d,!=,NULL) || NOT_P(nv12,!=,NULL)) return 1;
+    bytes_t stride = MemMgr_GetStride(nv12);
+
+    memset(zero, 0, sizeof(zero));
+    ret |= NOT_I(MemMgr_GetUserData(nv12, 0, data, sizeof(data)),==,0);
+    ret |= NOT_I(memcmp(data, zero, sizeof(data)),==,0);
+
+    for (ix = 0; ix < MEMMGR_USER_DATA_SIZE; ix++) data[ix] = ix;
+    ret |= NOT_I(MemMgr_SetUserData(buf1d, 0, data, sizeof(data)),==,0);
+    ret |= NOT_I(MemMgr_SetUserData(nv12, 8, &frame_id, sizeof(frame_id)),
+                 ==,0);
+
+    /* any pointer within the buffer resolves to the same metadata */
+    memset(data, 0, sizeof(data));
+    ret |= NOT_I(MemMgr_GetUserData((char *) buf1d + 100, 0, data,
+                                    sizeof(data)),==,0);
+    for (ix = 0; ix < MEMMGR_USER_DATA_SIZE; ix++)
+    {
+        if (data[ix] != ix) ret |= NOT_I(data[ix],==,ix);
+    }
+    frame_id = 0;
+    ret |= NOT_I(MemMgr_GetUserData((char *) nv12 + 144 * stride + 10, 8,
+                                    &frame_id, sizeof(frame_id)),==,0);
+    ret |= NOT_I(frame_id,==,1234);
+    ret |= NOT_I(MemMgr_GetUserData(nv12, 0, data, 8),==,0);
+    ret |= NOT_I(memcmp(data, zero, 8),==,0);
+
+    /* out of bounds accesses and unknown pointers fail */
+    ret |= NOT_I(MemMgr_SetUserData(nv12, MEMMGR_USER_DATA_SIZE - 2,
+                                    &frame_id, sizeof(frame_id)),!=,0);
+    ret |= NOT_I(MemMgr_GetUserData(nv12, MEMMGR_USER_DATA_SIZE + 1, data,
+                                    0),!=,0);
+    ret |= NOT_I(MemMgr_GetUserData(data, 0, data, 1),!=,0);
+
+    /* metadata is cleared for new buffers */
+    ret |= free_1D(PAGE_SIZE, 0, 0, buf1d);
+    ret |= NOT_I(MemMgr_GetUserData(buf1d, 0, data, 1),!=,0);
+    buf1d = alloc_1D(PAGE_SIZE, 0, 0);
+    if (NOT_P(buf1d,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_GetUserData(buf1d, 0, data, sizeof(data)),==,0);
+    ret |= NOT_I(memcmp(data, zero, sizeof(data)),==,0);
+
+    ret |= free_1D(PAGE_SIZE, 0, 0, buf1d);
+    ret |= free_NV12(176, 144, 0, nv12);
+    return ret;
+}
+
+/* takes and drops references, then drops the one it was given */
+static void *ref_worker(void *bufPtr)
+{
+    int ix, failed = 0;
+    for (ix = 0; ix < 1000; ix++)
+    {
+        failed |= MemMgr_Ref(bufPtr);
+        failed |= MemMgr_RefCount(bufPtr) < 2;
+        failed |= MemMgr_Unref(bufPtr);
+    }
+    failed |= MemMgr_Unref(bufPtr);
+    return (void *)(intptr_t) failed;
+}
+
+/**
+ * Tests shared ownership.  Verifies that buffers start with one
+ * reference, that references are counted across threads, that
+ * the last MemMgr_Unref() frees the buffer, that MemMgr_Free()
+ * only drops the allocator's reference while others hold one,
+ * and that interior and freed pointers are rejected.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int ref_test()
+{
+    printf("Shared ownership tests\n");
+    pthread_t threads[4];
+    int ix, ret = 0;
+    void *res;
+
+    void *bufPtr = alloc_2D(64, 64, PIXEL_FMT_8BIT, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,1);
+    ret |= NOT_I(MemMgr_Ref((char *) bufPtr + 1),!=,0);
+    ret |= NOT_I(MemMgr_RefCount((char *) bufPtr + 1),==,0);
+
+    /* the references of the workers outlive the allocator's */
+    for (ix = 0; ix < 4; ix++)
+    {
+        ret |= NOT_I(MemMgr_Ref(bufPtr),==,0);
+    }
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,5);
+    ret |= NOT_I(MemMgr_Unref(bufPtr),==,0);
+    for (ix = 0; ix < 4; ix++)
+    {
+        ret |= NOT_I(pthread_create(threads + ix, NULL, ref_worker,
+                                    bufPtr),==,0);
+    }
+    for (ix = 0; ix < 4; ix++)
+    {
+        pthread_join(threads[ix], &res);
+        ret |= NOT_P(res,==,NULL);
+    }
+
+    /* the last worker freed the buffer */
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,0);
+    ret |= NOT_I(MemMgr_Ref(bufPtr),!=,0);
+    ret |= NOT_I(MemMgr_Unref(bufPtr),!=,0);
+    ret |= NOT_I(MemMgr_Free(bufPtr),!=,0);
+
+    /* a buffer freed explicitly is gone as well */
+    bufPtr = alloc_1D(PAGE_SIZE, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_Ref(bufPtr),==,0);
+    ret |= NOT_I(MemMgr_Unref(bufPtr),==,0);
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,1);
+    ret |= free_1D(PAGE_SIZE, 0, 0, bufPtr);
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,0);
+
+    /* freeing a shared buffer leaves it to the other owners */
+    bufPtr = alloc_1D(PAGE_SIZE, 0, 0x55);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_Ref(bufPtr),==,0);
+    ret |= free_1D(PAGE_SIZE, 0, 0x55, bufPtr);
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,1);
+    ret |= NOT_I(MemMgr_Is1DBlock(bufPtr),!=,0);
+    ret |= NOT_I(MemMgr_Unref(bufPtr),==,0);
+    ret |= NOT_I(MemMgr_RefCount(bufPtr),==,0);
+    return ret;
+}
+
+/**
+ * Allocates an NV12 buffer for a usage, and checks that its
+ * blocks have the expected layout.
+ *
+ * @param usage   Usage bits
+ * @param layout  Expected layout of the blocks
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+static int usage_check(uint32_t usage, int layout)
+{
+    MemAllocBlock blocks[2];
+    MemMgrLayout lay;
+    int ix, ret = 0;
+
+    ZERO(blocks);
+    blocks[0].pixelFormat = PIXEL_FMT_8BIT;
+    blocks[0].dim.area.width  = 176;
+    blocks[0].dim.area.height = 144;
+    blocks[1].pixelFormat = PIXEL_FMT_16BIT;
+    blocks[1].dim.area.width  = 88;
+    blocks[1].dim.area.height = 72;
+
+    void *bufPtr = MemMgr_AllocUsage(blocks, 2, usage);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_GetLayout(blocks[1].ptr, &lay),==,0);
+    ret |= NOT_I(lay.usage,==,usage);
+    ret |= NOT_I(lay.num_blocks,==,2);
+    for (ix = 0; ix < 2; ix++)
+    {
+        ret |= NOT_I(lay.layout[ix],==,layout);
+        ret |= NOT_I(lay.stride[ix],==,blocks[ix].stride);
+        if (layout == MEMMGR_LAYOUT_2D)
+        {
+            ret |= NOT_I(MemMgr_Is2DBlock(blocks[ix].ptr),!=,0);
+            ret |= NOT_I(MemMgr_GetStride(blocks[ix].ptr),==,
+                         blocks[ix].stride);
+            continue;
+        }
+
+        /* planes are cache line aligned rows of 1D blocks */
+        ret |= NOT_I(MemMgr_Is1DBlock(blocks[ix].ptr),!=,0);
+        ret |= NOT_I(blocks[ix].pixelFormat,==,PIXEL_FMT_PAGE);
+        ret |= NOT_I(blocks[ix].stride,==,192);
+        ret |= NOT_I(MemMgr_GetStride(blocks[ix].ptr),==,192);
+        ret |= NOT_I(MemMgrView_GetStride(MemMgr_GetView(),
+                                          blocks[ix].ptr),==,192);
+        ret |= NOT_I(blocks[ix].dim.len,>=,192 * (144 >> ix));
+        memset(blocks[ix].ptr, ix + 1, 192 * (144 >> ix));
+    }
+    ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+    return ret;
+}
+
+/**
+ * Tests usage driven allocation.  Verifies that the usage bits
+ * select 1D or 2D blocks, that the layout of each block is
+ * reported, and that invalid usage bits are rejected.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int usage_test()
+{
+    printf("Usage driven allocation tests\n");
+    MemAllocBlock block;
+    MemMgrLayout lay;
+    int ret = 0;
+
+    ret |= usage_check(MEMMGR_USAGE_CPU_READ_OFTEN, MEMMGR_LAYOUT_1D);
+    ret |= usage_check(MEMMGR_USAGE_CPU_WRITE_OFTEN | MEMMGR_USAGE_DISPLAY,
+                       MEMMGR_LAYOUT_2D);
+    ret |= usage_check(MEMMGR_USAGE_CPU_READ_OFTEN |
+                       MEMMGR_USAGE_CPU_WRITE_OFTEN, MEMMGR_LAYOUT_1D);
+    ret |= usage_check(MEMMGR_USAGE_CPU_WRITE_OFTEN | MEMMGR_USAGE_ROTATE,
+                       MEMMGR_LAYOUT_2D);
+    ret |= usage_check(MEMMGR_USAGE_DISPLAY, MEMMGR_LAYOUT_2D);
+    ret |= usage_check(MEMMGR_USAGE_DMA_ONLY, MEMMGR_LAYOUT_2D);
+    ret |= usage_check(0, MEMMGR_LAYOUT_2D);
+
+    /* 1D blocks are passed through, and other buffers have no usage */
+    ZERO(block);
+    block.pixelFormat = PIXEL_FMT_PAGE;
+    block.dim.len = 3 * PAGE_SIZE;
+    void *bufPtr = MemMgr_AllocUsage(&block, 1, MEMMGR_USAGE_ROTATE);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_GetLayout(bufPtr, &lay),==,0);
+    ret |= NOT_I(lay.layout[0],==,MEMMGR_LAYOUT_1D);
+    ret |= NOT_I(lay.stride[0],==,0);
+    ret |= NOT_I(MemMgr_Free(bufPtr),==,0);
+
+    bufPtr = alloc_2D(64, 64, PIXEL_FMT_16BIT, 0, 0);
+    if (NOT_P(bufPtr,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_GetLayout(bufPtr, &lay),==,0);
+    ret |= NOT_I(lay.usage,==,0);
+    ret |= NOT_I(lay.layout[0],==,MEMMGR_LAYOUT_2D);
+    ret |= NOT_I(lay.stride[0],==,MemMgr_GetStride(bufPtr));
+    ret |= free_2D(64, 64, PIXEL_FMT_16BIT, 0, 0, bufPtr);
+
+    /* invalid or contradictory usage bits and unknown pointers fail */
+    ret |= NOT_P(MemMgr_AllocUsage(&block, 1, 0x100),==,NULL);
+    ret |= NOT_P(MemMgr_AllocUsage(&block, 1, MEMMGR_USAGE_DMA_ONLY |
+                                   MEMMGR_USAGE_CPU_READ_OFTEN),==,NULL);
+    ret |= NOT_P(MemMgr_AllocUsage(&block, 1, MEMMGR_USAGE_DMA_ONLY |
+                                   MEMMGR_USAGE_CPU_WRITE_OFTEN),==,NULL);
+    ret |= NOT_I(MemMgr_GetLayout(&lay, &lay),!=,0);
+    return ret;
+}
+
+/**
+ * Tests the read-only view of the registry.  Verifies that the
+ * inline queries agree with MemMgr_GetStride(),
+ * MemMgr_GetFormat() and MemMgr_IsMapped() for pointers within
+ * 1D, 2D and NV12 buffers, and that freed buffers drop out of
+ * the view.  In aperture mode 2D blocks are not in the view,
+ * and are resolved by the fallbacks.
+ *
+ * @param aperture  Whether to use aperture mode
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int view_test(int aperture)
+{
+    printf("Registry view tests (%s)\n",
+           aperture ? "aperture" : "per-buffer mmap");
+    static const int buf_ix[6] = {0, 0, 1, 2, 2, 2};
+    const MemMgrView *view = MemMgr_GetView();
+    MemAllocBlock blocks[3];
+    MemMgrViewRange r;
+    void *bufs[3], *ptrs[6];
+    int ix, ret = 0;
+
+    if (aperture && MemMgr_SetApertureMode(1)) return TESTERR_NOTIMPLEMENTED;
+    uint32_t seq = view->seq;
+    ZERO(blocks);
+    blocks[0].pixelFormat = PIXEL_FMT_8BIT;
+    blocks[0].dim.area.width  = 176;
+    blocks[0].dim.area.height = 144;
+    blocks[1].pixelFormat = PIXEL_FMT_16BIT;
+    blocks[1].dim.area.width  = 88;
+    blocks[1].dim.area.height = 72;
+    blocks[2].pixelFormat = PIXEL_FMT_16BIT;
+    blocks[2].dim.area.width  = 176;
+    blocks[2].dim.area.height = 144;
+    bufs[0] = alloc_1D(3 * PAGE_SIZE, 0, 0);
+    bufs[1] = MemMgr_Alloc(blocks + 2, 1);
+    bufs[2] = MemMgr_Alloc(blocks, 2);
+    if (NOT_P(bufs[0],!=,NULL) || NOT_P(bufs[1],!=,NULL) ||
+        NOT_P(bufs[2],!=,NULL)) return 1;
+    ret |= NOT_I(view->seq,==,seq + 6);
+
+    ptrs[0] = bufs[0];
+    ptrs[1] = (char *) bufs[0] + 3 * PAGE_SIZE - 1;
+    ptrs[2] = (char *) bufs[1] + 100 * blocks[2].stride + 7;
+    ptrs[3] = bufs[2];
+    ptrs[4] = (char *) blocks[1].ptr + 10;
+    ptrs[5] = (char *) blocks[1].ptr + 71 * blocks[1].stride + 175;
+    for (ix = 0; ix < 6; ix++)
+    {
+        bool in_view = !aperture || MemMgr_Is1DBlock(ptrs[ix]);
+        ret |= NOT_I(MemMgrView_Find(view, ptrs[ix], &r),==,in_view);
+        if (in_view) ret |= NOT_P(r.bufPtr,==,bufs[buf_ix[ix]]);
+        ret |= NOT_I(MemMgrView_GetStride(view, ptrs[ix]),==,
+                     MemMgr_GetStride(ptrs[ix]));
+        ret |= NOT_I(MemMgrView_GetFormat(view, ptrs[ix]),==,
+                     MemMgr_GetFormat(ptrs[ix]));
+        ret |= NOT_I(MemMgrView_IsMapped(view, ptrs[ix]),!=,0);
+    }
+    ret |= NOT_I(MemMgrView_GetFormat(view, ptrs[4]),==,PIXEL_FMT_16BIT);
+    ret |= NOT_I(MemMgrView_Find(view, &r, &r),==,0);
+    ret |= NOT_I(MemMgrView_IsMapped(view, &r),==,0);
+
+    /* freed buffers drop out of the view */
+    ret |= free_1D(3 * PAGE_SIZE, 0, 0, bufs[0]);
+    ret |= NOT_I(MemMgrView_Find(view, ptrs[1], &r),==,0);
+    ret |= NOT_I(MemMgr_Free(bufs[1]),==,0);
+    ret |= NOT_I(MemMgr_Free(bufs[2]),==,0);
+    ret |= NOT_I(MemMgrView_Find(view, ptrs[4], &r),==,0);
+    ret |= NOT_I(view->seq,==,seq + 12);
+    if (aperture) ret |= NOT_I(MemMgr_SetApertureMode(0),==,0);
+    return ret;
+}
+
+/* ring of the ring tests, with the number of bytes to pass through */
+struct ring_job {
+    MemMgrRing ring;
+    uint32_t   total;
+};
+
+/* produces a byte sequence into a ring in chunks of odd sizes */
+static void *ring_producer(void *arg)
+{
+    struct ring_job *job = arg;
+    uint32_t ix, num, avail, done = 0;
+    while (done < job->total)
+    {
+        uint8_t *p = MemMgrRing_WritePtr(&job->ring, &avail);
+        num = done % 1499 + 1;
+        if (num > avail) num = avail;
+        if (num > job->total - done) num = job->total - done;
+        for (ix = 0; ix < num; ix++) p[ix] = (uint8_t)(done + ix);
+        MemMgrRing_Produce(&job->ring, num);
+        done += num;
+        if (!num) sched_yield();
+    }
+    return NULL;
+}
+
+/**
+ * Tests double-mapped rings.  Verifies that both mappings of a
+ * ring share the backing and the system space address, that a
+ * byte sequence passes through the ring intact when produced
+ * and consumed across the wrap point on separate threads, and
+ * that invalid lengths and aperture mode are rejected.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int ring_test()
+{
+    printf("Ring buffer tests\n");
+    bytes_t len = 3 * PAGE_SIZE;
+    struct ring_job job;
+    pthread_t thread;
+    uint32_t ix, avail, done = 0;
+    int ret = 0;
+
+    char *ring = MemMgr_AllocRing(len);
+    if (NOT_P(ring,!=,NULL)) return 1;
+    ret |= NOT_I(MemMgr_Is1DBlock(ring),!=,0);
+    ret |= NOT_L(TilerMem_VirtToPhys(ring + len + 100),==,
+                 TilerMem_VirtToPhys(ring + 100));
+
+    /* writes across the end show up at the start */
+    memcpy(ring + len - 4, "wrapped!", 8);
+    ret |= NOT_I(memcmp(ring, "ped!", 4),==,0);
+    ret |= NOT_I(memcmp(ring + len - 4, "wrapped!", 8),==,0);
+
+    MemMgrRing_Init(&job.ring, ring, len);
+    job.total = 10 * len + 123;
+    ret |= NOT_I(pthread_create(&thread, NULL, ring_producer, &job),==,0);
+    while (!ret && done < job.total)
+    {
+        const uint8_t *p = MemMgrRing_ReadPtr(&job.ring, &avail);
+        if (avail > 1000) avail = 1000;
+        for (ix = 0; ix < avail; ix++)
+        {
+            if (p[ix] != (uint8_t)(done + ix))
+            {
+                ret |= NOT_I(p[ix],==,(uint8_t)(done + ix));
+                break;
+            }
+        }
+        MemMgrRing_Consume(&job.ring, avail);
+        done += avail;
+        if (!avail) sched_yield();
+    }
+    pthread_join(thread, NULL);
+    ret |= NOT_I(MemMgr_Free(ring),==,0);
+
+    ret |= NOT_P(MemMgr_AllocRing(PAGE_SIZE + 1),==,NULL);
+    if (!MemMgr_SetApertureMode(1))
+    {
+        ret |= NOT_P(MemMgr_AllocRing(len),==,NULL);
+        ret |= NOT_I(MemMgr_SetApertureMode(0),==,0);
+    }
+    return ret;
+}
+
+/**
+ * Tests concatenated views of 1D buffers.  Verifies that the
+ * view shares the pages and the system space addresses of its
+ * sources, that the sources are pinned while viewed and stay
+ * intact after the view is unmapped, and that unaligned or
+ * partial-page sources and aperture mode are rejected.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int concat_test()
+{
+    printf("Concatenated view tests\n");
+    bytes_t lens[3] = { 2 * PAGE_SIZE, PAGE_SIZE, PAGE_SIZE + 100 };
+    void *bufs[3], *swapped[2];
+    bytes_t offs;
+    int ix, ret = 0;
+
+    for (ix = 0; ix < 3; ix++)
+    {
+        bufs[ix] = alloc_1D(lens[ix], 0, 0x10 * ix);
+        if (NOT_P(bufs[ix],!=,NULL)) ret = 1;
+    }
+
+    char *view = ret ? NULL : MemMgr_MapConcat(bufs, 3);
+    ret |= NOT_P(view,!=,NULL);
+    for (offs = ix = 0; view && ix < 3; offs += lens[ix++])
+    {
+        char *src = bufs[ix];
+        ret |= NOT_I(memcmp(view + offs, src, lens[ix]),==,0);
+        ret |= NOT_L(TilerMem_VirtToPhys(view + offs + 8),==,
+                     TilerMem_VirtToPhys(src + 8));
+        ret |= NOT_I(MemMgr_IsDemoted(src),==,0);
+
+        /* writes through the view show up in the source, and back */
+        view[offs + 1] ^= 0xff;
+        ret |= NOT_I(view[offs + 1],==,src[1]);
+        src[1] ^= 0xff;
+        ret |= NOT_I(view[offs + 1],==,src[1]);
+    }
+    if (view)
+    {
+        for (ix = 0; ix < 3; ix++)
+        {
+            MemMgr_SetDemotable(bufs[ix], true);
+        }
+        MemMgr_DemoteIdle(0);
+        for (ix = 0; ix < 3; ix++)
+        {
+            ret |= NOT_I(MemMgr_IsDemoted(bufs[ix]),==,0);
+        }
+        ret |= NOT_I(MemMgr_UnMapConcat(view),==,0);
+        ret |= NOT_I(MemMgr_UnMapConcat(view),!=,0);
+    }
+
+    /* only the last source may end within a page */
+    if (!ret)
+    {
+        swapped[0] = bufs[2];
+        swapped[1] = bufs[0];
+        ret |= NOT_P(MemMgr_MapConcat(swapped, 2),==,NULL);
+        swapped[0] = (char *) bufs[0] + PAGE_SIZE;
+        ret |= NOT_P(MemMgr_MapConcat(swapped, 2),==,NULL);
+        ret |= NOT_P(MemMgr_MapConcat(bufs, 0),==,NULL);
+    }
+
+    for (ix = 0; ix < 3; ix++)
+    {
+        if (bufs[ix]) ERR_ADD(ret, free_1D(lens[ix], 0, 0x10 * ix, bufs[ix]));
+    }
+
+    if (!MemMgr_SetApertureMode(1))
+    {
+        MemAllocBlock block;
+        memset(&block, 0, sizeof(block));
+        block.pixelFormat = PIXEL_FMT_PAGE;
+        block.dim.len = PAGE_SIZE;
+        bufs[0] = MemMgr_Alloc(&block, 1);
+        ret |= NOT_P(bufs[0],!=,NULL);
+        if (bufs[0])
+        {
+            ret |= NOT_P(MemMgr_MapConcat(bufs, 1),==,NULL);
+            ret |= NOT_I(MemMgr_Free(bufs[0]),==,0);
+        }
+        ret |= NOT_I(MemMgr_SetApertureMode(0),==,0);
+    }
+    return ret;
+}
+
+/**
+ * Tests mapping file data into tiler space.  Verifies that a
+ * shared file mapping is mapped by MemMgr_Map without copying,
+ * so that writes to the file show up in the tiler mapping, and
+ * that a stream maps a file in windows with the expected
+ * lengths and contents.
+ *
+ * @return 0 on success, non-0 error value on failure
+ */
+int stream_test()
+{
+    printf("File mapping and streaming tests\n");
+    bytes_t file_len = 5 * PAGE_SIZE + 123, len, offs = 0;
+    MemAllocBlock block;
+    MemMgrStream stream;
+    char *data = NULL, *ptr;
+    int ix, ret = 0;
+
+    FILE *file = tmpfile();
+    if (NOT_P(file,!=,NULL)) return 1;
+    int fd = fileno(file);
+    ALLOCN(data, file_len);
+    if (NOT_P(data,!=,NULL)) goto DONE;
+    for (ix = 0; ix < file_len; ix++) data[ix] = rand();
+    if (NOT_I(write(fd, data, file_len),==,file_len)) goto DONE;
+
+    /* map the first two pages of the file */
+    void *src = mmap(NULL, 2 * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (NOT_P(src,!=,MAP_FAILED)) goto DONE;
+    memset(&block, 0, sizeof(block));
+    block.pixelFormat = PIXEL_FMT_PAGE;
+    block.dim.len = 2 * PAGE_SIZE;
+    block.ptr = src;
+    ptr = MemMgr_Map(&block, 1);
+    ret |= NOT_P(ptr,!=,NULL);
+    if (ptr)
+    {
+        ret |= NOT_I(MemMgr_IsMapped(ptr),!=,0);
+        ret |= NOT_I(memcmp(ptr, data, 2 * PAGE_SIZE),==,0);
+        ret |= NOT_I(pwrite(fd, "page cache", 10, PAGE_SIZE),==,10);
+        ret |= NOT_I(memcmp(ptr + PAGE_SIZE, "page cache", 10),==,0);
+        ret |= NOT_I(pwrite(fd, data + PAGE_SIZE, 10, PAGE_SIZE),==,10);
+        ret |= NOT_I(MemMgr_UnMap(ptr),==,0);
+    }
+    munmap(src, 2 * PAGE_SIZE);
+
+    /* stream the file in windows of two pages */
+    ret |= NOT_I(MemMgr_StreamOpen(&stream, fd, PAGE_SIZE + 1, 0),!=,0);
+    ret |= NOT_I(MemMgr_StreamOpen(&stream, fd, 2 * PAGE_SIZE, PAGE_SIZE),==,0);
+    for (ix = 0; !ret && (ptr = MemMgr_StreamNext(&stream, &len)); ix++)
+    {
+        ret |= NOT_I(len,==,ix < 2 ? 2 * PAGE_SIZE : PAGE_SIZE + 123);
+        ret |= NOT_I(MemMgr_Is1DBlock(ptr),!=,0);
+        ret |= NOT_I(memcmp(ptr, data + offs, len),==,0);
+        offs += len;
+    }
+    ret |= NOT_I(ix,==,3);
+    ret |= NOT_I(offs,==,file_len);
+    ret |= NOT_I(len,==,0);
+    ret |= NOT_I(MemMgr_StreamClose(&stream),==,0);
+
+    /* a stream can be closed before its end */
+    ret |= NOT_I(MemMgr_StreamOpen(&stream, fd, PAGE_SIZE, 0),==,0);
+    ret |= NOT_P(MemMgr_StreamNext(&stream, &len),!=,NULL);
+    ret |= NOT_I(MemMgr_StreamClose(&stream),==,0);
+
+DONE:
+    if (!data) ret = 1;
+    FREE(data);
+    fclose(file);
+    return ret;
+}
+
 DEFINE_TESTS(TESTS)
 
 /**
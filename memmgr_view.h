@@ -0,0 +1,176 @@
+/*
+ *  memmgr_view.h
+ *
+ *  Inline buffer queries on a read-only view of the registry.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MEMMGR_VIEW_H_
+#define _MEMMGR_VIEW_H_
+
+#include <stdint.h>
+#include <sched.h>
+#include "memmgr.h"
+
+/**
+ * Read-only view of the registry.  The memory allocator keeps
+ * the address ranges of the blocks of all tracked buffers in an
+ * array sorted by address, and publishes it with a sequence
+ * count that is odd while the array is being changed.  Readers
+ * copy what they need, and retry if the count changed
+ * meanwhile, so the queries below take no lock and make no
+ * function call in the common case.
+ * <p>
+ * In aperture mode the rows of 2D blocks interleave with those
+ * of other buffers, so only 1D blocks are in the view, and
+ * queries of 2D blocks fall back to the functions of memmgr.h.
+ * The view does not restore demoted buffers.
+ */
+struct MemMgrViewRange {
+    uintptr_t start;    /* first address of the block */
+    uintptr_t end;      /* address after the block */
+    void     *bufPtr;   /* buffer of the block */
+    bytes_t   stride;   /* stride of the block, as MemMgr_GetStride() */
+    uint16_t  fmt;      /* pixel format of the block */
+    uint16_t  type;     /* MEMMGR_BUF_ALLOCED or MEMMGR_BUF_MAPPED */
+};
+
+typedef struct MemMgrViewRange MemMgrViewRange;
+
+struct MemMgrView {
+    volatile uint32_t seq;              /* odd while being changed */
+    volatile int      num_ranges;       /* number of ranges */
+    MemMgrViewRange *volatile ranges;   /* ranges sorted by address */
+};
+
+typedef struct MemMgrView MemMgrView;
+
+/**
+ * Returns the view of the registry.  The view stays valid for
+ * the lifetime of the process, so it can be fetched once.
+ *
+ * @return Pointer to the view
+ */
+const MemMgrView *MemMgr_GetView();
+
+/**
+ * Finds the block containing a pointer in the view.
+ *
+ * @param view   Pointer to the view
+ * @param ptr    Pointer
+ * @param range  Pointer to store the range of the block at
+ *
+ * @return 1 if found, 0 if ptr is not in the view.
+ */
+static __inline__ int MemMgrView_Find(const MemMgrView *view,
+                                      const void *ptr,
+                                      MemMgrViewRange *range)
+{
+    const MemMgrViewRange *r;
+    uintptr_t p = (uintptr_t) ptr;
+    uint32_t seq;
+    int n, lo, hi, mid, found;
+
+    for (;;)
+    {
+        seq = view->seq;
+        if (!(seq & 1))
+        {
+            /* arrays are only replaced by larger ones, which are
+               published before the number of ranges grows */
+            n = view->num_ranges;
+            __sync_synchronize();
+            r = view->ranges;
+            for (lo = 0, hi = n; lo < hi; )
+            {
+                mid = (lo + hi) / 2;
+                if (r[mid].end <= p) lo = mid + 1;
+                else hi = mid;
+            }
+            found = lo < n && r[lo].start <= p;
+            if (found) *range = r[lo];
+            __sync_synchronize();
+            if (seq == view->seq) return found;
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * Returns the stride of the block containing a pointer, as
+ * MemMgr_GetStride() does.
+ *
+ * @param view   Pointer to the view
+ * @param ptr    Pointer
+ *
+ * @return Stride of the block
+ */
+static __inline__ bytes_t MemMgrView_GetStride(const MemMgrView *view,
+                                               void *ptr)
+{
+    MemMgrViewRange r;
+    return MemMgrView_Find(view, ptr, &r) ? r.stride : MemMgr_GetStride(ptr);
+}
+
+/**
+ * Returns the pixel format of the block containing a pointer,
+ * as MemMgr_GetFormat() does.
+ *
+ * @param view   Pointer to the view
+ * @param ptr    Pointer
+ *
+ * @return Pixel format of the block
+ */
+static __inline__ pixel_fmt_t MemMgrView_GetFormat(const MemMgrView *view,
+                                                   void *ptr)
+{
+    MemMgrViewRange r;
+    return MemMgrView_Find(view, ptr, &r) ? (pixel_fmt_t) r.fmt :
+                                            MemMgr_GetFormat(ptr);
+}
+
+/**
+ * Returns whether a pointer is in tiler space, as
+ * MemMgr_IsMapped() does.
+ *
+ * @param view   Pointer to the view
+ * @param ptr    Pointer
+ *
+ * @return TRUE (non-0) if ptr is in tiler space
+ */
+static __inline__ bool MemMgrView_IsMapped(const MemMgrView *view,
+                                           void *ptr)
+{
+    MemMgrViewRange r;
+    return MemMgrView_Find(view, ptr, &r) || MemMgr_IsMapped(ptr);
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ *  tiler_arb.h
+ *
+ *  Protocol of the TILER arbitration service.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TILER_ARB_H_
+#define _TILER_ARB_H_
+
+#include <stdint.h>
+
+/**
+ * The TILER arbitration service (tiler_arbd) lets processes
+ * that share the tiler lease container capacity, so that one
+ * process cannot starve the others.  Capacity is counted in
+ * container slots for 2D blocks and in pages for 1D blocks.
+ * <p>
+ * Clients talk to the service over a local SOCK_SEQPACKET
+ * socket.  Each request is answered by a single reply of the
+ * same structure.  Leases of a client are returned when it
+ * disconnects.
+ * <p>
+ * The service enforces a per-client quota, and keeps a reserve
+ * of the capacity that only normal priority clients can lease.
+ * Normal priority is granted from the peer's credentials: only
+ * root, the service's user and the users trusted with -n get it.
+ * Other clients lease at background priority, and a HELLO
+ * asking them for normal priority fails with -EPERM.
+ */
+
+#define TILER_ARB_SOCKET "/tmp/tiler_arb"
+
+/* client priorities */
+#define TILER_ARB_PRIO_NORMAL     0
+#define TILER_ARB_PRIO_BACKGROUND 1
+
+/* requests */
+enum tiler_arb_cmd {
+    TILER_ARB_HELLO = 1,    /* arg: priority, normal needs trust */
+    TILER_ARB_LEASE,        /* slots, pages: capacity to lease */
+    TILER_ARB_RETURN,       /* slots, pages: capacity to return */
+    TILER_ARB_STATS         /* reply: system-wide statistics */
+};
+
+struct tiler_arb_msg {
+    uint32_t cmd;           /* enum tiler_arb_cmd */
+    int32_t  result;        /* reply: 0 or -errno */
+    uint32_t slots;         /* container slots */
+    uint32_t pages;         /* page-mode pages */
+    uint32_t arg;
+
+    /* system-wide statistics in TILER_ARB_STATS replies (slots and
+       pages hold the capacity leased by all clients) */
+    uint32_t clients;       /* connected clients */
+    uint32_t max_slots;     /* container slots */
+    uint32_t max_pages;     /* page-mode pages */
+    uint32_t requests;      /* lease requests */
+    uint32_t denied;        /* lease requests denied */
+};
+
+#endif
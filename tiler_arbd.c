@@ -0,0 +1,346 @@
+/*
+ *  tiler_arbd.c
+ *
+ *  TILER arbitration service.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* sigaction() and getopt() are not part of ANSI C */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <tiler.h>
+
+#define __DEBUG__
+#undef  __DEBUG_ENTRY__
+#define __DEBUG_ASSERT__
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include "utils.h"
+#include "debug_utils.h"
+#include "tiler_arb.h"
+
+#define MAX_CLIENTS 64
+#define MAX_TRUSTED 16
+
+/* connected clients and their leases */
+struct client {
+    int      fd;
+    int      prio;
+    int      trusted;       /* may lease at normal priority */
+    uint32_t slots, pages;
+};
+
+static struct client clients[MAX_CLIENTS];
+static int num_clients = 0;
+
+/* capacity, limits and statistics */
+static struct tiler_arb_msg stats;
+static uint32_t quota_slots = TILER_WIDTH * TILER_HEIGHT;
+static uint32_t quota_pages = TILER_LENGTH / TILER_PAGE;
+static uint32_t reserve_slots = 0, reserve_pages = 0;
+
+/* users, besides root and the service's own, that may lease the reserve */
+static uid_t trusted_uids[MAX_TRUSTED];
+static int num_trusted = 0;
+
+static volatile sig_atomic_t done = 0;
+
+static void on_signal(int sig)
+{
+    done = 1;
+}
+
+/**
+ * Leases capacity to a client.  Leases are granted completely or
+ * not at all.  Background clients cannot lease the reserve.
+ *
+ * @return 0 on success, -EDQUOT if the client would exceed its
+ *         quota, -ENOSPC if there is not enough capacity.
+ */
+static int lease(struct client *c, uint32_t slots, uint32_t pages)
+{
+    uint64_t free_slots = stats.max_slots - stats.slots;
+    uint64_t free_pages = stats.max_pages - stats.pages;
+    if (c->prio != TILER_ARB_PRIO_NORMAL)
+    {
+        free_slots = free_slots > reserve_slots ? free_slots - reserve_slots : 0;
+        free_pages = free_pages > reserve_pages ? free_pages - reserve_pages : 0;
+    }
+
+    stats.requests++;
+    if ((uint64_t) c->slots + slots > quota_slots ||
+        (uint64_t) c->pages + pages > quota_pages)
+    {
+        stats.denied++;
+        return -EDQUOT;
+    }
+    if (slots > free_slots || pages > free_pages)
+    {
+        stats.denied++;
+        return -ENOSPC;
+    }
+
+    c->slots += slots;
+    c->pages += pages;
+    stats.slots += slots;
+    stats.pages += pages;
+    return 0;
+}
+
+/* returns capacity of a client, at most what it holds */
+static void give_back(struct client *c, uint32_t slots, uint32_t pages)
+{
+    if (slots > c->slots) slots = c->slots;
+    if (pages > c->pages) pages = c->pages;
+    c->slots -= slots;
+    c->pages -= pages;
+    stats.slots -= slots;
+    stats.pages -= pages;
+}
+
+/**
+ * Checks whether the peer of a client connection may lease at
+ * normal priority.  Priority is decided here from the peer's
+ * credentials, as the clients cannot be trusted to declare it.
+ *
+ * @return non-0 if the peer is root, runs as the service's user
+ *         or is one of the users trusted with -n.
+ */
+static int is_trusted(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int ix;
+
+    if (NOT_I(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len),==,0))
+        return 0;
+    if (cred.uid == 0 || cred.uid == getuid()) return 1;
+    for (ix = 0; ix < num_trusted; ix++)
+        if (cred.uid == trusted_uids[ix]) return 1;
+    return 0;
+}
+
+/**
+ * Serves a request of a client.
+ *
+ * @return 0 if the client is still connected, non-0 if it
+ *         disconnected.
+ */
+static int serve(struct client *c)
+{
+    struct tiler_arb_msg msg;
+    ssize_t len = recv(c->fd, &msg, sizeof(msg), 0);
+    if (len <= 0) return 1;
+
+    if (len != sizeof(msg))
+    {
+        ZERO(msg);
+        msg.result = -EINVAL;
+    }
+    else switch (msg.cmd)
+    {
+    case TILER_ARB_HELLO:
+        /* untrusted clients can only lease at background priority */
+        if (msg.arg == TILER_ARB_PRIO_NORMAL && !c->trusted)
+        {
+            msg.result = -EPERM;
+            break;
+        }
+        c->prio = msg.arg;
+        msg.result = 0;
+        break;
+    case TILER_ARB_LEASE:
+        msg.result = lease(c, msg.slots, msg.pages);
+        break;
+    case TILER_ARB_RETURN:
+        give_back(c, msg.slots, msg.pages);
+        msg.result = 0;
+        break;
+    case TILER_ARB_STATS:
+        msg = stats;
+        msg.cmd = TILER_ARB_STATS;
+        msg.clients = num_clients;
+        break;
+    default:
+        msg.result = -EINVAL;
+    }
+    return send(c->fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg);
+}
+
+/**
+ * Parses a slots:pages argument.
+ *
+ * @return 0 on success, non-0 if the argument is invalid.
+ */
+static int parse_pair(const char *arg, uint32_t *slots, uint32_t *pages)
+{
+    char *end;
+    *slots = strtoul(arg, &end, 0);
+    if (*end != ':') return 1;
+    *pages = strtoul(end + 1, &end, 0);
+    return *end != '\0';
+}
+
+/* prints the usage, and returns the exit code for it */
+static int usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-q slots:pages] "
+            "[-r slots:pages] [-n uid]...\n"
+            "  -s  socket path (default: %s)\n"
+            "  -q  quota of each client\n"
+            "  -r  reserve for normal priority clients\n"
+            "  -n  user allowed normal priority, besides root and "
+            "the service's own\n",
+            name, TILER_ARB_SOCKET);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = TILER_ARB_SOCKET;
+    struct pollfd pfds[MAX_CLIENTS + 1];
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int opt, ix;
+    char *end;
+
+    stats.max_slots = TILER_WIDTH * TILER_HEIGHT;
+    stats.max_pages = TILER_LENGTH / TILER_PAGE;
+    while ((opt = getopt(argc, argv, "s:q:r:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            path = optarg;
+            break;
+        case 'q':
+            if (parse_pair(optarg, &quota_slots, &quota_pages))
+                return usage(argv[0]);
+            break;
+        case 'r':
+            if (parse_pair(optarg, &reserve_slots, &reserve_pages))
+                return usage(argv[0]);
+            break;
+        case 'n':
+            if (num_trusted == MAX_TRUSTED) return usage(argv[0]);
+            trusted_uids[num_trusted++] = strtoul(optarg, &end, 0);
+            if (*optarg == '\0' || *end != '\0') return usage(argv[0]);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    ZERO(addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (NOT_I(lfd,>=,0) ||
+        NOT_I(bind(lfd, (struct sockaddr *) &addr, sizeof(addr)),==,0) ||
+        NOT_I(listen(lfd, MAX_CLIENTS),==,0)) return 1;
+
+    ZERO(sa);
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!done)
+    {
+        pfds[0].fd = lfd;
+        pfds[0].events = POLLIN;
+        for (ix = 0; ix < num_clients; ix++)
+        {
+            pfds[ix + 1].fd = clients[ix].fd;
+            pfds[ix + 1].events = POLLIN;
+        }
+        if (poll(pfds, num_clients + 1, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        /* serve clients, and drop the ones that disconnected - walking
+           backwards, as the last client takes the place of a dropped one */
+        for (ix = num_clients - 1; ix >= 0; ix--)
+        {
+            if (!pfds[ix + 1].revents) continue;
+            if (!(pfds[ix + 1].revents & POLLIN) || serve(clients + ix))
+            {
+                give_back(clients + ix, clients[ix].slots, clients[ix].pages);
+                close(clients[ix].fd);
+                clients[ix] = clients[--num_clients];
+            }
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0 && num_clients < MAX_CLIENTS)
+            {
+                ZERO(clients[num_clients]);
+                clients[num_clients].fd = fd;
+                clients[num_clients].trusted = is_trusted(fd);
+                if (!clients[num_clients].trusted)
+                    clients[num_clients].prio = TILER_ARB_PRIO_BACKGROUND;
+                num_clients++;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    for (ix = 0; ix < num_clients; ix++) close(clients[ix].fd);
+    close(lfd);
+    unlink(path);
+    return 0;
+}
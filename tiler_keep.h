@@ -0,0 +1,157 @@
+/*
+ *  tiler_keep.h
+ *
+ *  Protocol of the TILER buffer keeper.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TILER_KEEP_H_
+#define _TILER_KEEP_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <tiler.h>
+
+/**
+ * The TILER buffer keeper (tiler_keepd) holds buffers of client
+ * processes across their restarts.  A client hands a buffer to
+ * the keeper under an ID of its choice, together with a file
+ * descriptor that keeps the memory of the buffer alive.  After
+ * a restart, the client attaches to the buffer by its ID, and
+ * maps it again without allocating it.
+ * <p>
+ * Clients talk to the keeper over a local SOCK_SEQPACKET socket.
+ * Each request is answered by a single reply of the same
+ * structure.  File descriptors travel as SCM_RIGHTS ancillary
+ * data of TILER_KEEP_PUT requests and TILER_KEEP_GET replies.
+ * Unlike leases, kept buffers stay with the keeper when the
+ * client disconnects, until they are dropped.
+ * <p>
+ * The socket is only accessible to the keeper's user.  Each kept
+ * buffer belongs to the user that handed it over, as told by the
+ * peer's credentials: only that user or root can get or drop it,
+ * others get -EPERM.
+ */
+
+#define TILER_KEEP_SOCKET "/tmp/tiler_keep"
+
+/* requests */
+enum tiler_keep_cmd {
+    TILER_KEEP_PUT = 1,     /* id, buf + fd: keep a buffer */
+    TILER_KEEP_GET,         /* id; reply: buf + fd (owner or root) */
+    TILER_KEEP_DROP,        /* id: stop keeping a buffer (owner or root) */
+    TILER_KEEP_STATS        /* reply: count */
+};
+
+struct tiler_keep_msg {
+    uint32_t cmd;           /* enum tiler_keep_cmd */
+    int32_t  result;        /* reply: 0 or -errno */
+    uint32_t id;            /* buffer ID (non-0) */
+    uint32_t count;         /* reply: number of kept buffers */
+    struct tiler_buf_info buf;  /* blocks and registration */
+};
+
+/**
+ * Sends a keeper message, with a file descriptor if fd is not
+ * negative.
+ *
+ * @return 0 on success, non-0 on failure
+ */
+static __inline__ int TilerKeep_Send(int sock, struct tiler_keep_msg *msg,
+                                     int fd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct iovec iov;
+    struct msghdr mh;
+
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(*msg);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd >= 0)
+    {
+        memset(&ctl, 0, sizeof(ctl));
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = sizeof(ctl.buf);
+        CMSG_FIRSTHDR(&mh)->cmsg_level = SOL_SOCKET;
+        CMSG_FIRSTHDR(&mh)->cmsg_type = SCM_RIGHTS;
+        CMSG_FIRSTHDR(&mh)->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(CMSG_FIRSTHDR(&mh)), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) != sizeof(*msg);
+}
+
+/**
+ * Receives a keeper message, and the file descriptor that came
+ * with it.
+ *
+ * @param fd     Pointer to store the file descriptor, or -1 if
+ *               none came with the message
+ *
+ * @return length of the message, 0 if the peer disconnected, or
+ *         negative on failure
+ */
+static __inline__ int TilerKeep_Recv(int sock, struct tiler_keep_msg *msg,
+                                     int *fd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr *cm;
+
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(*msg);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+
+    int len = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    *fd = -1;
+    for (cm = CMSG_FIRSTHDR(&mh); len >= 0 && cm; cm = CMSG_NXTHDR(&mh, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    }
+    return len;
+}
+
+#endif
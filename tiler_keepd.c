@@ -0,0 +1,302 @@
+/*
+ *  tiler_keepd.c
+ *
+ *  TILER buffer keeper.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* sigaction() and getopt() are not part of ANSI C */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <tiler.h>
+
+#define __DEBUG__
+#undef  __DEBUG_ENTRY__
+#define __DEBUG_ASSERT__
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include "utils.h"
+#include "debug_utils.h"
+#include "tiler_keep.h"
+
+#define MAX_CLIENTS 64
+#define MAX_KEPT    1024
+
+/* kept buffers, and the file descriptors that keep them alive */
+struct kept {
+    uint32_t id;
+    int      fd;
+    uid_t    owner;         /* user that handed the buffer over */
+    struct tiler_buf_info buf;
+};
+
+static struct kept kept[MAX_KEPT];
+static int num_kept = 0;
+
+/* connected clients and their users */
+struct client {
+    int      fd;
+    uid_t    uid;
+};
+
+static struct client clients[MAX_CLIENTS];
+static int num_clients = 0;
+
+static volatile sig_atomic_t done = 0;
+
+static void on_signal(int sig)
+{
+    done = 1;
+}
+
+static struct kept *find_kept(uint32_t id)
+{
+    int ix;
+    for (ix = 0; ix < num_kept; ix++)
+    {
+        if (kept[ix].id == id) return kept + ix;
+    }
+    return NULL;
+}
+
+/**
+ * Finds a kept buffer for a client, which must own it unless it
+ * runs as root.
+ *
+ * @return Pointer to the kept buffer, or NULL.  *result is set
+ *         to -ENOENT if there is no such buffer, and to -EPERM if
+ *         the client may not access it.
+ */
+static struct kept *find_owned(struct client *c, uint32_t id, int32_t *result)
+{
+    struct kept *k = find_kept(id);
+    if (!k)
+        *result = -ENOENT;
+    else if (c->uid != 0 && c->uid != k->owner)
+        *result = -EPERM;
+    else
+        return k;
+    return NULL;
+}
+
+/**
+ * Serves a request of a client.  The file descriptor of a
+ * TILER_KEEP_PUT request is kept on success, and closed
+ * otherwise.
+ *
+ * @return 0 if the client is still connected, non-0 if it
+ *         disconnected.
+ */
+static int serve(struct client *c)
+{
+    struct tiler_keep_msg msg;
+    struct kept *k;
+    int buf_fd, reply_fd = -1;
+    int len = TilerKeep_Recv(c->fd, &msg, &buf_fd);
+    if (len <= 0) return 1;
+
+    if (len != sizeof(msg))
+    {
+        ZERO(msg);
+        msg.result = -EINVAL;
+    }
+    else switch (msg.cmd)
+    {
+    case TILER_KEEP_PUT:
+        if (!msg.id || buf_fd < 0 || msg.buf.num_blocks <= 0 ||
+            msg.buf.num_blocks > TILER_MAX_NUM_BLOCKS)
+            msg.result = -EINVAL;
+        else if (find_kept(msg.id))
+            msg.result = -EEXIST;
+        else if (num_kept == MAX_KEPT)
+            msg.result = -ENOSPC;
+        else
+        {
+            k = kept + num_kept++;
+            k->id = msg.id;
+            k->fd = buf_fd;
+            k->owner = c->uid;
+            k->buf = msg.buf;
+            buf_fd = -1;
+            msg.result = 0;
+        }
+        break;
+    case TILER_KEEP_GET:
+        k = find_owned(c, msg.id, &msg.result);
+        if (k)
+        {
+            msg.buf = k->buf;
+            reply_fd = k->fd;
+            msg.result = 0;
+        }
+        break;
+    case TILER_KEEP_DROP:
+        k = find_owned(c, msg.id, &msg.result);
+        if (k)
+        {
+            close(k->fd);
+            *k = kept[--num_kept];
+            msg.result = 0;
+        }
+        break;
+    case TILER_KEEP_STATS:
+        msg.result = 0;
+        break;
+    default:
+        msg.result = -EINVAL;
+    }
+    if (buf_fd >= 0) close(buf_fd);
+    msg.count = num_kept;
+    return TilerKeep_Send(c->fd, &msg, reply_fd);
+}
+
+/* prints the usage, and returns the exit code for it */
+static int usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket]\n"
+            "  -s  socket path (default: %s)\n",
+            name, TILER_KEEP_SOCKET);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = TILER_KEEP_SOCKET;
+    struct pollfd pfds[MAX_CLIENTS + 1];
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct ucred cred;
+    socklen_t cred_len;
+    mode_t mask;
+    int opt, ix;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            path = optarg;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    ZERO(addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    /* only the keeper's user may connect: kept buffers are handed out
+       as file descriptors of their memory */
+    int lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (NOT_I(lfd,>=,0)) return 1;
+    mask = umask(0177);
+    int ret = bind(lfd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+    if (NOT_I(ret,==,0) || NOT_I(listen(lfd, MAX_CLIENTS),==,0)) return 1;
+
+    ZERO(sa);
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!done)
+    {
+        pfds[0].fd = lfd;
+        pfds[0].events = POLLIN;
+        for (ix = 0; ix < num_clients; ix++)
+        {
+            pfds[ix + 1].fd = clients[ix].fd;
+            pfds[ix + 1].events = POLLIN;
+        }
+        if (poll(pfds, num_clients + 1, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        /* serve clients, and drop the ones that disconnected - their
+           buffers stay kept */
+        for (ix = num_clients - 1; ix >= 0; ix--)
+        {
+            if (!pfds[ix + 1].revents) continue;
+            if (!(pfds[ix + 1].revents & POLLIN) || serve(clients + ix))
+            {
+                close(clients[ix].fd);
+                clients[ix] = clients[--num_clients];
+            }
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            cred_len = sizeof(cred);
+            if (fd >= 0 && num_clients < MAX_CLIENTS &&
+                !NOT_I(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred,
+                                  &cred_len),==,0))
+            {
+                clients[num_clients].fd = fd;
+                clients[num_clients++].uid = cred.uid;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    /* the buffers are released with their file descriptors */
+    for (ix = 0; ix < num_kept; ix++) close(kept[ix].fd);
+    for (ix = 0; ix < num_clients; ix++) close(clients[ix].fd);
+    close(lfd);
+    unlink(path);
+    return 0;
+}
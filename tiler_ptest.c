@@ -99,7 +99,7 @@ enum ptr_type {
 struct ptr_info {
 	int num_blocks;
 	struct tiler_block_info blocks[TILER_MAX_NUM_BLOCKS];
-	int ptr;
+	unsigned long ptr;
     short type;
     uint16_t val;
 };
@@ -127,7 +127,7 @@ static void dump_block(struct tiler_block_info *blk, char *prefix, char *suffix)
 
 static void dump_slot(struct ptr_info* buf, char* prefix)
 {
-    P("%sbuf={n=%d,ptr=0x%x,type=%d,", prefix, buf->num_blocks, buf->ptr,
+    P("%sbuf={n=%d,ptr=0x%lx,type=%d,", prefix, buf->num_blocks, buf->ptr,
       buf->type);
     int ix = 0;
     for (ix = 0; ix < buf->num_blocks; ix++)
@@ -195,7 +195,7 @@ void fill_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && (height || ((PAGE_SIZE - 1) & (uint32_t)ptr32)))
+            while (i < stride && (height || ((PAGE_SIZE - 1) & (uintptr_t)ptr32)))
             {
                 *ptr32++ = 0;
                 i += sizeof(uint32_t);
@@ -215,7 +215,7 @@ void fill_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && (height || ((PAGE_SIZE - 1) & (uint32_t)ptr)))
+            while (i < stride && (height || ((PAGE_SIZE - 1) & (uintptr_t)ptr)))
             {
                 *ptr++ = 0;
                 i += sizeof(uint16_t);
@@ -283,7 +283,7 @@ int check_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uint32_t)ptr32)))
+            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uintptr_t)ptr32)))
             {
                 if (*ptr32++) {
                     DP("assert: val[%u,%u] (=0x%x) != 0", r, i, *--ptr32);
@@ -309,7 +309,7 @@ int check_mem(uint16_t start, MemAllocBlock *block)
                 if (delta < step) delta = ++step;
             }
 #ifdef __WRITE_IN_STRIDE__
-            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uint32_t)ptr)))
+            while (i < stride && ((r < height - 1) || ((PAGE_SIZE - 1) & (uintptr_t)ptr)))
             {
                 if (*ptr++) {
                     DP("assert: val[%u,%u] (=0x%x) != 0", r, i, *--ptr);
@@ -365,11 +365,11 @@ void *alloc_buf(int num_blocks, MemAllocBlock blocks[], uint16_t val)
                 NOT_I(MemMgr_IsMapped(ptr),!=,0) ||
                 NOT_I(MemMgr_Is1DBlock(ptr),==,fmt == PIXEL_FMT_PAGE ? 1 : 0) ||
                 NOT_I(MemMgr_Is2DBlock(ptr),==,fmt == PIXEL_FMT_PAGE ? 0 : 1) ||
-                NOT_I(MemMgr_GetStride(bufPtr),==,blocks[i].stride) ||
-                NOT_P(TilerMem_VirtToPhys(ptr),==,blocks[i].reserved) ||
+                NOT_I(MemMgr_GetStride(ptr),==,blocks[i].stride) ||
+                NOT_L(TilerMem_VirtToPhys(ptr),==,blocks[i].reserved) ||
                 NOT_I(TilerMem_GetStride(TilerMem_VirtToPhys(ptr)),==,cstride) ||
                 NOT_L((PAGE_SIZE - 1) & (long)ptr,==,(PAGE_SIZE - 1) & blocks[i].reserved) ||
-                (fmt == PIXEL_FMT_PAGE || NOT_I(blocks[i].stride,!=,0)))
+                (fmt != PIXEL_FMT_PAGE && NOT_I(blocks[i].stride,!=,0)))
             {
                 P("  for block %d", i);
                 MemMgr_Free(bufPtr);
@@ -636,7 +636,7 @@ int param_test(int argc, char **argv)
             if (buf.type == ptr_alloced)
             {
                 dump_slot(&buf, "==(alloc)=>");
-                buf.ptr = (int) alloc_buf(n, (MemAllocBlock *) buf.blocks, val);
+                buf.ptr = (unsigned long) alloc_buf(n, (MemAllocBlock *) buf.blocks, val);
                 dump_slot(&buf, "<=(alloc)==");
             }
             else
@@ -644,18 +644,18 @@ int param_test(int argc, char **argv)
                 dump_slot(&buf, "==(tiler_alloc)=>");
                 if (buf.blocks[0].fmt == TILFMT_PAGE)
                 {
-                    buf.ptr = (int) TilerMgr_PageModeAlloc(buf.blocks[0].dim.len);
+                    buf.ptr = (unsigned long) TilerMgr_PageModeAlloc(buf.blocks[0].dim.len);
                 }
                 else
                 {
-                    buf.ptr =(int)  TilerMgr_Alloc(buf.blocks[0].fmt,
+                    buf.ptr = (unsigned long) TilerMgr_Alloc(buf.blocks[0].fmt,
                                                    buf.blocks[0].dim.area.width,
                                                    buf.blocks[0].dim.area.height);
                 }
                 buf.blocks[0].ssptr = (unsigned long) buf.ptr;
                 dump_slot(&buf, "<=(tiler_alloc)==");
             }
-            if (NOT_I(buf.ptr,!=,0)) res = 1;
+            if (NOT_L(buf.ptr,!=,0)) res = 1;
             else memcpy(slots + ix, &buf, sizeof(buf));
 			break;
 
@@ -0,0 +1,1745 @@
+/*
+ *  tiler_stub.c
+ *
+ *  TILER driver emulation for non-OMAP hosts.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* mincore(), memfd_create(), MAP_ANONYMOUS and MAP_NORESERVE are not part
+   of ANSI C */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <tiler.h>
+
+#define __DEBUG__
+#undef  __DEBUG_ENTRY__
+#define __DEBUG_ASSERT__
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include "utils.h"
+#include "list_utils.h"
+#include "debug_utils.h"
+#include "tilermem_utils.h"
+
+/* we implement the redirected functions */
+#define __TILER_STUB__
+#include "tiler_stub.h"
+
+#define STUB_MAX_FDS   16
+/* buf.offset must stay below the tiler space, which is used to map apertures */
+#define STUB_MAX_BUFS  (TILER_MEM_8BIT / TILER_PAGE - 1)
+
+/* emulated physical memory for allocated blocks */
+#define STUB_PHYS_BASE  0x80000000
+#define STUB_PHYS_PAGES 0x40000
+
+/* fake physical pages handed out for host pages, below the tiler space,
+   each within STUB_HOST_PROBE entries of the hash of its host page */
+#define STUB_HOST_PAGES 0x20000
+#define STUB_HOST_PROBE 64
+
+struct _StubRefill;
+
+/* allocated or mapped tiler blocks */
+struct _StubBlock {
+    struct tiler_block_info info;
+    int       fd;               /* owner */
+    void     *src;              /* user buffer for mapped blocks */
+    uint16_t  x, y, w, h;       /* container area for 2D blocks (slots) */
+    uint32_t  page, num_pages;  /* page-mode area for 1D blocks */
+    int       part;             /* partition */
+    struct _StubRefill *refill; /* pending PAT refill */
+    struct _StubBlockList {
+        struct _StubBlockList *next, *last;
+        struct _StubBlock *me;
+    } link;
+};
+
+/* registered buffers - buf.offset is a handle into this table.  The
+   mappings of a buffer share a memfd, so that the buffer can outlive
+   the process if the memfd is handed to another one. */
+struct _StubBuf {
+    int fd;
+    struct tiler_buf_info info;
+    int mem_fd;                 /* backing memory if mem_len is not 0 */
+    size_t mem_len;
+};
+
+/* process mappings of registered buffers, and apertures */
+struct _StubView {
+    void    *addr;
+    size_t   len;
+    uint32_t ssptr;             /* start of the tiler space for apertures */
+    struct tiler_buf_info info;
+    struct _StubViewList {
+        struct _StubViewList *next, *last;
+        struct _StubView *me;
+    } link;
+};
+
+/* DMM PAT refill descriptor: programs the PAT entries of an area */
+struct _StubRefill {
+    uint32_t *pat;              /* first PAT entry of the area */
+    uint16_t  w, h;             /* area size in entries */
+    uint16_t  pitch;            /* number of entries in a PAT row */
+    uint32_t  phys;             /* physical address of the first page */
+    void     *src;              /* user pages to map if phys is 0 */
+    struct _StubBlock *block;
+    struct _StubRefillList {
+        struct _StubRefillList *next, *last;
+        struct _StubRefill *me;
+    } link;
+};
+
+typedef struct _StubBlock _StubBlock;
+typedef struct _StubBlockList _StubBlockList;
+typedef struct _StubBuf _StubBuf;
+typedef struct _StubView _StubView;
+typedef struct _StubViewList _StubViewList;
+typedef struct _StubRefill _StubRefill;
+typedef struct _StubRefillList _StubRefillList;
+
+static pthread_mutex_t stub_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int stub_inited = 0;
+
+static int fds[STUB_MAX_FDS];
+static int num_fds = 0;
+
+static _StubBlockList blocks;
+static _StubViewList views;
+
+static _StubBuf *bufs = NULL;
+static int max_bufs = 0;
+
+/* 2D container and page-mode area occupancy */
+static uint8_t container[TILER_HEIGHT][TILER_WIDTH];
+static uint8_t pages[TILER_LENGTH / TILER_PAGE];
+
+/* container partitions, and the owner of each slot row and page-mode page
+   (0 is the shared partition) */
+struct _StubPart {
+    char     name[TILER_STUB_PART_NAME];
+    uint16_t row, num_rows;
+    uint32_t page, num_pages;
+    uint32_t used_slots, used_pages, blocks;
+};
+static struct _StubPart parts[TILER_STUB_MAX_PARTS + 1];
+static uint8_t row_part[TILER_HEIGHT];
+static uint8_t page_part[TILER_LENGTH / TILER_PAGE];
+static __thread int cur_part = 0;
+
+/* DMM page address translator: a physical page address for each container
+   slot and for each page of the page-mode area */
+static uint32_t pat[TILER_HEIGHT][TILER_WIDTH];
+static uint32_t pat_1d[TILER_LENGTH / TILER_PAGE];
+
+static _StubRefillList refills;     /* pending refill descriptors */
+static int pat_batching = 1;
+static TilerStubPatStats pat_stats;
+static uint32_t phys_next = 0;
+
+/* host page (+1) given each fake physical page, hashed by host page, and
+   the number of mapped blocks referencing each fake physical page */
+static uintptr_t *host_pages = NULL;
+static uint32_t *host_refs = NULL;
+
+static TilerStubCacheStats cache_stats;
+
+/**
+ * Initializes the static structures.  Must be called with the
+ * stub mutex held.
+ */
+static void init()
+{
+    if (!stub_inited)
+    {
+        DLIST_INIT(blocks);
+        DLIST_INIT(views);
+        DLIST_INIT(refills);
+        stub_inited = 1;
+    }
+}
+
+/* ---------- block geometry ---------- */
+
+static uint32_t def_bpp(enum tiler_fmt fmt)
+{
+    return (fmt == TILFMT_32BIT ? 4 : fmt == TILFMT_16BIT ? 2 : 1);
+}
+
+static uint32_t def_stride(uint32_t width)
+{
+    return (PAGE_SIZE - 1 + width) & ~(PAGE_SIZE - 1);
+}
+
+static uint32_t def_size(struct tiler_block_info *blk)
+{
+    return (blk->fmt == TILFMT_PAGE ?
+            blk->dim.len :
+            blk->dim.area.height * def_stride(blk->dim.area.width * def_bpp(blk->fmt)));
+}
+
+/* width of a container slot in pixels */
+static uint32_t slot_width(enum tiler_fmt fmt)
+{
+    return (fmt == TILFMT_32BIT ? 32 : 64);
+}
+
+/* height of a container slot in pixels */
+static uint32_t slot_height(enum tiler_fmt fmt)
+{
+    return (fmt == TILFMT_8BIT ? 64 : 32);
+}
+
+/* stride of the container view for a format */
+static uint32_t container_stride(enum tiler_fmt fmt)
+{
+    return (fmt == TILFMT_8BIT  ? TILER_STRIDE_8BIT :
+            fmt == TILFMT_16BIT ? TILER_STRIDE_16BIT : TILER_STRIDE_32BIT);
+}
+
+/* system space base address of the container view for a format */
+static uint32_t container_base(enum tiler_fmt fmt)
+{
+    return (fmt == TILFMT_8BIT  ? TILER_MEM_8BIT :
+            fmt == TILFMT_16BIT ? TILER_MEM_16BIT : TILER_MEM_32BIT);
+}
+
+/* ---------- container and page-mode area management ---------- */
+
+/**
+ * Finds and reserves a free w * h slot area in the rows of a
+ * partition (first fit, row-major).  The area starts at a
+ * multiple of align slots horizontally.
+ *
+ * @return 0 on success, non-0 if there is no such free area
+ */
+static int area_alloc(int part, uint16_t w, uint16_t h, uint16_t align,
+                      uint16_t *x, uint16_t *y)
+{
+    int x0, y0, xx, yy, used;
+    int y_end = part ? parts[part].row + parts[part].num_rows : TILER_HEIGHT;
+
+    if (!w || !h || w > TILER_WIDTH || h > TILER_HEIGHT) return 1;
+
+    for (y0 = part ? parts[part].row : 0; y0 + h <= y_end; y0++)
+    {
+        /* all rows of the area must be in the partition */
+        for (yy = y0; yy < y0 + h && row_part[yy] == part; yy++);
+        if (yy < y0 + h)
+        {
+            y0 = yy;
+            continue;
+        }
+
+        for (x0 = 0; x0 + w <= TILER_WIDTH; x0 = ROUND_UP_TO(used + 1, align))
+        {
+            /* find the rightmost used slot in the candidate area */
+            for (used = -1, yy = y0; yy < y0 + h; yy++)
+            {
+                for (xx = x0 + w - 1; xx > used && xx >= x0; xx--)
+                {
+                    if (container[yy][xx]) { used = xx; break; }
+                }
+            }
+            if (used < 0)
+            {
+                for (yy = y0; yy < y0 + h; yy++)
+                    memset(container[yy] + x0, 1, w);
+                *x = x0;
+                *y = y0;
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void area_free(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    int yy;
+    for (yy = y; yy < y + h; yy++)
+        memset(container[yy] + x, 0, w);
+}
+
+/**
+ * Finds and reserves num_pages consecutive free pages in the
+ * page-mode range of a partition (first fit).
+ *
+ * @return 0 on success, non-0 if there is no such free range
+ */
+static int pages_alloc(int part, uint32_t num_pages, uint32_t *page)
+{
+    uint32_t start, end, total = sizeof(pages);
+
+    if (!num_pages || num_pages > total) return 1;
+    if (part) total = parts[part].page + parts[part].num_pages;
+
+    for (start = part ? parts[part].page : 0; start + num_pages <= total;
+         start = end + 1)
+    {
+        for (end = start; end < start + num_pages && !pages[end] &&
+                          page_part[end] == part; end++);
+        if (end == start + num_pages)
+        {
+            memset(pages + start, 1, num_pages);
+            *page = start;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void pages_free(uint32_t page, uint32_t num_pages)
+{
+    memset(pages + page, 0, num_pages);
+}
+
+/* ---------- container partitions ---------- */
+
+static int find_part(const char *name)
+{
+    int id;
+    for (id = 1; id <= TILER_STUB_MAX_PARTS; id++)
+    {
+        if (!strcmp(parts[id].name, name)) return id;
+    }
+    return -ENOENT;
+}
+
+/**
+ * Checks whether an area can be assigned to a partition: it must
+ * be in the container and the page-mode area, must not be in
+ * another named partition, and must be free.
+ *
+ * @return 0 if the area can be assigned, -EINVAL if it is out of
+ *         range, -EBUSY if it is not available
+ */
+static int part_check(int id, uint16_t row, uint16_t num_rows,
+                      uint32_t page, uint32_t num_pages)
+{
+    uint32_t ix;
+
+    if (row > TILER_HEIGHT || num_rows > TILER_HEIGHT - row ||
+        page > sizeof(pages) || num_pages > sizeof(pages) - page)
+        return -EINVAL;
+
+    for (ix = row; ix < (uint32_t) row + num_rows; ix++)
+    {
+        if ((row_part[ix] && row_part[ix] != id) ||
+            memchr(container[ix], 1, TILER_WIDTH)) return -EBUSY;
+    }
+    for (ix = page; ix < page + num_pages; ix++)
+    {
+        if ((page_part[ix] && page_part[ix] != id) || pages[ix]) return -EBUSY;
+    }
+    return 0;
+}
+
+/* assigns an area to a partition, returning its previous area to the
+   shared partition */
+static void part_assign(int id, uint16_t row, uint16_t num_rows,
+                        uint32_t page, uint32_t num_pages)
+{
+    struct _StubPart *p = parts + id;
+    memset(row_part + p->row, 0, p->num_rows);
+    memset(page_part + p->page, 0, p->num_pages);
+    p->row = row;
+    p->num_rows = num_rows;
+    p->page = page;
+    p->num_pages = num_pages;
+    memset(row_part + row, id, num_rows);
+    memset(page_part + page, id, num_pages);
+}
+
+/* ---------- DMM PAT emulation ---------- */
+
+/**
+ * Returns a fake physical address for a valid host address.  It
+ * is below the tiler space, and keeps the page offset.  Each
+ * host page is given its own fake page the first time it is
+ * seen, so distinct host pages never share an address.  Fake
+ * pages not referenced by a mapped block may be given to
+ * another host page later.
+ *
+ * @param ptr  Host address
+ * @param get  Whether to take a reference to the fake page
+ *
+ * @return the address, or 0 if all fake pages near the hash of
+ *         the host page are referenced.
+ */
+static uint32_t host_phys(void *ptr, int get)
+{
+    uintptr_t page = (uintptr_t) ptr / PAGE_SIZE;
+    uint32_t ix, n, free_ix = STUB_HOST_PAGES;
+
+    if (!host_pages) ALLOCN(host_pages, STUB_HOST_PAGES);
+    if (!host_refs) ALLOCN(host_refs, STUB_HOST_PAGES);
+    if (!host_pages || !host_refs) return 0;
+
+    /* fake pages are never emptied, so the probe ends at an empty one */
+    for (ix = (page * 2654435761u) % STUB_HOST_PAGES, n = 0;
+         n < STUB_HOST_PROBE && host_pages[ix] != page + 1;
+         ix = (ix + 1) % STUB_HOST_PAGES, n++)
+    {
+        if (free_ix == STUB_HOST_PAGES && !host_refs[ix]) free_ix = ix;
+        if (!host_pages[ix]) break;
+    }
+    if (n == STUB_HOST_PROBE || host_pages[ix] != page + 1)
+    {
+        if (free_ix == STUB_HOST_PAGES) return 0;
+        ix = free_ix;
+        host_pages[ix] = page + 1;
+    }
+    if (get) host_refs[ix]++;
+    return (ix + 1) * PAGE_SIZE + ((uintptr_t) ptr & (PAGE_SIZE - 1));
+}
+
+/* drops the references of num_pages host pages taken by host_get() */
+static void host_put(void *src, uint32_t num_pages)
+{
+    char *page = (char *)((uintptr_t) src & ~(PAGE_SIZE - 1));
+    while (num_pages--)
+    {
+        uint32_t phys = host_phys(page + num_pages * PAGE_SIZE, 0);
+        if (phys && host_refs[phys / PAGE_SIZE - 1])
+            host_refs[phys / PAGE_SIZE - 1]--;
+    }
+}
+
+/**
+ * Takes a reference to the fake pages of num_pages host pages
+ * for a mapped block, so they stay theirs until the block is
+ * freed.
+ *
+ * @return 0 on success, -ENOMEM if the fake pages are exhausted
+ */
+static int host_get(void *src, uint32_t num_pages)
+{
+    char *page = (char *)((uintptr_t) src & ~(PAGE_SIZE - 1));
+    uint32_t n;
+    for (n = 0; n < num_pages; n++)
+    {
+        if (!host_phys(page + n * PAGE_SIZE, 1))
+        {
+            host_put(src, n);
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/* allocates physical pages for a block */
+static uint32_t phys_alloc(uint32_t num_pages)
+{
+    if (phys_next + num_pages > STUB_PHYS_PAGES) phys_next = 0;
+    phys_next += num_pages;
+    return STUB_PHYS_BASE + (phys_next - num_pages) * PAGE_SIZE;
+}
+
+/**
+ * Programs the PAT for all pending refill descriptors in a
+ * single refill pass.
+ */
+static void pat_refill()
+{
+    _StubRefill *rf, *rf_safe;
+    if (DLIST_IS_EMPTY(refills)) return;
+
+    pat_stats.refills++;
+    DLIST_SAFE_MLOOP(refills, rf, rf_safe, link) {
+        uint32_t ix, iy, n;
+        for (n = iy = 0; iy < rf->h; iy++)
+        {
+            for (ix = 0; ix < rf->w; ix++, n++)
+            {
+                rf->pat[iy * rf->pitch + ix] = (rf->phys ?
+                    rf->phys + n * PAGE_SIZE :
+                    host_phys(rf->src + n * PAGE_SIZE, 0) & ~(PAGE_SIZE - 1));
+            }
+        }
+        pat_stats.entries += n;
+        pat_stats.descriptors++;
+
+        rf->block->refill = NULL;
+        DLIST_REMOVE(rf->link);
+        FREE(rf);
+    }
+}
+
+/**
+ * Queues the PAT refill for a newly allocated or mapped block.
+ * Without batching the PAT is programmed right away.
+ *
+ * @return 0 on success, -ENOMEM if out of memory
+ */
+static int pat_queue(_StubBlock *sb)
+{
+    _StubRefill *rf = NEW(_StubRefill);
+    if (!rf) return -ENOMEM;
+
+    if (sb->info.fmt == TILFMT_PAGE)
+    {
+        rf->pat = pat_1d + sb->page;
+        rf->w = rf->pitch = sb->num_pages;
+        rf->h = 1;
+    }
+    else
+    {
+        rf->pat = pat[sb->y] + sb->x;
+        rf->w = sb->w;
+        rf->h = sb->h;
+        rf->pitch = TILER_WIDTH;
+    }
+    if (sb->src)
+        rf->src = (void *)((uintptr_t) sb->src & ~(PAGE_SIZE - 1));
+    else
+        rf->phys = phys_alloc(rf->w * rf->h);
+    rf->block = sb;
+    sb->refill = rf;
+    DLIST_MADD_BEFORE(refills, rf, link);
+
+    if (!pat_batching) pat_refill();
+    return 0;
+}
+
+/**
+ * Releases the PAT entries of a block.  A pending refill is
+ * simply dropped.
+ */
+static void pat_release(_StubBlock *sb)
+{
+    if (sb->refill)
+    {
+        DLIST_REMOVE(sb->refill->link);
+        FREE(sb->refill);
+    }
+    else if (sb->info.fmt == TILFMT_PAGE)
+    {
+        memset(pat_1d + sb->page, 0, sb->num_pages * sizeof(*pat_1d));
+    }
+    else
+    {
+        int iy;
+        for (iy = sb->y; iy < sb->y + sb->h; iy++)
+            memset(pat[iy] + sb->x, 0, sb->w * sizeof(**pat));
+    }
+}
+
+/* ---------- ioctl emulation ---------- */
+
+static int is_stub_fd(int fd)
+{
+    int ix;
+    for (ix = 0; ix < num_fds; ix++)
+    {
+        if (fds[ix] == fd) return 1;
+    }
+    return 0;
+}
+
+static _StubBlock *find_block(uint32_t ssptr)
+{
+    _StubBlock *sb;
+    DLIST_MLOOP(blocks, sb, link) {
+        if (sb->info.ssptr == ssptr) return sb;
+    }
+    return NULL;
+}
+
+static void free_block(_StubBlock *sb)
+{
+    struct _StubPart *p = parts + sb->part;
+    pat_release(sb);
+    if (sb->src) host_put(sb->src, sb->num_pages);
+    if (sb->info.fmt == TILFMT_PAGE)
+    {
+        pages_free(sb->page, sb->num_pages);
+        p->used_pages -= sb->num_pages;
+    }
+    else
+    {
+        area_free(sb->x, sb->y, sb->w, sb->h);
+        p->used_slots -= sb->w * sb->h;
+    }
+    p->blocks--;
+    DLIST_REMOVE(sb->link);
+    FREE(sb);
+}
+
+/**
+ * Accounts for a newly reserved block, and queues its PAT
+ * refill.  The block is freed on failure.
+ *
+ * @return 0 on success, -ENOMEM if out of memory
+ */
+static int block_add(_StubBlock *sb)
+{
+    parts[sb->part].used_pages += sb->num_pages;
+    parts[sb->part].used_slots += sb->w * sb->h;
+    parts[sb->part].blocks++;
+    DLIST_MADD_BEFORE(blocks, sb, link);
+    if (pat_queue(sb))
+    {
+        free_block(sb);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * Allocates a 1D or 2D block (TILIOC_GBUF), or maps a user
+ * buffer into the page-mode area (TILIOC_MBUF) if src is not
+ * NULL.
+ */
+static int stub_gbuf(int fd, struct tiler_block_info *blk, void *src)
+{
+    _StubBlock *sb = NEW(_StubBlock);
+    if (!sb) return -ENOMEM;
+
+    sb->fd = fd;
+    sb->src = src;
+    sb->info = *blk;
+    sb->part = cur_part;
+    if (sb->part && !parts[sb->part].name[0])
+    {
+        FREE(sb);
+        return -EINVAL;
+    }
+
+    if (blk->fmt == TILFMT_PAGE)
+    {
+        uint32_t offs = (uintptr_t) src & (PAGE_SIZE - 1);
+        sb->num_pages = (offs + blk->dim.len + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (!blk->dim.len || pages_alloc(sb->part, sb->num_pages, &sb->page))
+        {
+            FREE(sb);
+            return -ENOMEM;
+        }
+        if (src && host_get(src, sb->num_pages))
+        {
+            pages_free(sb->page, sb->num_pages);
+            FREE(sb);
+            return -ENOMEM;
+        }
+        sb->info.ssptr = TILER_MEM_PAGED + sb->page * PAGE_SIZE + offs;
+    }
+    else if (blk->fmt >= TILFMT_8BIT && blk->fmt <= TILFMT_32BIT && !src)
+    {
+        uint32_t sw = slot_width(blk->fmt), sh = slot_height(blk->fmt);
+        uint32_t w = (blk->dim.area.width + sw - 1) / sw;
+        uint32_t h = (blk->dim.area.height + sh - 1) / sh;
+
+        /* like the driver, start 2D blocks on a page boundary */
+        uint32_t align = PAGE_SIZE / (sw * def_bpp(blk->fmt));
+        if (w > TILER_WIDTH || h > TILER_HEIGHT ||
+            area_alloc(sb->part, w, h, align, &sb->x, &sb->y))
+        {
+            FREE(sb);
+            return -ENOMEM;
+        }
+        sb->w = w;
+        sb->h = h;
+        sb->info.ssptr = container_base(blk->fmt) +
+            sb->y * sh * container_stride(blk->fmt) +
+            sb->x * sw * def_bpp(blk->fmt);
+    }
+    else
+    {
+        FREE(sb);
+        return -EINVAL;
+    }
+
+    if (block_add(sb)) return -ENOMEM;
+    blk->ssptr = sb->info.ssptr;
+    return 0;
+}
+
+/**
+ * Allocates a 1D or 2D block at the system space address in its
+ * ssptr field, in whichever partition owns that area.  This is
+ * how blocks that outlived their process are taken over.
+ *
+ * @return 0 on success, -EINVAL if the block is invalid, -EBUSY
+ *         if its area is not free, -ENOMEM if out of memory
+ */
+static int stub_place(int fd, struct tiler_block_info *blk)
+{
+    uint32_t ix, iy;
+    _StubBlock *sb = NEW(_StubBlock);
+    if (!sb) return -ENOMEM;
+
+    sb->fd = fd;
+    sb->info = *blk;
+    sb->info.ptr = NULL;
+    if (blk->fmt == TILFMT_PAGE && blk->ssptr >= TILER_MEM_PAGED &&
+        blk->ssptr < TILER_MEM_END && blk->dim.len)
+    {
+        uint32_t offs = blk->ssptr & (PAGE_SIZE - 1);
+        sb->page = (blk->ssptr - TILER_MEM_PAGED) / PAGE_SIZE;
+        sb->num_pages = (offs + blk->dim.len + PAGE_SIZE - 1) / PAGE_SIZE;
+        sb->part = page_part[sb->page];
+        if (sb->num_pages > sizeof(pages) - sb->page) goto INVALID;
+        for (ix = sb->page; ix < sb->page + sb->num_pages; ix++)
+        {
+            if (pages[ix] || page_part[ix] != sb->part) goto BUSY;
+        }
+        memset(pages + sb->page, 1, sb->num_pages);
+    }
+    else if (blk->fmt >= TILFMT_8BIT && blk->fmt <= TILFMT_32BIT &&
+             blk->ssptr >= container_base(blk->fmt) &&
+             blk->ssptr < container_base(blk->fmt) + TILER_MEM_16BIT - TILER_MEM_8BIT)
+    {
+        uint32_t sw = slot_width(blk->fmt), sh = slot_height(blk->fmt);
+        uint32_t offs = blk->ssptr - container_base(blk->fmt);
+        uint32_t stride = container_stride(blk->fmt);
+        if (offs % stride % (sw * def_bpp(blk->fmt)) || offs / stride % sh)
+            goto INVALID;
+        sb->x = offs % stride / (sw * def_bpp(blk->fmt));
+        sb->y = offs / stride / sh;
+        sb->w = (blk->dim.area.width + sw - 1) / sw;
+        sb->h = (blk->dim.area.height + sh - 1) / sh;
+        sb->part = row_part[sb->y];
+        if (!sb->w || !sb->h || sb->x + sb->w > TILER_WIDTH ||
+            sb->y + sb->h > TILER_HEIGHT) goto INVALID;
+        for (iy = sb->y; iy < sb->y + sb->h; iy++)
+        {
+            if (row_part[iy] != sb->part ||
+                memchr(container[iy] + sb->x, 1, sb->w)) goto BUSY;
+        }
+        for (iy = sb->y; iy < sb->y + sb->h; iy++)
+            memset(container[iy] + sb->x, 1, sb->w);
+    }
+    else goto INVALID;
+
+    return block_add(sb);
+
+INVALID:
+    FREE(sb);
+    return -EINVAL;
+BUSY:
+    FREE(sb);
+    return -EBUSY;
+}
+
+/* frees (TILIOC_FBUF) or unmaps (TILIOC_UMBUF) a block */
+static int stub_fbuf(struct tiler_block_info *blk, int mapped)
+{
+    _StubBlock *sb = find_block(blk->ssptr);
+    if (!sb || !sb->src != !mapped) return -EFAULT;
+    free_block(sb);
+    return 0;
+}
+
+/* registers a buffer (TILIOC_RBUF) */
+static int stub_rbuf(int fd, struct tiler_buf_info *buf)
+{
+    int ix;
+
+    if (buf->num_blocks <= 0 || buf->num_blocks > TILER_MAX_NUM_BLOCKS)
+        return -EINVAL;
+    for (ix = 0; ix < buf->num_blocks; ix++)
+    {
+        if (!find_block(buf->blocks[ix].ssptr)) return -EFAULT;
+    }
+
+    /* the blocks of the buffer become accessible from now on, so program
+       the PAT for all of them (and any other pending blocks) in one pass */
+    pat_refill();
+
+    /* find a free handle, and grow the handle table if needed */
+    for (ix = 0; ix < max_bufs && bufs[ix].info.num_blocks; ix++);
+    if (ix == max_bufs)
+    {
+        int more_bufs = max_bufs ? 2 * max_bufs : 64;
+        _StubBuf *new_bufs;
+        if (more_bufs > STUB_MAX_BUFS) more_bufs = STUB_MAX_BUFS;
+        if (more_bufs == max_bufs) return -ENOMEM;
+        ALLOCN(new_bufs, more_bufs);
+        if (!new_bufs) return -ENOMEM;
+        if (bufs) memcpy(new_bufs, bufs, sizeof(*bufs) * max_bufs);
+        FREE(bufs);
+        bufs = new_bufs;
+        max_bufs = more_bufs;
+    }
+
+    buf->offset = (ix + 1) * PAGE_SIZE;
+    bufs[ix].fd = fd;
+    bufs[ix].info = *buf;
+    return 0;
+}
+
+static _StubBuf *find_buf(int32_t offset)
+{
+    int ix = offset / PAGE_SIZE - 1;
+    if (offset % PAGE_SIZE || ix < 0 || ix >= max_bufs ||
+        !bufs[ix].info.num_blocks) return NULL;
+    return bufs + ix;
+}
+
+/* unregisters a buffer, releasing its backing memory */
+static void buf_drop(_StubBuf *sbuf)
+{
+    if (sbuf->mem_len) close(sbuf->mem_fd);
+    ZERO(*sbuf);
+}
+
+/**
+ * Makes sure that a registered buffer has at least len bytes of
+ * backing memory.
+ *
+ * @return 0 on success, -errno on failure
+ */
+static int buf_backing(_StubBuf *sbuf, size_t len)
+{
+    int fd = sbuf->mem_len ? sbuf->mem_fd : memfd_create("tiler", MFD_CLOEXEC);
+    if (fd < 0) return -errno;
+    if (len > sbuf->mem_len && ftruncate(fd, len))
+    {
+        int err = errno;
+        if (!sbuf->mem_len) close(fd);
+        return -err;
+    }
+    sbuf->mem_fd = fd;
+    if (len > sbuf->mem_len) sbuf->mem_len = len;
+    return 0;
+}
+
+/**
+ * Finds the block that contains a virtual address in the stub's
+ * mappings.
+ *
+ * @param ptr    Virtual address
+ * @param start  Pointer to store the address of the first byte
+ *               of the block.  It is set to the mapping
+ *               address if ptr is in a mapping but not in a
+ *               block, and to NULL if ptr is not in a mapping.
+ *
+ * @return Pointer to the block info, or NULL if not found.
+ */
+static struct tiler_block_info *find_mapped_block(void *ptr, void **start)
+{
+    _StubView *sv;
+    DLIST_MLOOP(views, sv, link) {
+        if (ptr < sv->addr || ptr >= sv->addr + sv->len) continue;
+
+        /* blocks are packed consecutively, starting at the page offset
+           of their ssptr */
+        uint32_t cum = 0;
+        int ix;
+        for (ix = 0; ix < sv->info.num_blocks; ix++)
+        {
+            struct tiler_block_info *blk = sv->info.blocks + ix;
+            *start = sv->addr + cum + (blk->ssptr & (PAGE_SIZE - 1));
+            uint32_t size = def_size(blk);
+            if (ptr >= *start && ptr < *start + size) return blk;
+            cum += size;
+        }
+        *start = sv->addr;
+        return NULL;
+    }
+    *start = NULL;
+    return NULL;
+}
+
+/**
+ * Translates a virtual address into a system space address
+ * (TILIOC_GSSP).  Addresses in tiler mappings are translated
+ * into the tiler views.  Other valid addresses get a fake
+ * physical address below the tiler space that keeps the page
+ * offset.  Invalid addresses return 0.
+ */
+static uint32_t stub_gssp(void *ptr)
+{
+    void *start;
+    _StubView *sv;
+    DLIST_MLOOP(views, sv, link) {
+        if (sv->ssptr && ptr >= sv->addr && ptr < sv->addr + sv->len)
+            return sv->ssptr + (ptr - sv->addr);
+    }
+
+    struct tiler_block_info *blk = find_mapped_block(ptr, &start);
+    if (blk)
+    {
+        uint32_t offs = ptr - start;
+        if (blk->fmt == TILFMT_PAGE) return blk->ssptr + offs;
+
+        uint32_t stride = def_stride(blk->dim.area.width * def_bpp(blk->fmt));
+        return blk->ssptr + offs / stride * container_stride(blk->fmt) +
+               offs % stride;
+    }
+    else if (start)
+    {
+        return 0;
+    }
+
+    /* see if this is a valid address at all */
+    unsigned char vec;
+    void *page = (void *)((uintptr_t) ptr & ~(PAGE_SIZE - 1));
+    if (!ptr || mincore(page, PAGE_SIZE, &vec)) return 0;
+    return host_phys(ptr, 0);
+}
+
+/* number of rows of len bytes, stride apart, that fit in avail bytes */
+static uint32_t linear_rows(uint32_t avail, uint32_t len, uint32_t stride,
+                            uint32_t max_rows)
+{
+    uint32_t rows = stride ? (avail - len) / stride + 1 : max_rows;
+    return (rows < max_rows ? rows : max_rows);
+}
+
+/**
+ * Translates rows in system space into the stub's mappings: the
+ * inverse of stub_gssp.  Mappings of registered buffers are
+ * preferred over apertures, as they hold the buffer data.
+ *
+ * @param ssptr        System space address of the first row
+ * @param len          Bytes per row
+ * @param stride       System space stride of the rows
+ * @param max_rows     Number of rows to translate
+ * @param host         Set to the address of the first row
+ * @param host_stride  Set to the stride of the rows in the mapping
+ *
+ * @return number of rows (up to max_rows) mapped at host + row *
+ *         host_stride, or 0 if the first row is not mapped.
+ */
+static uint32_t stub_host_rows(uint32_t ssptr, uint32_t len,
+                               uint32_t stride, uint32_t max_rows,
+                               char **host, uint32_t *host_stride)
+{
+    _StubView *sv;
+    uint64_t end = (uint64_t) ssptr + len;
+    DLIST_MLOOP(views, sv, link) {
+        if (sv->ssptr) continue;
+
+        uint32_t cum = 0;
+        int ix;
+        for (ix = 0; ix < sv->info.num_blocks; ix++)
+        {
+            struct tiler_block_info *blk = sv->info.blocks + ix;
+            char *start = (char *) sv->addr + cum +
+                          (blk->ssptr & (PAGE_SIZE - 1));
+            uint32_t size = def_size(blk);
+            cum += size;
+            if (ssptr < blk->ssptr) continue;
+
+            uint32_t offs = ssptr - blk->ssptr;
+            if (blk->fmt == TILFMT_PAGE)
+            {
+                if (end > (uint64_t) blk->ssptr + size) continue;
+                *host = start + offs;
+                *host_stride = stride;
+                return linear_rows(size - offs, len, stride, max_rows);
+            }
+
+            /* 2D rows are contiguous in the mapping only if the rows
+               are consecutive in the container view */
+            uint32_t width = blk->dim.area.width * def_bpp(blk->fmt);
+            uint32_t row = offs / container_stride(blk->fmt);
+            uint32_t col = offs % container_stride(blk->fmt);
+            if (row >= blk->dim.area.height || (uint64_t) col + len > width)
+                continue;
+            *host = start + row * def_stride(width) + col;
+            *host_stride = def_stride(width);
+            if (stride != container_stride(blk->fmt)) return 1;
+            row = blk->dim.area.height - row;
+            return (row < max_rows ? row : max_rows);
+        }
+    }
+
+    DLIST_MLOOP(views, sv, link) {
+        if (!sv->ssptr || ssptr < sv->ssptr ||
+            end > (uint64_t) sv->ssptr + sv->len) continue;
+        *host = (char *) sv->addr + (ssptr - sv->ssptr);
+        *host_stride = stride;
+        return linear_rows(sv->ssptr + sv->len - ssptr, len, stride,
+                           max_rows);
+    }
+    return 0;
+}
+
+/**
+ * Drops the views that a fixed mapping replaces.  The parts of
+ * the views outside the new mapping are unmapped as well.
+ *
+ * @param addr   Start of the new mapping
+ * @param len    Length of the new mapping
+ */
+static void drop_views(void *addr, size_t len)
+{
+    _StubView *sv, *sv_;
+    void *end = addr + ROUND_UP_TO2POW(len, PAGE_SIZE);
+    DLIST_SAFE_MLOOP(views, sv, sv_, link) {
+        if (sv->addr >= end || sv->addr + sv->len <= addr) continue;
+        if (sv->addr < addr) munmap(sv->addr, addr - sv->addr);
+        if (sv->addr + sv->len > end) munmap(end, sv->addr + sv->len - end);
+        DLIST_REMOVE(sv->link);
+        FREE(sv);
+    }
+}
+
+/* ---------- redirected entry points ---------- */
+
+int TilerStub_Open(const char *path, int flags)
+{
+    if (strcmp(path, TILER_DEVICE_PATH)) return open(path, flags);
+
+    pthread_mutex_lock(&stub_mutex);
+    init();
+
+    /* use a real file descriptor so that it does not clash with others */
+    int fd = -1;
+    if (num_fds < STUB_MAX_FDS)
+    {
+        fd = open("/dev/null", O_RDWR);
+        if (fd >= 0) fds[num_fds++] = fd;
+    }
+    else
+    {
+        errno = EMFILE;
+    }
+
+    pthread_mutex_unlock(&stub_mutex);
+    return fd;
+}
+
+int TilerStub_Close(int fd)
+{
+    pthread_mutex_lock(&stub_mutex);
+    if (is_stub_fd(fd))
+    {
+        int ix;
+
+        /* like the driver, release everything the fd still owns */
+        for (ix = 0; ix < max_bufs; ix++)
+        {
+            if (bufs[ix].info.num_blocks && bufs[ix].fd == fd)
+                buf_drop(bufs + ix);
+        }
+        _StubBlock *sb, *sb_safe;
+        DLIST_SAFE_MLOOP(blocks, sb, sb_safe, link) {
+            if (sb->fd == fd) free_block(sb);
+        }
+
+        for (ix = 0; fds[ix] != fd; ix++);
+        fds[ix] = fds[--num_fds];
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return close(fd);
+}
+
+int TilerStub_Ioctl(int fd, unsigned long cmd, unsigned long arg)
+{
+    pthread_mutex_lock(&stub_mutex);
+    if (!is_stub_fd(fd))
+    {
+        pthread_mutex_unlock(&stub_mutex);
+        return ioctl(fd, cmd, arg);
+    }
+
+    int ret = 0;
+    struct tiler_block_info *blk = (struct tiler_block_info *) arg;
+    struct tiler_buf_info *buf = (struct tiler_buf_info *) arg;
+    _StubBuf *sbuf;
+
+    switch (cmd)
+    {
+    case TILIOC_GBUF:
+        ret = stub_gbuf(fd, blk, NULL);
+        break;
+    case TILIOC_FBUF:
+        ret = stub_fbuf(blk, 0);
+        break;
+    case TILIOC_MBUF:
+        ret = (blk->fmt == TILFMT_PAGE && blk->ptr ?
+               stub_gbuf(fd, blk, blk->ptr) : -EINVAL);
+        break;
+    case TILIOC_UMBUF:
+        ret = stub_fbuf(blk, 1);
+        break;
+    case TILIOC_GSSP:
+        pat_refill();
+        ret = stub_gssp((void *) arg);
+        break;
+    case TILIOC_RBUF:
+        ret = stub_rbuf(fd, buf);
+        break;
+    case TILIOC_QBUF:
+        sbuf = find_buf(buf->offset);
+        if (sbuf) *buf = sbuf->info;
+        else ret = -EFAULT;
+        break;
+    case TILIOC_URBUF:
+        sbuf = find_buf(buf->offset);
+        if (sbuf) buf_drop(sbuf);
+        else ret = -EFAULT;
+        break;
+    default:
+        ret = -EINVAL;
+    }
+
+    pthread_mutex_unlock(&stub_mutex);
+
+    if (ret < 0)
+    {
+        errno = -ret;
+        ret = -1;
+    }
+    return ret;
+}
+
+void *TilerStub_Mmap(void *addr, size_t len, int prot, int flags, int fd,
+                     off_t offset)
+{
+    void *ptr = MAP_FAILED;
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    if (!is_stub_fd(fd))
+    {
+        ptr = mmap(addr, len, prot, flags, fd, offset);
+        if (ptr != MAP_FAILED && (flags & MAP_FIXED)) drop_views(addr, len);
+        pthread_mutex_unlock(&stub_mutex);
+        return ptr;
+    }
+
+    _StubBuf *sbuf = find_buf(offset);
+    pat_refill();
+    _StubView *sv = NEW(_StubView);
+    if (sv && offset >= TILER_MEM_8BIT && offset < TILER_MEM_END && len &&
+        len <= TILER_MEM_END - (uint32_t) offset)
+    {
+        /* aperture: only pages that are touched take up memory */
+        sv->len = len;
+        sv->ssptr = offset;
+        sv->addr = mmap(addr, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                        (flags & MAP_FIXED), -1, 0);
+        if (sv->addr != MAP_FAILED)
+        {
+            ptr = sv->addr;
+            DLIST_MADD_BEFORE(views, sv, link);
+            sv = NULL;
+        }
+    }
+    else if (sbuf && sv)
+    {
+        /* the first block may start at a page offset, which a fixed
+           mapping must account for in its length */
+        sv->len = (flags & MAP_FIXED) ? len : len + PAGE_SIZE;
+        sv->info = sbuf->info;
+        if (flags & MAP_FIXED) drop_views(addr, len);
+
+        /* like the driver, map the user pages of a mapped buffer
+           themselves.  This is only possible for shared pages, such as
+           those of a shared file mapping; others get backing memory. */
+        _StubBlock *sb = sbuf->info.num_blocks == 1 ?
+            find_block(sbuf->info.blocks[0].ssptr) : NULL;
+        sv->addr = MAP_FAILED;
+        if (sb && sb->src && !sbuf->mem_len)
+        {
+            sv->addr = mremap(sb->src, 0, len, MREMAP_MAYMOVE |
+                              ((flags & MAP_FIXED) ? MREMAP_FIXED : 0), addr);
+            if (sv->addr != MAP_FAILED) sv->len = len;
+        }
+        int err = sv->addr != MAP_FAILED ? 0 : buf_backing(sbuf, sv->len);
+        if (sv->addr == MAP_FAILED)
+        {
+            sv->addr = err ? MAP_FAILED :
+                mmap(addr, sv->len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | (flags & MAP_FIXED), sbuf->mem_fd, 0);
+        }
+        if (err) errno = -err;
+        if (sv->addr != MAP_FAILED)
+        {
+            ptr = sv->addr;
+            DLIST_MADD_BEFORE(views, sv, link);
+            sv = NULL;
+        }
+    }
+    else
+    {
+        errno = sbuf ? ENOMEM : EINVAL;
+    }
+    FREE(sv);
+
+    pthread_mutex_unlock(&stub_mutex);
+    return ptr;
+}
+
+int TilerStub_Munmap(void *addr, size_t len)
+{
+    _StubView *sv;
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    DLIST_MLOOP(views, sv, link) {
+        if (sv->addr == addr) {
+            DLIST_REMOVE(sv->link);
+            pthread_mutex_unlock(&stub_mutex);
+
+            int ret = munmap(sv->addr, sv->len);
+            FREE(sv);
+            return ret;
+        }
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return munmap(addr, len);
+}
+
+void TilerStub_GetPatStats(TilerStubPatStats *stats)
+{
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    pat_refill();
+    *stats = pat_stats;
+    pthread_mutex_unlock(&stub_mutex);
+}
+
+void TilerStub_ResetPatStats()
+{
+    pthread_mutex_lock(&stub_mutex);
+    ZERO(pat_stats);
+    pthread_mutex_unlock(&stub_mutex);
+}
+
+int TilerStub_SetPatBatching(int enable)
+{
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    int was_enabled = pat_batching;
+    pat_batching = enable;
+    if (!enable) pat_refill();
+    pthread_mutex_unlock(&stub_mutex);
+    return was_enabled;
+}
+
+uint32_t TilerStub_GetPatEntry(uint32_t ssptr)
+{
+    uint32_t entry = 0;
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    pat_refill();
+    if (ssptr >= TILER_MEM_PAGED && ssptr < TILER_MEM_END)
+    {
+        entry = pat_1d[(ssptr - TILER_MEM_PAGED) / PAGE_SIZE];
+    }
+    else if (ssptr >= TILER_MEM_8BIT && ssptr < TILER_MEM_PAGED)
+    {
+        enum tiler_fmt fmt = (ssptr < TILER_MEM_16BIT ? TILFMT_8BIT :
+                              ssptr < TILER_MEM_32BIT ? TILFMT_16BIT :
+                                                        TILFMT_32BIT);
+        uint32_t offs = ssptr - container_base(fmt);
+        uint32_t y = offs / container_stride(fmt) / slot_height(fmt);
+        uint32_t x = offs % container_stride(fmt) /
+                     (slot_width(fmt) * def_bpp(fmt));
+        if (y < TILER_HEIGHT) entry = pat[y][x];
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return entry;
+}
+
+int TilerStub_GetView(void *ptr, int rotation, TilerStubView *view)
+{
+    int ret = -EINVAL;
+    void *start;
+
+    if (rotation != 0 && rotation != 90 && rotation != 180 &&
+        rotation != 270) return ret;
+
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    struct tiler_block_info *blk = find_mapped_block(ptr, &start);
+    if (blk && blk->fmt != TILFMT_PAGE && ptr == start)
+    {
+        view->ptr = start;
+        view->bpp = def_bpp(blk->fmt);
+        view->stride = def_stride(blk->dim.area.width * view->bpp);
+        view->nat_width = blk->dim.area.width;
+        view->nat_height = blk->dim.area.height;
+        view->rotation = rotation;
+        view->width = (rotation % 180 ? view->nat_height : view->nat_width);
+        view->height = (rotation % 180 ? view->nat_width : view->nat_height);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+void TilerStub_CacheSync(void *ptr, size_t len, int for_device)
+{
+    pthread_mutex_lock(&stub_mutex);
+    if (for_device)
+        cache_stats.cleaned += len;
+    else
+        cache_stats.invalidated += len;
+    cache_stats.ops++;
+    pthread_mutex_unlock(&stub_mutex);
+}
+
+void TilerStub_GetCacheStats(TilerStubCacheStats *stats)
+{
+    pthread_mutex_lock(&stub_mutex);
+    *stats = cache_stats;
+    pthread_mutex_unlock(&stub_mutex);
+}
+
+void TilerStub_ResetCacheStats()
+{
+    pthread_mutex_lock(&stub_mutex);
+    ZERO(cache_stats);
+    pthread_mutex_unlock(&stub_mutex);
+}
+
+int TilerStub_CreatePartition(const char *name, uint16_t row,
+                              uint16_t num_rows, uint32_t page,
+                              uint32_t num_pages)
+{
+    int id, ret;
+    if (!name || !*name || strlen(name) >= TILER_STUB_PART_NAME) return -EINVAL;
+
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    for (id = 1; id <= TILER_STUB_MAX_PARTS && parts[id].name[0]; id++);
+    if (find_part(name) > 0)
+    {
+        ret = -EEXIST;
+    }
+    else if (id > TILER_STUB_MAX_PARTS)
+    {
+        ret = -ENOSPC;
+    }
+    else if (!(ret = part_check(id, row, num_rows, page, num_pages)))
+    {
+        strcpy(parts[id].name, name);
+        part_assign(id, row, num_rows, page, num_pages);
+        ret = id;
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+int TilerStub_ResizePartition(int id, uint16_t row, uint16_t num_rows,
+                              uint32_t page, uint32_t num_pages)
+{
+    int ret = -EINVAL;
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    if (id > 0 && id <= TILER_STUB_MAX_PARTS && parts[id].name[0])
+    {
+        ret = parts[id].blocks ? -EBUSY :
+              part_check(id, row, num_rows, page, num_pages);
+        if (!ret) part_assign(id, row, num_rows, page, num_pages);
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+int TilerStub_DeletePartition(int id)
+{
+    int ret = -EINVAL;
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    if (id > 0 && id <= TILER_STUB_MAX_PARTS && parts[id].name[0])
+    {
+        ret = parts[id].blocks ? -EBUSY : 0;
+        if (!ret)
+        {
+            part_assign(id, 0, 0, 0, 0);
+            ZERO(parts[id]);
+        }
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+int TilerStub_FindPartition(const char *name)
+{
+    pthread_mutex_lock(&stub_mutex);
+    int id = name ? find_part(name) : -ENOENT;
+    pthread_mutex_unlock(&stub_mutex);
+    return id;
+}
+
+int TilerStub_UsePartition(int id)
+{
+    int ret = -EINVAL;
+    pthread_mutex_lock(&stub_mutex);
+    if (id == 0 || (id > 0 && id <= TILER_STUB_MAX_PARTS && parts[id].name[0]))
+    {
+        ret = cur_part;
+        cur_part = id;
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+int TilerStub_GetPartitionStats(int id, TilerStubPartStats *stats)
+{
+    uint32_t ix, run = 0;
+    if (id < 0 || id > TILER_STUB_MAX_PARTS) return -EINVAL;
+
+    pthread_mutex_lock(&stub_mutex);
+    if (id && !parts[id].name[0])
+    {
+        pthread_mutex_unlock(&stub_mutex);
+        return -EINVAL;
+    }
+
+    ZERO(*stats);
+    for (ix = 0; ix < TILER_HEIGHT; ix++)
+    {
+        if (row_part[ix] == id) stats->slots += TILER_WIDTH;
+    }
+    for (ix = 0; ix < sizeof(pages); ix++)
+    {
+        if (page_part[ix] != id)
+        {
+            run = 0;
+            continue;
+        }
+        stats->pages++;
+        run = pages[ix] ? 0 : run + 1;
+        if (run > stats->max_free_pages) stats->max_free_pages = run;
+    }
+    stats->free_slots = stats->slots - parts[id].used_slots;
+    stats->free_pages = stats->pages - parts[id].used_pages;
+    stats->blocks = parts[id].blocks;
+    pthread_mutex_unlock(&stub_mutex);
+    return 0;
+}
+
+int TilerStub_ExportBuf(int fd, int32_t offset)
+{
+    pthread_mutex_lock(&stub_mutex);
+    _StubBuf *sbuf = is_stub_fd(fd) ? find_buf(offset) : NULL;
+    int ix, ret = -EINVAL;
+    if (sbuf)
+    {
+        /* a buffer that was never mapped gets its backing now */
+        size_t len = PAGE_SIZE;
+        for (ix = 0; ix < sbuf->info.num_blocks; ix++)
+            len += def_size(sbuf->info.blocks + ix);
+        ret = buf_backing(sbuf, len);
+    }
+    if (!ret)
+    {
+        ret = fcntl(sbuf->mem_fd, F_DUPFD_CLOEXEC, 0);
+        if (ret < 0) ret = -errno;
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+int TilerStub_AdoptBuf(int fd, struct tiler_buf_info *buf, int mem_fd)
+{
+    struct stat st;
+    int placed = 0, ret = 0;
+
+    pthread_mutex_lock(&stub_mutex);
+    init();
+    if (!is_stub_fd(fd) || buf->num_blocks <= 0 ||
+        buf->num_blocks > TILER_MAX_NUM_BLOCKS || fstat(mem_fd, &st) ||
+        !st.st_size) ret = -EINVAL;
+
+    while (!ret && placed < buf->num_blocks)
+    {
+        ret = stub_place(fd, buf->blocks + placed);
+        if (!ret) placed++;
+    }
+    if (!ret) ret = stub_rbuf(fd, buf);
+    if (!ret)
+    {
+        _StubBuf *sbuf = find_buf(buf->offset);
+        sbuf->mem_fd = fcntl(mem_fd, F_DUPFD_CLOEXEC, 0);
+        if (sbuf->mem_fd >= 0)
+        {
+            sbuf->mem_len = st.st_size;
+        }
+        else
+        {
+            ret = -errno;
+            ZERO(*sbuf);
+        }
+    }
+
+    /* free the blocks placed so far on failure */
+    while (ret && placed--)
+    {
+        free_block(find_block(buf->blocks[placed].ssptr));
+    }
+    pthread_mutex_unlock(&stub_mutex);
+    return ret;
+}
+
+/* ---------- DMA engine ---------- */
+
+/* a submitted descriptor list */
+struct _StubDmaList {
+    int seq;
+    int num_descs;
+    struct _StubDmaListList {
+        struct _StubDmaListList *next, *last;
+        struct _StubDmaList *me;
+    } link;
+    TilerStubDmaDesc descs[1];  /* num_descs descriptors */
+};
+
+typedef struct _StubDmaList _StubDmaList;
+typedef struct _StubDmaListList _StubDmaListList;
+
+struct TilerStubDma {
+    pthread_mutex_t  mutex;     /* protects the fields below */
+    pthread_cond_t   cond;      /* signaled when a list is queued */
+    _StubDmaListList queue;     /* lists waiting for a worker */
+    pthread_t       *workers;
+    int              num_workers;
+    int              efd;       /* completion eventfd */
+    int              stop;
+    int              next_seq;
+    int              in_flight; /* lists submitted but not completed */
+    int              results[TILER_STUB_DMA_DEPTH];
+    TilerStubDmaStats stats;
+};
+
+/**
+ * Executes a descriptor.  Rows are translated under the stub
+ * mutex in runs that are contiguous in both mappings, and copied
+ * without it.
+ *
+ * @return 0 on success, or -EFAULT if a row is not mapped.
+ */
+static int dma_run(const TilerStubDmaDesc *d)
+{
+    uint32_t rows = d->op == TILER_STUB_DMA_COPY ? 1 : d->height;
+    uint32_t row = 0, n;
+
+    while (row < rows)
+    {
+        char *dst, *src = NULL;
+        uint32_t dst_stride, src_stride = 0;
+
+        pthread_mutex_lock(&stub_mutex);
+        n = stub_host_rows(d->dst + row * d->dst_stride, d->width,
+                           d->dst_stride, rows - row, &dst, &dst_stride);
+        if (n && d->op != TILER_STUB_DMA_FILL)
+        {
+            n = stub_host_rows(d->src + row * d->src_stride, d->width,
+                               d->src_stride, n, &src, &src_stride);
+        }
+        pthread_mutex_unlock(&stub_mutex);
+        if (!n) return -EFAULT;
+
+        for (row += n; n--; dst += dst_stride, src += src_stride)
+        {
+            if (d->op == TILER_STUB_DMA_FILL)
+                memset(dst, d->value, d->width);
+            else
+                memcpy(dst, src, d->width);
+        }
+    }
+    return 0;
+}
+
+static void *dma_worker(void *arg)
+{
+    TilerStubDma *dma = (TilerStubDma *) arg;
+
+    pthread_mutex_lock(&dma->mutex);
+    for (;;)
+    {
+        while (DLIST_IS_EMPTY(dma->queue) && !dma->stop)
+        {
+            pthread_cond_wait(&dma->cond, &dma->mutex);
+        }
+        if (DLIST_IS_EMPTY(dma->queue)) break;
+
+        _StubDmaList *dl = dma->queue.next->me;
+        DLIST_REMOVE(dl->link);
+        pthread_mutex_unlock(&dma->mutex);
+
+        uint64_t bytes = 0;
+        int ix, ret = 0;
+        for (ix = 0; !ret && ix < dl->num_descs; ix++)
+        {
+            const TilerStubDmaDesc *d = dl->descs + ix;
+            ret = dma_run(d);
+            if (!ret) bytes += (uint64_t) d->width *
+                               (d->op == TILER_STUB_DMA_COPY ? 1 : d->height);
+        }
+
+        pthread_mutex_lock(&dma->mutex);
+        dma->results[dl->seq % TILER_STUB_DMA_DEPTH] = ret;
+        dma->in_flight--;
+        dma->stats.lists++;
+        dma->stats.descriptors += ret ? ix - 1 : ix;
+        dma->stats.bytes += bytes;
+        if (ret) dma->stats.faults++;
+        pthread_mutex_unlock(&dma->mutex);
+
+        /* signal after the result is recorded */
+        eventfd_write(dma->efd, 1);
+        FREE(dl);
+        pthread_mutex_lock(&dma->mutex);
+    }
+    pthread_mutex_unlock(&dma->mutex);
+    return NULL;
+}
+
+TilerStubDma *TilerStub_DmaCreate(int num_workers)
+{
+    IN;
+    int ix;
+
+    if (NOT_I(num_workers,>,0)) return R_P(NULL);
+
+    TilerStubDma *dma = NEW(TilerStubDma);
+    if (NOT_P(dma,!=,NULL)) return R_P(NULL);
+    pthread_mutex_init(&dma->mutex, NULL);
+    pthread_cond_init(&dma->cond, NULL);
+    DLIST_INIT(dma->queue);
+    dma->next_seq = 1;
+    dma->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALLOCN(dma->workers, num_workers);
+    if (NOT_I(dma->efd,>=,0) || NOT_P(dma->workers,!=,NULL)) goto FAIL;
+
+    for (ix = 0; ix < num_workers; ix++)
+    {
+        if (NOT_I(pthread_create(dma->workers + ix, NULL, dma_worker, dma),
+                  ==,0)) goto FAIL;
+        dma->num_workers++;
+    }
+    return R_P(dma);
+
+FAIL:
+    TilerStub_DmaDestroy(dma);
+    return R_P(NULL);
+}
+
+void TilerStub_DmaDestroy(TilerStubDma *dma)
+{
+    IN;
+    int ix;
+
+    if (!dma) return;
+    pthread_mutex_lock(&dma->mutex);
+    dma->stop = 1;
+    pthread_cond_broadcast(&dma->cond);
+    pthread_mutex_unlock(&dma->mutex);
+    for (ix = 0; ix < dma->num_workers; ix++)
+    {
+        pthread_join(dma->workers[ix], NULL);
+    }
+
+    if (dma->efd >= 0) close(dma->efd);
+    FREE(dma->workers);
+    FREE(dma);
+}
+
+int TilerStub_DmaGetFd(TilerStubDma *dma)
+{
+    return dma->efd;
+}
+
+int TilerStub_DmaSubmit(TilerStubDma *dma, const TilerStubDmaDesc descs[],
+                        int num_descs)
+{
+    int ix, seq;
+
+    if (!dma || !descs || num_descs <= 0) return -EINVAL;
+    for (ix = 0; ix < num_descs; ix++)
+    {
+        const TilerStubDmaDesc *d = descs + ix;
+        uint32_t rows = d->op == TILER_STUB_DMA_COPY ? 1 : d->height;
+        if (d->op < TILER_STUB_DMA_COPY || d->op > TILER_STUB_DMA_FILL ||
+            !d->width || !rows) return -EINVAL;
+
+        /* rows must not wrap around the system space */
+        if ((uint64_t) d->dst + (uint64_t) (rows - 1) * d->dst_stride +
+            d->width > 0x100000000ULL) return -EINVAL;
+        if (d->op != TILER_STUB_DMA_FILL &&
+            (uint64_t) d->src + (uint64_t) (rows - 1) * d->src_stride +
+            d->width > 0x100000000ULL) return -EINVAL;
+    }
+
+    _StubDmaList *dl = malloc(sizeof(*dl) + (num_descs - 1) * sizeof(*descs));
+    if (!dl) return -ENOMEM;
+    dl->num_descs = num_descs;
+    memcpy(dl->descs, descs, num_descs * sizeof(*descs));
+
+    pthread_mutex_lock(&dma->mutex);
+    if (dma->in_flight >= TILER_STUB_DMA_DEPTH)
+    {
+        pthread_mutex_unlock(&dma->mutex);
+        FREE(dl);
+        return -EAGAIN;
+    }
+    seq = dl->seq = dma->next_seq++;
+    dma->results[seq % TILER_STUB_DMA_DEPTH] = -EINPROGRESS;
+    dma->in_flight++;
+    DLIST_MADD_BEFORE(dma->queue, dl, link);
+    pthread_cond_signal(&dma->cond);
+    pthread_mutex_unlock(&dma->mutex);
+    return seq;
+}
+
+int TilerStub_DmaResult(TilerStubDma *dma, int seq)
+{
+    int ret = -ENOENT;
+    pthread_mutex_lock(&dma->mutex);
+    if (seq > 0 && seq < dma->next_seq &&
+        dma->next_seq - seq <= TILER_STUB_DMA_DEPTH)
+    {
+        ret = dma->results[seq % TILER_STUB_DMA_DEPTH];
+    }
+    pthread_mutex_unlock(&dma->mutex);
+    return ret;
+}
+
+void TilerStub_DmaGetStats(TilerStubDma *dma, TilerStubDmaStats *stats)
+{
+    pthread_mutex_lock(&dma->mutex);
+    *stats = dma->stats;
+    pthread_mutex_unlock(&dma->mutex);
+}
@@ -0,0 +1,483 @@
+/*
+ *  tiler_stub.h
+ *
+ *  TILER driver emulation for non-OMAP hosts.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TILER_STUB_H_
+#define _TILER_STUB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * The tiler stub emulates the /dev/tiler driver in user space,
+ * so that the memory allocator and tiler manager can be built
+ * and tested on hosts without a TILER (configure
+ * --enable-stub).
+ * <p>
+ * The stub keeps the 32-bit system-space layout of the device:
+ * 2D blocks are allocated in a 256x128 slot container and
+ * receive ssptrs in the 8/16/32-bit views, 1D blocks receive
+ * ssptrs in the page-mode area.  Registered buffers are tracked
+ * in a handle table, and buf.offset is a page-aligned handle
+ * into this table, never a host pointer.  Host memory backing
+ * the buffers is only created when a registered buffer is
+ * mmap-ed, and virtual-to-system address translation goes
+ * through these mappings.  This keeps the stub correct on
+ * 64-bit hosts.
+ * <p>
+ * Mapping at an offset in the tiler space maps that range of
+ * the tiler space instead (e.g. a whole TILER_MEM_* region for
+ * aperture mode).  Such apertures are backed by host memory
+ * that is only committed when touched.  Fixed mappings
+ * (MAP_FIXED) are placed at the requested address, and drop the
+ * parts of any views they replace.
+ * <p>
+ * Sources that talk to the driver include this header when
+ * STUB_TILER is defined.  It redirects open, close, ioctl, mmap
+ * and munmap to the stub.  The stub functions pass any file
+ * descriptor or address that does not belong to the stub to the
+ * C library.
+ */
+
+int TilerStub_Open(const char *path, int flags);
+int TilerStub_Close(int fd);
+int TilerStub_Ioctl(int fd, unsigned long cmd, unsigned long arg);
+void *TilerStub_Mmap(void *addr, size_t len, int prot, int flags, int fd,
+                     off_t offset);
+int TilerStub_Munmap(void *addr, size_t len);
+
+/**
+ * The stub also models the DMM page address translator (PAT):
+ * one entry per container slot and per page-mode page, each
+ * holding the physical address of the backing page.  Allocating
+ * or mapping a block queues a refill descriptor for its area.
+ * Pending descriptors are processed in a single refill pass when
+ * a buffer is registered, or when an address is translated or
+ * mapped.  Descriptors of blocks freed before that are dropped.
+ */
+struct TilerStubPatStats {
+    uint32_t entries;       /* PAT entries written */
+    uint32_t descriptors;   /* refill descriptors processed */
+    uint32_t refills;       /* refill passes */
+};
+
+typedef struct TilerStubPatStats TilerStubPatStats;
+
+/**
+ * Returns the PAT statistics accumulated since the last reset.
+ * Pending refills are processed first.
+ *
+ * @param stats  Pointer to the statistics to fill out
+ */
+void TilerStub_GetPatStats(TilerStubPatStats *stats);
+
+/**
+ * Resets the PAT statistics.
+ */
+void TilerStub_ResetPatStats();
+
+/**
+ * Enables or disables batching of PAT refills.  Without
+ * batching, each block is refilled in its own pass as soon as it
+ * is allocated or mapped.  Batching is enabled by default.
+ *
+ * @param enable  Non-0 to enable batching
+ *
+ * @return the previous setting
+ */
+int TilerStub_SetPatBatching(int enable);
+
+/**
+ * Returns the PAT entry for a system space address.
+ *
+ * @param ssptr  System space address
+ *
+ * @return physical page address the PAT maps ssptr to, or 0 if
+ *         it is not mapped.
+ */
+uint32_t TilerStub_GetPatEntry(uint32_t ssptr);
+
+/**
+ * Rotated view of a 2D block.  The device provides rotated
+ * views of 2D blocks as separate tiler mappings.  The stub
+ * serves them through a software accessor instead, which
+ * translates view coordinates into the natural view of the
+ * block.  The rotation is clockwise.
+ */
+struct TilerStubView {
+    void    *ptr;           /* natural view of the block */
+    uint32_t stride;        /* stride of the natural view */
+    uint16_t nat_width;     /* natural width in pixels */
+    uint16_t nat_height;    /* natural height in pixels */
+    uint16_t width;         /* view width in pixels */
+    uint16_t height;        /* view height in pixels */
+    uint16_t bpp;           /* bytes per pixel */
+    int      rotation;      /* 0, 90, 180 or 270 */
+};
+
+typedef struct TilerStubView TilerStubView;
+
+/**
+ * Gets a rotated view of a 2D block.
+ *
+ * @param ptr       Pointer to the start of a mapped 2D block
+ *                  (e.g. the ptr field of the block after
+ *                  MemMgr_Alloc)
+ * @param rotation  Clockwise rotation: 0, 90, 180 or 270
+ * @param view      Pointer to the view to fill out
+ *
+ * @return 0 on success, -EINVAL if ptr is not the start of a
+ *         2D block, or the rotation is not supported.
+ */
+int TilerStub_GetView(void *ptr, int rotation, TilerStubView *view);
+
+/**
+ * Returns the address of a pixel of a rotated view.
+ *
+ * @param view   Pointer to the view
+ * @param x      Column in the view
+ * @param y      Row in the view
+ *
+ * @return Address of the pixel in the natural view.
+ */
+static __inline__ void *TilerStub_ViewPixel(const TilerStubView *view,
+                                            uint32_t x, uint32_t y)
+{
+    uint32_t nx, ny;
+    switch (view->rotation)
+    {
+    case 90:  nx = y; ny = view->nat_height - 1 - x; break;
+    case 180: nx = view->nat_width - 1 - x; ny = view->nat_height - 1 - y; break;
+    case 270: nx = view->nat_width - 1 - y; ny = x; break;
+    default:  nx = x; ny = y;
+    }
+    return (char *) view->ptr + ny * view->stride + nx * view->bpp;
+}
+
+/**
+ * Cache maintenance.  1D blocks are cacheable, so the memory
+ * allocator cleans or invalidates their cache lines before
+ * handing them over to or back from a device.  The stub does
+ * not maintain caches, but counts the bytes and the number of
+ * maintenance operations.
+ */
+struct TilerStubCacheStats {
+    uint64_t cleaned;       /* bytes cleaned for device access */
+    uint64_t invalidated;   /* bytes invalidated for CPU access */
+    uint32_t ops;           /* maintenance operations */
+};
+
+typedef struct TilerStubCacheStats TilerStubCacheStats;
+
+/**
+ * Performs cache maintenance on a range.
+ *
+ * @param ptr         Start of the range
+ * @param len         Length of the range
+ * @param for_device  Non-0 to clean the range for device
+ *                    access, 0 to invalidate it for CPU access
+ */
+void TilerStub_CacheSync(void *ptr, size_t len, int for_device);
+
+/**
+ * Returns the cache maintenance statistics accumulated since the
+ * last reset.
+ *
+ * @param stats  Pointer to the statistics to fill out
+ */
+void TilerStub_GetCacheStats(TilerStubCacheStats *stats);
+
+/**
+ * Resets the cache maintenance statistics.
+ */
+void TilerStub_ResetCacheStats();
+
+/**
+ * Container partitions.  The 2D container can be split into
+ * named bands of slot rows, and the page-mode area into named
+ * page ranges, so that the allocation churn of one client does
+ * not fragment the area of another.  Each partition tracks its
+ * own free space.  Partition 0 is the shared partition: all
+ * rows and pages that are not in a named partition.
+ * <p>
+ * Blocks are allocated (and 1D buffers mapped) in the partition
+ * selected by the allocating thread, which is partition 0 by
+ * default.  A partition can only be resized or deleted while it
+ * holds no blocks.
+ */
+#define TILER_STUB_MAX_PARTS    8
+#define TILER_STUB_PART_NAME    16
+
+struct TilerStubPartStats {
+    uint32_t slots;         /* container slots in the partition */
+    uint32_t free_slots;    /* free container slots */
+    uint32_t pages;         /* page-mode pages in the partition */
+    uint32_t free_pages;    /* free page-mode pages */
+    uint32_t max_free_pages;/* largest free page range */
+    uint32_t blocks;        /* blocks allocated or mapped */
+};
+
+typedef struct TilerStubPartStats TilerStubPartStats;
+
+/**
+ * Creates a named partition.  The rows and pages must not be in
+ * another named partition, and must be free.
+ *
+ * @param name       Name of the partition
+ * @param row        First slot row of the 2D band
+ * @param num_rows   Number of slot rows (may be 0)
+ * @param page       First page of the page-mode range
+ * @param num_pages  Number of pages (may be 0)
+ *
+ * @return ID of the partition (> 0) on success, -EINVAL on
+ *         invalid arguments, -EEXIST if the name is taken,
+ *         -ENOSPC if there are too many partitions, or -EBUSY if
+ *         the area is not available.
+ */
+int TilerStub_CreatePartition(const char *name, uint16_t row,
+                              uint16_t num_rows, uint32_t page,
+                              uint32_t num_pages);
+
+/**
+ * Moves or resizes an empty partition.  See
+ * TilerStub_CreatePartition for the parameters.
+ *
+ * @return 0 on success, -EINVAL on invalid arguments, or -EBUSY
+ *         if the partition is not empty or the area is not
+ *         available.
+ */
+int TilerStub_ResizePartition(int id, uint16_t row, uint16_t num_rows,
+                              uint32_t page, uint32_t num_pages);
+
+/**
+ * Deletes an empty partition.  Its area returns to the shared
+ * partition.
+ *
+ * @param id     ID of the partition
+ *
+ * @return 0 on success, -EINVAL if there is no such partition,
+ *         or -EBUSY if it is not empty.
+ */
+int TilerStub_DeletePartition(int id);
+
+/**
+ * Finds a partition by name.
+ *
+ * @param name   Name of the partition
+ *
+ * @return ID of the partition, or -ENOENT if not found.
+ */
+int TilerStub_FindPartition(const char *name);
+
+/**
+ * Selects the partition that the calling thread allocates from.
+ *
+ * @param id     ID of the partition, or 0 for the shared
+ *               partition
+ *
+ * @return the previously selected partition, or -EINVAL if there
+ *         is no such partition.
+ */
+int TilerStub_UsePartition(int id);
+
+/**
+ * Returns the occupancy of a partition.
+ *
+ * @param id     ID of the partition, or 0 for the shared
+ *               partition
+ * @param stats  Pointer to the statistics to fill out
+ *
+ * @return 0 on success, or -EINVAL if there is no such
+ *         partition.
+ */
+int TilerStub_GetPartitionStats(int id, TilerStubPartStats *stats);
+
+/**
+ * Buffer hand-over.  The mappings of a registered buffer are
+ * backed by a memfd, which stands in for the driver keeping the
+ * blocks of a buffer alive while another process holds on to
+ * them.  A buffer exported by one process can be adopted by
+ * another, e.g. the same client after a restart, at the same
+ * system space addresses.
+ */
+struct tiler_buf_info;
+
+/**
+ * Exports the backing memory of a registered buffer.
+ *
+ * @param fd      Stub device fd the buffer is registered with
+ * @param offset  Registration offset of the buffer
+ *
+ * @return a new file descriptor of the backing memory on
+ *         success, -EINVAL if there is no such buffer, or
+ *         another -errno value on failure.
+ */
+int TilerStub_ExportBuf(int fd, int32_t offset);
+
+/**
+ * Adopts an exported buffer: allocates its blocks at their
+ * ssptrs, and registers the buffer backed by the exported
+ * memory.  The offset field of the buffer info is set to the
+ * new registration offset.
+ *
+ * @param fd      Stub device fd to own the blocks
+ * @param buf     Pointer to the buffer info of the exported
+ *                buffer
+ * @param mem_fd  Backing memory from TilerStub_ExportBuf (it is
+ *                duplicated, the caller keeps it)
+ *
+ * @return 0 on success, -EINVAL on invalid arguments, -EBUSY if
+ *         the area of a block is not free, or another -errno
+ *         value on failure.
+ */
+int TilerStub_AdoptBuf(int fd, struct tiler_buf_info *buf, int mem_fd);
+
+/**
+ * DMA engine.  The stub stands in for the system DMA with a
+ * software engine that executes descriptor lists on worker
+ * threads.  Descriptors address memory by system space address,
+ * which the engine translates through the stub's mappings of
+ * registered buffers and apertures, the way a device goes
+ * through the DMM.  Only the tiler space can be addressed.
+ * <p>
+ * A descriptor list completes when all its descriptors are done,
+ * or when one of them hits an address that is not mapped.  Each
+ * completed list adds 1 to the eventfd of the engine.  Lists may
+ * complete out of order if there are several workers.
+ */
+enum TilerStubDmaOp {
+    TILER_STUB_DMA_COPY = 1,    /* copies width bytes */
+    TILER_STUB_DMA_COPY_2D,     /* copies height rows of width bytes */
+    TILER_STUB_DMA_FILL         /* fills height rows of width bytes */
+};
+
+struct TilerStubDmaDesc {
+    uint32_t op;            /* enum TilerStubDmaOp */
+    uint32_t src;           /* source ssptr (not used for fills) */
+    uint32_t dst;           /* destination ssptr */
+    uint32_t width;         /* bytes per row */
+    uint32_t height;        /* rows (not used for 1D copies) */
+    uint32_t src_stride;    /* source row stride in system space */
+    uint32_t dst_stride;    /* destination row stride in system space */
+    uint32_t value;         /* fill byte */
+};
+
+typedef struct TilerStubDmaDesc TilerStubDmaDesc;
+
+/* number of descriptor lists an engine can have in flight */
+#define TILER_STUB_DMA_DEPTH    256
+
+struct TilerStubDmaStats {
+    uint64_t lists;         /* completed descriptor lists */
+    uint64_t descriptors;   /* completed descriptors */
+    uint64_t bytes;         /* bytes written */
+    uint64_t faults;        /* lists stopped by a translation fault */
+};
+
+typedef struct TilerStubDmaStats TilerStubDmaStats;
+
+typedef struct TilerStubDma TilerStubDma;
+
+/**
+ * Creates a DMA engine.
+ *
+ * @param num_workers  Number of worker threads (1 or more)
+ *
+ * @return Pointer to the engine, or NULL on failure.
+ */
+TilerStubDma *TilerStub_DmaCreate(int num_workers);
+
+/**
+ * Destroys a DMA engine.  Lists in flight are completed first.
+ *
+ * @param dma    Pointer to the engine
+ */
+void TilerStub_DmaDestroy(TilerStubDma *dma);
+
+/**
+ * Returns the completion eventfd of a DMA engine.  Reading it
+ * returns (and clears) the number of lists completed since the
+ * last read.  The engine owns the fd.
+ *
+ * @param dma    Pointer to the engine
+ */
+int TilerStub_DmaGetFd(TilerStubDma *dma);
+
+/**
+ * Submits a descriptor list.  The descriptors are copied, so the
+ * caller may reuse them after the call.
+ *
+ * @param dma        Pointer to the engine
+ * @param descs      Array of descriptors
+ * @param num_descs  Number of descriptors
+ *
+ * @return sequence number of the list (> 0) on success, -EINVAL
+ *         on invalid descriptors, -EAGAIN if
+ *         TILER_STUB_DMA_DEPTH lists are in flight, or -ENOMEM.
+ */
+int TilerStub_DmaSubmit(TilerStubDma *dma, const TilerStubDmaDesc descs[],
+                        int num_descs);
+
+/**
+ * Returns the result of a descriptor list.  Results are kept for
+ * the last TILER_STUB_DMA_DEPTH lists submitted.
+ *
+ * @param dma    Pointer to the engine
+ * @param seq    Sequence number from TilerStub_DmaSubmit
+ *
+ * @return 0 if the list completed, -EINPROGRESS if it has not
+ *         completed yet, -EFAULT if it hit an unmapped address,
+ *         or -ENOENT if the result is no longer (or not) known.
+ */
+int TilerStub_DmaResult(TilerStubDma *dma, int seq);
+
+/**
+ * Returns the statistics of a DMA engine.
+ *
+ * @param dma    Pointer to the engine
+ * @param stats  Pointer to the statistics to fill out
+ */
+void TilerStub_DmaGetStats(TilerStubDma *dma, TilerStubDmaStats *stats);
+
+#ifndef __TILER_STUB__
+#define open(path, flags)   TilerStub_Open(path, flags)
+#define close(fd)           TilerStub_Close(fd)
+#define ioctl(fd, cmd, arg) TilerStub_Ioctl(fd, cmd, (unsigned long)(arg))
+#define mmap(addr, len, prot, flags, fd, offset) \
+    TilerStub_Mmap(addr, len, prot, flags, fd, offset)
+#define munmap(addr, len)   TilerStub_Munmap(addr, len)
+#endif
+
+#endif
@@ -0,0 +1,343 @@
+/*
+ *  tilermem_iter.h
+ *
+ *  Slot-order traversal helpers for 2D tiler buffers.
+ *
+ *  Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  *  Neither the name of Texas Instruments Incorporated nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ *  OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TILERMEM_ITER_H_
+#define _TILERMEM_ITER_H_
+
+#include <stdint.h>
+#include "mem_types.h"
+
+/**
+ * Each slot of a 2D block is mapped to a separate DMM page.
+ * Walking a 2D buffer in raster order crosses into a new slot
+ * every slot width, while walking it slot by slot stays in one
+ * page for the whole slot.  A slot is 64x64 pixels for 8-bit,
+ * 64x32 pixels for 16-bit and 32x32 pixels for 32-bit buffers.
+ *
+ * 2D blocks start at a slot boundary, so the tiles below are
+ * slot aligned for any 2D buffer (e.g. the ptr of a block after
+ * MemMgr_Alloc).
+ */
+#define TILER_SLOT_WIDTH(fmt)  ((fmt) == PIXEL_FMT_32BIT ? 32 : 64)
+#define TILER_SLOT_HEIGHT(fmt) ((fmt) == PIXEL_FMT_8BIT ? 64 : 32)
+#define TILER_PIXEL_SIZE(fmt)  ((fmt) == PIXEL_FMT_32BIT ? 4 : \
+                                (fmt) == PIXEL_FMT_16BIT ? 2 : 1)
+
+#ifdef __GNUC__
+#define TILER_PREFETCH(p)  __builtin_prefetch(p)
+#else
+#define TILER_PREFETCH(p)  ((void) (p))
+#endif
+
+/**
+ * Slot-order tile iterator.  x, y, width and height give the
+ * current tile in pixels, and ptr points to its top-left pixel.
+ * The tiles are visited left to right, top to bottom.  The
+ * tiles at the right and bottom edges are cropped to the
+ * buffer.
+ */
+struct TilerTileIter {
+    /* current tile */
+    uint32_t x, y;          /* position in pixels */
+    uint32_t width, height; /* size in pixels */
+    char    *ptr;           /* top-left pixel */
+
+    /* buffer */
+    char    *base;          /* top-left pixel */
+    uint32_t stride;        /* stride in bytes */
+    uint32_t buf_width, buf_height;
+    uint16_t slot_width, slot_height, bpp;
+    uint16_t started;
+};
+
+typedef struct TilerTileIter TilerTileIter;
+
+/**
+ * Prefetches the first cache line of each row of a tile.
+ *
+ * @param it   Pointer to the iterator
+ * @param x    Column of the tile in pixels
+ * @param y    Row of the tile in pixels
+ */
+static __inline__ void TilerTile_Prefetch(const TilerTileIter *it,
+                                          uint32_t x, uint32_t y)
+{
+    uint32_t h = it->buf_height - y < it->slot_height ?
+                 it->buf_height - y : it->slot_height;
+    char *p = it->base + y * it->stride + x * it->bpp;
+    while (h--)
+    {
+        TILER_PREFETCH(p);
+        p += it->stride;
+    }
+}
+
+/**
+ * Starts a slot-order traversal of a 2D buffer.
+ *
+ * @param it      Pointer to the iterator
+ * @param ptr     Pointer to the top-left pixel of the buffer
+ * @param stride  Stride of the buffer in bytes
+ * @param width   Width of the buffer in pixels
+ * @param height  Height of the buffer in pixels
+ * @param fmt     Pixel format of the buffer (PIXEL_FMT_8BIT,
+ *                PIXEL_FMT_16BIT or PIXEL_FMT_32BIT)
+ */
+static __inline__ void TilerTile_Begin(TilerTileIter *it, void *ptr,
+                                       uint32_t stride, uint32_t width,
+                                       uint32_t height, pixel_fmt_t fmt)
+{
+    it->base = (char *) ptr;
+    it->stride = stride;
+    it->buf_width = width;
+    it->buf_height = height;
+    it->slot_width = TILER_SLOT_WIDTH(fmt);
+    it->slot_height = TILER_SLOT_HEIGHT(fmt);
+    it->bpp = TILER_PIXEL_SIZE(fmt);
+    it->x = it->y = it->width = it->height = 0;
+    it->ptr = it->base;
+    it->started = 0;
+}
+
+/**
+ * Advances a slot-order traversal to the next tile, and
+ * prefetches the tile after it.
+ *
+ * @param it   Pointer to the iterator
+ *
+ * @return 1 if there is a next tile, 0 at the end of the
+ *         buffer.
+ */
+static __inline__ int TilerTile_Next(TilerTileIter *it)
+{
+    uint32_t nx, ny;
+
+    if (!it->started)
+    {
+        it->started = 1;
+        if (!it->buf_width || !it->buf_height) return 0;
+    }
+    else
+    {
+        it->x += it->slot_width;
+        if (it->x >= it->buf_width)
+        {
+            it->x = 0;
+            it->y += it->slot_height;
+            if (it->y >= it->buf_height) return 0;
+        }
+    }
+    it->width = it->buf_width - it->x < it->slot_width ?
+                it->buf_width - it->x : it->slot_width;
+    it->height = it->buf_height - it->y < it->slot_height ?
+                 it->buf_height - it->y : it->slot_height;
+    it->ptr = it->base + it->y * it->stride + it->x * it->bpp;
+
+    /* prefetch the next tile */
+    nx = it->x + it->slot_width;
+    ny = it->y;
+    if (nx >= it->buf_width)
+    {
+        nx = 0;
+        ny += it->slot_height;
+    }
+    if (ny < it->buf_height) TilerTile_Prefetch(it, nx, ny);
+    return 1;
+}
+
+/**
+ * Returns a pointer to a row of the current tile.
+ *
+ * @param it   Pointer to the iterator
+ * @param row  Row within the tile
+ *
+ * @return Pointer to the first pixel of the row in the tile.
+ */
+static __inline__ void *TilerTile_Row(const TilerTileIter *it, uint32_t row)
+{
+    return it->ptr + row * it->stride;
+}
+
+/**
+ * Visits the tiles of a 2D buffer in slot order.  it must be a
+ * TilerTileIter variable.  E.g.
+ *
+ *   TilerTileIter it;
+ *   uint32_t x, y;
+ *   TILER_FOR_EACH_TILE(it, ptr, stride, width, height, fmt)
+ *   {
+ *       for (y = 0; y < it.height; y++)
+ *       {
+ *           uint8_t *row = TilerTile_Row(&it, y);
+ *           for (x = 0; x < it.width; x++) row[x] = ...;
+ *       }
+ *   }
+ */
+#define TILER_FOR_EACH_TILE(it, ptr, stride, width, height, fmt)\
+    for (TilerTile_Begin(&(it), (ptr), (stride), (width), (height), (fmt));\
+         TilerTile_Next(&(it)); )
+
+/**
+ * Visits the pixels of a 2D buffer in slot order: the pixels of
+ * each tile in raster order, and the tiles in slot order.  x and
+ * y are set to the coordinates of the pixel in the buffer.  Use
+ * TILER_TILE_PIXEL to get its address.  As this is a nested
+ * loop, break only leaves the current row of the tile.
+ */
+#define TILER_FOR_EACH_PIXEL(it, x, y, ptr, stride, width, height, fmt)\
+    TILER_FOR_EACH_TILE(it, ptr, stride, width, height, fmt)\
+        for ((y) = (it).y; (y) < (it).y + (it).height; (y)++)\
+            for ((x) = (it).x; (x) < (it).x + (it).width; (x)++)
+
+/* address of pixel (x, y) of the buffer of a tile iterator */
+#define TILER_TILE_PIXEL(it, x, y)\
+    ((void *) ((it).base + (y) * (it).stride + (x) * (it).bpp))
+
+#ifdef __cplusplus
+
+namespace tiler {
+
+/**
+ * Range of the tiles of a 2D buffer in slot order, e.g.
+ *
+ *   for (const TilerTileIter &t : tiler::tiles(ptr, stride, w, h, fmt))
+ *       for (uint32_t y = 0; y < t.height; y++)
+ *           process(TilerTile_Row(&t, y), t.width);
+ */
+class tiles {
+public:
+    class iterator {
+    public:
+        iterator() : done(true) {}
+        explicit iterator(const TilerTileIter &begin) : it(begin)
+        {
+            done = !TilerTile_Next(&it);
+        }
+        const TilerTileIter &operator*() const { return it; }
+        const TilerTileIter *operator->() const { return &it; }
+        iterator &operator++()
+        {
+            done = !TilerTile_Next(&it);
+            return *this;
+        }
+        bool operator==(const iterator &o) const
+        {
+            return done == o.done && (done || (it.x == o.it.x &&
+                                               it.y == o.it.y));
+        }
+        bool operator!=(const iterator &o) const { return !(*this == o); }
+    private:
+        TilerTileIter it;
+        bool done;
+    };
+
+    tiles(void *ptr, uint32_t stride, uint32_t width, uint32_t height,
+          pixel_fmt_t fmt)
+    {
+        TilerTile_Begin(&start, ptr, stride, width, height, fmt);
+    }
+    iterator begin() const { return iterator(start); }
+    iterator end() const { return iterator(); }
+
+private:
+    TilerTileIter start;
+};
+
+/**
+ * Range of the pixels of a 2D buffer in slot order.  T is the
+ * pixel type (uint8_t, uint16_t or uint32_t), e.g.
+ *
+ *   for (uint8_t &p : tiler::pixels<uint8_t>(ptr, stride, w, h))
+ *       p = 0;
+ */
+template <typename T>
+class pixels {
+public:
+    class iterator {
+    public:
+        iterator() : done(true), row(0), col(0) {}
+        explicit iterator(const TilerTileIter &begin) :
+            it(begin), row(0), col(0)
+        {
+            done = !TilerTile_Next(&it);
+        }
+        T &operator*() const
+        {
+            return ((T *) TilerTile_Row(&it, row))[col];
+        }
+        iterator &operator++()
+        {
+            if (++col == it.width)
+            {
+                col = 0;
+                if (++row == it.height)
+                {
+                    row = 0;
+                    done = !TilerTile_Next(&it);
+                }
+            }
+            return *this;
+        }
+        bool operator==(const iterator &o) const
+        {
+            return done == o.done &&
+                   (done || (it.x == o.it.x && it.y == o.it.y &&
+                             row == o.row && col == o.col));
+        }
+        bool operator!=(const iterator &o) const { return !(*this == o); }
+    private:
+        TilerTileIter it;
+        bool done;
+        uint32_t row, col;
+    };
+
+    pixels(void *ptr, uint32_t stride, uint32_t width, uint32_t height)
+    {
+        TilerTile_Begin(&start, ptr, stride, width, height,
+                        sizeof(T) == 4 ? PIXEL_FMT_32BIT :
+                        sizeof(T) == 2 ? PIXEL_FMT_16BIT : PIXEL_FMT_8BIT);
+    }
+    iterator begin() const { return iterator(start); }
+    iterator end() const { return iterator(); }
+
+private:
+    TilerTileIter start;
+};
+
+}
+
+#endif
+
+#endif
@@ -44,6 +44,12 @@
 #include <tiler.h>
 #include "tilermgr.h"
 #include "mem_types.h"
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#ifdef STUB_TILER
+    #include "tiler_stub.h"
+#endif
 
 
 #define TILERMGR_ERROR() \
@@ -83,7 +83,7 @@ int test_new() {
     p = NEW(int);
     int res = NOT_I(all_zero(p, 1),==,0);
     FREE(p);
-    res |= NOT_I(p,==,NULL);
+    res |= NOT_P(p,==,NULL);
     p = NEWN(int, 8000);
     res |= NOT_I(all_zero(p, 8000),==,0);
     FREE(p);